@@ -0,0 +1,104 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+ * Measures the bandwidth of pulling an object replicated on several
+ * servers, from a single replica with remote_bulk::operator>> and from
+ * all the replicas with remote_bulk::pull_striped, for several stripe
+ * sizes. Each replica is served by its own engine (margo instance) in
+ * this process, and the client pulls with another engine, so each
+ * transfer goes through Mercury. It also prints the share of the data
+ * pulled from each replica with the last stripe size.
+ *
+ * Usage: bench_bulk_striping [protocol] [num_replicas] [object_size] [num_iterations]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thallium.hpp>
+
+namespace tl = thallium;
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double mbps(size_t bytes, double seconds) {
+    return bytes / seconds / (1024.0 * 1024.0);
+}
+
+int main(int argc, char** argv) {
+    std::string protocol       = argc > 1 ? argv[1] : "na+sm";
+    size_t      num_replicas   = argc > 2 ? std::atol(argv[2]) : 4;
+    size_t      object_size    = argc > 3 ? std::atol(argv[3]) : (64 << 20);
+    size_t      num_iterations = argc > 4 ? std::atol(argv[4]) : 20;
+
+    std::vector<char> object(object_size);
+    for(size_t i = 0; i < object.size(); i++) object[i] = static_cast<char>(i * 7);
+
+    // each server holds a copy of the object and sends its bulk handle on request
+    std::vector<std::unique_ptr<tl::engine>> servers;
+    std::vector<std::vector<char>>           copies(num_replicas, object);
+    std::vector<tl::bulk>                    exposed;
+    exposed.reserve(num_replicas);
+    for(size_t i = 0; i < num_replicas; i++) {
+        servers.emplace_back(new tl::engine(protocol, THALLIUM_SERVER_MODE, true, 1));
+        exposed.push_back(servers[i]->expose({{copies[i].data(), copies[i].size()}},
+                                             tl::bulk_mode::read_only));
+        tl::bulk& b = exposed.back();
+        servers[i]->define("get_replica", [&b](const tl::request& req) { req.respond(b); });
+    }
+
+    tl::engine client(protocol, THALLIUM_CLIENT_MODE, true);
+    auto get_replica = client.define("get_replica");
+    std::vector<tl::remote_bulk> replicas;
+    std::vector<tl::bulk>        handles;
+    for(auto& server : servers) {
+        tl::endpoint ep = client.lookup(static_cast<std::string>(server->self()));
+        handles.push_back(get_replica.on(ep)());
+        replicas.push_back(handles.back().on(ep));
+    }
+
+    std::vector<char> dest(object_size);
+    tl::bulk local = client.expose({{dest.data(), dest.size()}}, tl::bulk_mode::write_only);
+    size_t   total = object_size * num_iterations;
+
+    std::cout << num_replicas << " replicas of " << object_size << " bytes, "
+              << num_iterations << " iterations, bandwidths in MiB/s" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < num_iterations; i++) replicas[0] >> local;
+    std::cout << "single replica: " << mbps(total, elapsed(start)) << std::endl;
+
+    std::vector<size_t> per_replica;
+    for(size_t stripe_size : {size_t(256) << 10, size_t(1) << 20, size_t(4) << 20}) {
+        start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < num_iterations; i++)
+            tl::remote_bulk::pull_striped(replicas, local, stripe_size, 2, &per_replica);
+        std::cout << "striped, " << (stripe_size >> 10) << " KiB stripes: "
+                  << mbps(total, elapsed(start)) << std::endl;
+    }
+    if(dest != object) {
+        std::cerr << "error: pulled data does not match the object" << std::endl;
+        return 1;
+    }
+    std::cout << "share of the last pull per replica:";
+    for(auto bytes : per_replica)
+        std::cout << " " << static_cast<double>(bytes) / object_size;
+    std::cout << std::endl;
+
+    local = tl::bulk();
+    handles.clear();
+    replicas.clear();
+    client.finalize();
+    exposed.clear();
+    for(auto& server : servers) server->finalize();
+    return 0;
+}
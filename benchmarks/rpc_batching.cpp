@@ -0,0 +1,71 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+ * Compares the throughput of small RPCs sent one by one
+ * and sent through an rpc_batcher.
+ *
+ * Usage: bench_rpc_batching [protocol] [num_calls] [max_calls_per_batch]
+ * The engine sends the RPCs to itself, through Mercury.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thallium.hpp>
+
+namespace tl = thallium;
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    std::string protocol  = argc > 1 ? argv[1] : "na+sm";
+    size_t      num_calls = argc > 2 ? std::atol(argv[2]) : 100000;
+    size_t      max_calls = argc > 3 ? std::atol(argv[3]) : 64;
+
+    tl::engine engine(protocol, THALLIUM_SERVER_MODE, true, 1);
+    engine.enable_batching();
+    auto rpc = engine.define("bench_add", [](const tl::request& req, int a, int b) {
+        req.respond(a + b);
+    });
+
+    tl::endpoint server = engine.self();
+
+    // warm up
+    for(int i = 0; i < 100; i++) rpc.on(server)(i, i);
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<tl::async_response> responses;
+        responses.reserve(num_calls);
+        for(size_t i = 0; i < num_calls; i++)
+            responses.push_back(rpc.on(server).async((int)i, 1));
+        for(auto& r : responses) r.wait();
+    }
+    double unbatched = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        tl::rpc_batcher batcher(engine, max_calls);
+        std::vector<tl::async_response> responses;
+        responses.reserve(num_calls);
+        for(size_t i = 0; i < num_calls; i++)
+            responses.push_back(batcher.async(rpc, server, (int)i, 1));
+        for(auto& r : responses) r.wait();
+    }
+    double batched = elapsed(start);
+
+    std::cout << "calls: " << num_calls << ", calls per batch: " << max_calls << std::endl;
+    std::cout << "unbatched: " << num_calls / unbatched << " RPC/s" << std::endl;
+    std::cout << "batched:   " << num_calls / batched << " RPC/s" << std::endl;
+
+    engine.finalize();
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+ * Measures the effective bandwidth (uncompressed bytes delivered per
+ * second) of RPC arguments and bulk pulls with and without compression,
+ * for payloads of several compressibility profiles: zeros, a sparse
+ * array of doubles, log-like text and random bytes. For each profile it
+ * prints the bandwidth of plain and compressed RPCs, of plain and
+ * compressed bulk pulls, and the compression ratio of the lz codec.
+ *
+ * Usage: bench_rpc_compression [protocol] [payload_size] [num_iterations]
+ * The engine sends the RPCs to itself, through Mercury.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <thallium.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+
+namespace tl = thallium;
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<char> make_payload(const std::string& profile, size_t size) {
+    std::vector<char> data(size, 0);
+    if(profile == "sparse") {
+        for(size_t i = 0; i + sizeof(double) <= size; i += 64 * sizeof(double)) {
+            double v = static_cast<double>(i) * 0.5;
+            std::memcpy(data.data() + i, &v, sizeof(v));
+        }
+    } else if(profile == "text") {
+        std::mt19937 gen(1);
+        std::string  text;
+        while(text.size() < size) {
+            text += "2024-01-01T00:00:" + std::to_string(gen() % 60)
+                  + " INFO worker " + std::to_string(gen() % 16)
+                  + " processed request " + std::to_string(gen()) + "\n";
+        }
+        std::memcpy(data.data(), text.data(), size);
+    } else if(profile == "random") {
+        std::mt19937 gen(1);
+        for(auto& b : data) b = static_cast<char>(gen());
+    }
+    return data;
+}
+
+static double mbps(size_t bytes, double seconds) {
+    return bytes / seconds / (1024.0 * 1024.0);
+}
+
+int main(int argc, char** argv) {
+    std::string protocol       = argc > 1 ? argv[1] : "na+sm";
+    size_t      payload_size   = argc > 2 ? std::atol(argv[2]) : (4 << 20);
+    size_t      num_iterations = argc > 3 ? std::atol(argv[3]) : 100;
+
+    tl::engine engine(protocol, THALLIUM_SERVER_MODE, true, 1);
+    engine.define("bench_send", [](const tl::request& req, const std::vector<char>& v) {
+        req.respond(v.size());
+    });
+    engine.define("bench_pull_plain", [&engine](const tl::request& req, tl::bulk& b) {
+        std::vector<char> data(b.size());
+        std::vector<std::pair<void*, size_t>> segments{{data.data(), data.size()}};
+        auto local = engine.expose(segments, tl::bulk_mode::write_only);
+        local << b.on(req.get_endpoint());
+        req.respond(data.size());
+    });
+    engine.define("bench_pull_compressed", [](const tl::request& req, const tl::compressed_bulk& b) {
+        std::vector<char> data(b.raw_size());
+        b.pull_to(req.get_endpoint(), data.data(), data.size());
+        req.respond(data.size());
+    });
+    tl::endpoint server = engine.self();
+
+    auto plain      = engine.define("bench_send");
+    auto compressed = engine.define("bench_send")
+                            .set_compression(std::make_shared<tl::lz_codec>());
+    auto pull_plain      = engine.define("bench_pull_plain");
+    auto pull_compressed = engine.define("bench_pull_compressed");
+
+    std::cout << "payload of " << payload_size << " bytes, "
+              << num_iterations << " iterations, bandwidths in MiB/s" << std::endl;
+
+    for(const char* profile : {"zeros", "sparse", "text", "random"}) {
+        std::vector<char>     data   = make_payload(profile, payload_size);
+        tl::compression_stats before = compressed.get_compression_stats();
+
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < num_iterations; i++) plain.on(server)(data);
+        double rpc_plain = elapsed(start);
+
+        start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < num_iterations; i++) compressed.on(server)(data);
+        double rpc_compressed = elapsed(start);
+
+        std::vector<std::pair<void*, size_t>> segments{{data.data(), data.size()}};
+        tl::bulk b = engine.expose(segments, tl::bulk_mode::read_only);
+        start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < num_iterations; i++) pull_plain.on(server)(b);
+        double bulk_plain = elapsed(start);
+
+        // compression happens when the compressed_bulk is created
+        start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < num_iterations; i++) {
+            tl::compressed_bulk cb(engine, data.data(), data.size());
+            pull_compressed.on(server)(cb);
+        }
+        double bulk_compressed = elapsed(start);
+
+        size_t total = payload_size * num_iterations;
+        auto   stats = compressed.get_compression_stats();
+        auto   raw   = stats.raw_bytes - before.raw_bytes;
+        auto   sent  = stats.compressed_bytes - before.compressed_bytes;
+        double ratio = sent ? static_cast<double>(raw) / sent : 1.0;
+        std::cout << profile
+                  << ": rpc " << mbps(total, rpc_plain)
+                  << " -> " << mbps(total, rpc_compressed)
+                  << ", bulk " << mbps(total, bulk_plain)
+                  << " -> " << mbps(total, bulk_compressed)
+                  << ", compression ratio " << ratio << std::endl;
+    }
+
+    engine.finalize();
+    return 0;
+}
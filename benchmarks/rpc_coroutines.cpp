@@ -0,0 +1,121 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+ * Compares two ways of keeping many RPCs in flight: one ULT per
+ * request, each blocked in a synchronous call, and one coroutine per
+ * request, suspended on co_wait(). A suspended coroutine holds no ULT:
+ * it is resumed by a ULT created by the completion callback of its RPC.
+ * Besides the throughput, the benchmark reports the number of ULTs
+ * blocked in the pool once all the requests have been issued.
+ *
+ * Usage: bench_rpc_coroutines [protocol] [num_requests] [num_rounds]
+ * The engine sends the RPCs to itself, through Mercury.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thallium.hpp>
+
+namespace tl = thallium;
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct run_stats {
+    double seconds = 0.0;
+    size_t blocked = 0;
+};
+
+/*
+ * Lets the pool run the ULTs that were pushed into it, then returns
+ * the number of ULTs left in it, which are blocked.
+ */
+static size_t blocked_ults(const tl::pool& pool) {
+    while(pool.size() != 0) tl::thread::yield();
+    return pool.total_size();
+}
+
+static tl::co_task<int> request(tl::remote_procedure& rpc, const tl::endpoint& server,
+                                tl::pool pool, int x) {
+    int r = co_await tl::co_wait(rpc.on(server).async(x), pool);
+    co_return r;
+}
+
+static run_stats run_ults(tl::remote_procedure& rpc, const tl::endpoint& server,
+                          tl::pool pool, size_t num_requests) {
+    run_stats stats;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<tl::managed<tl::thread>> ults;
+    ults.reserve(num_requests);
+    for(size_t i = 0; i < num_requests; i++) {
+        ults.push_back(pool.make_thread([&rpc, &server, i]() {
+            int r = rpc.on(server)((int)i);
+            (void)r;
+        }));
+    }
+    stats.blocked = blocked_ults(pool);
+    for(auto& ult : ults) ult->join();
+    stats.seconds = elapsed(start);
+    return stats;
+}
+
+static run_stats run_coroutines(tl::remote_procedure& rpc, const tl::endpoint& server,
+                                tl::pool pool, size_t num_requests) {
+    run_stats stats;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<tl::co_task<int>> tasks;
+    tasks.reserve(num_requests);
+    for(size_t i = 0; i < num_requests; i++) {
+        tasks.push_back(request(rpc, server, pool, (int)i));
+        tasks.back().start(pool);
+    }
+    stats.blocked = blocked_ults(pool);
+    for(auto& t : tasks) t.wait();
+    stats.seconds = elapsed(start);
+    return stats;
+}
+
+int main(int argc, char** argv) {
+    std::string protocol     = argc > 1 ? argv[1] : "na+sm";
+    size_t      num_requests = argc > 2 ? std::atol(argv[2]) : 10000;
+    size_t      num_rounds   = argc > 3 ? std::atol(argv[3]) : 10;
+
+    tl::engine engine(protocol, THALLIUM_SERVER_MODE, true, 1);
+    auto rpc = engine.define("bench_echo", [](const tl::request& req, int x) {
+        req.respond(x);
+    });
+    tl::endpoint server = engine.self();
+    tl::pool     pool   = engine.get_handler_pool();
+
+    // warm up
+    run_ults(rpc, server, pool, 100);
+    run_coroutines(rpc, server, pool, 100);
+
+    double ults = 0.0, coroutines = 0.0;
+    size_t ults_blocked = 0, coroutines_blocked = 0;
+    for(size_t i = 0; i < num_rounds; i++) {
+        auto u = run_ults(rpc, server, pool, num_requests);
+        auto c = run_coroutines(rpc, server, pool, num_requests);
+        ults               += u.seconds;
+        coroutines         += c.seconds;
+        ults_blocked       = std::max(ults_blocked, u.blocked);
+        coroutines_blocked = std::max(coroutines_blocked, c.blocked);
+    }
+    double total = (double)(num_requests * num_rounds);
+    std::cout << "ULT per request:       " << total / ults << " req/s, "
+              << ults_blocked << " blocked ULTs" << std::endl;
+    std::cout << "coroutine per request: " << total / coroutines << " req/s, "
+              << coroutines_blocked << " blocked ULTs" << std::endl;
+
+    engine.finalize();
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+ * Measures the latency of rpc.on(ep)(args) with and without the
+ * engine's handle cache, as well as the cost of creating the
+ * callable_remote_procedure alone (which is where margo_create
+ * is called when the cache is disabled).
+ *
+ * Usage: bench_rpc_handle_cache [protocol] [num_calls] [cache_size]
+ * The engine sends the RPCs to itself, through Mercury.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thallium.hpp>
+
+namespace tl = thallium;
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void run(tl::remote_procedure& rpc,
+                const tl::endpoint& server, size_t num_calls, const char* label) {
+    // warm up
+    for(int i = 0; i < 100; i++) rpc.on(server)(i);
+
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < num_calls; i++) {
+        auto callable = rpc.on(server);
+        (void)callable;
+    }
+    double create = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < num_calls; i++) {
+        int r = rpc.on(server)((int)i);
+        (void)r;
+    }
+    double call = elapsed(start);
+
+    std::cout << label << ": on(ep) " << create * 1e6 / num_calls << " us, "
+              << "on(ep)(args) " << call * 1e6 / num_calls << " us" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string protocol   = argc > 1 ? argv[1] : "na+sm";
+    size_t      num_calls  = argc > 2 ? std::atol(argv[2]) : 100000;
+    size_t      cache_size = argc > 3 ? std::atol(argv[3]) : 16;
+
+    tl::engine engine(protocol, THALLIUM_SERVER_MODE, true, 1);
+    auto rpc = engine.define("bench_echo", [](const tl::request& req, int x) {
+        req.respond(x);
+    });
+    tl::endpoint server = engine.self();
+
+    engine.set_handle_cache_size(0);
+    run(rpc, server, num_calls, "without handle cache");
+
+    engine.set_handle_cache_size(cache_size);
+    run(rpc, server, num_calls, "with handle cache   ");
+
+    engine.finalize();
+    return 0;
+}
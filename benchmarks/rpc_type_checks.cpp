@@ -0,0 +1,90 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+ * Measures the cost of RPC type checking: the time to encode and decode
+ * the arguments of a small RPC into a buffer, the size of the encoded
+ * arguments, and the latency of the RPC. This file is built three times:
+ * bench_rpc_type_checks (no checks), bench_rpc_type_checks_hash
+ * (THALLIUM_HASH_RPC_TYPES) and bench_rpc_type_checks_debug
+ * (THALLIUM_DEBUG_RPC_TYPES), whose outputs can be compared.
+ *
+ * Usage: bench_rpc_type_checks [protocol] [num_calls]
+ * The engine sends the RPCs to itself, through Mercury.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+
+namespace tl = thallium;
+
+#if defined(THALLIUM_DEBUG_RPC_TYPES)
+static const char* mode = "type names (THALLIUM_DEBUG_RPC_TYPES)";
+#elif defined(THALLIUM_HASH_RPC_TYPES)
+static const char* mode = "type fingerprints (THALLIUM_HASH_RPC_TYPES)";
+#else
+static const char* mode = "no type checks";
+#endif
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    std::string protocol  = argc > 1 ? argv[1] : "na+sm";
+    size_t      num_calls = argc > 2 ? std::atol(argv[2]) : 100000;
+
+    tl::engine engine(protocol, THALLIUM_SERVER_MODE, true, 1);
+    auto rpc = engine.define("bench_put",
+        [](const tl::request& req, const std::string& key, uint64_t value) {
+            req.respond(key.size() + value);
+        });
+    tl::endpoint server = engine.self();
+    margo_instance_id mid = engine.get_margo_instance();
+
+    std::string  key = "some-key";
+    uint64_t     value = 42;
+    auto         args = std::make_tuple(std::cref(key), std::cref(value));
+    std::tuple<> ctx;
+
+    // encoding and decoding of the arguments alone
+    std::vector<char> buffer;
+    tl::meta_proc_fn encode = [&](hg_proc_t proc) {
+        return tl::proc_object_encode(proc, args, mid, ctx);
+    };
+    std::tuple<std::string, uint64_t> decoded;
+    tl::meta_proc_fn decode = [&](hg_proc_t proc) {
+        return tl::proc_object_decode(proc, decoded, mid, ctx);
+    };
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < num_calls; i++) {
+        tl::detail::proc_encode_to_buffer(mid, encode, buffer);
+        tl::detail::proc_decode_from_buffer(mid, decode, buffer);
+    }
+    double serialization = elapsed(start);
+
+    // round trips
+    for(int i = 0; i < 100; i++) rpc.on(server)(key, value);
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < num_calls; i++) {
+        uint64_t r = rpc.on(server)(key, value);
+        (void)r;
+    }
+    double call = elapsed(start);
+
+    std::cout << mode << ": " << buffer.size() << " bytes of arguments, "
+              << "encode+decode " << serialization * 1e9 / num_calls << " ns, "
+              << "rpc " << call * 1e6 / num_calls << " us" << std::endl;
+
+    engine.finalize();
+    return 0;
+}
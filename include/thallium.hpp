@@ -8,11 +8,16 @@
 #include <thallium/bulk_mode.hpp>
 #include <thallium/bulk.hpp>
 #include <thallium/timeout.hpp>
+#include <thallium/busy.hpp>
 #include <thallium/engine.hpp>
 #include <thallium/endpoint.hpp>
 #include <thallium/remote_procedure.hpp>
+#include <thallium/rpc_batcher.hpp>
 #include <thallium/callable_remote_procedure.hpp>
+#include <thallium/typed_rpc.hpp>
 #include <thallium/remote_bulk.hpp>
+#include <thallium/compressed_bulk.hpp>
+#include <thallium/bulk_pool.hpp>
 #include <thallium/timed_remote_bulk.hpp>
 #include <thallium/provider.hpp>
 #include <thallium/provider_handle.hpp>
@@ -31,6 +36,8 @@
 #include <thallium/future.hpp>
 #include <thallium/xstream_barrier.hpp>
 #include <thallium/self.hpp>
+#include <thallium/span.hpp>
 #include <thallium/logger.hpp>
+#include <thallium/coroutine.hpp>
 
 #endif
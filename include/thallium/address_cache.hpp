@@ -0,0 +1,133 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_ADDRESS_CACHE_HPP
+#define __THALLIUM_ADDRESS_CACHE_HPP
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <margo.h>
+#include <thallium/mutex.hpp>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Cache of the addresses looked up by engine::lookup(), attached
+ * to a margo instance (see engine::enable_lookup_cache()). The cache holds
+ * a copy (margo_addr_dup) of each address and hands out copies of it.
+ */
+class address_cache {
+
+  public:
+
+    address_cache(margo_instance_id mid)
+    : m_mid(mid) {}
+
+    address_cache(const address_cache&)            = delete;
+    address_cache& operator=(const address_cache&) = delete;
+
+    ~address_cache() {
+        clear();
+    }
+
+    /**
+     * @brief Looks up an address, using the cached copy if any.
+     * The caller is responsible for freeing the returned address.
+     */
+    hg_return_t lookup(const std::string& address, hg_addr_t* addr) {
+        if(m_enabled) {
+            std::lock_guard<mutex> lock(m_mutex);
+            auto it = m_addrs.find(address);
+            if(it != m_addrs.end())
+                return margo_addr_dup(m_mid, it->second, addr);
+        }
+        hg_return_t ret = margo_addr_lookup(m_mid, address.c_str(), addr);
+        if(ret != HG_SUCCESS || !m_enabled)
+            return ret;
+        hg_addr_t copy = HG_ADDR_NULL;
+        if(margo_addr_dup(m_mid, *addr, &copy) != HG_SUCCESS)
+            return HG_SUCCESS;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            if(!m_closed && m_addrs.emplace(address, copy).second)
+                return HG_SUCCESS;
+        }
+        // the address was looked up concurrently or the cache is closed
+        margo_addr_free(m_mid, copy);
+        return HG_SUCCESS;
+    }
+
+    /**
+     * @brief Removes an address from the cache.
+     */
+    void invalidate(const std::string& address) {
+        hg_addr_t addr = HG_ADDR_NULL;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            auto it = m_addrs.find(address);
+            if(it == m_addrs.end())
+                return;
+            addr = it->second;
+            m_addrs.erase(it);
+        }
+        margo_addr_free(m_mid, addr);
+    }
+
+    /**
+     * @brief Removes all the addresses from the cache.
+     */
+    void clear() {
+        std::unordered_map<std::string, hg_addr_t> addrs;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            addrs.swap(m_addrs);
+        }
+        for(auto& p : addrs) margo_addr_free(m_mid, p.second);
+    }
+
+    void set_enabled(bool enabled) {
+        m_enabled = enabled;
+        if(!enabled) clear();
+    }
+
+    bool enabled() const {
+        return m_enabled;
+    }
+
+    size_t size() {
+        std::lock_guard<mutex> lock(m_mutex);
+        return m_addrs.size();
+    }
+
+    /**
+     * @brief Called when the margo instance is finalized.
+     */
+    void on_finalize() {
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        clear();
+    }
+
+  private:
+
+    margo_instance_id                          m_mid;
+    std::atomic<bool>                          m_enabled{false};
+    bool                                       m_closed = false;
+    std::unordered_map<std::string, hg_addr_t> m_addrs;
+    mutex                                      m_mutex;
+};
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
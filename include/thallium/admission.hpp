@@ -0,0 +1,342 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_ADMISSION_HPP
+#define __THALLIUM_ADMISSION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <margo.h>
+#include <thallium/condition_variable.hpp>
+#include <thallium/mutex.hpp>
+
+namespace thallium {
+
+/**
+ * @brief Limits on the requests of a provider or of an RPC (see
+ * engine::set_admission_limits() and remote_procedure::set_admission_limits()).
+ * They are enforced when a request is received, before a ULT is created
+ * for it: requests that exceed them are rejected, and their caller gets
+ * a busy exception. The calls that carry a header (those propagating
+ * their deadline, see remote_procedure::enable_deadline_propagation(),
+ * those sent through a remote_procedure that enabled busy replies, see
+ * remote_procedure::enable_busy_replies(), or through an rpc_batcher)
+ * get a busy status in their response; the others, e.g. those sent by
+ * plain margo clients, which expect the output of the RPC, fail with
+ * HG_BUSY. The calls of a broadcast or a reduction that are rejected
+ * count as failed on their target (see remote_procedure::broadcast()).
+ * A limit of 0 means unlimited.
+ */
+struct admission_limits {
+    /**
+     * @brief Maximum number of handlers running concurrently.
+     * Admitted requests beyond this number wait for a running
+     * handler to return before starting.
+     */
+    size_t max_in_flight = 0;
+    /**
+     * @brief Maximum number of admitted requests waiting to start.
+     */
+    size_t max_queued = 0;
+};
+
+/**
+ * @brief Counters of the requests subject to admission limits.
+ */
+struct admission_stats {
+    size_t   in_flight  = 0; // handlers currently running
+    size_t   queued     = 0; // admitted requests that have not started
+    size_t   max_queued = 0; // highest value reached by queued
+    uint64_t admitted   = 0; // requests admitted so far
+    uint64_t rejected   = 0; // requests rejected so far
+};
+
+namespace detail {
+
+/**
+ * @brief Admission state of a provider or of an RPC.
+ */
+class admission_limiter {
+
+  public:
+
+    admission_limiter(const admission_limits& limits)
+    : m_limits(limits) {}
+
+    admission_limiter(const admission_limiter&)            = delete;
+    admission_limiter& operator=(const admission_limiter&) = delete;
+
+    void set_limits(const admission_limits& limits) {
+        std::lock_guard<mutex> lock(m_mutex);
+        m_limits = limits;
+        m_cv.notify_all();
+    }
+
+    /**
+     * @brief Returns whether a new request can be admitted,
+     * counting it as queued if it can and as rejected otherwise.
+     */
+    bool try_admit() {
+        std::lock_guard<mutex> lock(m_mutex);
+        bool admit = m_limits.max_in_flight == 0
+            ? (m_limits.max_queued == 0 || m_stats.queued < m_limits.max_queued)
+            : (m_stats.in_flight + m_stats.queued
+               < m_limits.max_in_flight + m_limits.max_queued);
+        if(!admit) {
+            m_stats.rejected += 1;
+            return false;
+        }
+        m_stats.admitted += 1;
+        m_stats.queued   += 1;
+        m_stats.max_queued = std::max(m_stats.max_queued, m_stats.queued);
+        return true;
+    }
+
+    /**
+     * @brief Cancels the admission of a request that was not started,
+     * because another limiter rejected it or its handler could not be
+     * started. The request is not counted as rejected by this limiter.
+     */
+    void cancel() {
+        std::lock_guard<mutex> lock(m_mutex);
+        m_stats.queued   -= 1;
+        m_stats.admitted -= 1;
+    }
+
+    /**
+     * @brief Blocks until the admitted request can start.
+     */
+    void start() {
+        std::unique_lock<mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() {
+            return m_limits.max_in_flight == 0
+                || m_stats.in_flight < m_limits.max_in_flight;
+        });
+        m_stats.queued    -= 1;
+        m_stats.in_flight += 1;
+    }
+
+    /**
+     * @brief Marks the handler of a started request as returned.
+     */
+    void finish() {
+        std::lock_guard<mutex> lock(m_mutex);
+        m_stats.in_flight -= 1;
+        m_cv.notify_one();
+    }
+
+    admission_stats stats() {
+        std::lock_guard<mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+  private:
+
+    admission_limits   m_limits;
+    admission_stats    m_stats;
+    mutex              m_mutex;
+    condition_variable m_cv;
+};
+
+/**
+ * @brief Limiters that admitted a request, released
+ * when the request's handler returns.
+ */
+struct admission_ticket {
+    std::shared_ptr<admission_limiter> m_provider;
+    std::shared_ptr<admission_limiter> m_rpc;
+
+    void start() {
+        if(m_provider) m_provider->start();
+        if(m_rpc) m_rpc->start();
+    }
+
+    void finish() {
+        if(m_rpc) m_rpc->finish();
+        if(m_provider) m_provider->finish();
+    }
+
+    /**
+     * @brief Cancels the admission of a request whose handler
+     * could not be started.
+     */
+    void cancel() {
+        if(m_rpc) m_rpc->cancel();
+        if(m_provider) m_provider->cancel();
+        m_rpc.reset();
+        m_provider.reset();
+    }
+};
+
+/**
+ * @brief Holds the execution slots of an admitted request
+ * while its handler runs.
+ */
+class admission_scope {
+
+  public:
+
+    admission_scope(admission_ticket&& ticket)
+    : m_ticket(std::move(ticket)) {
+        m_ticket.start();
+    }
+
+    admission_scope(const admission_scope&)            = delete;
+    admission_scope& operator=(const admission_scope&) = delete;
+
+    ~admission_scope() {
+        m_ticket.finish();
+    }
+
+  private:
+
+    admission_ticket m_ticket;
+};
+
+/**
+ * @brief Admission limiters of the providers and RPCs of a margo
+ * instance. Requests are admitted by the progress loop (see
+ * thallium_admission_handler) and the ticket of each admitted request
+ * is kept, keyed by its handle, until the ULT handling it starts.
+ */
+class admission_control {
+
+  public:
+
+    admission_control(margo_instance_id) {}
+
+    admission_control(const admission_control&)            = delete;
+    admission_control& operator=(const admission_control&) = delete;
+
+    void set_provider_limits(uint16_t provider_id, const admission_limits& limits) {
+        set_limits(m_providers, provider_id, limits);
+    }
+
+    void set_rpc_limits(hg_id_t id, const admission_limits& limits) {
+        set_limits(m_rpcs, id, limits);
+    }
+
+    admission_stats provider_stats(uint16_t provider_id) {
+        return stats(m_providers, provider_id);
+    }
+
+    admission_stats rpc_stats(hg_id_t id) {
+        return stats(m_rpcs, id);
+    }
+
+    /**
+     * @brief Tries to admit a request.
+     *
+     * @param handle Handle of the request.
+     * @param id RPC id of the request (including its provider id).
+     * @param provider_id Provider id of the request.
+     *
+     * @return false if the request must be rejected.
+     */
+    bool admit(hg_handle_t handle, hg_id_t id, uint16_t provider_id) {
+        admission_ticket ticket;
+        if(!admit(id, provider_id, ticket))
+            return false;
+        if(!ticket.m_provider && !ticket.m_rpc)
+            return true;
+        std::lock_guard<mutex> lock(m_mutex);
+        m_tickets[handle] = std::move(ticket);
+        return true;
+    }
+
+    /**
+     * @brief Tries to admit a request that does not have a handle of its
+     * own (e.g. a call received within a batch), whose ticket is returned
+     * to the caller instead of being kept by the admission_control.
+     *
+     * @return false if the request must be rejected.
+     */
+    bool admit(hg_id_t id, uint16_t provider_id, admission_ticket& ticket) {
+        if(!m_enabled.load(std::memory_order_acquire))
+            return true;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            auto p = m_providers.find(provider_id);
+            if(p != m_providers.end()) ticket.m_provider = p->second;
+            auto r = m_rpcs.find(id);
+            if(r != m_rpcs.end()) ticket.m_rpc = r->second;
+        }
+        if(!ticket.m_provider && !ticket.m_rpc)
+            return true;
+        if(ticket.m_provider && !ticket.m_provider->try_admit()) {
+            ticket = admission_ticket();
+            return false;
+        }
+        if(ticket.m_rpc && !ticket.m_rpc->try_admit()) {
+            if(ticket.m_provider) ticket.m_provider->cancel();
+            ticket = admission_ticket();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Removes and returns the ticket of an admitted request
+     * (an empty ticket if the request was not subject to any limit).
+     */
+    admission_ticket take(hg_handle_t handle) {
+        admission_ticket ticket;
+        if(!m_enabled.load(std::memory_order_acquire))
+            return ticket;
+        std::lock_guard<mutex> lock(m_mutex);
+        auto it = m_tickets.find(handle);
+        if(it != m_tickets.end()) {
+            ticket = std::move(it->second);
+            m_tickets.erase(it);
+        }
+        return ticket;
+    }
+
+    void on_finalize() {}
+
+  private:
+
+    template <typename Key>
+    void set_limits(std::unordered_map<Key, std::shared_ptr<admission_limiter>>& limiters,
+                    Key key, const admission_limits& limits) {
+        std::lock_guard<mutex> lock(m_mutex);
+        auto it = limiters.find(key);
+        if(it == limiters.end())
+            limiters.emplace(key, std::make_shared<admission_limiter>(limits));
+        else
+            it->second->set_limits(limits);
+        m_enabled.store(true, std::memory_order_release);
+    }
+
+    template <typename Key>
+    admission_stats stats(std::unordered_map<Key, std::shared_ptr<admission_limiter>>& limiters,
+                          Key key) {
+        std::shared_ptr<admission_limiter> limiter;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            auto it = limiters.find(key);
+            if(it == limiters.end())
+                return admission_stats();
+            limiter = it->second;
+        }
+        return limiter->stats();
+    }
+
+    std::atomic<bool>                                                 m_enabled{false};
+    std::unordered_map<uint16_t, std::shared_ptr<admission_limiter>>  m_providers;
+    std::unordered_map<hg_id_t, std::shared_ptr<admission_limiter>>   m_rpcs;
+    std::unordered_map<hg_handle_t, admission_ticket>                 m_tickets;
+    mutex                                                             m_mutex;
+};
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
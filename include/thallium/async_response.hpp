@@ -8,9 +8,20 @@
 
 #include <thallium/margo_instance_ref.hpp>
 #include <thallium/margo_exception.hpp>
+#include <thallium/busy.hpp>
 #include <thallium/packed_data.hpp>
 #include <thallium/proc_object.hpp>
+#include <thallium/self_dispatch.hpp>
+#include <thallium/batch_state.hpp>
+#include <thallium/handle_cache.hpp>
+#include <thallium/completion_watcher.hpp>
+#include <thallium/instance_data.hpp>
+#include <thallium/thread.hpp>
 #include <thallium/timeout.hpp>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -19,6 +30,12 @@ namespace thallium {
 
 template<typename ... CtxArg> class callable_remote_procedure_with_context;
 using callable_remote_procedure = callable_remote_procedure_with_context<>;
+class rpc_batcher;
+class pool;
+
+namespace detail {
+class response_awaiter;
+}
 
 /**
  * @brief async_response objects are created by sending an
@@ -27,31 +44,99 @@ using callable_remote_procedure = callable_remote_procedure_with_context<>;
  */
 class async_response {
     template<typename ... CtxArg> friend class callable_remote_procedure_with_context;
+    friend class rpc_batcher;
+    friend class detail::response_awaiter;
 
   private:
     margo_instance_ref m_mid;
-    margo_request      m_request = MARGO_REQUEST_NULL;
+    std::shared_ptr<detail::completion_state> m_completion; // reset once waited on
     hg_handle_t        m_handle  = HG_HANDLE_NULL;
     bool               m_ignore_response = false;
+    bool               m_with_status = false; // see detail::rpc_status
+    std::shared_ptr<detail::local_call> m_local;
+    std::shared_ptr<detail::batched_call> m_batched;
+    std::shared_ptr<detail::handle_cache> m_handle_cache;
+    std::shared_ptr<detail::offload_holder> m_offload;
+
+    /**
+     * @brief Returns the completion of the RPC, which completes once its
+     * response has been received (a batched call is flushed first). It
+     * only refers to state shared with this object.
+     */
+    std::shared_ptr<detail::completion_state> completion() {
+        if(m_ignore_response && (m_local || m_batched))
+            return detail::completion_state::completed();
+        if(m_local)
+            return std::shared_ptr<detail::completion_state>(m_local, &m_local->m_completed);
+        if(m_batched)
+            return m_batched->completion();
+        if(m_completion)
+            return m_completion;
+        return detail::completion_state::completed();
+    }
 
     /**
      * @brief Constructor. Made private since async_response
      * objects are created by callable_remote_procedure only.
      *
-     * @param req Margo request to wait on.
+     * @param completion Completion of the RPC.
      * @param mid Margo instance associated with the RPC.
      * @param c callable_remote_procedure that created the async_response.
      * @param ignore_resp whether response should be ignored.
+     * @param with_status whether the response starts with a detail::rpc_status.
+     * @param handle_cache cache to release the handle into, if any.
      */
-    async_response(margo_request req, margo_instance_ref mid,
-                   hg_handle_t handle, bool ignore_resp) noexcept
+    async_response(std::shared_ptr<detail::completion_state> completion,
+                   margo_instance_ref mid, hg_handle_t handle, bool ignore_resp,
+                   bool with_status,
+                   std::shared_ptr<detail::handle_cache> handle_cache = nullptr) noexcept
     : m_mid(std::move(mid))
-    , m_request(req)
+    , m_completion(std::move(completion))
     , m_handle(handle)
-    , m_ignore_response(ignore_resp) {
+    , m_ignore_response(ignore_resp)
+    , m_with_status(with_status)
+    , m_handle_cache(std::move(handle_cache)) {
         margo_ref_incr(handle);
     }
 
+    /**
+     * @brief Returns the packed_data from which the response received
+     * in the handle is decoded.
+     */
+    packed_data<> response_data() const {
+        packed_data<> data(margo_get_output, margo_free_output, m_handle, m_mid);
+        data.m_with_status = m_with_status;
+        return data;
+    }
+
+    /**
+     * @brief Constructor for an RPC that was dispatched locally.
+     *
+     * @param mid Margo instance associated with the RPC.
+     * @param local State shared with the handler.
+     * @param ignore_resp whether response should be ignored.
+     */
+    async_response(margo_instance_ref mid,
+                   std::shared_ptr<detail::local_call> local,
+                   bool ignore_resp) noexcept
+    : m_mid(std::move(mid))
+    , m_ignore_response(ignore_resp)
+    , m_local(std::move(local)) {}
+
+    /**
+     * @brief Constructor for an RPC sent through an rpc_batcher.
+     *
+     * @param mid Margo instance associated with the RPC.
+     * @param batched State of the call within its batch.
+     * @param ignore_resp whether response should be ignored.
+     */
+    async_response(margo_instance_ref mid,
+                   std::shared_ptr<detail::batched_call> batched,
+                   bool ignore_resp) noexcept
+    : m_mid(std::move(mid))
+    , m_ignore_response(ignore_resp)
+    , m_batched(std::move(batched)) {}
+
   public:
 
     async_response() = default;
@@ -68,9 +153,14 @@ class async_response {
      */
     async_response(async_response&& other) noexcept
     : m_mid(std::move(other.m_mid))
-    , m_request{std::exchange(other.m_request, MARGO_REQUEST_NULL)}
+    , m_completion(std::move(other.m_completion))
     , m_handle{std::exchange(other.m_handle, HG_HANDLE_NULL)}
-    , m_ignore_response(other.m_ignore_response) {}
+    , m_ignore_response(other.m_ignore_response)
+    , m_with_status(other.m_with_status)
+    , m_local(std::move(other.m_local))
+    , m_batched(std::move(other.m_batched))
+    , m_handle_cache(std::move(other.m_handle_cache))
+    , m_offload(std::move(other.m_offload)) {}
 
     /**
      * @brief Copy-assignment operator is deleted.
@@ -81,15 +171,22 @@ class async_response {
      * @brief Move-assignment operator.
      */
     async_response& operator=(async_response&& other) {
-        if(&other == this || m_request == other.m_request) return *this;
-        if(m_request != MARGO_REQUEST_NULL)
-            wait();
+        if(&other == this) return *this;
+        if(m_completion == other.m_completion && m_local == other.m_local
+        && m_batched == other.m_batched && m_handle == other.m_handle) return *this;
+        if(m_completion)
+            m_completion->wait();
         if(m_handle != HG_HANDLE_NULL)
-            margo_destroy(m_handle);
+            detail::release_handle(m_handle_cache, m_handle);
         m_mid             = std::move(other.m_mid);
-        m_request         = std::exchange(other.m_request, MARGO_REQUEST_NULL);
+        m_completion      = std::move(other.m_completion);
         m_handle          = std::exchange(other.m_handle, HG_HANDLE_NULL);
         m_ignore_response = other.m_ignore_response;
+        m_with_status     = other.m_with_status;
+        m_local           = std::move(other.m_local);
+        m_batched         = std::move(other.m_batched);
+        m_handle_cache    = std::move(other.m_handle_cache);
+        m_offload         = std::move(other.m_offload);
         return *this;
     }
 
@@ -97,10 +194,11 @@ class async_response {
      * @brief Destructor.
      */
     ~async_response() noexcept {
-        if(m_request != MARGO_REQUEST_NULL)
-            wait();
+        // the handle cannot be released while the RPC is in flight
+        if(m_completion)
+            m_completion->wait();
         if(m_handle != HG_HANDLE_NULL)
-            margo_destroy(m_handle);
+            detail::release_handle(m_handle_cache, m_handle);
     }
 
     /**
@@ -110,20 +208,35 @@ class async_response {
      * @return a packed_data containing the response.
      */
     packed_data<> wait() {
+        if(m_local) {
+            if(m_ignore_response)
+                return packed_data<>();
+            m_local->m_completed.wait();
+            return packed_data<>(m_mid, m_local->m_output);
+        }
+        if(m_batched) {
+            if(m_ignore_response)
+                return packed_data<>();
+            return packed_data<>(m_mid, m_batched->wait());
+        }
         if(m_handle == HG_HANDLE_NULL)
             throw exception("Calling wait on an invalid async_response");
-        hg_return_t ret;
-        if(m_request != MARGO_REQUEST_NULL) {
-            ret = margo_wait(m_request);
-            m_request = MARGO_REQUEST_NULL;
+        if(m_completion) {
+            hg_return_t ret = m_completion->wait();
+            m_completion.reset();
+            // the server has decoded the arguments once it responded
+            m_offload.reset();
             if(ret == HG_TIMEOUT) {
                 throw timeout();
             }
-            MARGO_ASSERT(ret, margo_wait);
+            // a plain call rejected by admission control (see admission_limits)
+            if(ret == HG_BUSY)
+                throw busy();
+            MARGO_ASSERT(ret, margo_provider_cforward);
         }
         if(m_ignore_response)
             return packed_data<>();
-        return packed_data<>(margo_get_output, margo_free_output, m_handle, m_mid);
+        return response_data();
     }
 
     /**
@@ -132,15 +245,47 @@ class async_response {
      * @return true if the response has been received, false otherwise.
      */
     bool received() const {
-        if(m_request == MARGO_REQUEST_NULL)
-            return true;
-        int ret;
-        int flag;
-        ret = margo_test(m_request, &flag);
-        MARGO_ASSERT((hg_return_t)ret, margo_test);
-        return flag;
+        if(m_local)
+            return m_ignore_response || m_local->m_completed.test();
+        if(m_batched)
+            return m_ignore_response || m_batched->test();
+        return !m_completion || m_completion->test();
     }
 
+    /**
+     * @brief Registers a callback to be invoked with the response (as a
+     * packed_data<>) once it has been received, in a new ULT pushed into
+     * the provided pool. Contrary to wait(), then() does not block the
+     * calling ULT, and no ULT waits for the response: the ULT running the
+     * callback is created when the response is received. The async_response
+     * is moved into the continuation, after which this object is invalid.
+     *
+     * If the RPC fails (e.g. it times out), or if the margo instance is
+     * finalized before the response is received, the callback is not
+     * invoked and the error is logged. Exceptions thrown by the callback
+     * are logged as well.
+     *
+     * @tparam F type of callback, invocable with a packed_data<>.
+     * @param p Pool in which to run the callback.
+     * @param callback Callback.
+     */
+    template <typename F>
+    void then(const pool& p, F&& callback);
+
+    /**
+     * @brief Same as then(p, callback), with an error callback
+     * invoked with the exception (const std::exception&) raised
+     * if the RPC fails, instead of the callback.
+     *
+     * @tparam F type of callback, invocable with a packed_data<>.
+     * @tparam E type of error callback, invocable with a const std::exception&.
+     * @param p Pool in which to run the callbacks.
+     * @param callback Callback.
+     * @param on_error Error callback.
+     */
+    template <typename F, typename E>
+    void then(const pool& p, F&& callback, E&& on_error);
+
     /**
      * @brief Waits for any of the provided async_response to complete,
      * and return a packed_data. The completed iterator will be set to point
@@ -159,28 +304,143 @@ class async_response {
     template <typename Iterator>
     static packed_data<> wait_any(const Iterator& begin, const Iterator& end,
                                   Iterator& completed) {
-        std::vector<margo_request> reqs;
-        size_t                     count = std::distance(begin, end);
-        reqs.reserve(count);
+        completed = begin;
+        if(begin == end)
+            throw exception("Calling wait_any on an empty range of async_response");
+        auto done = wait_some(begin, end, 1);
+        if(!done.empty())
+            completed = done.front();
+        return completed->wait();
+    }
+
+    /**
+     * @brief Waits until at least min_count of the provided async_response
+     * have received their response, and returns iterators to those that
+     * have. The calling ULT is woken up only once, when enough responses
+     * have been received, rather than once per response. The responses
+     * can then be obtained without blocking by calling wait() on them.
+     *
+     * @tparam Iterator Iterator type (e.g.
+     * std::vector<async_response>::iterator)
+     * @param begin Begin iterator
+     * @param end End iterator
+     * @param min_count Minimum number of responses to wait for.
+     *
+     * @return iterators to the async_response that received their response.
+     */
+    template <typename Iterator>
+    static std::vector<Iterator> wait_some(const Iterator& begin, const Iterator& end,
+                                           size_t min_count) {
+        std::vector<Iterator>                                  iterators;
+        std::vector<std::shared_ptr<detail::completion_state>> states;
         for(auto it = begin; it != end; it++) {
-            reqs.push_back(it->m_request);
+            iterators.push_back(it);
+            // invalid async_response objects are considered completed
+            states.push_back(it->completion());
         }
-        completed         = begin;
-        size_t      index = 0;
-        hg_return_t ret   = margo_wait_any(count, reqs.data(), &index);
-        std::advance(completed, index);
-        if(ret == HG_TIMEOUT) {
-            throw timeout();
-        }
-        MARGO_ASSERT(ret, margo_wait_any);
-        if(completed->m_ignore_response) {
-            return packed_data<>();
+        auto indices = detail::wait_some(states, min_count);
+        std::vector<Iterator> completed;
+        completed.reserve(indices.size());
+        for(auto i : indices) completed.push_back(iterators[i]);
+        return completed;
+    }
+
+    /**
+     * @brief Waits until all the provided async_response have received
+     * their response, waking up the calling ULT only once. The responses
+     * can then be obtained without blocking by calling wait() on them.
+     *
+     * @tparam Iterator Iterator type (e.g.
+     * std::vector<async_response>::iterator)
+     * @param begin Begin iterator
+     * @param end End iterator
+     */
+    template <typename Iterator>
+    static void wait_all(const Iterator& begin, const Iterator& end) {
+        wait_some(begin, end, std::distance(begin, end));
+    }
+
+    /**
+     * @brief Waits until all the provided async_response have received
+     * their response, waking up the calling ULT only once, and returns
+     * the responses in the same order. This method throws the exception
+     * that wait() throws for the first failed RPC, if any.
+     *
+     * @tparam Iterator Iterator type (e.g.
+     * std::vector<async_response>::iterator)
+     * @param begin Begin iterator
+     * @param end End iterator
+     *
+     * @return a vector of packed_data.
+     */
+    template <typename Iterator>
+    static std::vector<packed_data<>> when_all(const Iterator& begin, const Iterator& end) {
+        wait_all(begin, end);
+        std::vector<packed_data<>> responses;
+        responses.reserve(std::distance(begin, end));
+        for(auto it = begin; it != end; it++)
+            responses.push_back(it->wait());
+        return responses;
+    }
+};
+
+namespace detail {
+
+/**
+ * @brief State of a continuation attached to an async_response.
+ */
+template <typename F, typename E>
+struct response_continuation {
+    async_response m_response;
+    F              m_callback;
+    E              m_on_error;
+
+    template <typename F1, typename E1>
+    response_continuation(async_response&& response, F1&& callback, E1&& on_error)
+    : m_response(std::move(response))
+    , m_callback(std::forward<F1>(callback))
+    , m_on_error(std::forward<E1>(on_error)) {}
+
+    void run() {
+        packed_data<> data;
+        try {
+            data = m_response.wait();
+        } catch(const std::exception& ex) {
+            m_on_error(ex);
+            return;
         }
-        return packed_data<>(margo_get_output, margo_free_output,
-                completed->m_handle, completed->m_mid);
+        m_callback(std::move(data));
     }
 };
 
+} // namespace detail
+
+} // namespace thallium
+
+#include <thallium/pool.hpp>
+
+namespace thallium {
+
+template <typename F>
+void async_response::then(const pool& p, F&& callback) {
+    margo_instance_id mid = m_mid;
+    then(p, std::forward<F>(callback), detail::log_continuation_error{mid});
+}
+
+template <typename F, typename E>
+void async_response::then(const pool& p, F&& callback, E&& on_error) {
+    if(!m_local && !m_batched && m_handle == HG_HANDLE_NULL)
+        throw exception("Calling then on an invalid async_response");
+    auto watcher = detail::get_instance_data<detail::completion_watcher>(m_mid);
+    auto state   = completion();
+    using continuation_type = detail::response_continuation<
+        typename std::decay<F>::type, typename std::decay<E>::type>;
+    auto c = std::make_shared<continuation_type>(
+        std::move(*this), std::forward<F>(callback), std::forward<E>(on_error));
+    watcher->watch(p.native_handle(), state, [c]() { c->run(); },
+                   [c](const std::exception& ex) { c->m_on_error(ex); });
+}
+
 } // namespace thallium
 
 #endif
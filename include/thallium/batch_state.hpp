@@ -0,0 +1,532 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_BATCH_STATE_HPP
+#define __THALLIUM_BATCH_STATE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <margo.h>
+#include <thallium/busy.hpp>
+#include <thallium/completion_state.hpp>
+#include <thallium/endpoint.hpp>
+#include <thallium/margo_exception.hpp>
+#include <thallium/margo_instance_ref.hpp>
+#include <thallium/mutex.hpp>
+#include <thallium/proc_buffer.hpp>
+#include <thallium/proc_object.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <tuple>
+#include <vector>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Name of the RPC carrying batches of calls sent by an rpc_batcher.
+ */
+inline const char* batch_rpc_name() {
+    return "__thallium_batch__";
+}
+
+/**
+ * @brief Whether an engine accepts batches of calls (see
+ * engine::enable_batching()), attached to a margo instance. The batch
+ * RPC is also registered by the engines sending batches, whose handler
+ * refuses the calls of the batches they receive.
+ */
+class batch_control {
+
+  public:
+
+    batch_control(margo_instance_id) {}
+
+    void enable() {
+        m_enabled = true;
+    }
+
+    bool enabled() const {
+        return m_enabled;
+    }
+
+    void on_finalize() {
+        m_enabled = false;
+    }
+
+  private:
+
+    std::atomic<bool> m_enabled{false};
+};
+
+/**
+ * @brief A call within a batch: the id of the RPC to invoke (including
+ * its provider id) and its serialized arguments.
+ */
+struct batch_entry {
+    hg_id_t           m_id = 0;
+    bool              m_expect_response = true;
+    std::vector<char> m_payload;
+
+    template <typename A> void serialize(A& ar) {
+        ar & m_id;
+        ar & m_expect_response;
+        ar & m_payload;
+    }
+};
+
+/**
+ * @brief Response to a call within a batch: the detail::rpc_status of
+ * the call (busy if it was rejected by admission control, error if no
+ * RPC defined by an engine has its id) and its serialized response.
+ */
+struct batch_output {
+    uint8_t           m_status = static_cast<uint8_t>(rpc_status::ok);
+    std::vector<char> m_payload;
+
+    template <typename A> void serialize(A& ar) {
+        ar & m_status;
+        ar & m_payload;
+    }
+};
+
+/**
+ * @brief Calls whose arguments and responses are serialized in buffers
+ * instead of being carried by a Mercury handle of their own (calls
+ * received within a batch or a collective). The request_with_context
+ * created for the index-th call reads its arguments from, and stores
+ * its response into, such an object.
+ */
+class buffered_calls {
+
+  public:
+
+    virtual ~buffered_calls() = default;
+
+    /**
+     * @brief Returns the handle of the RPC that carried the calls.
+     */
+    virtual hg_handle_t handle() const = 0;
+
+    /**
+     * @brief Returns the serialized arguments of the index-th call.
+     */
+    virtual const std::vector<char>& payload(size_t index) const = 0;
+
+    /**
+     * @brief Stores the serialized response of the index-th call.
+     */
+    virtual hg_return_t respond(size_t index, std::vector<char>&& output) = 0;
+
+    /**
+     * @brief Returns the serialized arguments of the index-th call.
+     * The returned pointer shares ownership of the calls.
+     */
+    static std::shared_ptr<const std::vector<char>>
+    input(const std::shared_ptr<buffered_calls>& calls, size_t index) {
+        return std::shared_ptr<const std::vector<char>>(
+            calls, &calls->payload(index));
+    }
+};
+
+/**
+ * @brief Server-side state of a received batch. Each call of the batch
+ * is handled by its own request_with_context, which stores its response
+ * here; the last one to respond sends the response of the whole batch.
+ */
+class batch_state : public buffered_calls {
+
+  public:
+
+    batch_state(margo_instance_id mid, hg_handle_t handle)
+    : m_mid(mid)
+    , m_handle(handle) {
+        margo_ref_incr(m_handle);
+    }
+
+    batch_state(const batch_state&)            = delete;
+    batch_state& operator=(const batch_state&) = delete;
+
+    ~batch_state() {
+        margo_destroy(m_handle);
+    }
+
+    hg_handle_t handle() const override {
+        return m_handle;
+    }
+
+    const std::vector<char>& payload(size_t index) const override {
+        return m_entries[index].m_payload;
+    }
+
+    std::vector<batch_entry>& entries() {
+        return m_entries;
+    }
+
+    /**
+     * @brief Decodes the calls contained in the batch.
+     */
+    hg_return_t decode() {
+        std::tuple<> ctx;
+        meta_proc_fn mproc = [this, &ctx](hg_proc_t proc) {
+            try {
+                return proc_object_decode(proc, m_entries, m_mid, ctx);
+            } catch(const std::exception& ex) {
+                margo_error(m_mid, "[thallium] Could not decode batch: %s", ex.what());
+                return HG_INVALID_ARG;
+            }
+        };
+        hg_return_t ret = margo_get_input(m_handle, &mproc);
+        if(ret != HG_SUCCESS)
+            return ret;
+        ret = margo_free_input(m_handle, &mproc);
+        m_outputs.resize(m_entries.size());
+        size_t pending = 0;
+        for(auto& e : m_entries)
+            if(e.m_expect_response) pending += 1;
+        m_pending = pending;
+        return ret;
+    }
+
+    /**
+     * @brief Stores the serialized response of the index-th call,
+     * sending the batch's response if it was the last one expected.
+     */
+    hg_return_t respond(size_t index, std::vector<char>&& output) override {
+        if(!m_entries[index].m_expect_response)
+            return HG_SUCCESS;
+        m_outputs[index].m_payload = std::move(output);
+        if(--m_pending != 0)
+            return HG_SUCCESS;
+        return send_response();
+    }
+
+    /**
+     * @brief Responds to the index-th call, which was not handed to
+     * a handler, with the provided status.
+     */
+    hg_return_t fail(size_t index, rpc_status status) {
+        if(!m_entries[index].m_expect_response)
+            return HG_SUCCESS;
+        m_outputs[index].m_status = static_cast<uint8_t>(status);
+        if(--m_pending != 0)
+            return HG_SUCCESS;
+        return send_response();
+    }
+
+    /**
+     * @brief Responds to a batch that could not be decoded with no
+     * responses, so that each of its callers gets an exception instead
+     * of waiting for a response that would never come.
+     */
+    hg_return_t reject() {
+        m_entries.clear();
+        m_outputs.clear();
+        m_pending = 0;
+        return send_response();
+    }
+
+    /**
+     * @brief Sends the response of the batch (called directly
+     * if none of its calls expects a response).
+     */
+    hg_return_t send_response() {
+        std::tuple<> ctx;
+        meta_proc_fn mproc = [this, &ctx](hg_proc_t proc) {
+            return proc_object_encode(proc, m_outputs, m_mid, ctx);
+        };
+        return margo_respond(m_handle, &mproc);
+    }
+
+    size_t pending() const {
+        return m_pending;
+    }
+
+  private:
+
+    margo_instance_id              m_mid;
+    hg_handle_t                    m_handle;
+    std::vector<batch_entry>       m_entries;
+    std::vector<batch_output>      m_outputs;
+    std::atomic<size_t>            m_pending{0};
+};
+
+/**
+ * @brief Client-side state of a batch that has been sent.
+ * m_completion completes when the response of the batch has been
+ * received; the first caller to wait on it then decodes the responses
+ * of all the calls.
+ */
+class sent_batch {
+
+  public:
+
+    sent_batch(margo_instance_id mid)
+    : m_mid(mid) {}
+
+    sent_batch(const sent_batch&)            = delete;
+    sent_batch& operator=(const sent_batch&) = delete;
+
+    ~sent_batch() {
+        if(m_handle != HG_HANDLE_NULL) {
+            m_completion->wait();
+            margo_destroy(m_handle);
+        }
+    }
+
+    /**
+     * @brief Sends the provided calls to the endpoint.
+     */
+    void send(hg_addr_t addr, hg_id_t batch_id, std::vector<batch_entry>& entries) {
+        std::tuple<> ctx;
+        meta_proc_fn mproc = [this, &entries, &ctx](hg_proc_t proc) {
+            return proc_object_encode(proc, entries, m_mid, ctx);
+        };
+        hg_return_t ret = margo_create(m_mid, addr, batch_id, &m_handle);
+        if(ret == HG_SUCCESS)
+            ret = provider_cforward(MARGO_DEFAULT_PROVIDER_ID, m_handle, &mproc,
+                                    -1.0, m_completion);
+        if(ret != HG_SUCCESS)
+            m_completion->complete(ret);
+    }
+
+    /**
+     * @brief Waits for the response of the batch.
+     */
+    void wait() {
+        hg_return_t ret = m_completion->wait();
+        std::lock_guard<mutex> lock(m_mutex);
+        decode(ret);
+    }
+
+    /**
+     * @brief Checks without blocking whether the response of the batch
+     * has been received.
+     */
+    bool test() {
+        return m_completion->test();
+    }
+
+    /**
+     * @brief Returns the completion of the batch.
+     */
+    const std::shared_ptr<completion_state>& completion() const {
+        return m_completion;
+    }
+
+    /**
+     * @brief Returns the serialized response of the index-th call of
+     * the batch, or throws if the batch could not be completed, if the
+     * call was rejected by the server's admission control (busy), or if
+     * the server has no handler for it. The returned pointer shares
+     * ownership of the batch.
+     */
+    static std::shared_ptr<const std::vector<char>>
+    output(const std::shared_ptr<sent_batch>& batch, size_t index) {
+        batch->wait();
+        MARGO_ASSERT(batch->m_status, margo_provider_cforward);
+        if(index >= batch->m_outputs.size())
+            throw exception("Invalid response received for a batched RPC");
+        auto& output = batch->m_outputs[index];
+        switch(static_cast<rpc_status>(output.m_status)) {
+        case rpc_status::ok:
+            break;
+        case rpc_status::busy:
+            throw busy();
+        default:
+            throw exception("No handler is defined for the batched RPC");
+        }
+        return std::shared_ptr<const std::vector<char>>(batch, &output.m_payload);
+    }
+
+  private:
+
+    void decode(hg_return_t ret) {
+        if(m_done)
+            return;
+        m_status = ret;
+        if(m_status == HG_SUCCESS) {
+            std::tuple<> ctx;
+            meta_proc_fn mproc = [this, &ctx](hg_proc_t proc) {
+                return proc_object_decode(proc, m_outputs, m_mid, ctx);
+            };
+            m_status = margo_get_output(m_handle, &mproc);
+            if(m_status == HG_SUCCESS)
+                m_status = margo_free_output(m_handle, &mproc);
+        }
+        m_done = true;
+    }
+
+    margo_instance_id                 m_mid;
+    hg_handle_t                       m_handle     = HG_HANDLE_NULL;
+    std::shared_ptr<completion_state> m_completion = std::make_shared<completion_state>();
+    hg_return_t                       m_status     = HG_SUCCESS;
+    bool                              m_done       = false;
+    std::vector<batch_output>         m_outputs;
+    mutex                             m_mutex;
+};
+
+class batch_queue;
+
+/**
+ * @brief Client-side state of a call made through an rpc_batcher.
+ * m_batch is set (under the queue's mutex) when the call is sent.
+ */
+struct batched_call {
+    std::shared_ptr<batch_queue> m_queue;
+    std::shared_ptr<sent_batch>  m_batch;
+    size_t                       m_index = 0;
+
+    std::shared_ptr<const std::vector<char>> wait();
+    std::shared_ptr<completion_state> completion();
+    bool test();
+    void flush();
+};
+
+/**
+ * @brief Calls buffered by an rpc_batcher for a given endpoint and
+ * provider id. The queue is flushed when it reaches the size thresholds
+ * of the batcher, when the batcher's timer fires, or when a caller waits
+ * on one of its calls.
+ */
+class batch_queue {
+
+    friend struct batched_call;
+
+  public:
+
+    batch_queue(margo_instance_ref mid, const endpoint& ep, uint16_t provider_id,
+                hg_id_t batch_id, size_t max_calls, size_t max_bytes)
+    : m_mid(std::move(mid))
+    , m_endpoint(ep)
+    , m_provider_id(provider_id)
+    , m_batch_id(batch_id)
+    , m_max_calls(max_calls)
+    , m_max_bytes(max_bytes) {}
+
+    batch_queue(const batch_queue&)            = delete;
+    batch_queue& operator=(const batch_queue&) = delete;
+
+    const endpoint& get_endpoint() const {
+        return m_endpoint;
+    }
+
+    uint16_t provider_id() const {
+        return m_provider_id;
+    }
+
+    /**
+     * @brief Adds a call to the queue, flushing it if a threshold is reached.
+     */
+    std::shared_ptr<batched_call> push(const std::shared_ptr<batch_queue>& self,
+                                       batch_entry&& entry) {
+        auto call     = std::make_shared<batched_call>();
+        call->m_queue = self;
+        std::lock_guard<mutex> lock(m_mutex);
+        m_bytes += entry.m_payload.size();
+        m_entries.push_back(std::move(entry));
+        m_calls.push_back(call);
+        if(m_entries.size() >= m_max_calls || m_bytes >= m_max_bytes)
+            flush_locked();
+        return call;
+    }
+
+    /**
+     * @brief Sends the buffered calls.
+     */
+    void flush() {
+        std::lock_guard<mutex> lock(m_mutex);
+        flush_locked();
+    }
+
+    /**
+     * @brief Flushes the queue and waits for all its batches to complete.
+     */
+    void drain() {
+        std::vector<std::shared_ptr<sent_batch>> in_flight;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            flush_locked();
+            in_flight.swap(m_in_flight);
+        }
+        for(auto& b : in_flight) b->wait();
+    }
+
+  private:
+
+    void flush_locked() {
+        if(m_entries.empty())
+            return;
+        auto batch = std::make_shared<sent_batch>(m_mid);
+        batch->send(m_endpoint.get_addr(), m_batch_id, m_entries);
+        for(size_t i = 0; i < m_calls.size(); i++) {
+            m_calls[i]->m_batch = batch;
+            m_calls[i]->m_index = i;
+        }
+        m_entries.clear();
+        m_calls.clear();
+        m_bytes = 0;
+        // keep batches alive until completed, since callers that
+        // ignore responses will never wait on them
+        m_in_flight.erase(
+            std::remove_if(m_in_flight.begin(), m_in_flight.end(),
+                [](const std::shared_ptr<sent_batch>& b) { return b->test(); }),
+            m_in_flight.end());
+        m_in_flight.push_back(std::move(batch));
+    }
+
+    margo_instance_ref                          m_mid;
+    endpoint                                    m_endpoint;
+    uint16_t                                    m_provider_id;
+    hg_id_t                                     m_batch_id;
+    size_t                                      m_max_calls;
+    size_t                                      m_max_bytes;
+    size_t                                      m_bytes = 0;
+    std::vector<batch_entry>                    m_entries;
+    std::vector<std::shared_ptr<batched_call>>  m_calls;
+    std::vector<std::shared_ptr<sent_batch>>    m_in_flight;
+    mutex                                       m_mutex;
+};
+
+inline std::shared_ptr<const std::vector<char>> batched_call::wait() {
+    std::shared_ptr<sent_batch> batch;
+    {
+        std::lock_guard<mutex> lock(m_queue->m_mutex);
+        if(!m_batch)
+            m_queue->flush_locked();
+        batch = m_batch;
+    }
+    return sent_batch::output(batch, m_index);
+}
+
+inline std::shared_ptr<completion_state> batched_call::completion() {
+    std::lock_guard<mutex> lock(m_queue->m_mutex);
+    if(!m_batch)
+        m_queue->flush_locked();
+    return m_batch->completion();
+}
+
+inline void batched_call::flush() {
+    std::lock_guard<mutex> lock(m_queue->m_mutex);
+    if(!m_batch)
+        m_queue->flush_locked();
+}
+
+inline bool batched_call::test() {
+    std::shared_ptr<sent_batch> batch;
+    {
+        std::lock_guard<mutex> lock(m_queue->m_mutex);
+        batch = m_batch;
+    }
+    return batch && batch->test();
+}
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
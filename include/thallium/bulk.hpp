@@ -9,7 +9,10 @@
 #include <thallium/margo_instance_ref.hpp>
 #include <thallium/margo_exception.hpp>
 #include <thallium/timeout.hpp>
+#include <thallium/completion_watcher.hpp>
 #include <cstdint>
+#include <functional>
+#include <iterator>
 #include <memory>
 #include <margo.h>
 #include <string>
@@ -22,6 +25,12 @@ class endpoint;
 class remote_bulk;
 class bulk_segment;
 class timed_remote_bulk;
+class pool;
+template <typename... CtxArg> class proc_output_archive;
+
+namespace detail {
+class bulk_awaiter;
+}
 
 
 /**
@@ -31,61 +40,171 @@ class timed_remote_bulk;
 class async_bulk_op {
 
     friend class remote_bulk;
+    friend class detail::bulk_awaiter;
 
     public:
 
     bool test() const {
-        if(m_request == MARGO_REQUEST_NULL)
+        if(!m_completion)
             throw exception{"Calling async_bulk_op::test() on a null request"};
-        int flag;
-        int ret = margo_test(m_request, &flag);
-        MARGO_ASSERT((hg_return_t)ret, margo_test);
-        return flag != 0;
+        return m_completion->test();
     }
 
     std::size_t wait() {
-        if(m_request == MARGO_REQUEST_NULL)
+        if(!m_completion)
             throw exception{"Calling async_bulk_op::wait() on a null request"};
-        hg_return_t ret = margo_wait(m_request);
-        m_request = MARGO_REQUEST_NULL;
+        hg_return_t ret = m_completion->wait();
+        m_completion.reset();
         if(ret == HG_TIMEOUT) throw timeout{};
-        MARGO_ASSERT(ret, margo_wait);
+        MARGO_ASSERT(ret, margo_bulk_ctransfer);
         return m_tranferred_size;
     }
 
     async_bulk_op(const async_bulk_op&) = delete;
 
     async_bulk_op(async_bulk_op&& other)
-    : m_request{std::exchange(other.m_request, MARGO_REQUEST_NULL)}
+    : m_mid{other.m_mid}
+    , m_tranferred_size{other.m_tranferred_size}
+    , m_completion{std::move(other.m_completion)}
     {}
 
     async_bulk_op& operator=(const async_bulk_op&) = delete;
 
     async_bulk_op& operator=(async_bulk_op&& other) {
-        if(&other == this || m_request == other.m_request) return *this;
-        if(m_request != MARGO_REQUEST_NULL)
-            wait();
-        m_request = std::exchange(other.m_request, MARGO_REQUEST_NULL);
+        if(&other == this || m_completion == other.m_completion)
+            return *this;
+        if(m_completion)
+            m_completion->wait();
+        m_mid             = other.m_mid;
+        m_tranferred_size = other.m_tranferred_size;
+        m_completion      = std::move(other.m_completion);
         return *this;
     }
 
     ~async_bulk_op() {
-        if(m_request != MARGO_REQUEST_NULL) {
-            wait();
-        }
+        if(m_completion)
+            m_completion->wait();
+    }
+
+    /**
+     * @brief Registers a callback to be invoked with the transferred
+     * size once the operation has completed, in a new ULT pushed into
+     * the provided pool when it completes, without blocking the calling
+     * ULT. The operation is moved into the continuation, after which this
+     * object is invalid.
+     *
+     * If the transfer fails, or if the margo instance is finalized before
+     * it completes, the callback is not invoked and the error is logged.
+     * Exceptions thrown by the callback are logged as well.
+     *
+     * @tparam F type of callback, invocable with a std::size_t.
+     * @param p Pool in which to run the callback.
+     * @param callback Callback.
+     */
+    template <typename F>
+    void then(const pool& p, F&& callback);
+
+    /**
+     * @brief Same as then(p, callback), with an error callback
+     * invoked with the exception (const std::exception&) raised
+     * if the transfer fails, instead of the callback.
+     *
+     * @tparam F type of callback, invocable with a std::size_t.
+     * @tparam E type of error callback, invocable with a const std::exception&.
+     * @param p Pool in which to run the callbacks.
+     * @param callback Callback.
+     * @param on_error Error callback.
+     */
+    template <typename F, typename E>
+    void then(const pool& p, F&& callback, E&& on_error);
+
+    /**
+     * @brief Waits until at least min_count of the provided operations
+     * have completed, and returns iterators to those that have. The calling
+     * ULT is woken up only once, rather than once per operation. The
+     * transferred sizes can then be obtained without blocking by calling
+     * wait() on the completed operations.
+     *
+     * @tparam Iterator Iterator type (e.g. std::vector<async_bulk_op>::iterator)
+     * @param begin Begin iterator
+     * @param end End iterator
+     * @param min_count Minimum number of operations to wait for.
+     *
+     * @return iterators to the completed operations.
+     */
+    template <typename Iterator>
+    static std::vector<Iterator> wait_some(const Iterator& begin, const Iterator& end,
+                                           std::size_t min_count);
+
+    /**
+     * @brief Waits until all the provided operations have completed,
+     * waking up the calling ULT only once.
+     *
+     * @tparam Iterator Iterator type (e.g. std::vector<async_bulk_op>::iterator)
+     * @param begin Begin iterator
+     * @param end End iterator
+     */
+    template <typename Iterator>
+    static void wait_all(const Iterator& begin, const Iterator& end) {
+        wait_some(begin, end, std::distance(begin, end));
+    }
+
+    /**
+     * @brief Waits until all the provided operations have completed,
+     * waking up the calling ULT only once, and returns the transferred
+     * sizes in the same order. This method throws the exception that
+     * wait() throws for the first failed operation, if any.
+     *
+     * @tparam Iterator Iterator type (e.g. std::vector<async_bulk_op>::iterator)
+     * @param begin Begin iterator
+     * @param end End iterator
+     *
+     * @return the transferred sizes.
+     */
+    template <typename Iterator>
+    static std::vector<std::size_t> when_all(const Iterator& begin, const Iterator& end) {
+        wait_all(begin, end);
+        std::vector<std::size_t> sizes;
+        sizes.reserve(std::distance(begin, end));
+        for(auto it = begin; it != end; it++)
+            sizes.push_back(it->wait());
+        return sizes;
     }
 
     private:
 
-    async_bulk_op(std::size_t size, margo_request req)
-    : m_tranferred_size{size}
-    , m_request{req}
+    async_bulk_op(margo_instance_id mid, std::size_t size,
+                  std::shared_ptr<detail::completion_state> completion)
+    : m_mid{mid}
+    , m_tranferred_size{size}
+    , m_completion{std::move(completion)}
     {}
 
-    std::size_t   m_tranferred_size;
-    margo_request m_request;
+    margo_instance_id m_mid = MARGO_INSTANCE_NULL;
+    std::size_t       m_tranferred_size = 0;
+    std::shared_ptr<detail::completion_state> m_completion; // reset once waited on
 };
 
+namespace detail {
+
+template <typename A>
+inline hg_return_t proc_bulk_handle(A& ar, hg_bulk_t* handle) {
+    return hg_proc_hg_bulk_t(ar.get_proc(), handle);
+}
+
+template <typename... CtxArg>
+inline hg_return_t proc_bulk_handle(proc_output_archive<CtxArg...>& ar, hg_bulk_t* handle) {
+    if(!ar.is_sizing())
+        return hg_proc_hg_bulk_t(ar.get_proc(), handle);
+    // hg_proc_hg_bulk_t encodes the size of the serialized handle, then
+    // the handle (its data is not embedded, since no eager flag is set)
+    hg_uint64_t size = *handle == HG_BULK_NULL ? 0 : HG_Bulk_get_serialize_size(*handle, 0);
+    ar.add_size(sizeof(size) + size);
+    return HG_SUCCESS;
+}
+
+} // namespace detail
+
 /**
  * @brief bulk objects represent abstractions of memory
  * segments exposed by a process for RDMA operations. A bulk
@@ -317,7 +436,7 @@ class bulk {
      */
     template <typename A> void serialize(A& ar) {
         using namespace std::string_literals;
-        auto ret = hg_proc_hg_bulk_t(ar.get_proc(), &m_bulk);
+        auto ret = detail::proc_bulk_handle(ar, &m_bulk);
         if(ret != HG_SUCCESS) {
             std::stringstream ss;
             throw exception{
@@ -477,6 +596,8 @@ class bulk_segment {
 
 #include <thallium/endpoint.hpp>
 #include <thallium/remote_bulk.hpp>
+#include <thallium/instance_data.hpp>
+#include <thallium/pool.hpp>
 
 namespace thallium {
 
@@ -535,6 +656,73 @@ inline async_bulk_op bulk::pull_from(const remote_bulk& b) const {
     return b.pull_to(*this);
 }
 
+namespace detail {
+
+/**
+ * @brief State of a continuation attached to an async_bulk_op.
+ */
+template <typename F, typename E>
+struct bulk_continuation {
+    async_bulk_op m_op;
+    F             m_callback;
+    E             m_on_error;
+
+    template <typename F1, typename E1>
+    bulk_continuation(async_bulk_op&& op, F1&& callback, E1&& on_error)
+    : m_op(std::move(op))
+    , m_callback(std::forward<F1>(callback))
+    , m_on_error(std::forward<E1>(on_error)) {}
+
+    void run() {
+        std::size_t size = 0;
+        try {
+            size = m_op.wait();
+        } catch(const std::exception& ex) {
+            m_on_error(ex);
+            return;
+        }
+        m_callback(size);
+    }
+};
+
+} // namespace detail
+
+template <typename F>
+void async_bulk_op::then(const pool& p, F&& callback) {
+    then(p, std::forward<F>(callback), detail::log_continuation_error{m_mid});
+}
+
+template <typename F, typename E>
+void async_bulk_op::then(const pool& p, F&& callback, E&& on_error) {
+    if(!m_completion)
+        throw exception{"Calling async_bulk_op::then() on a null request"};
+    auto watcher = detail::get_instance_data<detail::completion_watcher>(m_mid);
+    auto state   = m_completion;
+    using continuation_type = detail::bulk_continuation<
+        typename std::decay<F>::type, typename std::decay<E>::type>;
+    auto c = std::make_shared<continuation_type>(
+        std::move(*this), std::forward<F>(callback), std::forward<E>(on_error));
+    watcher->watch(p.native_handle(), state, [c]() { c->run(); },
+                   [c](const std::exception& ex) { c->m_on_error(ex); });
+}
+
+template <typename Iterator>
+std::vector<Iterator> async_bulk_op::wait_some(const Iterator& begin, const Iterator& end,
+                                               std::size_t min_count) {
+    std::vector<Iterator>                                  iterators;
+    std::vector<std::shared_ptr<detail::completion_state>> states;
+    for(auto it = begin; it != end; it++) {
+        iterators.push_back(it);
+        // operations already waited on (null) are considered completed
+        states.push_back(it->m_completion);
+    }
+    auto indices = detail::wait_some(states, min_count);
+    std::vector<Iterator> completed;
+    completed.reserve(indices.size());
+    for(auto i : indices) completed.push_back(iterators[i]);
+    return completed;
+}
+
 } // namespace thallium
 
 #endif
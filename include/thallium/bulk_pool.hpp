@@ -0,0 +1,340 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_BULK_POOL_HPP
+#define __THALLIUM_BULK_POOL_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <margo.h>
+#include <thallium/bulk.hpp>
+#include <thallium/bulk_mode.hpp>
+#include <thallium/engine.hpp>
+#include <thallium/exception.hpp>
+#include <thallium/mutex.hpp>
+
+namespace thallium {
+
+/**
+ * @brief Statistics of a bulk_pool (see bulk_pool::stats()).
+ */
+struct bulk_pool_stats {
+    uint64_t hits           = 0; // leases served from a pre-registered buffer
+    uint64_t misses         = 0; // leases that needed their own registration
+    size_t   leased         = 0; // pre-registered buffers currently leased
+    size_t   peak_leased    = 0; // highest value of leased so far
+    size_t   capacity       = 0; // number of pre-registered buffers
+    size_t   leased_bytes   = 0; // size of the pre-registered buffers currently leased
+    size_t   capacity_bytes = 0; // size of all the pre-registered buffers
+
+    /**
+     * @brief Fraction of the leases served without registering memory.
+     */
+    double hit_rate() const {
+        uint64_t total = hits + misses;
+        return total ? static_cast<double>(hits) / total : 1.0;
+    }
+
+    /**
+     * @brief Fraction of the pre-registered buffers currently leased.
+     */
+    double occupancy() const {
+        return capacity ? static_cast<double>(leased) / capacity : 0.0;
+    }
+};
+
+/**
+ * @brief A bulk_pool registers a set of buffers for RDMA once, when it is
+ * created, and leases them to avoid calling engine::expose() (and hence
+ * registering memory) for each transfer.
+ *
+ * The buffers are organized in size classes, each carved out of a single
+ * registered slab. A request for n bytes is served by a free buffer of the
+ * smallest class that fits n bytes, or of a larger class if all of those
+ * are leased. When no buffer can be found, the lease gets a buffer of its
+ * own, registered for this lease only, and counts as a miss.
+ *
+ * Leases return their buffer to the pool when destroyed, and keep the pool's
+ * buffers alive if they outlive the bulk_pool object.
+ */
+class bulk_pool {
+
+  public:
+
+    /**
+     * @brief Size class of a bulk_pool: count buffers of buffer_size bytes.
+     */
+    struct size_class {
+        size_t buffer_size;
+        size_t count;
+    };
+
+    class lease;
+
+    /**
+     * @brief Allocates and registers the buffers of the pool.
+     *
+     * @param e Engine with which to register the buffers.
+     * @param classes Size classes of the pool.
+     * @param mode Mode with which the buffers are exposed.
+     */
+    bulk_pool(engine& e, std::vector<size_class> classes,
+              bulk_mode mode = bulk_mode::read_write);
+
+    bulk_pool(const bulk_pool&)            = delete;
+    bulk_pool& operator=(const bulk_pool&) = delete;
+
+    /**
+     * @brief Move constructor. The moved-from pool remains usable but
+     * has no pre-registered buffers: all its leases are misses.
+     */
+    bulk_pool(bulk_pool&& other)
+    : m_state(std::move(other.m_state)) {
+        other.m_state = std::make_shared<state>(m_state->m_mid, m_state->m_mode);
+    }
+
+    /**
+     * @brief Move assignment operator (see the move constructor).
+     */
+    bulk_pool& operator=(bulk_pool&& other) {
+        if(this == &other) return *this;
+        m_state       = std::move(other.m_state);
+        other.m_state = std::make_shared<state>(m_state->m_mid, m_state->m_mode);
+        return *this;
+    }
+
+    /**
+     * @brief Leases a buffer of at least size bytes. The buffer is
+     * not initialized.
+     */
+    lease acquire(size_t size);
+
+    /**
+     * @brief Returns the hit rate and occupancy of the pool.
+     */
+    bulk_pool_stats stats() const;
+
+  private:
+
+    struct slab {
+        size_t                  buffer_size;
+        std::unique_ptr<char[]> memory;
+        bulk                    handle;
+        std::vector<size_t>     free_buffers;
+    };
+
+    struct state {
+        margo_instance_id m_mid;
+        bulk_mode         m_mode;
+        std::vector<slab> m_slabs; // sorted by buffer size
+        bulk_pool_stats   m_stats;
+        mutable mutex     m_mutex;
+
+        state(margo_instance_id mid, bulk_mode mode)
+        : m_mid(mid)
+        , m_mode(mode) {}
+
+        void release(size_t slab_index, size_t buffer) {
+            std::lock_guard<mutex> lock(m_mutex);
+            m_slabs[slab_index].free_buffers.push_back(buffer);
+            m_stats.leased       -= 1;
+            m_stats.leased_bytes -= m_slabs[slab_index].buffer_size;
+        }
+    };
+
+    std::shared_ptr<state> m_state;
+};
+
+/**
+ * @brief Buffer leased from a bulk_pool, returned to the pool when the
+ * lease is destroyed. The segment() of a lease can be used as the local
+ * side of any bulk transfer. It is the only access to the registered
+ * memory: a pooled lease shares the bulk handle of a whole slab with the
+ * other leases of its size class, so the handle itself is never exposed.
+ */
+class bulk_pool::lease {
+
+    friend class bulk_pool;
+
+    std::shared_ptr<bulk_pool::state> m_state;
+    size_t                            m_slab   = 0;
+    size_t                            m_buffer = 0;
+    char*                             m_data   = nullptr;
+    size_t                            m_size   = 0;
+    size_t                            m_offset = 0;
+    bulk                              m_bulk; // whole slab for pooled leases
+    std::unique_ptr<char[]>           m_own; // set for leases that missed the pool
+
+  public:
+
+    lease() = default;
+
+    lease(const lease&)            = delete;
+    lease& operator=(const lease&) = delete;
+
+    lease(lease&& other) noexcept
+    : m_state(std::move(other.m_state))
+    , m_slab(other.m_slab)
+    , m_buffer(other.m_buffer)
+    , m_data(other.m_data)
+    , m_size(other.m_size)
+    , m_offset(other.m_offset)
+    , m_bulk(std::move(other.m_bulk))
+    , m_own(std::move(other.m_own)) {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    lease& operator=(lease&& other) noexcept {
+        if(this == &other) return *this;
+        release();
+        m_state      = std::move(other.m_state);
+        m_slab       = other.m_slab;
+        m_buffer     = other.m_buffer;
+        m_data       = other.m_data;
+        m_size       = other.m_size;
+        m_offset     = other.m_offset;
+        m_bulk       = std::move(other.m_bulk);
+        m_own        = std::move(other.m_own);
+        other.m_data = nullptr;
+        other.m_size = 0;
+        return *this;
+    }
+
+    ~lease() {
+        release();
+    }
+
+    /**
+     * @brief Returns the buffer to the pool (or deregisters it if the
+     * lease missed the pool). The lease becomes empty.
+     */
+    void release() {
+        if(m_state && !m_own)
+            m_state->release(m_slab, m_buffer);
+        // deregister the memory before freeing it
+        m_bulk = bulk();
+        m_own.reset();
+        m_state.reset();
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    /**
+     * @brief Leased memory.
+     */
+    char* data() const {
+        return m_data;
+    }
+
+    /**
+     * @brief Size requested when acquiring the lease.
+     */
+    size_t size() const {
+        return m_size;
+    }
+
+    /**
+     * @brief Returns whether the buffer comes from the pool's
+     * pre-registered buffers.
+     */
+    bool is_pooled() const {
+        return m_state && !m_own;
+    }
+
+    /**
+     * @brief Registered region of the leased memory, restricted to
+     * the size requested when acquiring the lease.
+     */
+    bulk_segment segment() const {
+        return m_bulk.select(m_offset, m_size);
+    }
+
+    /**
+     * @see lease::segment.
+     */
+    operator bulk_segment() const {
+        return segment();
+    }
+
+    /**
+     * @brief Returns whether the lease holds a buffer.
+     */
+    explicit operator bool() const {
+        return m_data != nullptr;
+    }
+};
+
+inline bulk_pool::bulk_pool(engine& e, std::vector<size_class> classes, bulk_mode mode)
+: m_state(std::make_shared<state>(e.get_margo_instance(), mode)) {
+    std::sort(classes.begin(), classes.end(),
+              [](const size_class& a, const size_class& b) {
+                  return a.buffer_size < b.buffer_size;
+              });
+    m_state->m_slabs.reserve(classes.size());
+    for(auto& c : classes) {
+        if(c.buffer_size == 0 || c.count == 0)
+            throw exception("bulk_pool: size classes must have a non-zero size and count");
+        slab s;
+        s.buffer_size = c.buffer_size;
+        s.memory.reset(new char[c.buffer_size * c.count]);
+        std::vector<std::pair<void*, size_t>> segments{{s.memory.get(), c.buffer_size * c.count}};
+        s.handle = detail::expose_uncached(e.get_margo_instance(), segments, mode);
+        // buffers are handed out from the back, lowest addresses first
+        s.free_buffers.reserve(c.count);
+        for(size_t i = c.count; i > 0; i--) s.free_buffers.push_back(i - 1);
+        m_state->m_stats.capacity       += c.count;
+        m_state->m_stats.capacity_bytes += c.buffer_size * c.count;
+        m_state->m_slabs.push_back(std::move(s));
+    }
+}
+
+inline bulk_pool::lease bulk_pool::acquire(size_t size) {
+    lease l;
+    l.m_size = size;
+    {
+        std::lock_guard<mutex> lock(m_state->m_mutex);
+        auto& slabs = m_state->m_slabs;
+        for(size_t i = 0; i < slabs.size(); i++) {
+            slab& s = slabs[i];
+            if(s.buffer_size < size || s.free_buffers.empty())
+                continue;
+            l.m_state  = m_state;
+            l.m_slab   = i;
+            l.m_buffer = s.free_buffers.back();
+            l.m_offset = l.m_buffer * s.buffer_size;
+            l.m_data   = s.memory.get() + l.m_offset;
+            l.m_bulk   = s.handle;
+            s.free_buffers.pop_back();
+            auto& stats = m_state->m_stats;
+            stats.hits         += 1;
+            stats.leased       += 1;
+            stats.leased_bytes += s.buffer_size;
+            stats.peak_leased   = std::max(stats.peak_leased, stats.leased);
+            return l;
+        }
+        m_state->m_stats.misses += 1;
+    }
+    // no buffer available, register one for this lease only
+    l.m_state = m_state;
+    l.m_own.reset(new char[size ? size : 1]);
+    l.m_data  = l.m_own.get();
+    std::vector<std::pair<void*, size_t>> segments{{l.m_data, size ? size : 1}};
+    l.m_bulk = detail::expose_uncached(m_state->m_mid, segments, m_state->m_mode);
+    return l;
+}
+
+inline bulk_pool_stats bulk_pool::stats() const {
+    std::lock_guard<mutex> lock(m_state->m_mutex);
+    return m_state->m_stats;
+}
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_BUSY_HPP
+#define __THALLIUM_BUSY_HPP
+
+#include <exception>
+#include <stdexcept>
+
+namespace thallium {
+
+/**
+ * @brief This exception is thrown when an RPC is rejected by the
+ * server because it exceeds the admission limits of the targeted
+ * provider or RPC (see engine::set_admission_limits()). The caller
+ * may retry later.
+ */
+class busy : public std::exception {
+  public:
+    virtual const char* what() const throw() { return "Server busy, request rejected"; }
+};
+
+} // namespace thallium
+
+#endif
@@ -11,12 +11,16 @@
 #include <margo.h>
 #include <thallium/async_response.hpp>
 #include <thallium/margo_exception.hpp>
+#include <thallium/busy.hpp>
 #include <thallium/packed_data.hpp>
+#include <thallium/proc_buffer.hpp>
 #include <thallium/serialization/proc_output_archive.hpp>
 #include <thallium/serialization/serialize.hpp>
 #include <thallium/timeout.hpp>
 #include <thallium/margo_instance_ref.hpp>
 #include <thallium/reference_util.hpp>
+#include <thallium/self_dispatch.hpp>
+#include <thallium/handle_cache.hpp>
 #include <tuple>
 #include <utility>
 
@@ -39,27 +43,55 @@ class callable_remote_procedure_with_context {
     template<typename ... CtxArg2> friend class callable_remote_procedure_with_context;
 
   private:
-    margo_instance_ref            m_mid;
-    hg_handle_t                   m_handle;
-    bool                          m_ignore_response;
-    uint16_t                      m_provider_id;
-    mutable std::tuple<CtxArg...> m_context;
+    margo_instance_ref                     m_mid;
+    hg_handle_t                            m_handle;
+    mutable hg_handle_t                    m_header_handle = HG_HANDLE_NULL; // see call_handle()
+    hg_id_t                                m_header_id = 0;
+    bool                                   m_status_replies = false; // always send an rpc_header
+    bool                                   m_deadlines = false; // send the deadline of timed calls
+    bool                                   m_ignore_response;
+    uint16_t                               m_provider_id;
+    mutable std::tuple<CtxArg...>          m_context;
+    bool                                   m_self_dispatch = false;
+    std::shared_ptr<detail::handle_cache>  m_handle_cache;
+    std::shared_ptr<detail::compression>   m_compression;
+    std::shared_ptr<detail::offload_state> m_offload;
 
     callable_remote_procedure_with_context(
             margo_instance_ref mid,
             hg_handle_t handle,
+            hg_handle_t header_handle,
+            hg_id_t header_id,
+            bool status_replies,
+            bool deadlines,
             bool ignore_response,
             uint16_t provider_id,
-            std::tuple<CtxArg...>&& context)
+            std::tuple<CtxArg...>&& context,
+            bool self_dispatch = false,
+            std::shared_ptr<detail::handle_cache> handle_cache = nullptr,
+            std::shared_ptr<detail::compression> compression = nullptr,
+            std::shared_ptr<detail::offload_state> offload = nullptr)
     : m_mid(std::move(mid))
     , m_handle(handle)
+    , m_header_handle(header_handle)
+    , m_header_id(header_id)
+    , m_status_replies(status_replies)
+    , m_deadlines(deadlines)
     , m_ignore_response(ignore_response)
     , m_provider_id(provider_id)
-    , m_context(std::move(context)) {
+    , m_context(std::move(context))
+    , m_self_dispatch(self_dispatch)
+    , m_handle_cache(std::move(handle_cache))
+    , m_compression(std::move(compression))
+    , m_offload(std::move(offload)) {
         if(m_handle != HG_HANDLE_NULL) {
             auto ret = margo_ref_incr(m_handle);
             MARGO_ASSERT(ret, margo_ref_incr);
         }
+        if(m_header_handle != HG_HANDLE_NULL) {
+            auto ret = margo_ref_incr(m_header_handle);
+            MARGO_ASSERT(ret, margo_ref_incr);
+        }
     }
 
     /**
@@ -68,23 +100,145 @@ class callable_remote_procedure_with_context {
      *
      * @param mid Margo instance used to create the callable_remote_procedure.
      * @param id id of the RPC to call.
+     * @param header_id id of the header variant of the RPC.
+     * @param status_replies whether all the calls are sent to the header
+     * variant of the RPC, to get a status with their response.
+     * @param deadlines whether timed calls send their deadline
+     * to the server.
      * @param ep endpoint on which to call the RPC.
      * @param ignore_resp whether the response should be ignored.
      * @param provider_id provider id
      * @param context serialization context
+     * @param self_dispatch whether to dispatch the RPC locally if ep is
+     * the calling process.
+     * @param handle_cache cache from which to get the handle, if any.
+     * @param compression compression settings of the RPC, if any.
+     * @param offload RDMA offload state of the margo instance, if any.
      */
     callable_remote_procedure_with_context(
             margo_instance_ref mid,
-            hg_id_t id, const endpoint& ep,
-            bool ignore_resp, uint16_t provider_id,
-            const std::tuple<CtxArg...>& context = std::tuple<CtxArg...>())
+            hg_id_t id, hg_id_t header_id, bool status_replies, bool deadlines,
+            const endpoint& ep, bool ignore_resp, uint16_t provider_id,
+            const std::tuple<CtxArg...>& context = std::tuple<CtxArg...>(),
+            bool self_dispatch = false,
+            std::shared_ptr<detail::handle_cache> handle_cache = nullptr,
+            std::shared_ptr<detail::compression> compression = nullptr,
+            std::shared_ptr<detail::offload_state> offload = nullptr)
     : m_mid(std::move(mid))
+    , m_header_id(header_id)
+    , m_status_replies(status_replies)
+    , m_deadlines(deadlines)
     , m_ignore_response(ignore_resp)
     , m_provider_id(provider_id)
-    , m_context(context) {
+    , m_context(context)
+    , m_handle_cache(std::move(handle_cache))
+    , m_compression(std::move(compression))
+    , m_offload(std::move(offload)) {
         m_ignore_response = ignore_resp;
-        hg_return_t ret = margo_create(m_mid, ep.m_addr, id, &m_handle);
+        hg_return_t ret;
+        if(m_handle_cache)
+            ret = m_handle_cache->acquire(ep.m_addr, id, &m_handle);
+        else
+            ret = margo_create(m_mid, ep.m_addr, id, &m_handle);
         MARGO_ASSERT(ret, margo_create);
+        // calls that always carry a header are all sent on the header handle
+        if(m_status_replies || m_compression)
+            call_handle(true);
+        if(self_dispatch) {
+            hg_addr_t self_addr;
+            ret = margo_addr_self(m_mid, &self_addr);
+            MARGO_ASSERT(ret, margo_addr_self);
+            m_self_dispatch = margo_addr_cmp(m_mid, self_addr, ep.m_addr);
+            margo_addr_free(m_mid, self_addr);
+        }
+    }
+
+    /**
+     * @brief Tries to dispatch the RPC to its local handler without going
+     * through Mercury, moving the arguments passed as rvalues into the
+     * handler's input. Returns a null pointer (leaving args untouched) if
+     * the RPC must be forwarded. Timed calls and calls with a serialization
+     * context, which the local handler could not honor, are always
+     * forwarded.
+     */
+    template <typename... T>
+    std::shared_ptr<detail::local_call>
+    try_self_dispatch(std::tuple<T...>&& args, double timeout_ms) const {
+        if(!m_self_dispatch || timeout_ms > 0.0 || sizeof...(CtxArg) != 0)
+            return nullptr;
+        return detail::self_dispatch(m_mid, m_handle, m_provider_id, std::move(args));
+    }
+
+    /**
+     * @brief Returns the holder exposing the arguments offloaded to RDMA,
+     * or a null pointer if offloading is disabled. Without a response, we
+     * cannot know when the server is done pulling offloaded arguments, so
+     * none are offloaded.
+     */
+    std::shared_ptr<detail::offload_holder> make_offload() const {
+        if(m_ignore_response || !m_offload || m_offload->threshold() == 0)
+            return nullptr;
+        return std::make_shared<detail::offload_holder>(m_mid, m_offload);
+    }
+
+    /**
+     * @brief Tuple of const references to the arguments, through which
+     * they are serialized when the RPC goes through Mercury.
+     */
+    template <typename... T>
+    using const_args = std::tuple<const typename std::remove_reference<T>::type&...>;
+
+    /**
+     * @brief Creates the header of a call sent with the provided timeout,
+     * which only carries its deadline if deadlines are propagated (see
+     * remote_procedure::enable_deadline_propagation()).
+     */
+    detail::rpc_header make_header(double timeout_ms) const {
+        if(!m_deadlines)
+            return detail::rpc_header();
+        return detail::rpc_header::with_timeout(timeout_ms);
+    }
+
+    /**
+     * @brief Returns whether a call with the provided header is sent to
+     * the header variant of the RPC, in which case its response starts
+     * with a detail::rpc_status.
+     */
+    bool needs_header(const detail::rpc_header& header) const {
+        return m_status_replies || !header.empty();
+    }
+
+    /**
+     * @brief Returns the handle on which a call is sent: the handle of the
+     * RPC, or for a call sent to the header variant of the RPC, a handle of
+     * the header variant addressed to the same endpoint. The latter is
+     * created by the first call that needs it (or by the constructor, if
+     * all the calls need it) and reused by the following ones, like the
+     * handle of the RPC.
+     */
+    hg_handle_t call_handle(bool with_header) const {
+        if(!with_header)
+            return m_handle;
+        if(m_header_handle == HG_HANDLE_NULL) {
+            hg_addr_t   addr = margo_get_info(m_handle)->addr;
+            hg_return_t ret;
+            if(m_handle_cache)
+                ret = m_handle_cache->acquire(addr, m_header_id, &m_header_handle);
+            else
+                ret = margo_create(m_mid, addr, m_header_id, &m_header_handle);
+            MARGO_ASSERT(ret, margo_create);
+        }
+        return m_header_handle;
+    }
+
+    /**
+     * @brief Returns the packed_data from which the response received
+     * in the provided handle is decoded.
+     */
+    packed_data<> response_data(hg_handle_t handle, bool with_status) const {
+        packed_data<> data(margo_get_output, margo_free_output, handle, m_mid);
+        data.m_with_status = with_status;
+        return data;
     }
 
     /**
@@ -99,58 +253,106 @@ class callable_remote_procedure_with_context {
      * deserialized.
      */
     template <typename... T>
-    packed_data<> forward(const std::tuple<T...>& args,
-                            double                timeout_ms = -1.0) {
+    packed_data<> forward(std::tuple<T...>&& fwd_args,
+                            double            timeout_ms = -1.0) {
+        if(auto local = try_self_dispatch(std::move(fwd_args), timeout_ms)) {
+            if(m_ignore_response)
+                return packed_data<>();
+            local->m_completed.wait();
+            return packed_data<>(m_mid, local->m_output);
+        }
+        const_args<T...> args(fwd_args);
         hg_return_t  ret;
-        meta_proc_fn mproc = [this, &args](hg_proc_t proc) {
-            return proc_object_encode(proc, const_cast<std::tuple<T...>&>(args),
-                               m_mid, m_context);
+        auto         header = make_header(timeout_ms);
+        auto         offload = make_offload();
+        auto         offload_ptr = offload.get();
+        detail::compressed_payload compressed;
+        bool is_compressed = m_compression && detail::compress_rpc_input(
+            *m_compression, m_mid, args, m_context, header, compressed);
+        // arguments left uncompressed are sent as serialized for compression,
+        // unless they must be serialized again to offload their containers
+        bool is_encoded = m_compression && !is_compressed && offload_ptr == nullptr;
+        bool with_header = needs_header(header);
+        hg_handle_t handle = call_handle(with_header);
+        auto header_ptr = with_header ? &header : nullptr;
+        meta_proc_fn mproc  = [this, &args, header_ptr, offload_ptr,
+                               is_compressed, is_encoded,
+                               &compressed](hg_proc_t proc) {
+            if(is_compressed)
+                return detail::proc_rpc_compressed_input(proc, *header_ptr, compressed);
+            if(is_encoded)
+                return detail::proc_rpc_encoded_input(proc, header_ptr, compressed);
+            return proc_rpc_input_encode(proc, header_ptr,
+                                         args,
+                                         m_mid, m_context, offload_ptr);
         };
         if(timeout_ms > 0.0) {
             ret = margo_provider_forward_timed(
-                m_provider_id, m_handle,
+                m_provider_id, handle,
                 const_cast<void*>(static_cast<const void*>(&mproc)),
                 timeout_ms);
             if(ret == HG_TIMEOUT)
                 throw timeout();
-            MARGO_ASSERT(ret, margo_provider_iforward);
+            // a plain call rejected by admission control (see admission_limits)
+            if(ret == HG_BUSY)
+                throw busy();
+            MARGO_ASSERT(ret, margo_provider_forward_timed);
         } else {
             ret = margo_provider_forward(
-                m_provider_id, m_handle,
+                m_provider_id, handle,
                 const_cast<void*>(static_cast<const void*>(&mproc)));
+            // a plain call rejected by admission control (see admission_limits)
+            if(ret == HG_BUSY)
+                throw busy();
             MARGO_ASSERT(ret, margo_provider_forward);
         }
         if(m_ignore_response)
             return packed_data<>();
-        return packed_data<>(margo_get_output, margo_free_output, m_handle, m_mid);
+        return response_data(handle, with_header);
     }
 
     packed_data<> forward(double timeout_ms = -1.0) const {
+        if(auto local = try_self_dispatch(std::tuple<>(), timeout_ms)) {
+            if(m_ignore_response)
+                return packed_data<>();
+            local->m_completed.wait();
+            return packed_data<>(m_mid, local->m_output);
+        }
         hg_return_t  ret;
-        meta_proc_fn mproc = [this](hg_proc_t proc) {
-            return proc_void_object(proc, m_context);
+        auto         header = make_header(timeout_ms);
+        bool         with_header = needs_header(header);
+        hg_handle_t  handle = call_handle(with_header);
+        auto         header_ptr = with_header ? &header : nullptr;
+        meta_proc_fn mproc  = [this, header_ptr](hg_proc_t proc) {
+            return proc_rpc_void_input(proc, header_ptr, m_context);
         };
         if(timeout_ms > 0.0) {
             ret = margo_provider_forward_timed(
-                m_provider_id, m_handle,
+                m_provider_id, handle,
                 const_cast<void*>(static_cast<const void*>(&mproc)),
                 timeout_ms);
             if(ret == HG_TIMEOUT)
                 throw timeout();
+            // a plain call rejected by admission control (see admission_limits)
+            if(ret == HG_BUSY)
+                throw busy();
             MARGO_ASSERT(ret, margo_provider_forward_timed);
         } else {
             ret = margo_provider_forward(
-                m_provider_id, m_handle,
+                m_provider_id, handle,
                 const_cast<void*>(static_cast<const void*>(&mproc)));
+            // a plain call rejected by admission control (see admission_limits)
+            if(ret == HG_BUSY)
+                throw busy();
             MARGO_ASSERT(ret, margo_provider_forward);
         }
         if(m_ignore_response)
             return packed_data<>();
-        return packed_data<>(margo_get_output, margo_free_output, m_handle, m_mid);
+        return response_data(handle, with_header);
     }
 
     /**
-     * @brief Sends the RPC to the endpoint (calls margo_iforward), passing a
+     * @brief Sends the RPC to the endpoint (calls margo_cforward), passing a
      * buffer in which the arguments have been serialized. The RPC is sent in a
      * non-blocking manner.
      *
@@ -164,48 +366,67 @@ class callable_remote_procedure_with_context {
      * calling wait() on the async_response.
      */
     template <typename... T>
-    async_response iforward(const std::tuple<T...>& args,
-                            double                  timeout_ms = -1.0) {
+    async_response iforward(std::tuple<T...>&& fwd_args,
+                            double             timeout_ms = -1.0) {
+        if(auto local = try_self_dispatch(std::move(fwd_args), timeout_ms))
+            return async_response(m_mid, std::move(local), m_ignore_response);
+        const_args<T...> args(fwd_args);
         hg_return_t   ret;
-        margo_request req;
-        meta_proc_fn  mproc = [this, &args](hg_proc_t proc) {
-            return proc_object_encode(proc, const_cast<std::tuple<T...>&>(args),
-                                      m_mid, m_context);
+        auto          completion = std::make_shared<detail::completion_state>();
+        auto          header = make_header(timeout_ms);
+        auto          offload = make_offload();
+        auto          offload_ptr = offload.get();
+        detail::compressed_payload compressed;
+        bool is_compressed = m_compression && detail::compress_rpc_input(
+            *m_compression, m_mid, args, m_context, header, compressed);
+        // arguments left uncompressed are sent as serialized for compression,
+        // unless they must be serialized again to offload their containers
+        bool is_encoded = m_compression && !is_compressed && offload_ptr == nullptr;
+        bool          with_header = needs_header(header);
+        hg_handle_t handle = call_handle(with_header);
+        auto          header_ptr = with_header ? &header : nullptr;
+        meta_proc_fn  mproc  = [this, &args, header_ptr, offload_ptr,
+                                is_compressed, is_encoded,
+                                &compressed](hg_proc_t proc) {
+            if(is_compressed)
+                return detail::proc_rpc_compressed_input(proc, *header_ptr, compressed);
+            if(is_encoded)
+                return detail::proc_rpc_encoded_input(proc, header_ptr, compressed);
+            return proc_rpc_input_encode(proc, header_ptr,
+                                         args,
+                                         m_mid, m_context, offload_ptr);
         };
-        if(timeout_ms > 0.0) {
-            ret = margo_provider_iforward_timed(
-                m_provider_id, m_handle,
-                const_cast<void*>(static_cast<const void*>(&mproc)), timeout_ms,
-                &req);
-            MARGO_ASSERT(ret, margo_provider_iforward_timed);
-        } else {
-            ret = margo_provider_iforward(
-                m_provider_id, m_handle,
-                const_cast<void*>(static_cast<const void*>(&mproc)), &req);
-            MARGO_ASSERT(ret, margo_provider_iforward);
-        }
-        return async_response(req, m_mid, m_handle, m_ignore_response);
+        ret = detail::provider_cforward(
+            m_provider_id, handle,
+            const_cast<void*>(static_cast<const void*>(&mproc)), timeout_ms,
+            completion);
+        MARGO_ASSERT(ret, margo_provider_cforward);
+        async_response response(std::move(completion), m_mid, handle,
+                                m_ignore_response, with_header, m_handle_cache);
+        if(offload && !offload->empty())
+            response.m_offload = std::move(offload);
+        return response;
     }
 
     async_response iforward(double timeout_ms = -1.0) const {
+        if(auto local = try_self_dispatch(std::tuple<>(), timeout_ms))
+            return async_response(m_mid, std::move(local), m_ignore_response);
         hg_return_t   ret;
-        margo_request req;
-        meta_proc_fn  mproc = [this](hg_proc_t proc) {
-            return proc_void_object(proc, m_context);
+        auto          completion = std::make_shared<detail::completion_state>();
+        auto          header = make_header(timeout_ms);
+        bool          with_header = needs_header(header);
+        hg_handle_t handle = call_handle(with_header);
+        auto          header_ptr = with_header ? &header : nullptr;
+        meta_proc_fn  mproc  = [this, header_ptr](hg_proc_t proc) {
+            return proc_rpc_void_input(proc, header_ptr, m_context);
         };
-        if(timeout_ms > 0.0) {
-            ret = margo_provider_iforward_timed(
-                m_provider_id, m_handle,
-                const_cast<void*>(static_cast<const void*>(&mproc)), timeout_ms,
-                &req);
-            MARGO_ASSERT(ret, margo_provider_iforward_timed);
-        } else {
-            ret = margo_provider_iforward(
-                m_provider_id, m_handle,
-                const_cast<void*>(static_cast<const void*>(&mproc)), &req);
-            MARGO_ASSERT(ret, margo_provider_iforward);
-        }
-        return async_response(req, m_mid, m_handle, m_ignore_response);
+        ret = detail::provider_cforward(
+            m_provider_id, handle,
+            const_cast<void*>(static_cast<const void*>(&mproc)), timeout_ms,
+            completion);
+        MARGO_ASSERT(ret, margo_provider_cforward);
+        return async_response(std::move(completion), m_mid, handle,
+                              m_ignore_response, with_header, m_handle_cache);
     }
 
   public:
@@ -216,14 +437,26 @@ class callable_remote_procedure_with_context {
             const callable_remote_procedure_with_context& other)
     : m_mid(other.m_mid)
     , m_handle(other.m_handle)
+    , m_header_handle(other.m_header_handle)
+    , m_header_id(other.m_header_id)
+    , m_status_replies(other.m_status_replies)
+    , m_deadlines(other.m_deadlines)
     , m_ignore_response(other.m_ignore_response)
     , m_provider_id(other.m_provider_id)
-    , m_context(other.m_context) {
+    , m_context(other.m_context)
+    , m_self_dispatch(other.m_self_dispatch)
+    , m_handle_cache(other.m_handle_cache)
+    , m_compression(other.m_compression)
+    , m_offload(other.m_offload) {
         hg_return_t ret;
         if(m_handle != HG_HANDLE_NULL) {
             ret = margo_ref_incr(m_handle);
             MARGO_ASSERT(ret, margo_ref_incr);
         }
+        if(m_header_handle != HG_HANDLE_NULL) {
+            ret = margo_ref_incr(m_header_handle);
+            MARGO_ASSERT(ret, margo_ref_incr);
+        }
     }
 
     /**
@@ -233,9 +466,17 @@ class callable_remote_procedure_with_context {
             callable_remote_procedure_with_context&& other) noexcept
     : m_mid(other.m_mid)
     , m_handle(std::exchange(other.m_handle, HG_HANDLE_NULL))
+    , m_header_handle(std::exchange(other.m_header_handle, HG_HANDLE_NULL))
+    , m_header_id(other.m_header_id)
+    , m_status_replies(other.m_status_replies)
+    , m_deadlines(other.m_deadlines)
     , m_ignore_response(other.m_ignore_response)
     , m_provider_id(other.m_provider_id)
-    , m_context(std::move(other.m_context)) {}
+    , m_context(std::move(other.m_context))
+    , m_self_dispatch(other.m_self_dispatch)
+    , m_handle_cache(std::move(other.m_handle_cache))
+    , m_compression(std::move(other.m_compression))
+    , m_offload(std::move(other.m_offload)) {}
 
     /**
      * @brief Copy-assignment operator.
@@ -246,16 +487,32 @@ class callable_remote_procedure_with_context {
         if(&other == this)
             return *this;
         if(m_handle != HG_HANDLE_NULL) {
-            ret = margo_destroy(m_handle);
+            ret = detail::release_handle(m_handle_cache, m_handle);
+            MARGO_ASSERT(ret, margo_destroy);
+        }
+        if(m_header_handle != HG_HANDLE_NULL) {
+            ret = detail::release_handle(m_handle_cache, m_header_handle);
             MARGO_ASSERT(ret, margo_destroy);
         }
         m_handle          = other.m_handle;
+        m_header_handle   = other.m_header_handle;
+        m_header_id       = other.m_header_id;
+        m_status_replies  = other.m_status_replies;
+        m_deadlines       = other.m_deadlines;
         m_mid             = other.m_mid;
         m_ignore_response = other.m_ignore_response;
         m_provider_id     = other.m_provider_id;
         m_context         = other.m_context;
+        m_self_dispatch   = other.m_self_dispatch;
+        m_handle_cache    = other.m_handle_cache;
+        m_compression     = other.m_compression;
+        m_offload         = other.m_offload;
         ret               = margo_ref_incr(m_handle);
         MARGO_ASSERT(ret, margo_ref_incr);
+        if(m_header_handle != HG_HANDLE_NULL) {
+            ret = margo_ref_incr(m_header_handle);
+            MARGO_ASSERT(ret, margo_ref_incr);
+        }
         return *this;
     }
 
@@ -267,14 +524,26 @@ class callable_remote_procedure_with_context {
         if(&other == this)
             return *this;
         if(m_handle != HG_HANDLE_NULL) {
-            hg_return_t ret = margo_destroy(m_handle);
+            hg_return_t ret = detail::release_handle(m_handle_cache, m_handle);
+            MARGO_ASSERT(ret, margo_destroy);
+        }
+        if(m_header_handle != HG_HANDLE_NULL) {
+            hg_return_t ret = detail::release_handle(m_handle_cache, m_header_handle);
             MARGO_ASSERT(ret, margo_destroy);
         }
         m_handle          = std::exchange(other.m_handle, HG_HANDLE_NULL);
+        m_header_handle   = std::exchange(other.m_header_handle, HG_HANDLE_NULL);
+        m_header_id       = other.m_header_id;
+        m_status_replies  = other.m_status_replies;
+        m_deadlines       = other.m_deadlines;
         m_mid             = std::move(other.m_mid);
         m_ignore_response = other.m_ignore_response;
         m_provider_id     = other.m_provider_id;
         m_context         = std::move(other.m_context);
+        m_self_dispatch   = other.m_self_dispatch;
+        m_handle_cache    = std::move(other.m_handle_cache);
+        m_compression     = std::move(other.m_compression);
+        m_offload         = std::move(other.m_offload);
         return *this;
     }
 
@@ -283,7 +552,11 @@ class callable_remote_procedure_with_context {
      */
     ~callable_remote_procedure_with_context() {
         if(m_handle != HG_HANDLE_NULL) {
-            hg_return_t ret = margo_destroy(m_handle);
+            hg_return_t ret = detail::release_handle(m_handle_cache, m_handle);
+            MARGO_ASSERT_TERMINATE(ret, margo_destroy);
+        }
+        if(m_header_handle != HG_HANDLE_NULL) {
+            hg_return_t ret = detail::release_handle(m_handle_cache, m_header_handle);
             MARGO_ASSERT_TERMINATE(ret, margo_destroy);
         }
     }
@@ -301,23 +574,33 @@ class callable_remote_procedure_with_context {
             <unwrap_decay_t<NewCtxArg>...>(
                 m_mid,
                 m_handle,
+                m_header_handle,
+                m_header_id,
+                m_status_replies,
+                m_deadlines,
                 m_ignore_response,
                 m_provider_id,
-                std::make_tuple<NewCtxArg...>(std::forward<NewCtxArg>(args)...));
+                std::make_tuple<NewCtxArg...>(std::forward<NewCtxArg>(args)...),
+                m_self_dispatch,
+                m_handle_cache,
+                m_compression,
+                m_offload);
     }
 
 
     /**
      * @brief Operator to call the RPC. Will serialize the arguments
-     * in a buffer and send the RPC to the endpoint.
+     * in a buffer and send the RPC to the endpoint. If the RPC is
+     * dispatched locally, arguments passed as rvalues are moved to the
+     * handler instead of being copied.
      *
      * @tparam T Types of the parameters.
      * @param t Parameters of the RPC.
      *
      * @return a packed_data object containing the returned value.
      */
-    template <typename... T> packed_data<> operator()(const T&... args) {
-        return forward(std::make_tuple(std::cref(args)...));
+    template <typename... T> packed_data<> operator()(T&&... args) {
+        return forward(std::forward_as_tuple(std::forward<T>(args)...));
     }
 
     /**
@@ -336,10 +619,10 @@ class callable_remote_procedure_with_context {
      */
     template <typename R, typename P, typename... T>
     packed_data<> timed(const std::chrono::duration<R, P>& t,
-                          const T&... args) {
+                          T&&... args) {
         std::chrono::duration<double, std::milli> fp_ms      = t;
         double                                    timeout_ms = fp_ms.count();
-        return forward(std::make_tuple(std::cref(args)...), timeout_ms);
+        return forward(std::forward_as_tuple(std::forward<T>(args)...), timeout_ms);
     }
 
     /**
@@ -374,8 +657,8 @@ class callable_remote_procedure_with_context {
      *
      * @return an async_response object that the caller can wait on.
      */
-    template <typename... T> async_response async(const T&... args) {
-        return iforward(std::make_tuple(std::cref(args)...));
+    template <typename... T> async_response async(T&&... args) {
+        return iforward(std::forward_as_tuple(std::forward<T>(args)...));
     }
 
     /**
@@ -393,10 +676,10 @@ class callable_remote_procedure_with_context {
      */
     template <typename R, typename P, typename... T>
     async_response timed_async(const std::chrono::duration<R, P>& t,
-                               const T&... args) {
+                               T&&... args) {
         std::chrono::duration<double, std::milli> fp_ms      = t;
         double                                    timeout_ms = fp_ms.count();
-        return iforward(std::make_tuple(std::cref(args)...), timeout_ms);
+        return iforward(std::forward_as_tuple(std::forward<T>(args)...), timeout_ms);
     }
 
     /**
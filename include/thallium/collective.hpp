@@ -0,0 +1,585 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_COLLECTIVE_HPP
+#define __THALLIUM_COLLECTIVE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <margo.h>
+#include <thallium/address_cache.hpp>
+#include <thallium/batch_state.hpp>
+#include <thallium/collective_policy.hpp>
+#include <thallium/completion_watcher.hpp>
+#include <thallium/eventual.hpp>
+#include <thallium/instance_data.hpp>
+#include <thallium/margo_exception.hpp>
+#include <thallium/mutex.hpp>
+#include <thallium/proc_buffer.hpp>
+#include <thallium/proc_object.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/tuple.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+
+namespace thallium {
+
+class engine;
+class remote_procedure;
+
+/**
+ * @brief Handle on a reduction operation defined with
+ * engine::define_reduction(), to be passed to remote_procedure::reduce().
+ * The reduction must be defined, with the same name, by all the engines
+ * taking part in the collective, since intermediate nodes of the tree
+ * combine the results of their subtree.
+ *
+ * @tparam T Type of the values reduced.
+ */
+template <typename T> class reduction {
+
+    friend class engine;
+    friend class remote_procedure;
+
+    std::string m_name;
+
+    reduction(std::string name)
+    : m_name(std::move(name)) {}
+
+  public:
+
+    reduction() = default;
+
+    /**
+     * @brief Returns the name of the reduction.
+     */
+    const std::string& name() const {
+        return m_name;
+    }
+};
+
+namespace detail {
+
+/**
+ * @brief Name of the RPC carrying the calls of a broadcast or a reduction
+ * (see remote_procedure::broadcast()) down the tree of target processes.
+ */
+inline const char* collective_rpc_name() {
+    return "__thallium_collective__";
+}
+
+/**
+ * @brief Target of a collective: an address and a provider id.
+ */
+struct collective_target {
+    std::string m_address;
+    uint16_t    m_provider_id = 0;
+
+    template <typename A> void serialize(A& ar) {
+        ar & m_address;
+        ar & m_provider_id;
+    }
+};
+
+/**
+ * @brief Call sent to a node of the tree: the id of the RPC to invoke
+ * (without its provider id), its serialized arguments, and the targets
+ * of the subtree rooted at the receiving node, to which the receiver
+ * forwards the call.
+ */
+struct collective_request {
+    hg_id_t                        m_id              = 0;
+    uint16_t                       m_provider_id     = 0;
+    bool                           m_expect_response = true;
+    std::string                    m_reduction;
+    uint32_t                       m_arity           = 2;
+    std::vector<collective_target> m_targets;
+    std::vector<char>              m_payload;
+
+    template <typename A> void serialize(A& ar) {
+        ar & m_id;
+        ar & m_provider_id;
+        ar & m_expect_response;
+        ar & m_reduction;
+        ar & m_arity;
+        ar & m_targets;
+        ar & m_payload;
+    }
+};
+
+/**
+ * @brief Result sent back by a node for its subtree: the number of
+ * nodes on which the call succeeded and failed, and (for a reduction)
+ * the serialized combination of their responses.
+ */
+struct collective_result {
+    uint64_t          m_succeeded = 0;
+    uint64_t          m_failed    = 0;
+    std::vector<char> m_payload;
+
+    template <typename A> void serialize(A& ar) {
+        ar & m_succeeded;
+        ar & m_failed;
+        ar & m_payload;
+    }
+};
+
+/**
+ * @brief A child of a node in the tree, along with the
+ * targets of the subtree it is responsible for.
+ */
+struct collective_subtree {
+    collective_target              m_root;
+    std::vector<collective_target> m_targets;
+};
+
+/**
+ * @brief Splits the targets into at most arity contiguous subtrees of
+ * balanced sizes. The first target of each subtree is a child of the
+ * current node; the others are forwarded to it. The depth of the tree
+ * is therefore logarithmic in the number of targets.
+ */
+inline std::vector<collective_subtree>
+split_collective_targets(const std::vector<collective_target>& targets,
+                         size_t arity) {
+    std::vector<collective_subtree> subtrees;
+    size_t n     = targets.size();
+    size_t k     = std::min<size_t>(std::max<size_t>(arity, 1), n);
+    size_t begin = 0;
+    subtrees.reserve(k);
+    for(size_t i = 0; i < k; i++) {
+        size_t             size = n / k + (i < n % k ? 1 : 0);
+        collective_subtree s;
+        s.m_root = targets[begin];
+        s.m_targets.assign(targets.begin() + begin + 1,
+                           targets.begin() + begin + size);
+        subtrees.push_back(std::move(s));
+        begin += size;
+    }
+    return subtrees;
+}
+
+/**
+ * @brief Encodes a value the way request_with_context::respond() does.
+ */
+template <typename T>
+hg_return_t encode_collective_value(margo_instance_id mid, const T& value,
+                                    std::vector<char>& buffer) {
+    auto         t = std::make_tuple(std::cref(value));
+    std::tuple<> ctx;
+    meta_proc_fn mproc = [mid, &t, &ctx](hg_proc_t proc) {
+        return proc_object_encode(proc, t, mid, ctx);
+    };
+    return proc_encode_to_buffer(mid, mproc, buffer);
+}
+
+/**
+ * @brief Decodes a value encoded by request_with_context::respond().
+ */
+template <typename T>
+hg_return_t decode_collective_value(margo_instance_id mid,
+                                    const std::vector<char>& buffer,
+                                    std::tuple<T>& value) {
+    std::tuple<> ctx;
+    meta_proc_fn mproc = [mid, &value, &ctx](hg_proc_t proc) {
+        return proc_object_decode(proc, value, mid, ctx);
+    };
+    return proc_decode_from_buffer(mid, mproc, buffer);
+}
+
+/**
+ * @brief Function combining two serialized values into a third one.
+ */
+using reduction_fn = std::function<hg_return_t(const std::vector<char>&,
+                                               const std::vector<char>&,
+                                               std::vector<char>&)>;
+
+/**
+ * @brief Reductions defined with engine::define_reduction(),
+ * attached to a margo instance.
+ */
+class reduction_registry {
+
+  public:
+
+    reduction_registry(margo_instance_id) {}
+
+    void add(const std::string& name, reduction_fn fn) {
+        std::lock_guard<mutex> lock(m_mutex);
+        m_reductions[name] = std::move(fn);
+    }
+
+    reduction_fn find(const std::string& name) {
+        std::lock_guard<mutex> lock(m_mutex);
+        auto it = m_reductions.find(name);
+        return it == m_reductions.end() ? reduction_fn() : it->second;
+    }
+
+    void on_finalize() {
+        std::lock_guard<mutex> lock(m_mutex);
+        m_reductions.clear();
+    }
+
+  private:
+
+    std::unordered_map<std::string, reduction_fn> m_reductions;
+    mutex                                         m_mutex;
+};
+
+/**
+ * @brief Whether an engine takes part in collectives, and with which
+ * policy (see engine::enable_collectives()), attached to a margo
+ * instance. A null policy means collectives are not enabled.
+ */
+class collective_control {
+
+  public:
+
+    collective_control(margo_instance_id) {}
+
+    void enable(const collective_policy& policy) {
+        std::lock_guard<mutex> lock(m_mutex);
+        m_policy = std::make_shared<const collective_policy>(policy);
+    }
+
+    std::shared_ptr<const collective_policy> policy() {
+        std::lock_guard<mutex> lock(m_mutex);
+        return m_policy;
+    }
+
+    void on_finalize() {
+        std::lock_guard<mutex> lock(m_mutex);
+        m_policy.reset();
+    }
+
+  private:
+
+    std::shared_ptr<const collective_policy> m_policy;
+    mutex                                    m_mutex;
+};
+
+/**
+ * @brief Accumulates the results of a node's own call and of its
+ * children, combining the responses if the collective is a reduction,
+ * and invokes the completion function once all of them arrived.
+ */
+class collective_gather {
+
+  public:
+
+    using done_fn = std::function<void(collective_result&&)>;
+
+    collective_gather(size_t pending, reduction_fn reduce, done_fn done)
+    : m_pending(pending)
+    , m_reduce(std::move(reduce))
+    , m_done(std::move(done)) {}
+
+    collective_gather(const collective_gather&)            = delete;
+    collective_gather& operator=(const collective_gather&) = delete;
+
+    /**
+     * @brief Adds the result of a call or of a subtree.
+     *
+     * @param succeeded Number of nodes on which the call succeeded.
+     * @param failed Number of nodes on which the call failed.
+     * @param payload Serialized response (ignored for a broadcast).
+     */
+    void add(uint64_t succeeded, uint64_t failed, std::vector<char>&& payload) {
+        done_fn done;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            if(m_reduce && !payload.empty()) {
+                if(m_result.m_payload.empty()) {
+                    m_result.m_payload = std::move(payload);
+                } else {
+                    std::vector<char> combined;
+                    if(m_reduce(m_result.m_payload, payload, combined) == HG_SUCCESS) {
+                        m_result.m_payload = std::move(combined);
+                    } else {
+                        failed += succeeded;
+                        succeeded = 0;
+                    }
+                }
+            }
+            m_result.m_succeeded += succeeded;
+            m_result.m_failed    += failed;
+            if(--m_pending != 0)
+                return;
+            done = std::move(m_done);
+        }
+        if(done) done(std::move(m_result));
+    }
+
+  private:
+
+    size_t            m_pending;
+    reduction_fn      m_reduce;
+    done_fn           m_done;
+    collective_result m_result;
+    mutex             m_mutex;
+};
+
+/**
+ * @brief Call forwarded by a node to one of its children.
+ */
+class collective_child {
+
+  public:
+
+    collective_child(margo_instance_id mid)
+    : m_mid(mid) {}
+
+    collective_child(const collective_child&)            = delete;
+    collective_child& operator=(const collective_child&) = delete;
+
+    ~collective_child() {
+        if(m_handle != HG_HANDLE_NULL) {
+            m_completion->wait();
+            margo_destroy(m_handle);
+        }
+        if(m_addr != HG_ADDR_NULL)
+            margo_addr_free(m_mid, m_addr);
+    }
+
+    /**
+     * @brief Sends the call to the child.
+     */
+    hg_return_t send(address_cache& cache, hg_id_t collective_id,
+                     const std::string& address, const collective_request& req) {
+        hg_return_t ret = cache.lookup(address, &m_addr);
+        if(ret != HG_SUCCESS)
+            return ret;
+        ret = margo_create(m_mid, m_addr, collective_id, &m_handle);
+        if(ret != HG_SUCCESS)
+            return ret;
+        std::tuple<> ctx;
+        meta_proc_fn mproc = [this, &req, &ctx](hg_proc_t proc) {
+            return proc_object_encode(proc, req, m_mid, ctx);
+        };
+        ret = provider_cforward(MARGO_DEFAULT_PROVIDER_ID, m_handle, &mproc,
+                                -1.0, m_completion);
+        if(ret != HG_SUCCESS)
+            m_completion->complete(ret);
+        return ret;
+    }
+
+    /**
+     * @brief Returns the completion of the call.
+     */
+    const std::shared_ptr<completion_state>& completion() const {
+        return m_completion;
+    }
+
+    /**
+     * @brief Completes the call and decodes the result of the child.
+     */
+    hg_return_t result(collective_result& result) {
+        hg_return_t ret = m_completion->wait();
+        if(ret != HG_SUCCESS)
+            return ret;
+        std::tuple<> ctx;
+        meta_proc_fn mproc = [this, &result, &ctx](hg_proc_t proc) {
+            return proc_object_decode(proc, result, m_mid, ctx);
+        };
+        ret = margo_get_output(m_handle, &mproc);
+        if(ret != HG_SUCCESS)
+            return ret;
+        return margo_free_output(m_handle, &mproc);
+    }
+
+  private:
+
+    margo_instance_id                 m_mid;
+    hg_addr_t                         m_addr       = HG_ADDR_NULL;
+    hg_handle_t                       m_handle     = HG_HANDLE_NULL;
+    std::shared_ptr<completion_state> m_completion = std::make_shared<completion_state>();
+};
+
+hg_id_t register_collective_rpc(margo_instance_id mid);
+
+/**
+ * @brief Forwards a call to the children of the current node. The result
+ * of each subtree is added to the gather object when it arrives; subtrees
+ * whose root cannot be reached count as failed. The calling ULT does not
+ * wait: the result of each child is handled by a ULT of the
+ * completion_watcher, started when the child responds.
+ *
+ * @param mid Margo instance.
+ * @param base Call to forward (its targets and provider id are replaced).
+ * @param subtrees Children of the current node.
+ * @param gather Object accumulating the results.
+ */
+inline void collective_forward(margo_instance_id mid, const collective_request& base,
+                               std::vector<collective_subtree>&& subtrees,
+                               const std::shared_ptr<collective_gather>& gather) {
+    if(subtrees.empty())
+        return;
+    hg_id_t collective_id = register_collective_rpc(mid);
+    auto    cache         = get_instance_data<address_cache>(mid);
+    auto    watcher       = get_instance_data<completion_watcher>(mid);
+    for(auto& s : subtrees) {
+        uint64_t           reached = 1 + s.m_targets.size();
+        collective_request req;
+        req.m_id              = base.m_id;
+        req.m_provider_id     = s.m_root.m_provider_id;
+        req.m_expect_response = base.m_expect_response;
+        req.m_reduction       = base.m_reduction;
+        req.m_arity           = base.m_arity;
+        req.m_targets         = std::move(s.m_targets);
+        req.m_payload         = base.m_payload;
+        auto child = std::make_shared<collective_child>(mid);
+        if(child->send(*cache, collective_id, s.m_root.m_address, req) != HG_SUCCESS) {
+            gather->add(0, reached, std::vector<char>());
+            continue;
+        }
+        try {
+            watcher->watch(
+                ABT_POOL_NULL, child->completion(),
+                [child, gather, reached]() {
+                    collective_result result;
+                    if(child->result(result) == HG_SUCCESS)
+                        gather->add(result.m_succeeded, result.m_failed,
+                                    std::move(result.m_payload));
+                    else
+                        gather->add(0, reached, std::vector<char>());
+                },
+                [gather, reached](const std::exception&) {
+                    gather->add(0, reached, std::vector<char>());
+                });
+        } catch(const exception&) {
+            // the margo instance is being finalized
+            gather->add(0, reached, std::vector<char>());
+        }
+    }
+}
+
+/**
+ * @brief Runs a collective from the calling process, which acts as the
+ * root of the tree without taking part in the call itself, and blocks
+ * until the results of all the targets have been gathered.
+ *
+ * @param mid Margo instance.
+ * @param req Call to send (its targets are split among the children).
+ * @param targets Processes taking part in the collective.
+ * @param reduce Function combining the responses (empty for a broadcast).
+ *
+ * @return the result of the collective.
+ */
+inline collective_result run_collective(margo_instance_id mid, const collective_request& req,
+                                        const std::vector<collective_target>& targets,
+                                        reduction_fn reduce) {
+    auto subtrees = split_collective_targets(targets, req.m_arity);
+    if(subtrees.empty())
+        return collective_result();
+    auto result = std::make_shared<collective_result>();
+    auto done   = std::make_shared<eventual<void>>();
+    auto gather = std::make_shared<collective_gather>(
+        subtrees.size(), std::move(reduce),
+        [result, done](collective_result&& r) {
+            *result = std::move(r);
+            done->set_value();
+        });
+    collective_forward(mid, req, std::move(subtrees), gather);
+    done->wait();
+    return std::move(*result);
+}
+
+/**
+ * @brief Server-side state of a call received through a collective.
+ * The request_with_context created for the call reads its arguments
+ * from here, and its response is added to the node's gather object
+ * (or dropped, if the collective does not expect responses).
+ */
+class collective_state : public buffered_calls {
+
+  public:
+
+    collective_state(margo_instance_id mid, hg_handle_t handle)
+    : m_mid(mid)
+    , m_handle(handle) {
+        margo_ref_incr(handle);
+    }
+
+    collective_state(const collective_state&)            = delete;
+    collective_state& operator=(const collective_state&) = delete;
+
+    ~collective_state() {
+        margo_destroy(m_handle);
+    }
+
+    hg_handle_t handle() const override {
+        return m_handle;
+    }
+
+    const std::vector<char>& payload(size_t) const override {
+        return m_request.m_payload;
+    }
+
+    hg_return_t respond(size_t, std::vector<char>&& output) override {
+        // without expected responses, the call counts as succeeded once
+        // its handler returned, whether or not the handler responded
+        if(m_gather && m_request.m_expect_response)
+            m_gather->add(1, 0, std::move(output));
+        return HG_SUCCESS;
+    }
+
+    /**
+     * @brief Decodes the call.
+     */
+    hg_return_t decode() {
+        std::tuple<> ctx;
+        meta_proc_fn mproc = [this, &ctx](hg_proc_t proc) {
+            try {
+                return proc_object_decode(proc, m_request, m_mid, ctx);
+            } catch(const std::exception& ex) {
+                margo_error(m_mid, "[thallium] Could not decode collective call: %s", ex.what());
+                return HG_INVALID_ARG;
+            }
+        };
+        hg_return_t ret = margo_get_input(m_handle, &mproc);
+        if(ret != HG_SUCCESS)
+            return ret;
+        return margo_free_input(m_handle, &mproc);
+    }
+
+    collective_request& request() {
+        return m_request;
+    }
+
+    void set_gather(std::shared_ptr<collective_gather> gather) {
+        m_gather = std::move(gather);
+    }
+
+    /**
+     * @brief Sends the result of the subtree to the parent node.
+     */
+    static hg_return_t send_result(margo_instance_id mid, hg_handle_t handle,
+                                   const collective_result& result) {
+        std::tuple<> ctx;
+        meta_proc_fn mproc = [mid, &result, &ctx](hg_proc_t proc) {
+            return proc_object_encode(proc, result, mid, ctx);
+        };
+        return margo_respond(handle, &mproc);
+    }
+
+  private:
+
+    margo_instance_id                  m_mid;
+    hg_handle_t                        m_handle;
+    collective_request                 m_request;
+    std::shared_ptr<collective_gather> m_gather;
+};
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
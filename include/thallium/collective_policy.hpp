@@ -0,0 +1,47 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_COLLECTIVE_POLICY_HPP
+#define __THALLIUM_COLLECTIVE_POLICY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace thallium {
+
+/**
+ * @brief Limits applied by an engine to the collectives it takes part in
+ * (see engine::enable_collectives()). The targets and arity of a
+ * collective are chosen by its caller and received from the network:
+ * the policy decides which of them the engine forwards the call to.
+ */
+struct collective_policy {
+    /**
+     * @brief Maximum number of children of the engine in the tree. A
+     * larger arity received from the parent is reduced to this value
+     * (0 means no limit).
+     */
+    size_t max_arity = 16;
+    /**
+     * @brief Maximum number of targets in the subtree of the engine.
+     * Calls with more targets are refused and count as failed on all
+     * of them (0 means no limit).
+     */
+    size_t max_targets = 4096;
+    /**
+     * @brief Function deciding whether the engine may forward the call
+     * to the provider provider_id at the given address. Targets that are
+     * not accepted count as failed, along with their subtree. If empty,
+     * the engine does not forward calls, and only the collectives sent
+     * by their caller directly to each target succeed.
+     */
+    std::function<bool(const std::string& address, uint16_t provider_id)> accept_target;
+};
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_COMPLETION_STATE_HPP
+#define __THALLIUM_COMPLETION_STATE_HPP
+
+#include <abt.h>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <margo.h>
+#include <thallium/condition_variable.hpp>
+#include <thallium/mutex.hpp>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Completion of a non-blocking operation (RPC, response, bulk
+ * transfer, locally dispatched call). The operation completes it from
+ * its completion callback, which runs in the progress loop: ULTs
+ * waiting on it are woken up, and the callbacks registered with
+ * add_callback() are invoked, so that continuations and coroutines
+ * do not need a ULT of their own blocked until the operation completes.
+ */
+class completion_state {
+
+  public:
+
+    using callback_type = std::function<void(hg_return_t)>;
+
+    completion_state() = default;
+
+    completion_state(const completion_state&)            = delete;
+    completion_state& operator=(const completion_state&) = delete;
+
+    /**
+     * @brief Returns a state that has already completed with the
+     * provided status.
+     */
+    static std::shared_ptr<completion_state> completed(hg_return_t ret = HG_SUCCESS) {
+        auto state = std::make_shared<completion_state>();
+        state->m_done   = true;
+        state->m_status = ret;
+        return state;
+    }
+
+    /**
+     * @brief Completion callback for the margo callback API (margo_cforward,
+     * margo_crespond, margo_bulk_ctransfer). uargs must have been obtained
+     * from callback_args().
+     */
+    static void on_complete(void* uargs, hg_return_t ret) {
+        std::unique_ptr<std::shared_ptr<completion_state>> state(
+            static_cast<std::shared_ptr<completion_state>*>(uargs));
+        (*state)->complete(ret);
+    }
+
+    /**
+     * @brief Returns the argument to pass along with on_complete. It keeps
+     * the state alive until the callback runs or release_callback_args() is
+     * called (if the operation could not be started).
+     */
+    static void* callback_args(const std::shared_ptr<completion_state>& state) {
+        return new std::shared_ptr<completion_state>(state);
+    }
+
+    static void release_callback_args(void* uargs) {
+        delete static_cast<std::shared_ptr<completion_state>*>(uargs);
+    }
+
+    /**
+     * @brief Completes the operation with the provided status, waking
+     * up the waiting ULTs and invoking the registered callbacks.
+     */
+    void complete(hg_return_t ret) {
+        std::vector<std::pair<uint64_t, callback_type>> callbacks;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            if(m_done)
+                return;
+            m_status = ret;
+            m_done   = true;
+            callbacks.swap(m_callbacks);
+            m_cv.notify_all();
+        }
+        for(auto& cb : callbacks) cb.second(ret);
+    }
+
+    /**
+     * @brief Blocks until the operation has completed.
+     *
+     * @return the status of the operation.
+     */
+    hg_return_t wait() {
+        std::unique_lock<mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return m_done; });
+        return m_status;
+    }
+
+    /**
+     * @brief Returns whether the operation has completed, without blocking.
+     */
+    bool test() {
+        std::lock_guard<mutex> lock(m_mutex);
+        return m_done;
+    }
+
+    /**
+     * @brief Registers a callback invoked with the status of the operation
+     * when it completes, from the context completing it (usually the
+     * progress loop), hence the callback should not block. If the operation
+     * has already completed, the callback is invoked immediately.
+     *
+     * @return an id to pass to remove_callback(), or 0 if the callback
+     * has already been invoked.
+     */
+    uint64_t add_callback(callback_type cb) {
+        hg_return_t ret;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            if(!m_done) {
+                uint64_t id = m_next_id++;
+                m_callbacks.emplace_back(id, std::move(cb));
+                return id;
+            }
+            ret = m_status;
+        }
+        cb(ret);
+        return 0;
+    }
+
+    /**
+     * @brief Unregisters a callback that was not invoked yet.
+     *
+     * @return true if the callback was removed, false if it was (or is
+     * being) invoked.
+     */
+    bool remove_callback(uint64_t id) {
+        std::lock_guard<mutex> lock(m_mutex);
+        for(auto it = m_callbacks.begin(); it != m_callbacks.end(); it++) {
+            if(it->first == id) {
+                m_callbacks.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+
+    mutex                                           m_mutex;
+    condition_variable                              m_cv;
+    bool                                            m_done    = false;
+    hg_return_t                                     m_status  = HG_SUCCESS;
+    uint64_t                                        m_next_id = 1;
+    std::vector<std::pair<uint64_t, callback_type>> m_callbacks;
+};
+
+/**
+ * @brief Blocks until at least min_count of the provided operations have
+ * completed, and returns the indices of those that have. The completion
+ * callback of each operation signals a counter shared with the calling
+ * ULT, which is woken up once enough operations have completed rather
+ * than once per operation, and no ULT is created. The callbacks of the
+ * operations that have not completed are unregistered before returning.
+ *
+ * @param states Completions of the operations (a null pointer stands
+ * for an operation that already completed).
+ * @param min_count Minimum number of operations to wait for.
+ *
+ * @return the indices of the completed operations.
+ */
+inline std::vector<size_t>
+wait_some(const std::vector<std::shared_ptr<completion_state>>& states, size_t min_count) {
+    struct counter {
+        std::vector<size_t> m_completed;
+        size_t              m_target;
+        mutex               m_mutex;
+        condition_variable  m_cv;
+    };
+    auto c      = std::make_shared<counter>();
+    c->m_target = std::min(min_count, states.size());
+    std::vector<uint64_t> callbacks(states.size(), 0);
+    for(size_t i = 0; i < states.size(); i++) {
+        if(!states[i] || states[i]->test()) {
+            std::lock_guard<mutex> lock(c->m_mutex);
+            c->m_completed.push_back(i);
+            continue;
+        }
+        callbacks[i] = states[i]->add_callback([c, i](hg_return_t) {
+            std::lock_guard<mutex> lock(c->m_mutex);
+            c->m_completed.push_back(i);
+            if(c->m_completed.size() == c->m_target)
+                c->m_cv.notify_one();
+        });
+    }
+    std::vector<size_t> completed;
+    {
+        std::unique_lock<mutex> lock(c->m_mutex);
+        c->m_cv.wait(lock, [&c]() { return c->m_completed.size() >= c->m_target; });
+        completed = c->m_completed;
+    }
+    for(size_t i = 0; i < states.size(); i++) {
+        if(callbacks[i] != 0) states[i]->remove_callback(callbacks[i]);
+    }
+    return completed;
+}
+
+#if MARGO_VERSION_NUM < 1500
+/**
+ * @brief Completes the state once the margo_request completes. Margo
+ * versions without a callback API can only report completion through
+ * margo_wait(), so a ULT of the handler pool waits in place of the
+ * callback.
+ */
+inline hg_return_t complete_on_wait(margo_instance_id mid, margo_request req,
+                                    const std::shared_ptr<completion_state>& state) {
+    struct waiter {
+        margo_request                     m_request;
+        std::shared_ptr<completion_state> m_state;
+
+        static void run(void* args) {
+            std::unique_ptr<waiter> w(static_cast<waiter*>(args));
+            w->m_state->complete(margo_wait(w->m_request));
+        }
+    };
+    ABT_pool pool = ABT_POOL_NULL;
+    margo_get_handler_pool(mid, &pool);
+    auto w = new waiter{req, state};
+    if(ABT_thread_create(pool, &waiter::run, w, ABT_THREAD_ATTR_NULL, NULL) != ABT_SUCCESS) {
+        delete w;
+        state->complete(margo_wait(req));
+    }
+    return HG_SUCCESS;
+}
+#endif
+
+/**
+ * @brief Sends an RPC, completing the provided state when its response
+ * has been received (or the RPC failed or timed out).
+ */
+inline hg_return_t provider_cforward(uint16_t provider_id, hg_handle_t handle,
+                                     void* in, double timeout_ms,
+                                     const std::shared_ptr<completion_state>& state) {
+#if MARGO_VERSION_NUM >= 1500
+    void*       uargs = completion_state::callback_args(state);
+    hg_return_t ret;
+    if(timeout_ms > 0.0)
+        ret = margo_provider_cforward_timed(provider_id, handle, in, timeout_ms,
+                                            &completion_state::on_complete, uargs);
+    else
+        ret = margo_provider_cforward(provider_id, handle, in,
+                                      &completion_state::on_complete, uargs);
+    if(ret != HG_SUCCESS)
+        completion_state::release_callback_args(uargs);
+    return ret;
+#else
+    margo_request req = MARGO_REQUEST_NULL;
+    hg_return_t   ret;
+    if(timeout_ms > 0.0)
+        ret = margo_provider_iforward_timed(provider_id, handle, in, timeout_ms, &req);
+    else
+        ret = margo_provider_iforward(provider_id, handle, in, &req);
+    if(ret != HG_SUCCESS)
+        return ret;
+    return complete_on_wait(margo_hg_handle_get_instance(handle), req, state);
+#endif
+}
+
+/**
+ * @brief Sends the response of an RPC, completing the provided state
+ * once it has been sent.
+ */
+inline hg_return_t crespond(hg_handle_t handle, void* out,
+                            const std::shared_ptr<completion_state>& state) {
+#if MARGO_VERSION_NUM >= 1500
+    void*       uargs = completion_state::callback_args(state);
+    hg_return_t ret   = margo_crespond(handle, out, &completion_state::on_complete, uargs);
+    if(ret != HG_SUCCESS)
+        completion_state::release_callback_args(uargs);
+    return ret;
+#else
+    margo_request req = MARGO_REQUEST_NULL;
+    hg_return_t   ret = margo_irespond(handle, out, &req);
+    if(ret != HG_SUCCESS)
+        return ret;
+    return complete_on_wait(margo_hg_handle_get_instance(handle), req, state);
+#endif
+}
+
+/**
+ * @brief Starts a bulk transfer, completing the provided state once
+ * it has completed (or failed or timed out).
+ */
+inline hg_return_t bulk_ctransfer(margo_instance_id mid, hg_bulk_op_t op,
+                                  hg_addr_t origin_addr, hg_bulk_t origin_handle,
+                                  size_t origin_offset, hg_bulk_t local_handle,
+                                  size_t local_offset, size_t size, double timeout_ms,
+                                  const std::shared_ptr<completion_state>& state) {
+#if MARGO_VERSION_NUM >= 1500
+    void*       uargs = completion_state::callback_args(state);
+    hg_return_t ret;
+    if(timeout_ms > 0.0)
+        ret = margo_bulk_ctransfer_timed(mid, op, origin_addr, origin_handle, origin_offset,
+                                         local_handle, local_offset, size, timeout_ms,
+                                         &completion_state::on_complete, uargs);
+    else
+        ret = margo_bulk_ctransfer(mid, op, origin_addr, origin_handle, origin_offset,
+                                   local_handle, local_offset, size,
+                                   &completion_state::on_complete, uargs);
+    if(ret != HG_SUCCESS)
+        completion_state::release_callback_args(uargs);
+    return ret;
+#else
+    margo_request req = MARGO_REQUEST_NULL;
+    hg_return_t   ret;
+    if(timeout_ms > 0.0)
+        ret = margo_bulk_itransfer_timed(mid, op, origin_addr, origin_handle, origin_offset,
+                                         local_handle, local_offset, size, timeout_ms, &req);
+    else
+        ret = margo_bulk_itransfer(mid, op, origin_addr, origin_handle, origin_offset,
+                                   local_handle, local_offset, size, &req);
+    if(ret != HG_SUCCESS)
+        return ret;
+    return complete_on_wait(mid, req, state);
+#endif
+}
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_COMPLETION_WATCHER_HPP
+#define __THALLIUM_COMPLETION_WATCHER_HPP
+
+#include <abt.h>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <margo.h>
+#include <thallium/completion_state.hpp>
+#include <thallium/condition_variable.hpp>
+#include <thallium/exception.hpp>
+#include <thallium/mutex.hpp>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Error callback of continuations, logging the error.
+ */
+struct log_continuation_error {
+    margo_instance_id m_mid;
+
+    void operator()(const std::exception& ex) const {
+        margo_error(m_mid, "[thallium] Continuation not invoked: %s", ex.what());
+    }
+};
+
+/**
+ * @brief Runs the continuations of pending operations (RPCs, bulk
+ * transfers) on behalf of a margo instance (see async_response::then()).
+ * A continuation does not occupy a ULT while its operation is pending:
+ * the completion callback of the operation (see completion_state) starts
+ * a ULT running it in the requested pool. The watcher keeps track of the
+ * pending and running continuations, so that finalizing the margo
+ * instance cancels those whose operation has not completed and waits
+ * for the running ones to return.
+ */
+class completion_watcher : public std::enable_shared_from_this<completion_watcher> {
+
+  public:
+
+    completion_watcher(margo_instance_id mid)
+    : m_mid(mid) {}
+
+    completion_watcher(const completion_watcher&)            = delete;
+    completion_watcher& operator=(const completion_watcher&) = delete;
+
+    /**
+     * @brief Registers a continuation.
+     *
+     * @param pool Pool in which to run the continuation
+     * (ABT_POOL_NULL for the handler pool of the margo instance).
+     * @param state Completion of the operation.
+     * @param run Continuation, run once the operation has completed.
+     * @param cancel Function invoked instead of run if the continuation
+     * cannot be run (the margo instance is finalized before the operation
+     * completes, or the ULT cannot be created).
+     */
+    void watch(ABT_pool pool, const std::shared_ptr<completion_state>& state,
+               std::function<void()> run,
+               std::function<void(const std::exception&)> cancel) {
+        if(pool == ABT_POOL_NULL)
+            margo_get_handler_pool(m_mid, &pool);
+        auto t = std::make_shared<task>();
+        t->m_pool   = pool;
+        t->m_run    = std::move(run);
+        t->m_cancel = std::move(cancel);
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            if(m_stopped)
+                throw exception("Cannot register a continuation after the margo instance was finalized");
+            m_pending.insert(t);
+        }
+        std::weak_ptr<completion_watcher> self = shared_from_this();
+        state->add_callback([self, t](hg_return_t) {
+            if(auto w = self.lock()) w->start(t);
+        });
+    }
+
+    /**
+     * @brief Returns the number of continuations that have not returned yet.
+     */
+    size_t pending() {
+        std::lock_guard<mutex> lock(m_mutex);
+        return m_pending.size() + m_running;
+    }
+
+    /**
+     * @brief Called when the margo instance is finalized. Cancels right
+     * away the continuations whose operation has not completed, so that
+     * an operation that never completes cannot delay the finalization,
+     * then waits for the continuations already running to return.
+     */
+    void on_finalize() {
+        std::unordered_set<std::shared_ptr<task>> cancelled;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            m_stopped = true;
+            cancelled.swap(m_pending);
+        }
+        exception ex("The margo instance was finalized before the operation completed");
+        for(auto& t : cancelled) t->m_cancel(ex);
+        std::unique_lock<mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return m_running == 0; });
+    }
+
+  private:
+
+    struct task {
+        ABT_pool                                   m_pool = ABT_POOL_NULL;
+        std::function<void()>                      m_run;
+        std::function<void(const std::exception&)> m_cancel;
+    };
+
+    struct running_task {
+        std::shared_ptr<completion_watcher> m_watcher;
+        std::shared_ptr<task>               m_task;
+    };
+
+    /**
+     * @brief Called by the completion callback of the operation of a
+     * task: starts a ULT running its continuation, unless it was cancelled.
+     */
+    void start(const std::shared_ptr<task>& t) {
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            // runs in the progress loop, hence the constant-time lookup
+            if(m_pending.erase(t) == 0)
+                return;
+            m_running += 1;
+        }
+        auto r = new running_task{shared_from_this(), t};
+        int ret = ABT_thread_create(t->m_pool, &completion_watcher::task_ult, r,
+                                    ABT_THREAD_ATTR_NULL, NULL);
+        if(ret != ABT_SUCCESS) {
+            delete r;
+            t->m_cancel(exception("ABT_thread_create failed to start a continuation"));
+            finished();
+        }
+    }
+
+    void finished() {
+        std::lock_guard<mutex> lock(m_mutex);
+        m_running -= 1;
+        if(m_running == 0) m_cv.notify_all();
+    }
+
+    static void task_ult(void* args) {
+        std::unique_ptr<running_task> r(static_cast<running_task*>(args));
+        auto w = r->m_watcher;
+        try {
+            r->m_task->m_run();
+        } catch(const std::exception& ex) {
+            log_continuation_error{w->m_mid}(ex);
+        } catch(...) {
+            log_continuation_error{w->m_mid}(exception("unknown exception"));
+        }
+        r.reset();
+        w->finished();
+    }
+
+    margo_instance_id                         m_mid;
+    std::unordered_set<std::shared_ptr<task>> m_pending;
+    size_t                                    m_running = 0;
+    bool                                      m_stopped = false;
+    mutex                                     m_mutex;
+    condition_variable                        m_cv;
+};
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
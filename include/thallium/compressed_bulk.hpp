@@ -0,0 +1,147 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_COMPRESSED_BULK_HPP
+#define __THALLIUM_COMPRESSED_BULK_HPP
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <margo.h>
+#include <thallium/bulk.hpp>
+#include <thallium/bulk_mode.hpp>
+#include <thallium/compression.hpp>
+#include <thallium/endpoint.hpp>
+#include <thallium/engine.hpp>
+#include <thallium/exception.hpp>
+#include <thallium/remote_bulk.hpp>
+
+namespace thallium {
+
+/**
+ * @brief A compressed_bulk exposes a compressed copy of a memory region
+ * for another process to pull it, when the data is large enough and
+ * compresses well, and the region itself otherwise. It is sent over RPC
+ * like a bulk object, and the receiver calls pull_to() to transfer and
+ * decompress the data. The codec must be registered with the receiver's
+ * engine (see engine::register_codec()) unless it is a built-in one such
+ * as lz_codec.
+ *
+ * The data is compressed when the compressed_bulk is created, so later
+ * changes to the region are not seen by the receiver if it was
+ * compressed. As with a bulk, the sender must keep the compressed_bulk
+ * (or a copy of it) alive until the receiver has pulled the data.
+ */
+class compressed_bulk {
+
+  private:
+
+    margo_instance_id                  m_mid = MARGO_INSTANCE_NULL;
+    std::shared_ptr<std::vector<char>> m_staging;
+    bulk                               m_bulk;
+    uint8_t                            m_codec    = 0;
+    uint64_t                           m_raw_size = 0;
+    uint64_t                           m_size     = 0;
+
+  public:
+
+    compressed_bulk() = default;
+
+    /**
+     * @brief Compresses and exposes a memory region.
+     *
+     * @param e Engine exposing the data.
+     * @param data Region to expose.
+     * @param size Size of the region.
+     * @param c Codec with which to compress the region.
+     * @param threshold Minimum size of the regions to compress.
+     */
+    compressed_bulk(engine& e, const void* data, size_t size,
+                    const codec& c = lz_codec(), size_t threshold = 4096)
+    : m_mid(e.get_margo_instance())
+    , m_raw_size(size)
+    , m_size(size) {
+        if(size == 0)
+            return;
+        void* region = const_cast<void*>(data);
+        if(size >= threshold) {
+            auto   staging = std::make_shared<std::vector<char>>(c.max_compressed_size(size));
+            size_t csize   = c.compress(data, size, staging->data(), staging->size());
+            if(csize != 0 && csize < size) {
+                staging->resize(csize);
+                m_staging = std::move(staging);
+                m_codec   = c.id();
+                m_size    = csize;
+                region    = m_staging->data();
+            }
+        }
+        std::vector<std::pair<void*, size_t>> segments{{region, static_cast<size_t>(m_size)}};
+        m_bulk = detail::expose_uncached(m_mid, segments, bulk_mode::read_only);
+    }
+
+    /**
+     * @brief Size of the data once decompressed.
+     */
+    size_t raw_size() const {
+        return m_raw_size;
+    }
+
+    /**
+     * @brief Number of bytes pull_to() transfers over the network.
+     */
+    size_t transfer_size() const {
+        return m_size;
+    }
+
+    /**
+     * @brief Returns whether the exposed data is compressed.
+     */
+    bool is_compressed() const {
+        return m_codec != 0;
+    }
+
+    /**
+     * @brief Pulls the data from the process that exposed it and
+     * decompresses it into the provided memory.
+     *
+     * @param ep Endpoint of the process that created the compressed_bulk.
+     * @param dest Memory in which to write the data.
+     * @param size Size of the memory (at least raw_size()).
+     *
+     * @return the number of bytes written (raw_size()).
+     */
+    size_t pull_to(const endpoint& ep, void* dest, size_t size) const {
+        if(size < m_raw_size)
+            throw exception("compressed_bulk::pull_to: destination is too small");
+        if(m_raw_size == 0)
+            return 0;
+        if(m_codec == 0) {
+            std::vector<std::pair<void*, size_t>> segments{{dest, static_cast<size_t>(m_raw_size)}};
+            bulk local = detail::expose_uncached(m_mid, segments, bulk_mode::write_only);
+            local << m_bulk.on(ep);
+            return m_raw_size;
+        }
+        std::vector<char> staging(m_size);
+        std::vector<std::pair<void*, size_t>> segments{{staging.data(), staging.size()}};
+        bulk local = detail::expose_uncached(m_mid, segments, bulk_mode::write_only);
+        local << m_bulk.on(ep);
+        detail::decompress(m_mid, m_codec, staging.data(), staging.size(), dest, m_raw_size);
+        return m_raw_size;
+    }
+
+    template <typename A> void serialize(A& ar) {
+        ar & m_bulk;
+        ar & m_codec;
+        ar & m_raw_size;
+        ar & m_size;
+        if(m_mid == MARGO_INSTANCE_NULL)
+            m_mid = ar.get_engine().get_margo_instance();
+    }
+};
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,377 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_COMPRESSION_HPP
+#define __THALLIUM_COMPRESSION_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <margo.h>
+#include <thallium/exception.hpp>
+#include <thallium/instance_data.hpp>
+#include <thallium/mutex.hpp>
+
+namespace thallium {
+
+/**
+ * @brief Interface of the compression algorithms that can be applied to
+ * the arguments of an RPC (see remote_procedure::set_compression()) and
+ * to bulk transfers (see compressed_bulk).
+ *
+ * A codec is identified on the wire by its id(): the receiver decodes a
+ * payload with the codec of the same id registered with its engine (see
+ * engine::register_codec()). Ids 1 to 15 are reserved for the codecs
+ * provided by thallium, and 0 means that a payload is not compressed.
+ * Codecs must be thread-safe.
+ */
+class codec {
+
+  public:
+
+    virtual ~codec() = default;
+
+    /**
+     * @brief Identifier of the codec on the wire.
+     */
+    virtual uint8_t id() const = 0;
+
+    /**
+     * @brief Size of the output buffer that compress() needs to be
+     * able to compress size bytes.
+     */
+    virtual size_t max_compressed_size(size_t size) const = 0;
+
+    /**
+     * @brief Compresses in_size bytes into out, which has room for
+     * out_size bytes.
+     *
+     * @return the compressed size, or 0 if the data did not fit.
+     */
+    virtual size_t compress(const void* in, size_t in_size,
+                            void* out, size_t out_size) const = 0;
+
+    /**
+     * @brief Decompresses in_size bytes into exactly out_size bytes.
+     *
+     * @return false if the data is malformed.
+     */
+    virtual bool decompress(const void* in, size_t in_size,
+                            void* out, size_t out_size) const = 0;
+
+    /**
+     * @brief Largest size that in_size compressed bytes can decompress
+     * to. Receivers reject payloads announcing a larger size before
+     * allocating memory for them. The default, 255 times in_size, suits
+     * codecs that encode lengths on single bytes, such as lz_codec;
+     * codecs that compress better must override it.
+     */
+    virtual size_t max_decompressed_size(size_t in_size) const {
+        if(in_size > std::numeric_limits<size_t>::max() / 255)
+            return std::numeric_limits<size_t>::max();
+        return in_size * 255;
+    }
+};
+
+/**
+ * @brief Fast LZ77 codec built into thallium (id 1). The output is a
+ * series of literal runs and back-references of at least 4 bytes found
+ * with a hash table, in the spirit of LZ4: it compresses runs of zeros
+ * and repeated records well at a low CPU cost, but is not meant for
+ * high compression ratios.
+ */
+class lz_codec : public codec {
+
+  public:
+
+    static constexpr uint8_t codec_id = 1;
+
+    uint8_t id() const override {
+        return codec_id;
+    }
+
+    size_t max_compressed_size(size_t size) const override {
+        return size + size / 255 + 16;
+    }
+
+    size_t compress(const void* in, size_t in_size,
+                    void* out, size_t out_size) const override {
+        auto src = static_cast<const uint8_t*>(in);
+        auto dst = static_cast<uint8_t*>(out);
+        std::vector<uint32_t> table(size_t(1) << hash_bits, 0);
+        size_t op = 0, anchor = 0, i = 0;
+        while(in_size >= min_match && i <= in_size - min_match) {
+            uint32_t  seq  = read32(src + i);
+            uint32_t& slot = table[hash(seq)];
+            size_t    cand = slot;
+            slot           = static_cast<uint32_t>(i);
+            if(cand >= i || i - cand > max_offset || read32(src + cand) != seq) {
+                i++;
+                continue;
+            }
+            size_t len = min_match;
+            while(i + len < in_size && src[cand + len] == src[i + len]) len++;
+            if(!write_sequence(dst, out_size, op, src + anchor, i - anchor,
+                               i - cand, len))
+                return 0;
+            i += len;
+            anchor = i;
+        }
+        // the last sequence only has literals
+        if(!write_sequence(dst, out_size, op, src + anchor, in_size - anchor, 0, 0))
+            return 0;
+        return op;
+    }
+
+    bool decompress(const void* in, size_t in_size,
+                    void* out, size_t out_size) const override {
+        auto ip   = static_cast<const uint8_t*>(in);
+        auto iend = ip + in_size;
+        auto dst  = static_cast<uint8_t*>(out);
+        size_t op = 0;
+        while(ip < iend) {
+            uint8_t token = *ip++;
+            size_t  lit   = token >> 4;
+            if(lit == 15 && !read_length(ip, iend, lit)) return false;
+            if(lit > static_cast<size_t>(iend - ip) || lit > out_size - op) return false;
+            if(lit != 0) std::memcpy(dst + op, ip, lit);
+            ip += lit;
+            op += lit;
+            if(op == out_size) return ip == iend;
+            if(iend - ip < 2) return false;
+            size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+            ip += 2;
+            size_t len = token & 15;
+            if(len == 15 && !read_length(ip, iend, len)) return false;
+            len += min_match;
+            if(offset == 0 || offset > op || len > out_size - op) return false;
+            // byte by byte, since the reference may overlap the output
+            const uint8_t* ref = dst + op - offset;
+            for(size_t k = 0; k < len; k++) dst[op + k] = ref[k];
+            op += len;
+        }
+        return op == out_size;
+    }
+
+  private:
+
+    static constexpr size_t min_match  = 4;
+    static constexpr size_t max_offset = 65535;
+    static constexpr size_t hash_bits  = 14;
+
+    static uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static size_t hash(uint32_t seq) {
+        return (seq * 2654435761u) >> (32 - hash_bits);
+    }
+
+    static bool write_length(uint8_t* dst, size_t out_size, size_t& op, size_t len) {
+        while(len >= 255) {
+            if(op == out_size) return false;
+            dst[op++] = 255;
+            len -= 255;
+        }
+        if(op == out_size) return false;
+        dst[op++] = static_cast<uint8_t>(len);
+        return true;
+    }
+
+    static bool read_length(const uint8_t*& ip, const uint8_t* iend, size_t& len) {
+        uint8_t b;
+        do {
+            if(ip == iend) return false;
+            b = *ip++;
+            len += b;
+        } while(b == 255);
+        return true;
+    }
+
+    /**
+     * @brief Writes a token, the literals, then the back-reference
+     * (omitted if match_len is 0).
+     */
+    static bool write_sequence(uint8_t* dst, size_t out_size, size_t& op,
+                               const uint8_t* lit, size_t lit_len,
+                               size_t offset, size_t match_len) {
+        size_t ml = match_len ? match_len - min_match : 0;
+        if(op == out_size) return false;
+        dst[op++] = static_cast<uint8_t>(((lit_len < 15 ? lit_len : 15) << 4)
+                                       | (ml < 15 ? ml : 15));
+        if(lit_len >= 15 && !write_length(dst, out_size, op, lit_len - 15))
+            return false;
+        if(lit_len > out_size - op) return false;
+        if(lit_len != 0) std::memcpy(dst + op, lit, lit_len);
+        op += lit_len;
+        if(match_len == 0) return true;
+        if(out_size - op < 2) return false;
+        dst[op++] = static_cast<uint8_t>(offset);
+        dst[op++] = static_cast<uint8_t>(offset >> 8);
+        if(ml >= 15 && !write_length(dst, out_size, op, ml - 15))
+            return false;
+        return true;
+    }
+};
+
+/**
+ * @brief Compression counters of an RPC (see
+ * remote_procedure::get_compression_stats()).
+ */
+struct compression_stats {
+    uint64_t compressed       = 0; // payloads sent compressed
+    uint64_t uncompressed     = 0; // payloads below the threshold or incompressible
+    uint64_t raw_bytes        = 0; // size of the compressed payloads before compression
+    uint64_t compressed_bytes = 0; // size of the compressed payloads on the wire
+};
+
+namespace detail {
+
+/**
+ * @brief Compression settings and counters of a remote_procedure,
+ * shared by its copies.
+ */
+class compression {
+
+  public:
+
+    compression(std::shared_ptr<const codec> c, size_t threshold)
+    : m_codec(std::move(c))
+    , m_threshold(threshold) {}
+
+    compression(const compression&)            = delete;
+    compression& operator=(const compression&) = delete;
+
+    const codec& get_codec() const {
+        return *m_codec;
+    }
+
+    size_t threshold() const {
+        return m_threshold;
+    }
+
+    void record(size_t raw_size, size_t compressed_size) {
+        m_compressed++;
+        m_raw_bytes        += raw_size;
+        m_compressed_bytes += compressed_size;
+    }
+
+    void record_uncompressed() {
+        m_uncompressed++;
+    }
+
+    compression_stats stats() const {
+        compression_stats s;
+        s.compressed       = m_compressed.load();
+        s.uncompressed     = m_uncompressed.load();
+        s.raw_bytes        = m_raw_bytes.load();
+        s.compressed_bytes = m_compressed_bytes.load();
+        return s;
+    }
+
+    /**
+     * @brief Compresses the provided buffer if it is large enough and
+     * compression makes it smaller.
+     *
+     * @return false if the buffer must be sent as it is.
+     */
+    bool compress(const std::vector<char>& raw, std::vector<char>& out) {
+        if(raw.size() < m_threshold || raw.empty()) {
+            record_uncompressed();
+            return false;
+        }
+        out.resize(m_codec->max_compressed_size(raw.size()));
+        size_t size = m_codec->compress(raw.data(), raw.size(), out.data(), out.size());
+        if(size == 0 || size >= raw.size()) {
+            record_uncompressed();
+            return false;
+        }
+        out.resize(size);
+        record(raw.size(), size);
+        return true;
+    }
+
+  private:
+
+    std::shared_ptr<const codec> m_codec;
+    size_t                       m_threshold;
+    std::atomic<uint64_t>        m_compressed{0};
+    std::atomic<uint64_t>        m_uncompressed{0};
+    std::atomic<uint64_t>        m_raw_bytes{0};
+    std::atomic<uint64_t>        m_compressed_bytes{0};
+};
+
+/**
+ * @brief Codecs with which a margo instance can decompress
+ * the data it receives, by id.
+ */
+class codec_registry {
+
+  public:
+
+    codec_registry(margo_instance_id) {
+        auto lz = std::make_shared<lz_codec>();
+        m_codecs[lz->id()] = std::move(lz);
+    }
+
+    codec_registry(const codec_registry&)            = delete;
+    codec_registry& operator=(const codec_registry&) = delete;
+
+    void add(std::shared_ptr<const codec> c) {
+        if(!c || c->id() == 0)
+            throw exception("Invalid codec: codecs must have a non-zero id");
+        std::lock_guard<mutex> lock(m_mutex);
+        m_codecs[c->id()] = std::move(c);
+    }
+
+    std::shared_ptr<const codec> find(uint8_t id) {
+        std::lock_guard<mutex> lock(m_mutex);
+        auto it = m_codecs.find(id);
+        return it == m_codecs.end() ? nullptr : it->second;
+    }
+
+    void on_finalize() {}
+
+  private:
+
+    std::map<uint8_t, std::shared_ptr<const codec>> m_codecs;
+    mutex                                           m_mutex;
+};
+
+/**
+ * @brief Returns the codec registered under the provided id,
+ * throwing an exception if there is none.
+ */
+inline std::shared_ptr<const codec> find_codec(margo_instance_id mid, uint8_t codec_id) {
+    auto c = get_instance_data<codec_registry>(mid)->find(codec_id);
+    if(!c) {
+        throw exception("Cannot decompress data: no codec registered with id ",
+                        static_cast<int>(codec_id));
+    }
+    return c;
+}
+
+/**
+ * @brief Decompresses a payload with the codec registered under the
+ * provided id, throwing an exception if none is or the data is malformed.
+ */
+inline void decompress(margo_instance_id mid, uint8_t codec_id,
+                       const void* data, size_t size, void* out, size_t out_size) {
+    if(!find_codec(mid, codec_id)->decompress(data, size, out, out_size))
+        throw exception("Cannot decompress data: malformed input");
+}
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,504 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_COROUTINE_HPP
+#define __THALLIUM_COROUTINE_HPP
+
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#define THALLIUM_HAS_COROUTINES
+#endif
+#endif
+
+#ifdef THALLIUM_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <thallium/async_response.hpp>
+#include <thallium/bulk.hpp>
+#include <thallium/completion_state.hpp>
+#include <thallium/engine.hpp>
+#include <thallium/eventual.hpp>
+#include <thallium/mutex.hpp>
+#include <thallium/packed_data.hpp>
+#include <thallium/pool.hpp>
+#include <thallium/timed_callback.hpp>
+
+namespace thallium {
+
+template <typename T = void> class co_task;
+
+namespace detail {
+
+/**
+ * @brief Pushes a ULT resuming the coroutine into the pool.
+ */
+inline void resume_on(ABT_pool pool, std::coroutine_handle<> h) {
+    auto resume = [](void* args) {
+        std::coroutine_handle<>::from_address(args).resume();
+    };
+    int ret = ABT_thread_create(pool, resume, h.address(), ABT_THREAD_ATTR_NULL, NULL);
+    if(ret != ABT_SUCCESS) h.resume();
+}
+
+/**
+ * @brief Part of the promise of a co_task that does not depend
+ * on the type of its result.
+ */
+class co_promise_base {
+
+  public:
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            return h.promise().finish();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept {
+        m_exception = std::current_exception();
+    }
+
+    /**
+     * @brief Starts the coroutine if it has not been started yet.
+     * Returns false if it was already started.
+     */
+    bool mark_started() {
+        std::lock_guard<mutex> lock(m_mutex);
+        return !std::exchange(m_started, true);
+    }
+
+    /**
+     * @brief Sets the coroutine to resume when this one completes.
+     * Returns false if it has already completed.
+     */
+    bool set_continuation(std::coroutine_handle<> h) {
+        std::lock_guard<mutex> lock(m_mutex);
+        if(m_finished) return false;
+        m_continuation = h;
+        return true;
+    }
+
+    bool started() {
+        std::lock_guard<mutex> lock(m_mutex);
+        return m_started;
+    }
+
+    bool finished() {
+        std::lock_guard<mutex> lock(m_mutex);
+        return m_finished;
+    }
+
+    void wait_finished() {
+        m_done.wait();
+    }
+
+    void rethrow_if_failed() {
+        if(m_exception) std::rethrow_exception(m_exception);
+    }
+
+  private:
+
+    std::coroutine_handle<> finish() noexcept {
+        std::coroutine_handle<> continuation;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            m_finished   = true;
+            continuation = m_continuation;
+        }
+        m_done.set_value();
+        if(continuation) return continuation;
+        return std::noop_coroutine();
+    }
+
+    std::exception_ptr      m_exception;
+    std::coroutine_handle<> m_continuation;
+    bool                    m_started  = false;
+    bool                    m_finished = false;
+    eventual<void>          m_done;
+    mutex                   m_mutex;
+};
+
+template <typename T> class co_promise : public co_promise_base {
+
+  public:
+
+    co_task<T> get_return_object();
+
+    template <typename U>
+    void return_value(U&& value) {
+        m_value.emplace(std::forward<U>(value));
+    }
+
+    T result() {
+        rethrow_if_failed();
+        return std::move(*m_value);
+    }
+
+  private:
+
+    std::optional<T> m_value;
+};
+
+template <> class co_promise<void> : public co_promise_base {
+
+  public:
+
+    co_task<void> get_return_object();
+
+    void return_void() {}
+
+    void result() {
+        rethrow_if_failed();
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief Return type of coroutines using the awaitables provided by
+ * thallium. A co_task is lazy: its coroutine runs when the co_task is
+ * co_awaited by another coroutine, when start() is called, or when a
+ * ULT calls wait(). A coroutine suspended on one of thallium's awaitables
+ * (co_wait(), co_sleep()) is not attached to any ULT while it is suspended:
+ * the completion callback of the operation (or the timer, or the ULT
+ * setting the eventual) pushes a new ULT resuming it into the pool passed
+ * to the awaitable.
+ *
+ * Example:
+ * @code
+ * tl::co_task<int> get(tl::remote_procedure& rpc, tl::endpoint ep, tl::pool p) {
+ *     int x = co_await tl::co_wait(rpc.on(ep).async(), p);
+ *     co_return x;
+ * }
+ * @endcode
+ *
+ * @tparam T Type of result of the coroutine.
+ */
+template <typename T> class co_task {
+
+  public:
+
+    using promise_type = detail::co_promise<T>;
+    using handle_type  = std::coroutine_handle<promise_type>;
+
+    co_task() = default;
+
+    explicit co_task(handle_type h)
+    : m_handle(h) {}
+
+    co_task(const co_task&)            = delete;
+    co_task& operator=(const co_task&) = delete;
+
+    co_task(co_task&& other) noexcept
+    : m_handle(std::exchange(other.m_handle, nullptr)) {}
+
+    co_task& operator=(co_task&& other) noexcept {
+        if(this == &other) return *this;
+        release();
+        m_handle = std::exchange(other.m_handle, nullptr);
+        return *this;
+    }
+
+    /**
+     * @brief Destructor. If the coroutine was started,
+     * waits for it to complete.
+     */
+    ~co_task() {
+        release();
+    }
+
+    /**
+     * @brief Starts the coroutine in a new ULT pushed into the pool,
+     * without waiting for it to complete.
+     *
+     * @param p Pool in which to start the coroutine.
+     */
+    void start(const pool& p) {
+        if(!m_handle)
+            throw exception("Calling start on an invalid co_task");
+        if(m_handle.promise().mark_started())
+            detail::resume_on(p.native_handle(), m_handle);
+    }
+
+    /**
+     * @brief Blocks the calling ULT until the coroutine completes,
+     * starting it in this ULT if needed, and returns its result.
+     * Rethrows the exception that escaped the coroutine, if any.
+     */
+    T wait() {
+        if(!m_handle)
+            throw exception("Calling wait on an invalid co_task");
+        if(m_handle.promise().mark_started())
+            m_handle.resume();
+        m_handle.promise().wait_finished();
+        return m_handle.promise().result();
+    }
+
+    /**
+     * @brief Tests without blocking whether the coroutine completed.
+     */
+    bool completed() const {
+        return m_handle && m_handle.promise().finished();
+    }
+
+    struct awaiter {
+        handle_type m_handle;
+
+        bool await_ready() { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+            auto& promise = m_handle.promise();
+            if(!promise.set_continuation(h))
+                return h;
+            if(promise.mark_started())
+                return m_handle;
+            return std::noop_coroutine();
+        }
+
+        T await_resume() {
+            return m_handle.promise().result();
+        }
+    };
+
+    /**
+     * @brief Suspends the awaiting coroutine until this one
+     * completes, starting it if needed.
+     */
+    awaiter operator co_await() const& noexcept {
+        return awaiter{m_handle};
+    }
+
+  private:
+
+    void release() {
+        if(!m_handle) return;
+        auto& promise = m_handle.promise();
+        if(promise.started())
+            promise.wait_finished();
+        m_handle.destroy();
+        m_handle = nullptr;
+    }
+
+    handle_type m_handle;
+};
+
+namespace detail {
+
+template <typename T>
+co_task<T> co_promise<T>::get_return_object() {
+    return co_task<T>(std::coroutine_handle<co_promise<T>>::from_promise(*this));
+}
+
+inline co_task<void> co_promise<void>::get_return_object() {
+    return co_task<void>(std::coroutine_handle<co_promise<void>>::from_promise(*this));
+}
+
+/**
+ * @brief Awaitable returned by co_wait(async_response&&, const pool&).
+ */
+class response_awaiter {
+
+  public:
+
+    response_awaiter(async_response&& response, const pool& p)
+    : m_response(std::move(response))
+    , m_pool(p) {}
+
+    bool await_ready() {
+        return m_response.received();
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        ABT_pool pool  = m_pool.native_handle();
+        auto     state = m_response.completion();
+        if(state->test())
+            return false;
+        // resumed by the completion callback of the RPC
+        state->add_callback([pool, h](hg_return_t) { resume_on(pool, h); });
+        return true;
+    }
+
+    packed_data<> await_resume() {
+        return m_response.wait();
+    }
+
+  private:
+
+    async_response m_response;
+    pool           m_pool;
+};
+
+/**
+ * @brief Awaitable returned by co_wait(async_bulk_op&&, const pool&).
+ */
+class bulk_awaiter {
+
+  public:
+
+    bulk_awaiter(async_bulk_op&& op, const pool& p)
+    : m_op(std::move(op))
+    , m_pool(p) {}
+
+    bool await_ready() {
+        return m_op.test();
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        ABT_pool pool  = m_pool.native_handle();
+        auto     state = m_op.m_completion;
+        if(state->test())
+            return false;
+        // resumed by the completion callback of the transfer
+        state->add_callback([pool, h](hg_return_t) { resume_on(pool, h); });
+        return true;
+    }
+
+    std::size_t await_resume() {
+        return m_op.wait();
+    }
+
+  private:
+
+    async_bulk_op m_op;
+    pool          m_pool;
+};
+
+/**
+ * @brief Awaitable returned by co_wait(eventual<T>&, const pool&).
+ */
+template <typename T> class eventual_awaiter {
+
+  public:
+
+    eventual_awaiter(eventual<T>& ev, const pool& p)
+    : m_eventual(ev)
+    , m_pool(p) {}
+
+    bool await_ready() {
+        return m_eventual.test();
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        ABT_pool pool = m_pool.native_handle();
+        // resumed by set_value(), or right away if it was called meanwhile
+        return m_eventual.m_listeners.add([pool, h]() { resume_on(pool, h); });
+    }
+
+    decltype(auto) await_resume() {
+        return m_eventual.wait();
+    }
+
+  private:
+
+    eventual<T>& m_eventual;
+    pool         m_pool;
+};
+
+/**
+ * @brief Awaitable returned by co_sleep().
+ */
+class sleep_awaiter {
+
+  public:
+
+    sleep_awaiter(const engine& e, double ms, const pool& p)
+    : m_engine(e)
+    , m_ms(ms)
+    , m_pool(p) {}
+
+    bool await_ready() {
+        return m_ms <= 0.0;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        ABT_pool target = m_pool.native_handle();
+        m_timer.reset(new timed_callback(
+            m_engine.create_timed_callback([target, h]() { resume_on(target, h); })));
+        m_timer->start(m_ms);
+    }
+
+    void await_resume() {}
+
+  private:
+
+    engine                          m_engine;
+    double                          m_ms;
+    pool                            m_pool;
+    std::unique_ptr<timed_callback> m_timer;
+};
+
+} // namespace detail
+
+/**
+ * @brief Returns an awaitable suspending the calling coroutine until the
+ * response is received, then resuming it in a new ULT in the provided
+ * pool. co_await-ing it produces the packed_data<> that wait() would have
+ * returned, or throws the exception that wait() would have thrown.
+ *
+ * @param response Response to wait for (moved into the awaitable).
+ * @param p Pool in which to resume the coroutine.
+ */
+inline detail::response_awaiter co_wait(async_response&& response, const pool& p) {
+    return detail::response_awaiter(std::move(response), p);
+}
+
+/**
+ * @brief Returns an awaitable suspending the calling coroutine until the
+ * bulk transfer completes, then resuming it in a new ULT in the provided
+ * pool. co_await-ing it produces the transferred size.
+ *
+ * @param op Bulk operation to wait for (moved into the awaitable).
+ * @param p Pool in which to resume the coroutine.
+ */
+inline detail::bulk_awaiter co_wait(async_bulk_op&& op, const pool& p) {
+    return detail::bulk_awaiter(std::move(op), p);
+}
+
+/**
+ * @brief Returns an awaitable suspending the calling coroutine until the
+ * eventual is set, then resuming it in a new ULT in the provided pool.
+ * co_await-ing it produces the value of the eventual. No ULT waits for
+ * the eventual: the ULT that sets it pushes the one resuming the coroutine.
+ *
+ * @param ev Eventual to wait for.
+ * @param p Pool in which to resume the coroutine.
+ */
+template <typename T>
+detail::eventual_awaiter<T> co_wait(eventual<T>& ev, const pool& p) {
+    return detail::eventual_awaiter<T>(ev, p);
+}
+
+/**
+ * @brief Returns an awaitable suspending the calling coroutine for the
+ * specified duration using a timed_callback, then resuming it in a new
+ * ULT in the provided pool.
+ *
+ * @param e Engine used to create the timed_callback.
+ * @param ms Duration in milliseconds.
+ * @param p Pool in which to resume the coroutine.
+ */
+inline detail::sleep_awaiter co_sleep(const engine& e, double ms, const pool& p) {
+    return detail::sleep_awaiter(e, ms, p);
+}
+
+} // namespace thallium
+
+#endif // THALLIUM_HAS_COROUTINES
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __THALLIUM_DECODE_CONTEXT_HPP
+#define __THALLIUM_DECODE_CONTEXT_HPP
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace thallium {
+
+/**
+ * @brief Wraps a function creating the serialization context with which
+ * the arguments of an RPC are decoded on the server (the server-side
+ * counterpart of callable_remote_procedure::with_serialization_context).
+ * The function is called once per request, and must return a std::tuple
+ * whose elements are accessible from serialization functions via
+ * ar.get_context(). The context lives until the handler returns and the
+ * arguments are destroyed, so an arena it holds can be freed at once
+ * when the request is done.
+ *
+ * decode_context_factory objects are created with decode_context().
+ *
+ * @tparam F Type of the function creating the context.
+ */
+template <typename F>
+class decode_context_factory {
+
+  public:
+
+    using context_type = typename std::decay<decltype(std::declval<const F&>()())>::type;
+
+    explicit decode_context_factory(F f)
+    : m_factory(std::move(f)) {}
+
+    context_type operator()() const {
+        return m_factory();
+    }
+
+  private:
+
+    F m_factory;
+};
+
+/**
+ * @brief Creates a decode_context_factory from a function returning
+ * a std::tuple, for instance:
+ *
+ * engine.define("put", handler, provider_id, pool,
+ *     tl::decode_context([]() { return std::make_tuple(arena()); }));
+ *
+ * @param f Function called for each request to create its context.
+ */
+template <typename F>
+decode_context_factory<typename std::decay<F>::type> decode_context(F&& f) {
+    return decode_context_factory<typename std::decay<F>::type>(std::forward<F>(f));
+}
+
+namespace detail {
+
+struct empty_decode_context {
+    std::tuple<> operator()() const {
+        return std::tuple<>();
+    }
+};
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
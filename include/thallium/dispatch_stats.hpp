@@ -0,0 +1,42 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_DISPATCH_STATS_HPP
+#define __THALLIUM_DISPATCH_STATS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <margo.h>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Counters of the RPCs that a margo instance received
+ * but did not hand to their handler.
+ */
+class dispatch_stats {
+
+  public:
+
+    dispatch_stats(margo_instance_id) {}
+
+    dispatch_stats(const dispatch_stats&)            = delete;
+    dispatch_stats& operator=(const dispatch_stats&) = delete;
+
+    /**
+     * @brief Number of RPCs dropped because their deadline had passed.
+     */
+    std::atomic<uint64_t> m_expired{0};
+
+    void on_finalize() {}
+};
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
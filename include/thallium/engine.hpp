@@ -19,6 +19,19 @@
 #include <thallium/function_util.hpp>
 #include <thallium/logger.hpp>
 #include <thallium/margo_instance_ref.hpp>
+#include <thallium/self_dispatch.hpp>
+#include <thallium/handle_cache.hpp>
+#include <thallium/registration_cache.hpp>
+#include <thallium/address_cache.hpp>
+#include <thallium/dispatch_stats.hpp>
+#include <thallium/admission.hpp>
+#include <thallium/collective_policy.hpp>
+#include <thallium/compression.hpp>
+#include <thallium/decode_context.hpp>
+#include <thallium/rdma_offload.hpp>
+#include <thallium/rpc_registry.hpp>
+#include <thallium/instance_data.hpp>
+#include <typeinfo>
 #include <unordered_map>
 #include <vector>
 #include <memory>
@@ -31,7 +44,9 @@
 namespace thallium {
 
 class bulk;
+class bulk_segment;
 class endpoint;
+class exposed_container;
 class remote_bulk;
 class remote_procedure;
 class timed_callback;
@@ -41,11 +56,31 @@ using request = request_with_context<>;
 template <typename ... CtxArg> class proc_input_archive;
 template <typename ... CtxArg> class proc_output_archive;
 template <typename T> class provider;
+template <typename T> class reduction;
 class xstream;
 class pool;
 
 DECLARE_MARGO_RPC_HANDLER(thallium_generic_rpc)
 hg_return_t thallium_generic_rpc(hg_handle_t handle);
+DECLARE_MARGO_RPC_HANDLER(thallium_admission)
+DECLARE_MARGO_RPC_HANDLER(thallium_batch_rpc)
+hg_return_t thallium_batch_rpc(hg_handle_t handle);
+DECLARE_MARGO_RPC_HANDLER(thallium_collective_rpc)
+hg_return_t thallium_collective_rpc(hg_handle_t handle);
+DECLARE_MARGO_RPC_HANDLER(thallium_offload_ack_rpc)
+hg_return_t thallium_offload_ack_rpc(hg_handle_t handle);
+
+template <typename Signature> class rpc_signature;
+template <typename Signature> class typed_remote_procedure;
+
+namespace detail {
+hg_id_t register_batch_rpc(margo_instance_id mid);
+hg_id_t register_collective_rpc(margo_instance_id mid);
+bulk expose_uncached(margo_instance_id mid,
+                     const std::vector<std::pair<void*, size_t>>& segments,
+                     bulk_mode flag);
+template <typename Signature, typename Handler> struct typed_rpc;
+}
 
 /**
  * @brief The engine class is at the core of Thallium,
@@ -66,6 +101,14 @@ class engine : public margo_instance_ref {
     friend class timed_callback;
 
     friend hg_return_t thallium_generic_rpc(hg_handle_t handle);
+    friend hg_return_t thallium_admission_handler(hg_handle_t handle);
+    friend hg_return_t thallium_batch_rpc(hg_handle_t handle);
+    friend hg_return_t thallium_collective_rpc(hg_handle_t handle);
+    template <typename... T>
+    friend std::shared_ptr<detail::local_call>
+    detail::self_dispatch(margo_instance_id mid, hg_handle_t handle,
+                          uint16_t provider_id, std::tuple<T...>&& args);
+    template <typename Signature, typename Handler> friend struct detail::typed_rpc;
 
   private:
     using rpc_t = std::function<void(const request&)>;
@@ -76,9 +119,42 @@ class engine : public margo_instance_ref {
      * (namely, the initiating thallium engine and the function to call)
      */
     struct rpc_callback_data {
-        rpc_t m_function;
+        rpc_t                 m_function;
+        const std::type_info* m_input_type = nullptr; // argument tuple expected by m_function
+        ABT_pool              m_pool = ABT_POOL_NULL; // pool the RPC was registered with
+        uint16_t              m_provider_id = 0;
+        hg_id_t               m_id = 0; // id of the RPC (including its provider id)
+        std::shared_ptr<detail::admission_control> m_admission;
+        std::shared_ptr<detail::offload_state>     m_offload; // used to respond
+        // set for the header variant of an RPC (see detail::rpc_header),
+        // whose requests are handled with the data of the RPC itself
+        rpc_callback_data*    m_primary = nullptr;
+
+        rpc_callback_data() = default;
+        rpc_callback_data(const rpc_callback_data&) = delete;
+        rpc_callback_data& operator=(const rpc_callback_data&) = delete;
+
+        ~rpc_callback_data() {
+            detail::rpc_registry::remove(this);
+        }
+
+        /**
+         * @brief Returns the data of the RPC itself.
+         */
+        rpc_callback_data* primary() {
+            return m_primary ? m_primary : this;
+        }
     };
 
+    /**
+     * @brief Returns the data of the RPC defined by an engine with the
+     * provided id, or nullptr if there is no such RPC (e.g. the id is
+     * that of an RPC registered directly with margo, or of the header
+     * variant of an RPC). Used to resolve the ids received from the
+     * network (see detail::rpc_registry).
+     */
+    static rpc_callback_data* find_rpc(margo_instance_id mid, hg_id_t id);
+
     /**
      * @brief Function to call to free the data registered with an RPC.
      *
@@ -89,6 +165,59 @@ class engine : public margo_instance_ref {
         delete cb_data;
     }
 
+    /**
+     * @brief Decides, in the progress loop, whether a request received
+     * through Mercury is admitted. Rejected requests are answered with
+     * a busy response.
+     *
+     * @return false if the request was rejected.
+     */
+    static bool admit(hg_handle_t handle);
+
+    /**
+     * @brief Cancels the admission of a request whose handler ULT
+     * could not be created.
+     */
+    static void cancel_admission(hg_handle_t handle);
+
+    /**
+     * @brief Registers the header variant of an RPC (see
+     * detail::header_rpc_name()), whose id was returned by MARGO_REGISTER
+     * or MARGO_REGISTER_PROVIDER, with data pointing to that of the RPC,
+     * and adds the data of the RPC to the detail::rpc_registry.
+     */
+    void register_header_variant(hg_id_t header_id, rpc_callback_data* primary);
+
+    /**
+     * @brief Runs a request received through Mercury: waits for an
+     * execution slot, then calls invoke with the data registered with
+     * the RPC and the request. The request's rpc_header, if any, is
+     * read along with its arguments (see request::decode_input()).
+     */
+    template <typename F>
+    static void handle_rpc(hg_handle_t handle, F&& invoke);
+
+    /**
+     * @brief Decodes the arguments of a request into a tuple of type
+     * Input, using the context created by make_context, and passes
+     * it to call. The arguments of a self-dispatched request are
+     * passed as they are. Requests whose caller gave up are dropped,
+     * and requests whose arguments cannot be decoded get an error
+     * response.
+     */
+    template <typename Input, typename F, typename Call>
+    static hg_return_t decode_and_call(const request& r, const F& make_context,
+                                       Call&& call);
+
+    /**
+     * @brief Checks the result of decoding the arguments of a request,
+     * dropping the request if its caller gave up and sending an error
+     * response if they could not be decoded.
+     *
+     * @return HG_SUCCESS if the handler can be called.
+     */
+    static hg_return_t check_input(const request& r, hg_return_t ret);
+
     static void finalize_callback_wrapper(void* arg) {
         auto cb = static_cast<finalize_callback_t*>(arg);
         (*cb)();
@@ -238,6 +367,9 @@ class engine : public margo_instance_ref {
 
     /**
      * @brief Finalize the engine. Can be called by any thread.
+     * Continuations registered with then() on operations that have
+     * not completed yet are cancelled right away (their error callback
+     * is invoked), while those already running are waited for.
      */
     void finalize() {
         MARGO_INSTANCE_MUST_BE_VALID;
@@ -330,6 +462,47 @@ class engine : public margo_instance_ref {
            std::function<void(const request&, A1, Args...)>&& fun,
            uint16_t provider_id = 0);
 
+    /**
+     * @brief Same as above, decoding the arguments of each request with
+     * the serialization context created by the provided factory (see
+     * decode_context()). Serialization functions of the argument types
+     * access it via ar.get_context(), e.g. to allocate from an arena.
+     *
+     * @tparam F Type of the function creating the context.
+     * @param name Name of the RPC.
+     * @param fun Function to associate with the RPC.
+     * @param provider_id ID of the provider registering this RPC.
+     * @param pool Argobots pool to use when receiving this type of RPC.
+     * @param ctx Factory of the context, called once per request.
+     *
+     * @return a remote_procedure object.
+     */
+    template <typename F, typename A1, typename... Args>
+    remote_procedure
+    define(const std::string&                                 name,
+           std::function<void(const request&, A1, Args...)>&& fun,
+           uint16_t provider_id, const pool& p,
+           const decode_context_factory<F>& ctx);
+
+    template <typename F, typename A1, typename... Args>
+    remote_procedure
+    define(const std::string&                                 name,
+           std::function<void(const request&, A1, Args...)>&& fun,
+           uint16_t provider_id, const decode_context_factory<F>& ctx);
+
+    template <typename F, typename A1, typename... Args>
+    remote_procedure
+    define(const std::string&                                      name,
+           const std::function<void(const request&, A1, Args...)>& fun,
+           uint16_t provider_id, const pool& p,
+           const decode_context_factory<F>& ctx);
+
+    template <typename F, typename A1, typename... Args>
+    remote_procedure
+    define(const std::string&                                      name,
+           const std::function<void(const request&, A1, Args...)>& fun,
+           uint16_t provider_id, const decode_context_factory<F>& ctx);
+
     template <typename Func, typename ... Extra>
     typename std::enable_if<
         !is_std_function_object<typename std::decay<Func>::type>::value
@@ -347,6 +520,22 @@ class engine : public margo_instance_ref {
                             const std::function<void(const request&)>& fun,
                             uint16_t provider_id = 0);
 
+    /**
+     * @brief Overloads for RPCs without arguments, for which the decode
+     * context is not used (provided for generic code).
+     */
+    template <typename F>
+    remote_procedure define(const std::string&                         name,
+                            const std::function<void(const request&)>& fun,
+                            uint16_t provider_id, const pool& p,
+                            const decode_context_factory<F>& ctx);
+
+    template <typename F>
+    remote_procedure define(const std::string&                         name,
+                            const std::function<void(const request&)>& fun,
+                            uint16_t provider_id,
+                            const decode_context_factory<F>& ctx);
+
     /**
      * @brief Defines an RPC with a name and a function pointer
      * to call when the RPC is received.
@@ -369,6 +558,78 @@ class engine : public margo_instance_ref {
                             void (*f)(const request&, Args...),
                             uint16_t provider_id = 0);
 
+    /**
+     * @brief Defines an RPC from a signature shared by its clients and
+     * servers (see rpc_signature). The handler is called with the
+     * arguments of the RPC and returns its result, which is sent back
+     * automatically. Each handler type gets its own Mercury callback,
+     * which calls it without going through an std::function.
+     *
+     * @param sig Signature of the RPC.
+     * @param handler Function taking Args... and returning R.
+     * @param provider_id ID of the provider registering this RPC.
+     * @param p Argobots pool to use when receiving this type of RPC.
+     *
+     * @return a typed_remote_procedure object.
+     */
+    template <typename R, typename... Args, typename F>
+    typed_remote_procedure<R(Args...)>
+    define(const rpc_signature<R(Args...)>& sig, F&& handler,
+           uint16_t provider_id, const pool& p);
+
+    template <typename R, typename... Args, typename F>
+    typed_remote_procedure<R(Args...)>
+    define(const rpc_signature<R(Args...)>& sig, F&& handler,
+           uint16_t provider_id = 0);
+
+    /**
+     * @brief Defines an RPC from its signature without providing
+     * a handler (used on clients).
+     *
+     * @param sig Signature of the RPC.
+     *
+     * @return a typed_remote_procedure object.
+     */
+    template <typename R, typename... Args>
+    typed_remote_procedure<R(Args...)>
+    define(const rpc_signature<R(Args...)>& sig);
+
+    /**
+     * @brief Defines a reduction operation for remote_procedure::reduce().
+     * All the engines taking part in a reduction must define it with the
+     * same name, since intermediate nodes of the tree combine the
+     * responses of their subtree before sending them up.
+     *
+     * @tparam T Type of the values reduced (the type of the responses).
+     * @tparam F Type of the operation.
+     * @param name Name of the reduction.
+     * @param op Associative operation combining two values of type T
+     * into a value of type T.
+     *
+     * @return a reduction object to pass to remote_procedure::reduce().
+     */
+    template <typename T, typename F>
+    reduction<T> define_reduction(const std::string& name, F&& op);
+
+    /**
+     * @brief Lets this engine take part in the broadcasts and reductions
+     * (see remote_procedure::broadcast()) of other processes: calls for
+     * the RPCs it defined are accepted, and forwarded to the other
+     * targets of the engine's subtree as allowed by the policy. Engines
+     * that did not call this function refuse collectives, which count
+     * as failed on them and on their subtree.
+     *
+     * @param policy Limits on the targets and arity of the collectives.
+     */
+    void enable_collectives(const collective_policy& policy = collective_policy());
+
+    /**
+     * @brief Lets this engine accept the batches of calls sent by an
+     * rpc_batcher. Engines that did not call this function refuse the
+     * calls of the batches they receive, which get an error status.
+     */
+    void enable_batching();
+
     /**
      * @brief Lookup an address and returns an endpoint object
      * to communicate with this address.
@@ -379,6 +640,65 @@ class engine : public margo_instance_ref {
      */
     endpoint lookup(const std::string& address) const;
 
+    /**
+     * @brief Looks up a series of addresses concurrently, each in its own
+     * ULT, and returns the corresponding endpoints (in the same order).
+     * If any of the lookups fails, an exception is thrown after all the
+     * lookups have completed.
+     *
+     * @param addresses String representations of the addresses.
+     * @param p Pool in which to run the lookups
+     * (defaults to the engine's handler pool).
+     *
+     * @return a vector of endpoints.
+     */
+    std::vector<endpoint> lookup_many(const std::vector<std::string>& addresses) const;
+    std::vector<endpoint> lookup_many(const std::vector<std::string>& addresses,
+                                      const pool& p) const;
+
+    /**
+     * @brief Enables or disables the cache of looked up addresses.
+     * When enabled, lookup() and lookup_many() resolve each address string
+     * only once and return copies of the resulting address afterwards,
+     * until the address is invalidated (for instance after the peer at
+     * this address failed and was restarted). Disabling the cache clears it.
+     * The cache is shared by all the engine objects referring to the same
+     * margo instance, and is disabled by default.
+     *
+     * @param enable Whether to enable the cache.
+     */
+    void enable_lookup_cache(bool enable = true) {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        detail::get_instance_data<detail::address_cache>(m_mid)->set_enabled(enable);
+    }
+
+    /**
+     * @brief Returns whether the cache of looked up addresses is enabled.
+     */
+    bool lookup_cache_enabled() const {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        return detail::get_instance_data<detail::address_cache>(m_mid)->enabled();
+    }
+
+    /**
+     * @brief Removes an address from the cache of looked up addresses,
+     * so that the next lookup of this address calls margo_addr_lookup.
+     *
+     * @param address String representation of the address.
+     */
+    void invalidate_lookup_cache(const std::string& address) {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        detail::get_instance_data<detail::address_cache>(m_mid)->invalidate(address);
+    }
+
+    /**
+     * @brief Removes all the addresses from the cache of looked up addresses.
+     */
+    void invalidate_lookup_cache() {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        detail::get_instance_data<detail::address_cache>(m_mid)->clear();
+    }
+
     /**
      * @brief Exposes a series of memory segments for bulk operations.
      *
@@ -430,6 +750,41 @@ class engine : public margo_instance_ref {
 
 #endif
 
+    /**
+     * @brief Exposes a single memory region for bulk operations, reusing
+     * a cached registration that contains it if the registration cache is
+     * enabled (see set_registration_cache_size()), in which case the
+     * returned segment may be a part of a larger bulk object. With the
+     * cache disabled, this is equivalent to calling expose() and selecting
+     * the whole bulk object.
+     *
+     * @param ptr Address of the region.
+     * @param size Size of the region.
+     * @param flag indicates whether the bulk is read-write, read-only or
+     * write-only.
+     *
+     * @return a bulk_segment representing the memory exposed for RDMA.
+     */
+    bulk_segment expose_cached(void* ptr, size_t size, bulk_mode flag);
+
+    /**
+     * @brief Exposes the elements of a container of contiguous ranges
+     * (e.g. a std::vector<std::string> or a std::vector<std::vector<T>>)
+     * as the segments of a single bulk object. The returned object also
+     * carries the size of each element, so that the receiver can shape
+     * its own container and pull all the elements at once with
+     * exposed_container::pull_to().
+     *
+     * @tparam C Type of container.
+     * @param container Container to expose.
+     * @param flag indicates whether the bulk is read-write, read-only or
+     * write-only.
+     *
+     * @return an exposed_container that can be sent over RPC.
+     */
+    template <typename C>
+    exposed_container expose_container(C& container, bulk_mode flag);
+
     /**
      * @brief Creates a bulk object from an hg_bulk_t handle. The user
      * is still responsible for calling margo_bulk_free or HG_Bulk_free
@@ -1037,6 +1392,181 @@ class engine : public margo_instance_ref {
             throw exception("Cannot set engine log level");
         }
     }
+
+    /**
+     * @brief Sets the maximum number of idle hg_handle_t the engine keeps
+     * for reuse. When enabled, the handle of a callable_remote_procedure
+     * (and of the async_response objects created from it) is not destroyed
+     * when the last of them goes away, but kept in a cache and reset with
+     * HG_Reset by the next call to remote_procedure::on(), avoiding the cost
+     * of margo_create in loops such as rpc.on(ep)(args). Idle handles keep
+     * a reference to their address. They are destroyed when the engine is
+     * finalized. The cache is shared by all the engine objects referring to
+     * the same margo instance, and is disabled (size 0) by default.
+     *
+     * @param max_handles Maximum number of idle handles (0 to disable).
+     */
+    void set_handle_cache_size(size_t max_handles) {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        detail::get_instance_data<detail::handle_cache>(m_mid)->set_capacity(max_handles);
+    }
+
+    /**
+     * @brief Returns the maximum number of idle hg_handle_t
+     * the engine keeps for reuse.
+     */
+    size_t get_handle_cache_size() const {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        return detail::get_instance_data<detail::handle_cache>(m_mid)->capacity();
+    }
+
+    /**
+     * @brief Sets the maximum number of memory registrations the engine
+     * keeps for reuse. When enabled, exposing a single region with expose()
+     * returns the cached registration of the same region and mode if any,
+     * sharing its hg_bulk_t (whose reference count is incremented) instead
+     * of registering the memory again, and expose_cached() also serves the
+     * regions contained in a cached registration. Registrations are evicted
+     * in least recently used order, and must be invalidated with
+     * invalidate_registrations() before the memory they cover is freed.
+     * The cache is shared by all the engine objects referring to the same
+     * margo instance, and is disabled (size 0) by default. The memory that
+     * thallium exposes itself (bulk_pool, exposed_container, compressed_bulk
+     * and staging buffers) is never cached.
+     *
+     * @param max_registrations Maximum number of cached registrations
+     * (0 to disable).
+     */
+    void set_registration_cache_size(size_t max_registrations) {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        detail::get_instance_data<detail::registration_cache>(m_mid)
+            ->set_capacity(max_registrations);
+    }
+
+    /**
+     * @brief Returns the maximum number of memory registrations
+     * the engine keeps for reuse.
+     */
+    size_t get_registration_cache_size() const {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        return detail::get_instance_data<detail::registration_cache>(m_mid)->capacity();
+    }
+
+    /**
+     * @brief Removes the cached registrations overlapping the provided
+     * region from the registration cache. This must be called before
+     * freeing memory that may have been exposed while the cache was
+     * enabled. Bulk objects already created from these registrations
+     * remain valid until destroyed.
+     */
+    void invalidate_registrations(const void* ptr, size_t size) {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        detail::get_instance_data<detail::registration_cache>(m_mid)->invalidate(ptr, size);
+    }
+
+    /**
+     * @brief Returns the hits, misses and evictions of the
+     * registration cache.
+     */
+    registration_cache_stats get_registration_cache_stats() const {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        return detail::get_instance_data<detail::registration_cache>(m_mid)->stats();
+    }
+
+    /**
+     * @brief Returns the number of RPCs received by this engine that were
+     * dropped without running their handler because the deadline set by
+     * their caller (see callable_remote_procedure::timed() and
+     * remote_procedure::enable_deadline_propagation()) had passed.
+     */
+    uint64_t get_expired_request_count() const {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        return detail::get_instance_data<detail::dispatch_stats>(m_mid)->m_expired.load();
+    }
+
+    /**
+     * @brief Sets the admission limits shared by all the RPCs defined
+     * with the provided provider id. The limits are checked by the
+     * progress loop when a request is received, before a ULT is created
+     * for it; requests exceeding them are rejected and their caller gets
+     * a busy exception (or nothing, if it disabled responses; callers that
+     * are not thallium clients get HG_BUSY as the return code of the RPC,
+     * see admission_limits). Limits can also be set for individual RPCs
+     * (see remote_procedure::set_admission_limits()), in which case a
+     * request must satisfy both. Calls received within a batch or a
+     * collective are subject to the limits as well; a rejected call of a
+     * collective counts as a failed target.
+     *
+     * @param provider_id Provider id.
+     * @param limits Limits (0 for unlimited).
+     */
+    void set_admission_limits(uint16_t provider_id, const admission_limits& limits) {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        detail::get_instance_data<detail::admission_control>(m_mid)
+            ->set_provider_limits(provider_id, limits);
+    }
+
+    /**
+     * @brief Returns the admission counters of the provided provider id
+     * (all zeros if no limits were set for it).
+     */
+    admission_stats get_admission_stats(uint16_t provider_id) const {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        return detail::get_instance_data<detail::admission_control>(m_mid)
+            ->provider_stats(provider_id);
+    }
+
+    /**
+     * @brief Sets the size (in bytes) from which contiguous containers
+     * (std::vector of arithmetic or bitwise-serializable types and
+     * std::string) passed as RPC arguments or responses are not
+     * copied into the RPC buffer: the sender exposes their memory and the
+     * receiver pulls it with RDMA while deserializing. The threshold
+     * applies to the data this engine sends. Responses are only offloaded
+     * for the calls that carry a header (calls propagating their deadline,
+     * compressed calls, and calls to RPCs accepting busy replies), since
+     * the others expect the wire format of plain margo responses; RPC
+     * arguments are offloaded to any thallium server.
+     *
+     * The offloaded containers of a response are copied once, and the
+     * copies stay exposed until the client has pulled them, or until the
+     * acknowledgement timeout expires, so respond() does not wait for the
+     * client.
+     * Arguments of RPCs that disabled responses, of batched, collective
+     * or self-dispatched calls are never offloaded.
+     *
+     * @param threshold_bytes Threshold in bytes (0 disables offloading).
+     * @param ack_timeout_ms Time after which the offloaded containers of
+     * a response are released if the client has not pulled them.
+     */
+    void set_rdma_offload_threshold(size_t threshold_bytes,
+                                    double ack_timeout_ms = 30000.0) {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        detail::get_instance_data<detail::offload_state>(m_mid)
+            ->configure(threshold_bytes, ack_timeout_ms);
+    }
+
+    /**
+     * @brief Returns the RDMA offload threshold (0 if disabled).
+     */
+    size_t get_rdma_offload_threshold() const {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        return detail::get_instance_data<detail::offload_state>(m_mid)->threshold();
+    }
+
+    /**
+     * @brief Registers a codec with which this engine can decompress the
+     * arguments of the RPCs it receives (see
+     * remote_procedure::set_compression()) and the data of the
+     * compressed_bulk objects it pulls. The built-in lz_codec is always
+     * registered. A codec registered with the id of another replaces it.
+     *
+     * @param c Codec.
+     */
+    void register_codec(std::shared_ptr<const codec> c) {
+        MARGO_INSTANCE_MUST_BE_VALID;
+        detail::get_instance_data<detail::codec_registry>(m_mid)->add(std::move(c));
+    }
 };
 
 } // namespace thallium
@@ -1045,12 +1575,16 @@ class engine : public margo_instance_ref {
 #include <thallium/request.hpp>
 #include <thallium/proc_object.hpp>
 #include <thallium/pool.hpp>
+#include <thallium/eventual.hpp>
 #include <thallium/xstream.hpp>
 #include <thallium/remote_procedure.hpp>
 #include <thallium/timed_callback.hpp>
+#include <thallium/collective.hpp>
 #include <thallium/serialization/proc_input_archive.hpp>
 #include <thallium/serialization/proc_output_archive.hpp>
 #include <thallium/serialization/stl/tuple.hpp>
+#include <thallium/typed_rpc.hpp>
+#include <thallium/exposed_container.hpp>
 
 namespace thallium {
 
@@ -1071,38 +1605,86 @@ remote_procedure
 engine::define(const std::string&                               name,
                std::function<void(const request&, T1, Tn...)>&& fun,
                uint16_t provider_id, const pool& p) {
+    return define(name, std::move(fun), provider_id, p,
+                  decode_context(detail::empty_decode_context()));
+}
+
+template <typename F, typename T1, typename... Tn>
+remote_procedure
+engine::define(const std::string&                               name,
+               std::function<void(const request&, T1, Tn...)>&& fun,
+               uint16_t provider_id, const pool& p,
+               const decode_context_factory<F>& ctx) {
     MARGO_INSTANCE_MUST_BE_VALID;
     hg_id_t id = MARGO_REGISTER_PROVIDER(
         m_mid, name.c_str(), meta_serialization, meta_serialization,
-        thallium_generic_rpc, provider_id, p.native_handle());
+        thallium_admission, provider_id, p.native_handle());
+
+    using input_type = std::tuple<typename std::decay<T1>::type,
+                                  typename std::decay<Tn>::type...>;
 
     rpc_callback_data* cb_data = new rpc_callback_data;
+    cb_data->m_input_type  = &typeid(input_type);
+    cb_data->m_pool        = p.native_handle();
+    cb_data->m_provider_id = provider_id;
+    cb_data->m_id          = id;
+    cb_data->m_admission   = detail::get_instance_data<detail::admission_control>(m_mid);
+    cb_data->m_offload     = detail::get_instance_data<detail::offload_state>(m_mid);
     cb_data->m_function =
-        [fun=std::move(fun), mid=get_margo_instance()](const request& r) {
-            std::function<void(T1, Tn...)> call_function =
-                [&fun, &r](const T1& a1, const Tn&... args) {
-                    fun(r, a1, args...);
-                };
-                std::tuple<typename std::decay<T1>::type,
-                   typename std::decay<Tn>::type...> iargs;
-            meta_proc_fn mproc = [mid, &iargs](hg_proc_t proc) {
-                auto ctx = std::tuple<>(); // TODO make this context available as argument
-                return proc_object_decode(proc, iargs, mid, ctx);
-            };
-            hg_return_t ret = margo_get_input(r.m_handle, &mproc);
-            if(ret != HG_SUCCESS)
-                return ret;
-            ret = margo_free_input(r.m_handle, &mproc);
-            if(ret != HG_SUCCESS)
-                return ret;
-            apply_function_to_tuple(call_function, iargs);
-            return HG_SUCCESS;
+        [fun=std::move(fun), make_context=ctx](const request& r) {
+            // arguments are moved into by-value parameters of fun
+            // and passed by reference to reference parameters
+            return decode_and_call<input_type>(r, make_context,
+                [&fun, &r](input_type& args) {
+                    detail::apply_forwarding<T1, Tn...>(fun, args, r);
+                });
         };
 
     auto ret = margo_register_data(m_mid, id, (void*)cb_data, free_rpc_callback_data);
     MARGO_ASSERT(ret, margo_register_data);
 
-    return remote_procedure(m_mid, id);
+    hg_id_t header_id = MARGO_REGISTER_PROVIDER(
+        m_mid, detail::header_rpc_name(name).c_str(), meta_serialization,
+        meta_serialization, thallium_admission, provider_id, p.native_handle());
+    register_header_variant(header_id, cb_data);
+
+    return remote_procedure(m_mid, id, header_id);
+}
+
+template <typename Input, typename F, typename Call>
+hg_return_t engine::decode_and_call(const request& r, const F& make_context,
+                                    Call&& call) {
+    if(r.m_local) {
+        // self-dispatched call, arguments were type-checked
+        // by detail::self_dispatch and copied for this handler
+        call(*r.m_local->m_input.template get<Input>());
+        return HG_SUCCESS;
+    }
+    margo_instance_id mid = r.m_mid;
+    // the context is declared first so that it outlives the arguments
+    auto  ctx = make_context();
+    Input iargs;
+    hg_addr_t origin = detail::handle_origin(r.m_handle);
+    meta_proc_fn mproc = [mid, &iargs, &ctx, origin](hg_proc_t proc) {
+        return proc_object_decode(proc, iargs, mid, ctx, origin);
+    };
+    hg_return_t ret = check_input(r, r.decode_input(mproc));
+    if(ret != HG_SUCCESS)
+        return ret;
+    call(iargs);
+    return HG_SUCCESS;
+}
+
+inline hg_return_t engine::check_input(const request& r, hg_return_t ret) {
+    if(ret == HG_SUCCESS && r.expired())
+        ret = HG_TIMEOUT; // the caller gave up while the arguments were decoded
+    if(ret == HG_TIMEOUT) {
+        detail::get_instance_data<detail::dispatch_stats>(r.m_mid)->m_expired++;
+    } else if(ret != HG_SUCCESS) {
+        // the caller gets an error rather than waiting for a response
+        r.respond_error();
+    }
+    return ret;
 }
 
 template <typename T1, typename... Tn>
@@ -1113,6 +1695,33 @@ engine::define(const std::string&                               name,
     return define(name, std::move(fun), provider_id, pool());
 }
 
+template <typename F, typename T1, typename... Tn>
+remote_procedure
+engine::define(const std::string&                               name,
+               std::function<void(const request&, T1, Tn...)>&& fun,
+               uint16_t provider_id, const decode_context_factory<F>& ctx) {
+    return define(name, std::move(fun), provider_id, pool(), ctx);
+}
+
+template <typename F, typename T1, typename... Tn>
+remote_procedure
+engine::define(const std::string&                                    name,
+               const std::function<void(const request&, T1, Tn...)>& fun,
+               uint16_t provider_id, const pool& p,
+               const decode_context_factory<F>& ctx) {
+    return define(name, std::function<void(const request&, T1, Tn...)>(fun),
+                  provider_id, p, ctx);
+}
+
+template <typename F, typename T1, typename... Tn>
+remote_procedure
+engine::define(const std::string&                                    name,
+               const std::function<void(const request&, T1, Tn...)>& fun,
+               uint16_t provider_id, const decode_context_factory<F>& ctx) {
+    return define(name, std::function<void(const request&, T1, Tn...)>(fun),
+                  provider_id, pool(), ctx);
+}
+
 template <typename T1, typename... Tn>
 remote_procedure
 engine::define(const std::string&                                    name,
@@ -1147,6 +1756,40 @@ remote_procedure engine::define(const std::string& name,
                   provider_id, pool());
 }
 
+template <typename T, typename F>
+reduction<T> engine::define_reduction(const std::string& name, F&& op) {
+    MARGO_INSTANCE_MUST_BE_VALID;
+    margo_instance_id mid = m_mid;
+    detail::reduction_fn fn =
+        [mid, op = std::forward<F>(op)](const std::vector<char>& a,
+                                        const std::vector<char>& b,
+                                        std::vector<char>& out) {
+            std::tuple<T> lhs, rhs;
+            hg_return_t ret = detail::decode_collective_value(mid, a, lhs);
+            if(ret != HG_SUCCESS)
+                return ret;
+            ret = detail::decode_collective_value(mid, b, rhs);
+            if(ret != HG_SUCCESS)
+                return ret;
+            T result = op(std::get<0>(lhs), std::get<0>(rhs));
+            return detail::encode_collective_value(mid, result, out);
+        };
+    detail::get_instance_data<detail::reduction_registry>(m_mid)->add(name, std::move(fn));
+    return reduction<T>(name);
+}
+
+inline void engine::enable_collectives(const collective_policy& policy) {
+    MARGO_INSTANCE_MUST_BE_VALID;
+    detail::get_instance_data<detail::collective_control>(m_mid)->enable(policy);
+    detail::register_collective_rpc(m_mid);
+}
+
+inline void engine::enable_batching() {
+    MARGO_INSTANCE_MUST_BE_VALID;
+    detail::get_instance_data<detail::batch_control>(m_mid)->enable();
+    detail::register_batch_rpc(m_mid);
+}
+
 inline remote_procedure engine::define(const std::string& name) {
     return define(name.c_str());
 }
@@ -1154,12 +1797,18 @@ inline remote_procedure engine::define(const std::string& name) {
 inline remote_procedure engine::define(const char* name) {
     MARGO_INSTANCE_MUST_BE_VALID;
     hg_bool_t flag;
-    hg_id_t   id;
+    hg_id_t   id, header_id;
     margo_registered_name(m_mid, name, &id, &flag);
     if(flag == HG_FALSE) {
         id = MARGO_REGISTER(m_mid, name, meta_serialization, meta_serialization, NULL);
     }
-    return remote_procedure(m_mid, id);
+    std::string header_name = detail::header_rpc_name(name);
+    margo_registered_name(m_mid, header_name.c_str(), &header_id, &flag);
+    if(flag == HG_FALSE) {
+        header_id = MARGO_REGISTER(m_mid, header_name.c_str(), meta_serialization,
+                                   meta_serialization, NULL);
+    }
+    return remote_procedure(m_mid, id, header_id);
 }
 
 inline remote_procedure engine::define(const std::string&                         name,
@@ -1168,16 +1817,58 @@ inline remote_procedure engine::define(const std::string&
     MARGO_INSTANCE_MUST_BE_VALID;
     hg_id_t id = MARGO_REGISTER_PROVIDER(
         m_mid, name.c_str(), meta_serialization, meta_serialization,
-        thallium_generic_rpc, provider_id, p.native_handle());
-
-    auto* cb_data       = new rpc_callback_data;
-    cb_data->m_function = fun;
+        thallium_admission, provider_id, p.native_handle());
+
+    auto* cb_data          = new rpc_callback_data;
+    cb_data->m_function    = [fun](const request& r) {
+        if(r.m_has_header) {
+            // reads the header to drop the request if its caller gave up
+            std::tuple<> ctx;
+            meta_proc_fn mproc = [&ctx](hg_proc_t proc) {
+                return proc_void_object(proc, ctx);
+            };
+            if(check_input(r, r.decode_input(mproc)) != HG_SUCCESS)
+                return;
+        }
+        fun(r);
+    };
+    cb_data->m_input_type  = &typeid(std::tuple<>);
+    cb_data->m_pool        = p.native_handle();
+    cb_data->m_provider_id = provider_id;
+    cb_data->m_id          = id;
+    cb_data->m_admission   = detail::get_instance_data<detail::admission_control>(m_mid);
+    cb_data->m_offload     = detail::get_instance_data<detail::offload_state>(m_mid);
 
     hg_return_t ret =
         margo_register_data(m_mid, id, (void*)cb_data, free_rpc_callback_data);
     MARGO_ASSERT(ret, margo_register_data);
 
-    return remote_procedure(m_mid, id);
+    hg_id_t header_id = MARGO_REGISTER_PROVIDER(
+        m_mid, detail::header_rpc_name(name).c_str(), meta_serialization,
+        meta_serialization, thallium_admission, provider_id, p.native_handle());
+    register_header_variant(header_id, cb_data);
+
+    return remote_procedure(m_mid, id, header_id);
+}
+
+inline void engine::register_header_variant(hg_id_t header_id, rpc_callback_data* primary) {
+    auto* cb_data      = new rpc_callback_data;
+    cb_data->m_primary = primary;
+    hg_return_t ret =
+        margo_register_data(m_mid, header_id, (void*)cb_data, free_rpc_callback_data);
+    MARGO_ASSERT(ret, margo_register_data);
+    detail::rpc_registry::add(primary);
+}
+
+inline engine::rpc_callback_data* engine::find_rpc(margo_instance_id mid, hg_id_t id) {
+    hg_bool_t flag = HG_FALSE;
+    if(HG_Registered(margo_get_class(mid), id, &flag) != HG_SUCCESS
+    || flag == HG_FALSE)
+        return nullptr;
+    void* data = margo_registered_data(mid, id);
+    if(!detail::rpc_registry::contains(data))
+        return nullptr;
+    return static_cast<rpc_callback_data*>(data)->primary();
 }
 
 inline remote_procedure engine::define(const std::string&                         name,
@@ -1186,14 +1877,62 @@ inline remote_procedure engine::define(const std::string&
     return define(name, fun, provider_id, pool());
 }
 
+template <typename F>
+remote_procedure engine::define(const std::string&                         name,
+                                const std::function<void(const request&)>& fun,
+                                uint16_t provider_id, const pool& p,
+                                const decode_context_factory<F>& ctx) {
+    (void)ctx;
+    return define(name, fun, provider_id, p);
+}
+
+template <typename F>
+remote_procedure engine::define(const std::string&                         name,
+                                const std::function<void(const request&)>& fun,
+                                uint16_t provider_id,
+                                const decode_context_factory<F>& ctx) {
+    (void)ctx;
+    return define(name, fun, provider_id, pool());
+}
+
 inline endpoint engine::lookup(const std::string& address) const {
     MARGO_INSTANCE_MUST_BE_VALID;
     hg_addr_t   addr;
-    hg_return_t ret = margo_addr_lookup(m_mid, address.c_str(), &addr);
+    hg_return_t ret = detail::get_instance_data<detail::address_cache>(m_mid)
+                        ->lookup(address, &addr);
     MARGO_ASSERT(ret, margo_addr_lookup);
     return endpoint(m_mid, addr);
 }
 
+inline std::vector<endpoint>
+engine::lookup_many(const std::vector<std::string>& addresses) const {
+    return lookup_many(addresses, get_handler_pool());
+}
+
+inline std::vector<endpoint>
+engine::lookup_many(const std::vector<std::string>& addresses, const pool& p) const {
+    MARGO_INSTANCE_MUST_BE_VALID;
+    auto cache = detail::get_instance_data<detail::address_cache>(m_mid);
+    std::vector<hg_addr_t>       addrs(addresses.size(), HG_ADDR_NULL);
+    std::vector<hg_return_t>     rets(addresses.size(), HG_SUCCESS);
+    std::vector<managed<thread>> ults;
+    ults.reserve(addresses.size());
+    pool target = p;
+    for(size_t i = 0; i < addresses.size(); i++) {
+        ults.push_back(target.make_thread([&, i]() {
+            rets[i] = cache->lookup(addresses[i], &addrs[i]);
+        }));
+    }
+    for(auto& ult : ults) ult->join();
+    std::vector<endpoint> result;
+    result.reserve(addresses.size());
+    for(size_t i = 0; i < addresses.size(); i++)
+        result.push_back(endpoint(m_mid, rets[i] == HG_SUCCESS ? addrs[i] : HG_ADDR_NULL));
+    for(auto ret : rets)
+        MARGO_ASSERT(ret, margo_addr_lookup);
+    return result;
+}
+
 inline endpoint engine::self() const {
     MARGO_INSTANCE_MUST_BE_VALID;
     hg_addr_t   self_addr;
@@ -1205,6 +1944,16 @@ inline endpoint engine::self() const {
 inline bulk engine::expose(unsigned count, void** ptrs, size_t* sizes,
                            bulk_mode flag) {
     MARGO_INSTANCE_MUST_BE_VALID;
+    std::shared_ptr<detail::registration_cache> cache;
+    if(count == 1 && detail::registration_cache::any_enabled()) {
+        cache = detail::get_instance_data<detail::registration_cache>(m_mid);
+        size_t    offset = 0;
+        hg_bulk_t cached = cache->capacity() == 0 ? HG_BULK_NULL
+                         : cache->find(ptrs[0], sizes[0], static_cast<hg_uint32_t>(flag),
+                                       true, offset);
+        if(cached != HG_BULK_NULL)
+            return bulk(m_mid, cached, true);
+    }
     std::vector<hg_size_t> hg_sizes;
     hg_size_t* hg_sizes_ptr = nullptr;
     if(sizeof(size_t*) != sizeof(hg_size_t)) {
@@ -1219,9 +1968,62 @@ inline bulk engine::expose(unsigned count, void** ptrs, size_t* sizes,
         m_mid, count, ptrs, hg_sizes_ptr,
         static_cast<hg_uint32_t>(flag), &handle);
     MARGO_ASSERT(ret, margo_bulk_create);
+    if(cache && cache->capacity() != 0)
+        cache->insert(ptrs[0], sizes[0], static_cast<hg_uint32_t>(flag), handle);
     return bulk(m_mid, handle, true);
 }
 
+inline bulk_segment engine::expose_cached(void* ptr, size_t size, bulk_mode flag) {
+    MARGO_INSTANCE_MUST_BE_VALID;
+    std::shared_ptr<detail::registration_cache> cache;
+    if(detail::registration_cache::any_enabled())
+        cache = detail::get_instance_data<detail::registration_cache>(m_mid);
+    if(cache && cache->capacity() != 0) {
+        size_t    offset = 0;
+        hg_bulk_t cached = cache->find(ptr, size, static_cast<hg_uint32_t>(flag),
+                                       false, offset);
+        if(cached != HG_BULK_NULL)
+            return bulk(m_mid, cached, true).select(offset, size);
+    }
+    hg_size_t   hg_size = size;
+    hg_bulk_t   handle;
+    hg_return_t ret = margo_bulk_create(
+        m_mid, 1, &ptr, &hg_size, static_cast<hg_uint32_t>(flag), &handle);
+    MARGO_ASSERT(ret, margo_bulk_create);
+    if(cache && cache->capacity() != 0)
+        cache->insert(ptr, size, static_cast<hg_uint32_t>(flag), handle);
+    return bulk(m_mid, handle, true).select(0, size);
+}
+
+namespace detail {
+
+/**
+ * @brief Exposes memory without going through the registration cache.
+ * Used for the buffers that thallium allocates and frees itself (staging
+ * buffers, pools) and for memory it exposes on behalf of the user for a
+ * single transfer, neither of which may be left in the cache.
+ */
+inline bulk expose_uncached(margo_instance_id mid,
+                            const std::vector<std::pair<void*, size_t>>& segments,
+                            bulk_mode flag) {
+    std::vector<void*>     ptrs(segments.size());
+    std::vector<hg_size_t> sizes(segments.size());
+    for(size_t i = 0; i < segments.size(); i++) {
+        ptrs[i]  = segments[i].first;
+        sizes[i] = segments[i].second;
+    }
+    hg_bulk_t   handle = HG_BULK_NULL;
+    hg_return_t ret    = margo_bulk_create(mid, static_cast<uint32_t>(segments.size()),
+                                           ptrs.data(), sizes.data(),
+                                           static_cast<hg_uint32_t>(flag), &handle);
+    MARGO_ASSERT(ret, margo_bulk_create);
+    bulk result = engine(mid).wrap(handle, true);
+    margo_bulk_free(handle);
+    return result;
+}
+
+} // namespace detail
+
 inline bulk engine::expose(const std::vector<std::pair<void*, size_t>>& segments,
                            bulk_mode                                    flag) {
     MARGO_INSTANCE_MUST_BE_VALID;
@@ -1510,7 +2312,8 @@ inline timed_callback engine::create_timed_callback(F&& cb) const {
     return timed_callback(*this, std::forward<F>(cb));
 }
 
-inline hg_return_t thallium_generic_rpc(hg_handle_t handle) {
+template <typename F>
+void engine::handle_rpc(hg_handle_t handle, F&& invoke) {
     margo_instance_id mid = margo_hg_handle_get_instance(handle);
     THALLIUM_ASSERT_CONDITION(mid != 0,
             "margo_hg_handle_get_instance returned null");
@@ -1520,16 +2323,409 @@ inline hg_return_t thallium_generic_rpc(hg_handle_t handle) {
     void* data = margo_registered_data(mid, info->id);
     THALLIUM_ASSERT_CONDITION(data != nullptr,
             "margo_registered_data returned null");
-    auto    cb_data = static_cast<engine::rpc_callback_data*>(data);
-    auto&   rpc = cb_data->m_function;
+    auto cb_data    = static_cast<rpc_callback_data*>(data);
+    bool has_header = cb_data->m_primary != nullptr;
+    cb_data         = cb_data->primary();
+    // wait for an execution slot if the request is subject to admission limits
+    detail::admission_scope admission(cb_data->m_admission
+        ? cb_data->m_admission->take(handle) : detail::admission_ticket());
     request req(mid, handle, false);
-    rpc(req);
+    if(has_header) {
+        // only the calls sent to the header variant accept offloaded responses
+        req.m_has_header = true;
+        req.m_offload    = cb_data->m_offload;
+    }
+    invoke(cb_data, req);
+    margo_destroy(handle);
+}
+
+inline hg_return_t thallium_generic_rpc(hg_handle_t handle) {
+    engine::handle_rpc(handle,
+        [](engine::rpc_callback_data* cb_data, const request& req) {
+            cb_data->m_function(req);
+        });
+    return HG_SUCCESS;
+}
+
+namespace detail {
+
+/**
+ * @brief Responds to a request rejected by admission control. A request
+ * sent to the header variant of its RPC gets a busy status. Others expect
+ * the output of the RPC: encoding it fails with HG_BUSY, which Mercury
+ * sends back to the caller as the return code of the RPC. Since this
+ * runs in the progress loop, the response is sent without blocking, and
+ * the handle is destroyed by its completion callback.
+ */
+inline void reject_request(hg_handle_t handle, bool with_status) {
+    rpc_response_header status;
+    status.m_status      = rpc_status::busy;
+    meta_proc_fn  mproc  = [&status, with_status](hg_proc_t proc) {
+        if(with_status)
+            return proc_rpc_status(proc, status);
+        return hg_proc_get_op(proc) == HG_ENCODE ? HG_BUSY : HG_SUCCESS;
+    };
+    auto completion = std::make_shared<completion_state>();
+    completion->add_callback([handle](hg_return_t) { margo_destroy(handle); });
+    if(crespond(handle, &mproc, completion) != HG_SUCCESS)
+        margo_destroy(handle);
+}
+
+/**
+ * @brief Sends the acknowledgement of the offloaded data of a response
+ * without blocking. The handle is destroyed by its completion callback.
+ */
+inline void acknowledge_offload(margo_instance_id mid, hg_handle_t handle, uint64_t token) {
+    hg_id_t     id = get_instance_data<offload_state>(mid)->ack_id();
+    hg_handle_t h  = HG_HANDLE_NULL;
+    if(margo_create(mid, margo_get_info(handle)->addr, id, &h) != HG_SUCCESS)
+        return;
+    meta_proc_fn mproc = [&token](hg_proc_t proc) {
+        return hg_proc_uint64_t(proc, &token);
+    };
+    auto completion = std::make_shared<completion_state>();
+    completion->add_callback([h](hg_return_t) { margo_destroy(h); });
+    if(provider_cforward(MARGO_DEFAULT_PROVIDER_ID, h, &mproc, -1.0, completion) != HG_SUCCESS)
+        margo_destroy(h);
+}
+
+} // namespace detail
+
+/**
+ * @brief Handler called by the progress loop when a request for an RPC
+ * defined by engine::define() is received. Rejects the request if it
+ * exceeds the admission limits of its provider or RPC, otherwise hands
+ * it to margo, which runs thallium_generic_rpc in a new ULT.
+ */
+inline hg_return_t thallium_admission_handler(hg_handle_t handle) {
+    if(!engine::admit(handle))
+        return HG_SUCCESS;
+    hg_return_t ret = thallium_generic_rpc_handler(handle);
+    if(ret != HG_SUCCESS)
+        engine::cancel_admission(handle);
+    return ret;
+}
+
+inline bool engine::admit(hg_handle_t handle) {
+    margo_instance_id     mid  = margo_hg_handle_get_instance(handle);
+    const struct hg_info* info = margo_get_info(handle);
+    void* data = (mid != MARGO_INSTANCE_NULL && info != nullptr)
+               ? margo_registered_data(mid, info->id) : nullptr;
+    if(data == nullptr)
+        return true;
+    // the limits of an RPC also apply to its header variant, but only the
+    // calls sent to the header variant expect a status in their response
+    auto cb_data     = static_cast<rpc_callback_data*>(data);
+    bool with_status = cb_data->m_primary != nullptr;
+    cb_data          = cb_data->primary();
+    if(cb_data->m_admission
+    && !cb_data->m_admission->admit(handle, cb_data->m_id, cb_data->m_provider_id)) {
+        detail::reject_request(handle, with_status);
+        return false;
+    }
+    return true;
+}
+
+inline void engine::cancel_admission(hg_handle_t handle) {
+    margo_instance_id     mid  = margo_hg_handle_get_instance(handle);
+    const struct hg_info* info = margo_get_info(handle);
+    void* data = (mid != MARGO_INSTANCE_NULL && info != nullptr)
+               ? margo_registered_data(mid, info->id) : nullptr;
+    if(data == nullptr)
+        return;
+    auto cb_data = static_cast<rpc_callback_data*>(data)->primary();
+    if(cb_data->m_admission)
+        cb_data->m_admission->take(handle).cancel();
+}
+
+/**
+ * @brief Handler of the RPC carrying the calls sent by an rpc_batcher.
+ * Each call is handed to the function registered for its RPC id, in a
+ * ULT of the pool the RPC was defined with, with a request_with_context
+ * that reads its arguments from the batch and stores its response in it.
+ * The calls are subject to the admission limits of their RPC and
+ * provider; those that are rejected, and those whose id is not that of
+ * an RPC defined by an engine, get a busy or error status instead of
+ * a response.
+ */
+inline hg_return_t thallium_batch_rpc(hg_handle_t handle) {
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    THALLIUM_ASSERT_CONDITION(mid != 0,
+            "margo_hg_handle_get_instance returned null");
+    auto batch = std::make_shared<detail::batch_state>(mid, handle);
+    margo_destroy(handle);
+    hg_return_t ret = batch->decode();
+    if(ret != HG_SUCCESS) {
+        batch->reject();
+        return ret;
+    }
+    if(batch->pending() == 0)
+        batch->send_response();
+    auto& entries = batch->entries();
+    if(!detail::get_instance_data<detail::batch_control>(mid)->enabled()) {
+        for(size_t i = 0; i < entries.size(); i++)
+            batch->fail(i, detail::rpc_status::error);
+        return HG_SUCCESS;
+    }
+    for(size_t i = 0; i < entries.size(); i++) {
+        auto cb_data = engine::find_rpc(mid, entries[i].m_id);
+        if(cb_data == nullptr) {
+            batch->fail(i, detail::rpc_status::error);
+            continue;
+        }
+        auto ticket = std::make_shared<detail::admission_ticket>();
+        if(cb_data->m_admission
+        && !cb_data->m_admission->admit(cb_data->m_id, cb_data->m_provider_id,
+                                        *ticket)) {
+            batch->fail(i, detail::rpc_status::busy);
+            continue;
+        }
+        ABT_pool handler_pool = cb_data->m_pool;
+        if(handler_pool == ABT_POOL_NULL)
+            margo_get_handler_pool(mid, &handler_pool);
+        engine::rpc_t* fn = &cb_data->m_function;
+        try {
+            pool(handler_pool).make_thread(
+                [mid, batch, i, fn, ticket]() {
+                    detail::admission_scope admission(std::move(*ticket));
+                    request req(mid, batch, i);
+                    (*fn)(req);
+                }, anonymous());
+        } catch(const exception&) {
+            ticket->cancel();
+            batch->fail(i, detail::rpc_status::error);
+        }
+    }
+    return HG_SUCCESS;
+}
+
+/**
+ * @brief Handler of the RPC carrying the calls of a broadcast or a
+ * reduction. Unless the engine enabled collectives, the call is refused
+ * and counts as failed on the whole subtree. Otherwise, the call is
+ * forwarded to the children of this node in the tree, within the limits
+ * of the engine's collective_policy, and handed to the function
+ * registered for its RPC id, in a ULT of the pool the RPC was defined
+ * with, subject to the admission limits of its RPC and provider (a
+ * rejected call counts as failed on this node). The results of the local
+ * call and of the children are combined and sent back to the parent once
+ * all of them are available.
+ */
+inline hg_return_t thallium_collective_rpc(hg_handle_t handle) {
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    THALLIUM_ASSERT_CONDITION(mid != 0,
+            "margo_hg_handle_get_instance returned null");
+    auto state = std::make_shared<detail::collective_state>(mid, handle);
     margo_destroy(handle);
+    hg_return_t ret = state->decode();
+    if(ret != HG_SUCCESS) {
+        // the subtree is unknown, so only this node counts as failed,
+        // which is enough for the caller to report the failure
+        detail::collective_result result;
+        result.m_failed = 1;
+        detail::collective_state::send_result(mid, state->handle(), result);
+        return ret;
+    }
+    auto& creq   = state->request();
+    auto  policy = detail::get_instance_data<detail::collective_control>(mid)->policy();
+    if(!policy
+    || (policy->max_targets != 0 && creq.m_targets.size() > policy->max_targets)) {
+        detail::collective_result result;
+        result.m_failed = 1 + creq.m_targets.size();
+        return detail::collective_state::send_result(mid, state->handle(), result);
+    }
+    detail::reduction_fn reduce;
+    if(!creq.m_reduction.empty()) {
+        reduce = detail::get_instance_data<detail::reduction_registry>(mid)
+                     ->find(creq.m_reduction);
+        if(!reduce) {
+            // responses of the subtree could not be combined here
+            detail::collective_result result;
+            result.m_failed = 1 + creq.m_targets.size();
+            return detail::collective_state::send_result(mid, state->handle(), result);
+        }
+    }
+    if(policy->max_arity != 0 && creq.m_arity > policy->max_arity)
+        creq.m_arity = static_cast<uint32_t>(policy->max_arity);
+    auto subtrees = detail::split_collective_targets(creq.m_targets, creq.m_arity);
+    // subtrees whose root the policy does not accept count as failed
+    uint64_t refused = 0;
+    auto     it      = std::remove_if(subtrees.begin(), subtrees.end(),
+        [&policy, &refused](const detail::collective_subtree& s) {
+            if(policy->accept_target
+            && policy->accept_target(s.m_root.m_address, s.m_root.m_provider_id))
+                return false;
+            refused += 1 + s.m_targets.size();
+            return true;
+        });
+    subtrees.erase(it, subtrees.end());
+    hg_handle_t h = state->handle();
+    margo_ref_incr(h);
+    auto gather = std::make_shared<detail::collective_gather>(
+        subtrees.size() + (refused ? 2 : 1), std::move(reduce),
+        [mid, h](detail::collective_result&& result) {
+            detail::collective_state::send_result(mid, h, result);
+            margo_destroy(h);
+        });
+    state->set_gather(gather);
+    if(refused)
+        gather->add(0, refused, std::vector<char>());
+    detail::collective_forward(mid, creq, std::move(subtrees), gather);
+    // margo encodes the provider id in the lower 16 bits of the RPC id
+    hg_id_t id      = ((creq.m_id >> 16) << 16) | creq.m_provider_id;
+    auto    cb_data = engine::find_rpc(mid, id);
+    if(cb_data == nullptr) {
+        gather->add(0, 1, std::vector<char>());
+        return HG_SUCCESS;
+    }
+    auto ticket = std::make_shared<detail::admission_ticket>();
+    if(cb_data->m_admission
+    && !cb_data->m_admission->admit(cb_data->m_id, cb_data->m_provider_id,
+                                    *ticket)) {
+        gather->add(0, 1, std::vector<char>());
+        return HG_SUCCESS;
+    }
+    ABT_pool handler_pool = cb_data->m_pool;
+    if(handler_pool == ABT_POOL_NULL)
+        margo_get_handler_pool(mid, &handler_pool);
+    engine::rpc_t* fn     = &cb_data->m_function;
+    bool           expect = creq.m_expect_response;
+    try {
+        pool(handler_pool).make_thread(
+            [mid, state, gather, fn, expect, ticket]() {
+                detail::admission_scope admission(std::move(*ticket));
+                // responses stay enabled so that handlers calling respond()
+                // work as for any RPC; the state drops them if not expected
+                request req(mid, state, 0);
+                (*fn)(req);
+                if(!expect) gather->add(1, 0, std::vector<char>());
+            }, anonymous());
+    } catch(const exception&) {
+        ticket->cancel();
+        gather->add(0, 1, std::vector<char>());
+    }
     return HG_SUCCESS;
 }
 
+/**
+ * @brief Handler of the acknowledgements sent by clients once they have
+ * pulled the offloaded data of a response (see detail::acknowledge_offload()).
+ */
+inline hg_return_t thallium_offload_ack_rpc(hg_handle_t handle) {
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    THALLIUM_ASSERT_CONDITION(mid != 0,
+            "margo_hg_handle_get_instance returned null");
+    uint64_t     token = 0;
+    meta_proc_fn mproc = [&token](hg_proc_t proc) {
+        return hg_proc_uint64_t(proc, &token);
+    };
+    hg_return_t ret = margo_get_input(handle, &mproc);
+    if(ret == HG_SUCCESS) {
+        margo_free_input(handle, &mproc);
+        detail::get_instance_data<detail::offload_state>(mid)->release(
+            token, detail::handle_origin(handle));
+    }
+    margo_destroy(handle);
+    return ret;
+}
+
+namespace detail {
+
+inline hg_id_t register_collective_rpc(margo_instance_id mid) {
+    hg_bool_t flag = HG_FALSE;
+    hg_id_t   id   = 0;
+    margo_registered_name(mid, collective_rpc_name(), &id, &flag);
+    if(flag == HG_FALSE) {
+        id = MARGO_REGISTER(mid, collective_rpc_name(), meta_serialization,
+                            meta_serialization, thallium_collective_rpc);
+    }
+    return id;
+}
+
+inline hg_id_t register_offload_ack_rpc(margo_instance_id mid) {
+    hg_bool_t flag = HG_FALSE;
+    hg_id_t   id   = 0;
+    margo_registered_name(mid, "__thallium_offload_ack__", &id, &flag);
+    if(flag == HG_FALSE) {
+        id = MARGO_REGISTER(mid, "__thallium_offload_ack__", meta_serialization,
+                            meta_serialization, thallium_offload_ack_rpc);
+        margo_registered_disable_response(mid, id, HG_TRUE);
+    }
+    return id;
+}
+
+inline hg_id_t register_batch_rpc(margo_instance_id mid) {
+    hg_bool_t flag = HG_FALSE;
+    hg_id_t   id   = 0;
+    margo_registered_name(mid, batch_rpc_name(), &id, &flag);
+    if(flag == HG_FALSE) {
+        id = MARGO_REGISTER(mid, batch_rpc_name(), meta_serialization,
+                            meta_serialization, thallium_batch_rpc);
+    }
+    return id;
+}
+
+template <typename... T>
+std::shared_ptr<local_call> self_dispatch(margo_instance_id mid,
+                                          hg_handle_t handle,
+                                          uint16_t provider_id,
+                                          std::tuple<T...>&& args) {
+    using input_type = std::tuple<local_type_t<T>...>;
+    const struct hg_info* info = margo_get_info(handle);
+    if(info == nullptr)
+        return nullptr;
+    // margo encodes the provider id in the lower 16 bits of the RPC id
+    hg_id_t id      = ((info->id >> 16) << 16) | provider_id;
+    auto    cb_data = engine::find_rpc(mid, id);
+    if(cb_data == nullptr || cb_data->m_input_type == nullptr
+    || *cb_data->m_input_type != typeid(input_type))
+        return nullptr;
+    // elements of args that are rvalue references are moved, others copied
+    using constructible = std::is_constructible<input_type, std::tuple<T...>&&>;
+    if(!constructible::value)
+        return nullptr;
+    ABT_pool handler_pool = cb_data->m_pool;
+    if(handler_pool == ABT_POOL_NULL)
+        margo_get_handler_pool(mid, &handler_pool);
+    engine::rpc_t* fn   = &cb_data->m_function;
+    auto           call = std::make_shared<local_call>();
+    // the ULT is created before args are consumed so that, should its
+    // creation fail, the caller can still forward them through Mercury;
+    // it waits for the input to be in place before running the handler
+    std::shared_ptr<eventual<void>> ready;
+    try {
+        ready = std::make_shared<eventual<void>>();
+        pool(handler_pool).make_thread(
+            [mid, call, fn, ready]() {
+                ready->wait();
+                if(!call->m_input) return;
+                request req(mid, call);
+                (*fn)(req);
+            }, anonymous());
+    } catch(const std::exception& ex) {
+        margo_warning(mid, "[thallium] Could not self-dispatch RPC: %s", ex.what());
+        return nullptr;
+    }
+    try {
+        call->m_input = make_local_value<input_type>(constructible(), std::move(args));
+    } catch(...) {
+        ready->set_value();
+        throw;
+    }
+    ready->set_value();
+    return call;
+}
+
+} // namespace detail
+
 inline __MARGO_INTERNAL_RPC_WRAPPER(thallium_generic_rpc)
 inline __MARGO_INTERNAL_RPC_HANDLER(thallium_generic_rpc)
+inline __MARGO_INTERNAL_RPC_WRAPPER(thallium_batch_rpc)
+inline __MARGO_INTERNAL_RPC_HANDLER(thallium_batch_rpc)
+inline __MARGO_INTERNAL_RPC_WRAPPER(thallium_collective_rpc)
+inline __MARGO_INTERNAL_RPC_HANDLER(thallium_collective_rpc)
+inline __MARGO_INTERNAL_RPC_WRAPPER(thallium_offload_ack_rpc)
+inline __MARGO_INTERNAL_RPC_HANDLER(thallium_offload_ack_rpc)
 
 } // namespace thallium
 
@@ -7,8 +7,12 @@
 #define __THALLIUM_EVENTUAL_HPP
 
 #include <abt.h>
+#include <atomic>
+#include <functional>
 #include <thallium/exception.hpp>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace thallium {
 
@@ -35,6 +39,93 @@ class eventual_exception : public exception {
         }                                                                      \
     }
 
+namespace detail {
+
+template <typename T> class eventual_awaiter;
+
+/**
+ * @brief Callbacks invoked when an eventual is set, used to resume the
+ * coroutines awaiting it (see co_wait()) without a ULT blocked on the
+ * ABT_eventual. Guarded by a spinlock, only held to add or take the
+ * callbacks, so that eventuals do not need an ABT_mutex.
+ */
+class eventual_listeners {
+
+  public:
+
+    using callback_list = std::vector<std::function<void()>>;
+
+    eventual_listeners() = default;
+
+    eventual_listeners(eventual_listeners&& other) noexcept
+    : m_callbacks(std::move(other.m_callbacks))
+    , m_set(other.m_set) {}
+
+    eventual_listeners& operator=(eventual_listeners&& other) {
+        m_callbacks = std::move(other.m_callbacks);
+        m_set       = other.m_set;
+        return *this;
+    }
+
+    /**
+     * @brief Registers a callback, unless take() was already called,
+     * which is checked under the lock so that the callback cannot be missed.
+     *
+     * @return false if the eventual is already set (the callback is dropped).
+     */
+    bool add(std::function<void()> cb) {
+        lock();
+        if(m_set) {
+            unlock();
+            return false;
+        }
+        m_callbacks.push_back(std::move(cb));
+        unlock();
+        return true;
+    }
+
+    /**
+     * @brief Marks the eventual as set and returns the registered callbacks.
+     * Must be called before the ABT_eventual is set: once it is, a waiter
+     * may destroy the eventual, so the callbacks have to be invoked from
+     * the returned list without touching the eventual.
+     */
+    callback_list take() {
+        callback_list callbacks;
+        lock();
+        m_set = true;
+        callbacks.swap(m_callbacks);
+        unlock();
+        return callbacks;
+    }
+
+    /**
+     * @brief Marks the eventual as not set, when it is reset.
+     */
+    void reset() {
+        lock();
+        m_set = false;
+        unlock();
+    }
+
+  private:
+
+    void lock() {
+        while(m_lock.test_and_set(std::memory_order_acquire))
+            ABT_thread_yield();
+    }
+
+    void unlock() {
+        m_lock.clear(std::memory_order_release);
+    }
+
+    std::atomic_flag m_lock = ATOMIC_FLAG_INIT;
+    callback_list    m_callbacks;
+    bool             m_set = false;
+};
+
+} // namespace detail
+
 /**
  * @brief The eventual class wraps an ABT_eventual object.
  * It is a template class, with the template type T being
@@ -42,6 +133,9 @@ class eventual_exception : public exception {
  * and assignable.
  */
 template <typename T> class eventual {
+
+    template <typename U> friend class detail::eventual_awaiter;
+
   public:
     /**
      * @brief Type of value stored by the eventual.
@@ -54,8 +148,9 @@ template <typename T> class eventual {
     using native_handle_type = ABT_eventual;
 
   private:
-    ABT_eventual m_eventual;
-    value_type   m_value;
+    ABT_eventual               m_eventual;
+    value_type                 m_value;
+    detail::eventual_listeners m_listeners;
 
   public:
     /**
@@ -99,6 +194,7 @@ template <typename T> class eventual {
         }
         m_eventual       = other.m_eventual;
         other.m_eventual = ABT_EVENTUAL_NULL;
+        m_listeners      = std::move(other.m_listeners);
         return *this;
     }
 
@@ -106,7 +202,8 @@ template <typename T> class eventual {
      * @brief Move constructor.
      */
     eventual(eventual&& other)
-    : m_eventual(other.m_eventual) {
+    : m_eventual(other.m_eventual)
+    , m_listeners(std::move(other.m_listeners)) {
         other.m_eventual = ABT_EVENTUAL_NULL;
     }
 
@@ -117,7 +214,10 @@ template <typename T> class eventual {
      */
     void set_value(const T& val) {
         m_value = val;
+        auto callbacks = m_listeners.take();
         TL_EVENTUAL_ASSERT(ABT_eventual_set(m_eventual, nullptr, 0));
+        // a waiter may have destroyed the eventual at this point
+        for(auto& cb : callbacks) cb();
     }
 
     /**
@@ -127,7 +227,10 @@ template <typename T> class eventual {
      */
     void set_value(T&& val) {
         m_value = std::move(val);
+        auto callbacks = m_listeners.take();
         TL_EVENTUAL_ASSERT(ABT_eventual_set(m_eventual, nullptr, 0));
+        // a waiter may have destroyed the eventual at this point
+        for(auto& cb : callbacks) cb();
     }
 
     /**
@@ -165,6 +268,7 @@ template <typename T> class eventual {
     void reset() {
         m_value = value_type{};
         TL_EVENTUAL_ASSERT(ABT_eventual_reset(m_eventual));
+        m_listeners.reset();
     }
 };
 
@@ -172,6 +276,9 @@ template <typename T> class eventual {
  * @brief Specialization of eventual class for T=void
  */
 template <> class eventual<void> {
+
+    template <typename U> friend class detail::eventual_awaiter;
+
   public:
     /**
      * @brief Native handle type.
@@ -179,7 +286,8 @@ template <> class eventual<void> {
     using native_handle_type = ABT_eventual;
 
   private:
-    ABT_eventual m_eventual;
+    ABT_eventual               m_eventual;
+    detail::eventual_listeners m_listeners;
 
   public:
     /**
@@ -223,6 +331,7 @@ template <> class eventual<void> {
         }
         m_eventual       = other.m_eventual;
         other.m_eventual = ABT_EVENTUAL_NULL;
+        m_listeners      = std::move(other.m_listeners);
         return *this;
     }
 
@@ -230,7 +339,8 @@ template <> class eventual<void> {
      * @brief Move constructor.
      */
     eventual(eventual&& other) noexcept
-    : m_eventual(other.m_eventual) {
+    : m_eventual(other.m_eventual)
+    , m_listeners(std::move(other.m_listeners)) {
         other.m_eventual = ABT_EVENTUAL_NULL;
     }
 
@@ -238,7 +348,10 @@ template <> class eventual<void> {
      * @brief Set the eventual.
      */
     void set_value() {
+        auto callbacks = m_listeners.take();
         TL_EVENTUAL_ASSERT(ABT_eventual_set(m_eventual, nullptr, 0));
+        // a waiter may have destroyed the eventual at this point
+        for(auto& cb : callbacks) cb();
     }
 
     /**
@@ -258,7 +371,10 @@ template <> class eventual<void> {
     /**
      * @brief Reset the eventual.
      */
-    void reset() { TL_EVENTUAL_ASSERT(ABT_eventual_reset(m_eventual)); }
+    void reset() {
+        TL_EVENTUAL_ASSERT(ABT_eventual_reset(m_eventual));
+        m_listeners.reset();
+    }
 };
 
 } // namespace thallium
@@ -0,0 +1,168 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_EXPOSED_CONTAINER_HPP
+#define __THALLIUM_EXPOSED_CONTAINER_HPP
+
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <margo.h>
+#include <thallium/bulk.hpp>
+#include <thallium/bulk_mode.hpp>
+#include <thallium/endpoint.hpp>
+#include <thallium/engine.hpp>
+#include <thallium/exception.hpp>
+#include <thallium/remote_bulk.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Contiguous memory of an element of a container exposed with
+ * engine::expose_container(), e.g. a std::string or a std::vector<T>.
+ */
+template <typename E> struct container_segment {
+
+    using value_type = typename std::remove_const<typename E::value_type>::type;
+
+    static_assert(std::is_trivially_copyable<value_type>::value,
+                  "The elements of an exposed container must be contiguous "
+                  "ranges of trivially copyable values");
+
+    // called for non-empty elements only: unlike data(), &e[0] gives
+    // writable access to the content of a std::string in C++14
+    static void* data(E& e) {
+        return const_cast<value_type*>(&e[0]);
+    }
+
+    static size_t size(const E& e) {
+        return e.size() * sizeof(value_type);
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief An exposed_container exposes the elements of a container of
+ * contiguous ranges (e.g. a std::vector<std::string> or a
+ * std::vector<std::vector<T>>) as the segments of a single bulk object,
+ * along with the size of each element. It is created by
+ * engine::expose_container() and sent over RPC like a bulk object. The
+ * receiver calls pull_to() to shape a container of the same kind and
+ * fill it with a single bulk transfer, instead of one per element.
+ *
+ * As with a bulk, the sender must keep the exposed_container (or a copy
+ * of it) and the container alive, and must not resize the container or
+ * its elements, until the receiver has pulled the data.
+ */
+class exposed_container {
+
+    friend class engine;
+
+  private:
+
+    bulk                  m_bulk;
+    std::vector<uint64_t> m_sizes; // size in bytes of each element
+
+  public:
+
+    exposed_container() = default;
+
+    /**
+     * @brief Number of elements of the exposed container.
+     */
+    size_t count() const {
+        return m_sizes.size();
+    }
+
+    /**
+     * @brief Sizes in bytes of the elements of the exposed container.
+     */
+    const std::vector<uint64_t>& sizes() const {
+        return m_sizes;
+    }
+
+    /**
+     * @brief Underlying bulk object, whose segments are the non-empty
+     * elements of the container.
+     */
+    const bulk& get_bulk() const {
+        return m_bulk;
+    }
+
+    /**
+     * @brief Resizes the destination container and its elements to match
+     * the exposed container, then pulls all the elements into it with a
+     * single bulk transfer.
+     *
+     * @tparam C Type of container, whose elements must have the same
+     * size of values as those of the exposed container.
+     * @param ep Endpoint of the process that exposed the container.
+     * @param dest Container to fill.
+     *
+     * @return the number of bytes transferred.
+     */
+    template <typename C>
+    size_t pull_to(const endpoint& ep, C& dest) const;
+
+    template <typename A> void serialize(A& ar) {
+        ar & m_bulk;
+        ar & m_sizes;
+    }
+};
+
+template <typename C>
+exposed_container engine::expose_container(C& container, bulk_mode flag) {
+    MARGO_INSTANCE_MUST_BE_VALID;
+    using element = typename std::remove_reference<decltype(*std::begin(container))>::type;
+    using segment = detail::container_segment<element>;
+    exposed_container result;
+    std::vector<std::pair<void*, size_t>> segments;
+    for(auto& e : container) {
+        size_t size = segment::size(e);
+        result.m_sizes.push_back(size);
+        // Mercury does not accept empty segments
+        if(size != 0) segments.emplace_back(segment::data(e), size);
+    }
+    if(!segments.empty())
+        result.m_bulk = detail::expose_uncached(m_mid, segments, flag);
+    return result;
+}
+
+template <typename C>
+size_t exposed_container::pull_to(const endpoint& ep, C& dest) const {
+    using element = typename C::value_type;
+    using segment = detail::container_segment<element>;
+    using value   = typename segment::value_type;
+    dest.resize(m_sizes.size());
+    std::vector<std::pair<void*, size_t>> segments;
+    size_t total = 0;
+    auto   it    = m_sizes.begin();
+    for(auto& e : dest) {
+        uint64_t size = *it++;
+        if(size % sizeof(value) != 0)
+            throw exception("exposed_container::pull_to: element of ", size,
+                            " bytes does not match the destination's value type");
+        e.resize(size / sizeof(value));
+        if(size != 0) segments.emplace_back(segment::data(e), size);
+        total += size;
+    }
+    if(segments.empty())
+        return 0;
+    engine e(ep.get_engine());
+    bulk local = detail::expose_uncached(e.get_margo_instance(), segments,
+                                         bulk_mode::write_only);
+    local << m_bulk.on(ep);
+    return total;
+}
+
+} // namespace thallium
+
+#endif
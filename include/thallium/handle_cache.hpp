@@ -0,0 +1,184 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_HANDLE_CACHE_HPP
+#define __THALLIUM_HANDLE_CACHE_HPP
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <margo.h>
+#include <thallium/mutex.hpp>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Cache of idle hg_handle_t attached to a margo instance (see
+ * engine::set_handle_cache_size()). Handles are released into the cache
+ * when the last callable_remote_procedure or async_response using them
+ * goes away, and are reused with HG_Reset by subsequent calls, preferably
+ * for the same address and RPC. The cache is disabled (capacity 0) by
+ * default.
+ */
+class handle_cache {
+
+    // margo encodes the provider id in the lower 16 bits of the RPC id,
+    // and resets the handle's RPC id when forwarding to a provider,
+    // so idle handles are indexed by address and base RPC id
+    using key_type = std::pair<hg_addr_t, hg_id_t>;
+
+    static key_type make_key(hg_addr_t addr, hg_id_t id) {
+        return key_type(addr, id >> 16);
+    }
+
+  public:
+
+    handle_cache(margo_instance_id mid)
+    : m_mid(mid) {}
+
+    handle_cache(const handle_cache&)            = delete;
+    handle_cache& operator=(const handle_cache&) = delete;
+
+    ~handle_cache() {
+        clear();
+    }
+
+    /**
+     * @brief Gets a handle for the given address and RPC id, reusing
+     * an idle one if possible, otherwise creating one with margo_create.
+     */
+    hg_return_t acquire(hg_addr_t addr, hg_id_t id, hg_handle_t* handle) {
+        hg_handle_t h = pop(addr, id);
+        if(h != HG_HANDLE_NULL) {
+            if(HG_Reset(h, addr, id) == HG_SUCCESS) {
+                *handle = h;
+                return HG_SUCCESS;
+            }
+            margo_destroy(h);
+        }
+        return margo_create(m_mid, addr, id, handle);
+    }
+
+    /**
+     * @brief Releases a reference to a handle, keeping the handle
+     * in the cache if it was the last reference and the cache is not
+     * full, or calling margo_destroy otherwise.
+     */
+    hg_return_t release(hg_handle_t handle) {
+        if(m_capacity == 0 || HG_Ref_get(handle) != 1)
+            return margo_destroy(handle);
+        const struct hg_info* info = margo_get_info(handle);
+        if(info == nullptr)
+            return margo_destroy(handle);
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            if(!m_closed && m_size < m_capacity) {
+                m_idle[make_key(info->addr, info->id)].push_back(handle);
+                m_size += 1;
+                return HG_SUCCESS;
+            }
+        }
+        return margo_destroy(handle);
+    }
+
+    /**
+     * @brief Changes the maximum number of idle handles kept,
+     * destroying the handles in excess.
+     */
+    void set_capacity(size_t capacity) {
+        std::vector<hg_handle_t> excess;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            m_capacity = capacity;
+            for(auto it = m_idle.begin(); it != m_idle.end() && m_size > m_capacity;) {
+                while(!it->second.empty() && m_size > m_capacity) {
+                    excess.push_back(it->second.back());
+                    it->second.pop_back();
+                    m_size -= 1;
+                }
+                if(it->second.empty()) it = m_idle.erase(it);
+                else ++it;
+            }
+        }
+        for(auto h : excess) margo_destroy(h);
+    }
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    size_t size() {
+        std::lock_guard<mutex> lock(m_mutex);
+        return m_size;
+    }
+
+    /**
+     * @brief Destroys all the idle handles.
+     */
+    void clear() {
+        std::map<key_type, std::vector<hg_handle_t>> idle;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            idle.swap(m_idle);
+            m_size = 0;
+        }
+        for(auto& p : idle)
+            for(auto h : p.second) margo_destroy(h);
+    }
+
+    /**
+     * @brief Called when the margo instance is finalized.
+     */
+    void on_finalize() {
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        clear();
+    }
+
+  private:
+
+    hg_handle_t pop(hg_addr_t addr, hg_id_t id) {
+        std::lock_guard<mutex> lock(m_mutex);
+        if(m_size == 0)
+            return HG_HANDLE_NULL;
+        auto it = m_idle.find(make_key(addr, id));
+        // no idle handle for this address and RPC, take any handle
+        if(it == m_idle.end()) it = m_idle.begin();
+        hg_handle_t h = it->second.back();
+        it->second.pop_back();
+        if(it->second.empty()) m_idle.erase(it);
+        m_size -= 1;
+        return h;
+    }
+
+    margo_instance_id                            m_mid;
+    std::atomic<size_t>                          m_capacity{0};
+    size_t                                       m_size     = 0;
+    bool                                         m_closed   = false;
+    std::map<key_type, std::vector<hg_handle_t>> m_idle;
+    mutex                                        m_mutex;
+};
+
+/**
+ * @brief Releases a reference to a handle through the cache if any.
+ */
+inline hg_return_t release_handle(const std::shared_ptr<handle_cache>& cache,
+                                  hg_handle_t handle) {
+    if(cache) return cache->release(handle);
+    return margo_destroy(handle);
+}
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_INSTANCE_DATA_HPP
+#define __THALLIUM_INSTANCE_DATA_HPP
+
+#include <margo.h>
+#include <memory>
+#include <mutex>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Address used as owner of the pre-finalization callback
+ * that holds the instance data of type T.
+ */
+template <typename T> struct instance_data_key {
+    static const char value;
+};
+
+template <typename T> const char instance_data_key<T>::value = 0;
+
+/**
+ * @brief Returns the object of type T attached to the margo instance,
+ * creating it (as T(mid)) the first time. Since engine objects are only
+ * references to a margo instance, this is how state is shared by all the
+ * engines (and objects created from them) of a given margo instance.
+ *
+ * The object is stored as the argument of a pre-finalization callback,
+ * which calls its on_finalize() method and releases the instance's
+ * reference to it when the margo instance is finalized. Objects that
+ * hold the returned shared_ptr may therefore outlive the margo instance.
+ */
+template <typename T>
+std::shared_ptr<T> get_instance_data(margo_instance_id mid) {
+    static std::mutex           mtx;
+    std::lock_guard<std::mutex> lock(mtx);
+    const void*                 key   = &instance_data_key<T>::value;
+    margo_finalize_callback_t   cb    = nullptr;
+    void*                       uargs = nullptr;
+    if(margo_provider_top_prefinalize_callback(mid, key, &cb, &uargs))
+        return *static_cast<std::shared_ptr<T>*>(uargs);
+    auto data = new std::shared_ptr<T>(std::make_shared<T>(mid));
+    margo_provider_push_prefinalize_callback(mid, key,
+        [](void* args) {
+            auto d = static_cast<std::shared_ptr<T>*>(args);
+            (*d)->on_finalize();
+            delete d;
+        }, data);
+    return *data;
+}
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
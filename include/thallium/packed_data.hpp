@@ -6,12 +6,17 @@
 #ifndef __THALLIUM_PACKED_RESPONSE_HPP
 #define __THALLIUM_PACKED_RESPONSE_HPP
 
+#include <thallium/busy.hpp>
 #include <thallium/margo_exception.hpp>
 #include <thallium/proc_object.hpp>
 #include <thallium/serialization/proc_input_archive.hpp>
 #include <thallium/serialization/serialize.hpp>
 #include <thallium/reference_util.hpp>
 #include <thallium/margo_instance_ref.hpp>
+#include <thallium/self_dispatch.hpp>
+#include <thallium/proc_buffer.hpp>
+#include <memory>
+#include <vector>
 
 namespace thallium {
 
@@ -23,6 +28,10 @@ using request = request_with_context<>;
 /**
  * @brief packed_data objects encapsulate data serialized
  * into an hg_handle_t, whether it is input or output data.
+ * When the RPC was dispatched locally, they instead hold
+ * the values that were passed, without serialization.
+ * When the RPC was part of a batch (see rpc_batcher), they
+ * hold the buffer in which the data was serialized.
  */
 template<typename ... CtxArg>
 class packed_data {
@@ -37,6 +46,9 @@ class packed_data {
     hg_return_t (*m_unpack_fn)(hg_handle_t,void*) = nullptr;
     hg_return_t (*m_free_fn)(hg_handle_t,void*) = nullptr;
     mutable std::tuple<CtxArg...> m_context;
+    detail::local_value m_local;
+    std::shared_ptr<const std::vector<char>> m_buffer;
+    bool m_with_status = false; // response preceded by a detail::rpc_status
 
     /**
      * @brief Constructor. Made private since packed_data
@@ -56,6 +68,93 @@ class packed_data {
         MARGO_ASSERT(ret, margo_ref_incr);
     }
 
+    /**
+     * @brief Constructor used for locally dispatched RPCs.
+     */
+    packed_data(margo_instance_ref mid,
+                detail::local_value local,
+                std::tuple<CtxArg...>&& ctx = std::tuple<CtxArg...>())
+    : m_mid(std::move(mid))
+    , m_context(std::move(ctx))
+    , m_local(std::move(local)) {}
+
+    /**
+     * @brief Constructor used for RPCs sent within a batch.
+     */
+    packed_data(margo_instance_ref mid,
+                std::shared_ptr<const std::vector<char>> buffer,
+                std::tuple<CtxArg...>&& ctx = std::tuple<CtxArg...>())
+    : m_mid(std::move(mid))
+    , m_context(std::move(ctx))
+    , m_buffer(std::move(buffer)) {}
+
+    /**
+     * @brief Decodes the content of the buffer using the provided function.
+     */
+    void unpack_buffer(meta_proc_fn& mproc) const {
+        hg_return_t ret = detail::proc_decode_from_buffer(m_mid, mproc, *m_buffer);
+        MARGO_ASSERT(ret, proc_decode_from_buffer);
+    }
+
+    /**
+     * @brief Decodes the content of the handle using the provided function.
+     * A response with a status is checked in the same pass: a busy
+     * exception is thrown if the call was rejected by the server's
+     * admission control, and an exception if the server could not decode
+     * its arguments. If the status says the response offloaded data, the
+     * server is told it can release the data once the function has pulled
+     * the values it decodes, hence the data can only be unpacked once.
+     */
+    void unpack_handle(meta_proc_fn& mproc) const {
+        if(m_handle == HG_HANDLE_NULL) {
+            throw exception(
+                "Cannot unpack data from handle. Are you trying to "
+                "unpack data from an RPC that does not return any?");
+        }
+        hg_return_t ret;
+        if(!m_with_status) {
+            ret = m_unpack_fn(m_handle, &mproc);
+            MARGO_ASSERT(ret, m_unpack_fn);
+            ret = m_free_fn(m_handle, &mproc);
+            MARGO_ASSERT(ret, m_free_fn);
+            return;
+        }
+        detail::rpc_response_header status;
+        meta_proc_fn with_status = [&status, &mproc](hg_proc_t proc) {
+            hg_return_t ret = detail::proc_rpc_status(proc, status);
+            if(ret != HG_SUCCESS)
+                return ret;
+            if(status.m_status != detail::rpc_status::ok
+            && status.m_status != detail::rpc_status::offloaded)
+                return HG_SUCCESS;
+            return mproc(proc);
+        };
+        ret = m_unpack_fn(m_handle, &with_status);
+        if(status.m_status == detail::rpc_status::offloaded)
+            detail::acknowledge_offload(m_mid, m_handle, status.m_token);
+        MARGO_ASSERT(ret, m_unpack_fn);
+        ret = m_free_fn(m_handle, &with_status);
+        MARGO_ASSERT(ret, m_free_fn);
+        if(status.m_status == detail::rpc_status::busy)
+            throw busy();
+        if(status.m_status == detail::rpc_status::error)
+            throw exception("The server could not decode the arguments of the RPC");
+    }
+
+    /**
+     * @brief Returns a pointer to the locally passed values
+     * if their types match Tuple, throws otherwise.
+     */
+    template <typename Tuple> Tuple* get_local() const {
+        auto t = m_local.template get<Tuple>();
+        if(t == nullptr) {
+            throw exception(
+                "Cannot unpack data from a self-dispatched RPC: the types "
+                "requested do not match the types that were provided");
+        }
+        return t;
+    }
+
   public:
     packed_data() = default;
     packed_data(const packed_data&)            = delete;
@@ -66,7 +165,10 @@ class packed_data {
     , m_handle(std::exchange(other.m_handle, HG_HANDLE_NULL))
     , m_unpack_fn(std::exchange(other.m_unpack_fn, nullptr))
     , m_free_fn(std::exchange(other.m_free_fn, nullptr))
-    , m_context(std::move(other.m_context)) {}
+    , m_context(std::move(other.m_context))
+    , m_local(std::move(other.m_local))
+    , m_buffer(std::move(other.m_buffer))
+    , m_with_status(other.m_with_status) {}
 
     packed_data& operator=(packed_data&& rhs) {
         if(&rhs == this) return *this;
@@ -80,6 +182,10 @@ class packed_data {
         m_handle    = std::exchange(rhs.m_handle, HG_HANDLE_NULL);
         m_unpack_fn = std::exchange(rhs.m_unpack_fn, nullptr);
         m_free_fn   = std::exchange(rhs.m_free_fn, nullptr);
+        m_local     = std::move(rhs.m_local);
+        m_buffer    = std::move(rhs.m_buffer);
+        m_with_status = rhs.m_with_status;
+        return *this;
     }
 
     ~packed_data() {
@@ -102,9 +208,19 @@ class packed_data {
      */
     template<typename ... NewCtxArg>
     auto with_serialization_context(NewCtxArg&&... args) {
-        return packed_data<unwrap_decay_t<NewCtxArg>...>(
+        if(m_local) {
+            return packed_data<unwrap_decay_t<NewCtxArg>...>(m_mid, m_local,
+                std::make_tuple<NewCtxArg...>(std::forward<NewCtxArg>(args)...));
+        }
+        if(m_buffer) {
+            return packed_data<unwrap_decay_t<NewCtxArg>...>(m_mid, m_buffer,
+                std::make_tuple<NewCtxArg...>(std::forward<NewCtxArg>(args)...));
+        }
+        packed_data<unwrap_decay_t<NewCtxArg>...> result(
             m_unpack_fn, m_free_fn, m_handle, m_mid,
             std::make_tuple<NewCtxArg...>(std::forward<NewCtxArg>(args)...));
+        result.m_with_status = m_with_status;
+        return result;
     }
 
     /**
@@ -115,19 +231,18 @@ class packed_data {
      * @return Buffer converted into the desired type.
      */
     template <typename T> T as() const {
-        if(m_handle == HG_HANDLE_NULL) {
-            throw exception(
-                "Cannot unpack data from handle. Are you trying to "
-                "unpack data from an RPC that does not return any?");
-        }
+        if(m_local)
+            return std::get<0>(*get_local<std::tuple<detail::local_type_t<T>>>());
         std::tuple<T> t;
         meta_proc_fn  mproc = [this, &t](hg_proc_t proc) {
-            return proc_object_decode(proc, t, m_mid, m_context);
+            return proc_object_decode(proc, t, m_mid, m_context,
+                                      detail::handle_origin(m_handle));
         };
-        hg_return_t ret = m_unpack_fn(m_handle, &mproc);
-        MARGO_ASSERT(ret, m_unpack_fn);
-        ret = margo_free_output(m_handle, &mproc);
-        MARGO_ASSERT(ret, m_free_fn);
+        if(m_buffer) {
+            unpack_buffer(mproc);
+            return std::get<0>(std::move(t));
+        }
+        unpack_handle(mproc);
         return std::get<0>(std::move(t));
     }
 
@@ -147,21 +262,24 @@ class packed_data {
      * @return buffer content converted into the desired std::tuple.
      */
     template <typename T1, typename T2, typename... Tn> auto as() const {
-        if(m_handle == HG_HANDLE_NULL) {
-            throw exception(
-                "Cannot unpack data from handle. Are you trying to "
-                "unpack data from an RPC that does not return any?");
+        if(m_local) {
+            return std::tuple<typename std::decay<T1>::type, typename std::decay<T2>::type,
+                              typename std::decay<Tn>::type...>(
+                *get_local<std::tuple<detail::local_type_t<T1>, detail::local_type_t<T2>,
+                                      detail::local_type_t<Tn>...>>());
         }
         std::tuple<typename std::decay<T1>::type, typename std::decay<T2>::type,
                    typename std::decay<Tn>::type...>
                      t;
         meta_proc_fn mproc = [this, &t](hg_proc_t proc) {
-            return proc_object_decode(proc, t, m_mid, m_context);
+            return proc_object_decode(proc, t, m_mid, m_context,
+                                      detail::handle_origin(m_handle));
         };
-        hg_return_t ret = m_unpack_fn(m_handle, &mproc);
-        MARGO_ASSERT(ret, m_unpack_fn);
-        ret = m_free_fn(m_handle, &mproc);
-        MARGO_ASSERT(ret, m_free_fn);
+        if(m_buffer) {
+            unpack_buffer(mproc);
+            return t;
+        }
+        unpack_handle(mproc);
         return t;
     }
 
@@ -187,19 +305,20 @@ class packed_data {
      * @param x Objects into which to unpack.
      */
     template <typename... T> void unpack(T&... x) const {
-        if(m_handle == HG_HANDLE_NULL) {
-            throw exception(
-                "Cannot unpack data from handle. Are you trying to "
-                "unpack data from an RPC that does not return any?");
+        if(m_local) {
+            std::tie(x...) = *get_local<std::tuple<detail::local_type_t<T>...>>();
+            return;
         }
         auto t = std::make_tuple(std::ref(x)...);
         meta_proc_fn mproc = [this, &t](hg_proc_t proc) {
-            return proc_object_decode(proc, t, m_mid, m_context);
+            return proc_object_decode(proc, t, m_mid, m_context,
+                                      detail::handle_origin(m_handle));
         };
-        hg_return_t ret = m_unpack_fn(m_handle, &mproc);
-        MARGO_ASSERT(ret, m_unpack_fn);
-        ret = m_free_fn(m_handle, &mproc);
-        MARGO_ASSERT(ret, m_free_fn);
+        if(m_buffer) {
+            unpack_buffer(mproc);
+            return;
+        }
+        unpack_handle(mproc);
     }
 };
 
@@ -0,0 +1,221 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_PROC_BUFFER_HPP
+#define __THALLIUM_PROC_BUFFER_HPP
+
+#include <algorithm>
+#include <margo.h>
+#include <mercury_proc.h>
+#include <string>
+#include <thallium/compression.hpp>
+#include <thallium/margo_exception.hpp>
+#include <thallium/proc_object.hpp>
+#include <vector>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Frees an hg_proc_t when going out of scope.
+ */
+struct proc_guard {
+    hg_proc_t m_proc = HG_PROC_NULL;
+    ~proc_guard() {
+        if(m_proc != HG_PROC_NULL) hg_proc_free(m_proc);
+    }
+};
+
+/**
+ * @brief Runs a meta_proc_fn in HG_ENCODE mode on an hg_proc_t that
+ * writes into the provided buffer instead of an hg_handle_t. The buffer
+ * is grown until the encoded data fits, then shrunk to the encoded size.
+ *
+ * @param mid Margo instance (used to get the Mercury class).
+ * @param mproc Function encoding the data.
+ * @param buffer Buffer to write into.
+ *
+ * @return HG_SUCCESS or the error returned by Mercury or mproc.
+ */
+inline hg_return_t proc_encode_to_buffer(margo_instance_id mid,
+                                         const meta_proc_fn& mproc,
+                                         std::vector<char>& buffer) {
+    hg_class_t* hg_class = margo_get_class(mid);
+    buffer.resize(std::max<size_t>(buffer.capacity(), 256));
+    while(true) {
+        proc_guard  guard;
+        hg_return_t ret = hg_proc_create_set(hg_class, buffer.data(), buffer.size(),
+                                             HG_ENCODE, HG_NOHASH, &guard.m_proc);
+        if(ret != HG_SUCCESS)
+            return ret;
+        ret = mproc(guard.m_proc);
+        if(ret != HG_SUCCESS)
+            return ret;
+        // data that did not fit went into an extra buffer allocated by Mercury,
+        // in which case we encode again into a larger buffer
+        bool      overflow = hg_proc_get_extra_buf(guard.m_proc) != nullptr;
+        hg_size_t used     = hg_proc_get_size_used(guard.m_proc);
+        if(!overflow) {
+            buffer.resize(used);
+            return HG_SUCCESS;
+        }
+        buffer.resize(std::max<size_t>(used, 2 * buffer.size()));
+    }
+}
+
+/**
+ * @brief Runs a meta_proc_fn in HG_DECODE then HG_FREE mode on an
+ * hg_proc_t that reads from the provided buffer.
+ *
+ * @param mid Margo instance (used to get the Mercury class).
+ * @param mproc Function decoding the data.
+ * @param buffer Buffer to read from.
+ *
+ * @return HG_SUCCESS or the error returned by Mercury or mproc.
+ */
+inline hg_return_t proc_decode_from_buffer(margo_instance_id mid,
+                                           const meta_proc_fn& mproc,
+                                           const std::vector<char>& buffer) {
+    proc_guard  guard;
+    void*       buf = const_cast<char*>(buffer.data());
+    hg_return_t ret = hg_proc_create_set(margo_get_class(mid), buf, buffer.size(),
+                                         HG_DECODE, HG_NOHASH, &guard.m_proc);
+    if(ret != HG_SUCCESS)
+        return ret;
+    ret = mproc(guard.m_proc);
+    if(ret != HG_SUCCESS)
+        return ret;
+    ret = hg_proc_reset(guard.m_proc, buf, buffer.size(), HG_FREE);
+    if(ret != HG_SUCCESS)
+        return ret;
+    return mproc(guard.m_proc);
+}
+
+/**
+ * @brief Arguments of an RPC serialized then compressed (see
+ * remote_procedure::set_compression()). On the wire, they follow the
+ * rpc_header as their uncompressed size, their compressed size, and
+ * the compressed bytes. If they were not compressed, m_encoded holds
+ * them serialized as usual, so that they can be sent without being
+ * serialized again (see proc_rpc_encoded_input()).
+ */
+struct compressed_payload {
+    uint64_t          m_raw_size = 0;
+    std::vector<char> m_data;
+    std::vector<char> m_encoded;
+};
+
+/**
+ * @brief Serializes the arguments of an RPC into a buffer and compresses
+ * it, if the arguments are large enough and compress well. Containers
+ * are then never offloaded to RDMA, since the server decodes the
+ * arguments from a buffer rather than from the handle. The compression
+ * threshold is checked against the size of the buffer; if the arguments
+ * are not compressed, the buffer is kept in payload.m_encoded, from
+ * which they are sent, so that they are serialized once either way.
+ *
+ * @return false if the arguments were not compressed.
+ */
+template <typename T, typename ... CtxArg>
+bool compress_rpc_input(compression& c, margo_instance_id mid, const T& args,
+                        std::tuple<CtxArg...>& ctx, rpc_header& header,
+                        compressed_payload& payload) {
+    std::vector<char> raw;
+    meta_proc_fn mproc = [&args, mid, &ctx](hg_proc_t proc) {
+        return proc_object_encode(proc, const_cast<T&>(args), mid, ctx);
+    };
+    hg_return_t ret = proc_encode_to_buffer(mid, mproc, raw);
+    MARGO_ASSERT(ret, proc_encode_to_buffer);
+    if(!c.compress(raw, payload.m_data)) {
+        payload.m_encoded = std::move(raw);
+        return false;
+    }
+    payload.m_raw_size = raw.size();
+    header.m_codec     = c.get_codec().id();
+    return true;
+}
+
+/**
+ * @brief Encodes the header of an RPC followed by its compressed arguments.
+ */
+inline hg_return_t proc_rpc_compressed_input(hg_proc_t proc, rpc_header& header,
+                                             compressed_payload& payload) {
+    hg_return_t ret = proc_rpc_header(proc, header);
+    if(ret != HG_SUCCESS || hg_proc_get_op(proc) != HG_ENCODE)
+        return ret;
+    uint64_t size   = payload.m_data.size();
+    size_t   needed = 2 * sizeof(uint64_t) + size;
+    if(needed > hg_proc_get_size_left(proc)) {
+        ret = hg_proc_set_size(proc, hg_proc_get_size_used(proc) + needed);
+        if(ret != HG_SUCCESS) return ret;
+    }
+    ret = hg_proc_uint64_t(proc, &payload.m_raw_size);
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &size);
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_memcpy(proc, payload.m_data.data(), size);
+}
+
+/**
+ * @brief Encodes the header (if any) of an RPC followed by its arguments,
+ * already serialized in payload.m_encoded by compress_rpc_input(). The
+ * bytes are the same as those proc_rpc_input_encode() would produce
+ * without offloading.
+ */
+inline hg_return_t proc_rpc_encoded_input(hg_proc_t proc, rpc_header* header,
+                                          compressed_payload& payload) {
+    if(header != nullptr) {
+        hg_return_t ret = proc_rpc_header(proc, *header);
+        if(ret != HG_SUCCESS)
+            return ret;
+    }
+    if(hg_proc_get_op(proc) != HG_ENCODE)
+        return HG_SUCCESS;
+    size_t size = payload.m_encoded.size();
+    if(size > hg_proc_get_size_left(proc)) {
+        hg_return_t ret = hg_proc_set_size(proc, hg_proc_get_size_used(proc) + size);
+        if(ret != HG_SUCCESS) return ret;
+    }
+    return hg_proc_memcpy(proc, payload.m_encoded.data(), size);
+}
+
+/**
+ * @brief Decompresses the arguments that follow an rpc_header having the
+ * provided codec into the provided buffer, from which they are then
+ * decoded with proc_decode_from_buffer. Called while decoding the
+ * header, the compressed bytes are read in place from the proc's buffer.
+ * The uncompressed size, read from the wire, is checked against the
+ * codec's max_decompressed_size() before the buffer is allocated.
+ */
+inline hg_return_t proc_decompress_input(margo_instance_id mid, hg_proc_t proc,
+                                         uint8_t codec, std::vector<char>& buffer) {
+    uint64_t    raw_size = 0, size = 0;
+    hg_return_t ret      = hg_proc_uint64_t(proc, &raw_size);
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &size);
+    if(ret != HG_SUCCESS) return ret;
+    void* data = hg_proc_save_ptr(proc, size);
+    if(data == nullptr) return HG_NOMEM;
+    try {
+        auto c = find_codec(mid, codec);
+        if(raw_size > c->max_decompressed_size(size))
+            throw exception("Cannot decompress data: invalid uncompressed size ", raw_size);
+        buffer.resize(raw_size);
+        if(!c->decompress(data, size, buffer.data(), buffer.size()))
+            throw exception("Cannot decompress data: malformed input");
+    } catch(const std::exception& ex) {
+        margo_error(mid, "[thallium] Could not decode RPC arguments: %s", ex.what());
+        ret = HG_INVALID_ARG;
+    }
+    hg_proc_restore_ptr(proc, data, size);
+    return ret;
+}
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
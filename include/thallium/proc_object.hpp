@@ -10,13 +10,21 @@
 #include <cxxabi.h>
 #include <iostream>
 #include <thallium/serialization/stl/string.hpp>
+#include <thallium/type_fingerprint.hpp>
 #include <typeinfo>
 #endif
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <margo.h>
 #include <mercury_proc.h>
+#include <string>
 #include <thallium/serialization/proc_input_archive.hpp>
 #include <thallium/serialization/proc_output_archive.hpp>
+#include <thallium/rdma_offload.hpp>
+#include <thallium/type_fingerprint.hpp>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 #include <memory>
 
@@ -24,8 +32,9 @@ namespace thallium {
 
 #ifdef THALLIUM_DEBUG_RPC_TYPES
 template <typename T> std::string get_type_name() {
+    // arguments are sent as references but received as values
     int         status;
-    const char* mangled_type_name = typeid(T).name();
+    const char* mangled_type_name = typeid(typename detail::decayed_tuple<T>::type).name();
     char*       type_name =
         abi::__cxa_demangle(mangled_type_name, nullptr, nullptr, &status);
     if(status != 0)
@@ -52,17 +61,144 @@ inline hg_return_t hg_proc_meta_serialization(hg_proc_t proc, void* data) {
     return (*fun)(proc);
 }
 
+/**
+ * @brief Returns the number of bytes that serializing the provided
+ * objects would take, computed by running their serialization functions
+ * with a sizing archive, which copies nothing.
+ *
+ * @param args Objects to serialize.
+ *
+ * @return the size of the serialized objects.
+ */
+template <typename ... T>
+size_t serialized_size(const T&... args) {
+    size_t                size = 0;
+    std::tuple<>          ctx;
+    proc_output_archive<> ar(size, ctx, MARGO_INSTANCE_NULL);
+    using expander = int[];
+    (void)expander{0, (void(ar(args)), 0)...};
+    return size;
+}
+
+/**
+ * @brief Trait telling whether the objects of type T are sized (see
+ * serialized_size()) before they are encoded in an RPC or a response, so
+ * that the buffer of the RPC is grown once to their final size rather
+ * than repeatedly while they are encoded. Sizing runs their serialization
+ * functions twice, the first time with an archive whose get_proc()
+ * returns HG_PROC_NULL, so it only pays off for large objects whose
+ * serialization is cheap to run and does not use the proc directly.
+ * Specialize it to std::true_type for such types. An RPC's arguments or
+ * response are sized if all their types are.
+ */
+template <typename T>
+struct presize_serialization : std::false_type {};
+
+namespace detail {
+
+template <typename T>
+struct presized : presize_serialization<T> {};
+
+template <typename T>
+struct presized<std::reference_wrapper<T>>
+: presized<typename std::decay<T>::type> {};
+
+template <typename T>
+struct presized<std::tuple<T>>
+: presized<typename std::decay<T>::type> {};
+
+template <typename T1, typename T2, typename ... T>
+struct presized<std::tuple<T1, T2, T...>>
+: std::integral_constant<bool, presized<typename std::decay<T1>::type>::value
+                            && presized<std::tuple<T2, T...>>::value> {};
+
+/**
+ * @brief Writes the type information checked by check_type_tag: the
+ * demangled type name if THALLIUM_DEBUG_RPC_TYPES is defined, or its
+ * 64-bit fingerprint, computed at compile time, if THALLIUM_HASH_RPC_TYPES
+ * is defined. Nothing is written otherwise.
+ */
+template <typename T, typename Archive>
+void save_type_tag(Archive& ar) {
+#if defined(THALLIUM_DEBUG_RPC_TYPES)
+    std::string type_name = get_type_name<T>();
+    ar << type_name;
+#elif defined(THALLIUM_HASH_RPC_TYPES)
+    uint64_t fingerprint = type_fingerprint<T>::value;
+    ar << fingerprint;
+#else
+    (void)ar;
+#endif
+}
+
+/**
+ * @brief Reads the type information written by save_type_tag and
+ * returns whether it matches T.
+ */
+template <typename T, typename Archive>
+bool check_type_tag(Archive& ar) {
+#if defined(THALLIUM_DEBUG_RPC_TYPES)
+    std::string requested_type_name = get_type_name<T>();
+    std::string received_type_name;
+    ar >> received_type_name;
+    if(requested_type_name != received_type_name) {
+        std::cerr << "[thallium] RPC type error: invalid decoding from "
+                  << "(" << received_type_name << ") to ("
+                  << requested_type_name << ")" << std::endl;
+        return false;
+    }
+#elif defined(THALLIUM_HASH_RPC_TYPES)
+    uint64_t fingerprint = 0;
+    ar >> fingerprint;
+    if(fingerprint != type_fingerprint<T>::value)
+        return false;
+#else
+    (void)ar;
+#endif
+    return true;
+}
+
+/**
+ * @brief Returns the number of bytes proc_object_encode will write.
+ */
+template <typename T, typename ... CtxArg>
+size_t encoded_size(const T& data, margo_instance_id mid,
+                    std::tuple<CtxArg...>& ctx,
+                    offload_holder* offload = nullptr) {
+    size_t size = 0;
+    proc_output_archive<CtxArg...> ar(size, ctx, mid, offload);
+    save_type_tag<T>(ar);
+    ar << data;
+    return size;
+}
+
+} // namespace detail
+
+/**
+ * @brief Encodes an object. If an offload_holder is provided, the
+ * containers larger than the RDMA offload threshold of the margo
+ * instance are exposed through it and their content is not copied.
+ * Objects are sized first if their type opts in (see
+ * presize_serialization).
+ */
 template <typename T, typename ... CtxArg>
 hg_return_t proc_object_encode(hg_proc_t proc, T& data,
                                margo_instance_id mid,
-                               std::tuple<CtxArg...>& ctx) {
+                               std::tuple<CtxArg...>& ctx,
+                               detail::offload_holder* offload = nullptr) {
     switch(hg_proc_get_op(proc)) {
     case HG_ENCODE: {
-        proc_output_archive<CtxArg...> ar(proc, ctx, mid);
-#ifdef THALLIUM_DEBUG_RPC_TYPES
-        std::string type_name = get_type_name<T>();
-        ar << type_name;
-#endif
+        if(detail::presized<typename std::decay<T>::type>::value) {
+            // grow the proc's buffer once to the size of the data, rather
+            // than letting it grow repeatedly while the data is encoded
+            size_t size = detail::encoded_size(data, mid, ctx, offload);
+            if(size > hg_proc_get_size_left(proc)) {
+                hg_return_t ret = hg_proc_set_size(proc, hg_proc_get_size_used(proc) + size);
+                if(ret != HG_SUCCESS) return ret;
+            }
+        }
+        proc_output_archive<CtxArg...> ar(proc, ctx, mid, offload);
+        detail::save_type_tag<T>(ar);
         ar << data;
     } break;
     case HG_DECODE:
@@ -74,26 +210,22 @@ hg_return_t proc_object_encode(hg_proc_t proc, T& data,
     return HG_SUCCESS;
 }
 
+/**
+ * @brief Decodes an object. Offloaded containers are pulled from the
+ * provided origin address (see proc_object_encode).
+ */
 template <typename T, typename ... CtxArg>
 hg_return_t proc_object_decode(hg_proc_t proc, T& data,
                                margo_instance_id mid,
-                               std::tuple<CtxArg...>& ctx) {
+                               std::tuple<CtxArg...>& ctx,
+                               hg_addr_t origin = HG_ADDR_NULL) {
     switch(hg_proc_get_op(proc)) {
     case HG_ENCODE:
         return HG_INVALID_ARG; // not supposed to happen
     case HG_DECODE: {
-        proc_input_archive<CtxArg...> ar(proc, ctx, mid);
-#ifdef THALLIUM_DEBUG_RPC_TYPES
-        std::string requested_type_name = get_type_name<T>();
-        std::string received_type_name;
-        ar >> received_type_name;
-        if(requested_type_name != received_type_name) {
-            std::cerr << "[thallium] RPC type error: invalid decoding from "
-                      << "(" << received_type_name << ") to ("
-                      << requested_type_name << ")" << std::endl;
+        proc_input_archive<CtxArg...> ar(proc, ctx, mid, origin);
+        if(!detail::check_type_tag<T>(ar))
             return HG_INVALID_PARAM;
-        }
-#endif
         ar >> data;
     } break;
     case HG_FREE: {
@@ -108,25 +240,13 @@ template <typename ... CtxArg>
 inline hg_return_t proc_void_object(hg_proc_t proc, std::tuple<CtxArg...>& ctx) {
     switch(hg_proc_get_op(proc)) {
     case HG_ENCODE: {
-#ifdef THALLIUM_DEBUG_RPC_TYPES
         proc_output_archive<CtxArg...> ar(proc, ctx);
-        std::string         type_name = "void";
-        ar << type_name;
-#endif
+        detail::save_type_tag<void>(ar);
     } break;
     case HG_DECODE: {
-#ifdef THALLIUM_DEBUG_RPC_TYPES
         proc_input_archive<CtxArg...> ar(proc, ctx);
-        std::string        requested_type_name = "void";
-        std::string        received_type_name;
-        ar >> received_type_name;
-        if(requested_type_name != received_type_name) {
-            std::cerr << "[thallium] RPC type error: invalid decoding from "
-                      << "(" << received_type_name << ") to ("
-                      << requested_type_name << ")" << std::endl;
+        if(!detail::check_type_tag<void>(ar))
             return HG_INVALID_PARAM;
-        }
-#endif
     } break;
     case HG_FREE: {
     }
@@ -136,6 +256,222 @@ inline hg_return_t proc_void_object(hg_proc_t proc, std::tuple<CtxArg...>& ctx)
     return HG_SUCCESS;
 }
 
+namespace detail {
+
+/**
+ * @brief Header preceding the arguments of the calls that need one,
+ * i.e. the calls propagating their deadline (see
+ * remote_procedure::enable_deadline_propagation()), those with compressed
+ * arguments, and those expecting a status in their response (see
+ * rpc_status). It carries the absolute deadline of the call, in
+ * microseconds since the epoch of the system clock (0 if the call has no
+ * timeout or does not propagate it), so that the
+ * server can drop the calls whose caller has already given up. Deadlines
+ * are only meaningful if the clocks of the caller and of the server are
+ * synchronized. It also carries the id of the codec with which the
+ * arguments were compressed (0 if they were not, see
+ * remote_procedure::set_compression()). Calls with a header are sent
+ * to the header variant of their RPC (see header_rpc_name()), so the
+ * other calls keep the wire format of plain margo RPCs.
+ */
+struct rpc_header {
+    uint64_t m_deadline_us = 0;
+    uint8_t  m_codec       = 0;
+
+    /**
+     * @brief Creates the header of a call sent with the provided
+     * timeout (in milliseconds, no timeout if not positive).
+     */
+    static rpc_header with_timeout(double timeout_ms) {
+        rpc_header header;
+        if(timeout_ms > 0.0)
+            header.m_deadline_us = now_us() + static_cast<uint64_t>(timeout_ms * 1000.0);
+        return header;
+    }
+
+    static uint64_t now_us() {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(
+            system_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief Returns whether the call can be sent without the header.
+     */
+    bool empty() const {
+        return m_deadline_us == 0 && m_codec == 0;
+    }
+
+    bool expired() const {
+        return m_deadline_us != 0 && now_us() >= m_deadline_us;
+    }
+};
+
+inline hg_return_t proc_rpc_header(hg_proc_t proc, rpc_header& header) {
+    hg_return_t ret = hg_proc_uint64_t(proc, &header.m_deadline_us);
+    if(ret != HG_SUCCESS)
+        return ret;
+    return hg_proc_uint8_t(proc, &header.m_codec);
+}
+
+/**
+ * @brief Name under which the header variant of an RPC is registered.
+ * Its calls start with an rpc_header, and are handled by the same
+ * handler as the RPC itself.
+ */
+inline std::string header_rpc_name(const std::string& name) {
+    return name + "#header";
+}
+
+/**
+ * @brief Counterparts of margo_get_input and margo_free_input for the calls
+ * sent to the header variant of an RPC, skipping the rpc_header before
+ * running the provided meta_proc_fn on the arguments.
+ */
+inline hg_return_t get_rpc_input(hg_handle_t handle, void* data) {
+    auto         mproc = static_cast<meta_proc_fn*>(data);
+    meta_proc_fn skip  = [mproc](hg_proc_t proc) {
+        rpc_header  header;
+        hg_return_t ret = proc_rpc_header(proc, header);
+        if(ret != HG_SUCCESS)
+            return ret;
+        return (*mproc)(proc);
+    };
+    return margo_get_input(handle, &skip);
+}
+
+inline hg_return_t free_rpc_input(hg_handle_t handle, void* data) {
+    auto         mproc = static_cast<meta_proc_fn*>(data);
+    meta_proc_fn skip  = [mproc](hg_proc_t proc) {
+        rpc_header  header;
+        hg_return_t ret = proc_rpc_header(proc, header);
+        if(ret != HG_SUCCESS)
+            return ret;
+        return (*mproc)(proc);
+    };
+    return margo_free_input(handle, &skip);
+}
+
+/**
+ * @brief Status preceding the responses to the calls sent to the header
+ * variant of an RPC (see rpc_header): either the handler's response
+ * follows (ok, or offloaded if it contains data offloaded to RDMA, in
+ * which case the status is followed by the token the client acknowledges
+ * once it pulled the data), or the request was rejected by admission
+ * control (see admission_limits), or its arguments could not be decoded
+ * (error). Responses to the other calls carry no status, so they keep
+ * the wire format of plain margo responses.
+ */
+enum class rpc_status : uint8_t { ok = 0, busy = 1, offloaded = 2, error = 3 };
+
+struct rpc_response_header {
+    rpc_status m_status = rpc_status::ok;
+    uint64_t   m_token  = 0;
+};
+
+inline hg_return_t proc_rpc_status(hg_proc_t proc, rpc_response_header& header) {
+    uint8_t     s   = static_cast<uint8_t>(header.m_status);
+    hg_return_t ret = hg_proc_uint8_t(proc, &s);
+    if(ret != HG_SUCCESS)
+        return ret;
+    header.m_status = static_cast<rpc_status>(s);
+    if(header.m_status == rpc_status::offloaded)
+        ret = hg_proc_uint64_t(proc, &header.m_token);
+    return ret;
+}
+
+/**
+ * @brief Responds to a call whose arguments could not be decoded. A call
+ * sent to the header variant of its RPC gets the error status, the others
+ * get an empty response, which their caller fails to decode.
+ */
+inline hg_return_t respond_with_error(hg_handle_t handle, bool with_status) {
+    rpc_response_header status;
+    status.m_status    = rpc_status::error;
+    std::tuple<> ctx;
+    meta_proc_fn mproc = [&status, &ctx, with_status](hg_proc_t proc) {
+        if(with_status)
+            return proc_rpc_status(proc, status);
+        return proc_void_object(proc, ctx);
+    };
+    return margo_respond(handle, &mproc);
+}
+
+} // namespace detail
+
+/**
+ * @brief Encodes the status (if the call was sent to the header variant
+ * of its RPC) and the content of a response. Only responses with a
+ * status may offload data: the response is sized first, which exposes
+ * the containers to offload, so that the status preceding it tells
+ * whether any was.
+ */
+template <typename T, typename ... CtxArg>
+hg_return_t proc_rpc_output_encode(hg_proc_t proc, T& data, margo_instance_id mid,
+                                   std::tuple<CtxArg...>& ctx, bool with_status,
+                                   detail::offload_holder* offload = nullptr) {
+    if(!with_status)
+        return proc_object_encode(proc, data, mid, ctx);
+    detail::rpc_response_header status;
+    if(offload != nullptr && hg_proc_get_op(proc) == HG_ENCODE) {
+        detail::encoded_size(data, mid, ctx, offload);
+        if(!offload->empty()) {
+            status.m_status = detail::rpc_status::offloaded;
+            status.m_token  = offload->token();
+        }
+    }
+    hg_return_t ret = detail::proc_rpc_status(proc, status);
+    if(ret != HG_SUCCESS)
+        return ret;
+    return proc_object_encode(proc, data, mid, ctx, offload);
+}
+
+/**
+ * @brief Encodes the status (if the call was sent to the header variant
+ * of its RPC) of an empty response.
+ */
+template <typename ... CtxArg>
+hg_return_t proc_rpc_void_output(hg_proc_t proc, std::tuple<CtxArg...>& ctx,
+                                 bool with_status) {
+    if(!with_status)
+        return proc_void_object(proc, ctx);
+    detail::rpc_response_header status;
+    hg_return_t                 ret = detail::proc_rpc_status(proc, status);
+    if(ret != HG_SUCCESS)
+        return ret;
+    return proc_void_object(proc, ctx);
+}
+
+/**
+ * @brief Encodes the header (if any) and the arguments of an RPC.
+ */
+template <typename T, typename ... CtxArg>
+hg_return_t proc_rpc_input_encode(hg_proc_t proc, detail::rpc_header* header,
+                                  T& data, margo_instance_id mid,
+                                  std::tuple<CtxArg...>& ctx,
+                                  detail::offload_holder* offload = nullptr) {
+    if(header != nullptr) {
+        hg_return_t ret = detail::proc_rpc_header(proc, *header);
+        if(ret != HG_SUCCESS)
+            return ret;
+    }
+    return proc_object_encode(proc, data, mid, ctx, offload);
+}
+
+/**
+ * @brief Encodes the header (if any) of an RPC that has no arguments.
+ */
+template <typename ... CtxArg>
+hg_return_t proc_rpc_void_input(hg_proc_t proc, detail::rpc_header* header,
+                                std::tuple<CtxArg...>& ctx) {
+    if(header != nullptr) {
+        hg_return_t ret = detail::proc_rpc_header(proc, *header);
+        if(ret != HG_SUCCESS)
+            return ret;
+    }
+    return proc_void_object(proc, ctx);
+}
+
 } // namespace thallium
 
 #endif
@@ -99,81 +99,89 @@ template <typename T> class provider {
     }
 
   private:
+    static decode_context_factory<detail::empty_decode_context> no_decode_context() {
+        return decode_context(detail::empty_decode_context());
+    }
+
     // define_member as RPC for the case return value is NOT void and
     // the first argument is a request. The return value should be ignored,
     // since the user is expected to call req.respond(...).
-    template <typename S, typename R, typename A1, typename... Args>
+    template <typename S, typename R, typename A1, typename... Args, typename Ctx>
     remote_procedure define_member(
         S&& name, R (T::*func)(A1, Args...),
         const std::integral_constant<bool, false>& r_is_void,
         const std::integral_constant<bool, true>&  first_arg_is_request,
-        const pool&                                p) {
+        const pool&                                p,
+        const Ctx&                                 ctx) {
         (void)r_is_void;
         (void)first_arg_is_request;
         T* self = static_cast<T*>(this);
         std::function<void(const request&, Args...)> fun =
             [self, func](const request& req, Args... args) {
-                (self->*func)(req, args...);
+                (self->*func)(req, std::forward<Args>(args)...);
             };
-        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p);
+        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p, ctx);
     }
 
     // define_member as RPC for the case the return value is NOT void
     // and the request is not passed to the function. The return value
     // should be sent using req.respond(...).
-    template <typename S, typename R, typename... Args>
+    template <typename S, typename R, typename... Args, typename Ctx>
     remote_procedure define_member(
         S&&                                        name, R (T::*func)(Args...),
         const std::integral_constant<bool, false>& r_is_void,
         const std::integral_constant<bool, false>& first_arg_is_request,
-        const pool&                                p) {
+        const pool&                                p,
+        const Ctx&                                 ctx) {
         (void)r_is_void;
         (void)first_arg_is_request;
         T* self = static_cast<T*>(this);
         std::function<void(const request&, Args...)> fun =
             [self, func](const request& req, Args... args) {
-                R r = (self->*func)(args...);
-                req.respond(r);
+                R r = (self->*func)(std::forward<Args>(args)...);
+                req.respond(std::move(r));
             };
-        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p);
+        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p, ctx);
     }
 
     // define_memver as RPC for the case the return value IS void
     // and the first argument is a request. The user is expected to call
     // req.respond(...) himself.
-    template <typename S, typename R, typename A1, typename... Args>
+    template <typename S, typename R, typename A1, typename... Args, typename Ctx>
     remote_procedure define_member(
         S&& name, R (T::*func)(A1, Args...),
         const std::integral_constant<bool, true>& r_is_void,
         const std::integral_constant<bool, true>& first_arg_is_request,
-        const pool&                               p = pool()) {
+        const pool&                               p,
+        const Ctx&                                ctx) {
         (void)r_is_void;
         (void)first_arg_is_request;
         T* self = static_cast<T*>(this);
         std::function<void(const request&, Args...)> fun =
             [self, func](const request& req, Args... args) {
-                (self->*func)(req, args...);
+                (self->*func)(req, std::forward<Args>(args)...);
             };
-        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p);
+        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p, ctx);
     }
 
     // define_member as RPC for the case the return value IS void
     // and the first argument IS NOT a request. We call disable_response.
-    template <typename S, typename R, typename... Args>
+    template <typename S, typename R, typename... Args, typename Ctx>
     remote_procedure define_member(
         S&&                                        name, R (T::*func)(Args...),
         const std::integral_constant<bool, true>&  r_is_void,
         const std::integral_constant<bool, false>& first_arg_is_request,
-        const pool&                                p = pool()) {
+        const pool&                                p,
+        const Ctx&                                 ctx) {
         (void)r_is_void;
         (void)first_arg_is_request;
         T* self = static_cast<T*>(this);
         std::function<void(const request&, Args...)> fun =
             [self, func](const request& req, Args... args) {
                 (void)req;
-                (self->*func)(args...);
+                (self->*func)(std::forward<Args>(args)...);
             };
-        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p)
+        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p, ctx)
             .disable_response();
     }
 
@@ -184,78 +192,82 @@ template <typename T> class provider {
     // define_member as RPC for the case return value is NOT void and
     // the first argument is a request. The return value should be ignored,
     // since the user is expected to call req.respond(...).
-    template <typename S, typename R, typename A1, typename... Args>
+    template <typename S, typename R, typename A1, typename... Args, typename Ctx>
     remote_procedure define_member(
         S&& name, R (T::*func)(A1, Args...) const,
         const std::integral_constant<bool, false>& r_is_void,
         const std::integral_constant<bool, true>&  first_arg_is_request,
-        const pool&                                p) {
+        const pool&                                p,
+        const Ctx&                                 ctx) {
         (void)r_is_void;
         (void)first_arg_is_request;
         T* self = static_cast<T*>(this);
         std::function<void(const request&, Args...)> fun =
             [self, func](const request& req, Args... args) {
-                (self->*func)(req, args...);
+                (self->*func)(req, std::forward<Args>(args)...);
             };
-        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p);
+        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p, ctx);
     }
 
     // define_member as RPC for the case the return value is NOT void
     // and the request is not passed to the function. The return value
     // should be sent using req.respond(...).
-    template <typename S, typename R, typename... Args>
+    template <typename S, typename R, typename... Args, typename Ctx>
     remote_procedure define_member(
         S&& name, R (T::*func)(Args...) const,
         const std::integral_constant<bool, false>& r_is_void,
         const std::integral_constant<bool, false>& first_arg_is_request,
-        const pool&                                p) {
+        const pool&                                p,
+        const Ctx&                                 ctx) {
         (void)r_is_void;
         (void)first_arg_is_request;
         T* self = static_cast<T*>(this);
         std::function<void(const request&, Args...)> fun =
             [self, func](const request& req, Args... args) {
-                R r = (self->*func)(args...);
-                req.respond(r);
+                R r = (self->*func)(std::forward<Args>(args)...);
+                req.respond(std::move(r));
             };
-        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p);
+        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p, ctx);
     }
 
     // define_memver as RPC for the case the return value IS void
     // and the first argument is a request. The user is expected to call
     // req.respond(...) himself.
-    template <typename S, typename R, typename A1, typename... Args>
+    template <typename S, typename R, typename A1, typename... Args, typename Ctx>
     remote_procedure define_member(
         S&& name, R (T::*func)(A1, Args...) const,
         const std::integral_constant<bool, true>& r_is_void,
         const std::integral_constant<bool, true>& first_arg_is_request,
-        const pool&                               p = pool()) {
+        const pool&                               p,
+        const Ctx&                                ctx) {
         (void)r_is_void;
         (void)first_arg_is_request;
         T* self = static_cast<T*>(this);
         std::function<void(const request&, Args...)> fun =
             [self, func](const request& req, Args... args) {
-                (self->*func)(req, args...);
+                (self->*func)(req, std::forward<Args>(args)...);
             };
-        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p);
+        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p, ctx);
     }
 
     // define_member as RPC for the case the return value IS void
     // and the first argument IS NOT a request. We call disable_response.
-    template <typename S, typename R, typename... Args>
+    template <typename S, typename R, typename... Args, typename Ctx>
     remote_procedure define_member(
         S&& name, R (T::*func)(Args...) const,
         const std::integral_constant<bool, true>&  r_is_void,
         const std::integral_constant<bool, false>& first_arg_is_request,
-        const pool&                                p = pool()) {
+        const pool&                                p,
+        const Ctx&                                 ctx) {
         (void)r_is_void;
         (void)first_arg_is_request;
         T* self = static_cast<T*>(this);
         std::function<void(const request&, Args...)> fun =
             [self, func](const request& req, Args... args) {
                 (void)req;
-                (self->*func)(args...);
+                (self->*func)(std::forward<Args>(args)...);
             };
-        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p)
+        return get_engine().define(std::forward<S>(name), fun, m_provider_id, p, ctx)
             .disable_response();
     }
 
@@ -282,7 +294,7 @@ template <typename T> class provider {
                                    const pool& p,
                                    R_IS_VOID   r_is_void = R_IS_VOID()) {
         return define_member(std::forward<S>(name), func, r_is_void,
-                             FIRST_ARG_IS_REQUEST(), p);
+                             FIRST_ARG_IS_REQUEST(), p, no_decode_context());
     }
 
     template <typename S, typename R, typename A1, typename... Args,
@@ -292,7 +304,7 @@ template <typename T> class provider {
     inline remote_procedure define(S&&       name, R (T::*func)(A1, Args...),
                                    R_IS_VOID r_is_void = R_IS_VOID()) {
         return define_member(std::forward<S>(name), func, r_is_void,
-                             FIRST_ARG_IS_REQUEST(), pool());
+                             FIRST_ARG_IS_REQUEST(), pool(), no_decode_context());
     }
 
     template <typename S, typename R,
@@ -301,7 +313,7 @@ template <typename T> class provider {
                                    R_IS_VOID r_is_void = R_IS_VOID()) {
         std::integral_constant<bool, false> first_arg_is_request;
         return define_member(std::forward<S>(name), func, r_is_void,
-                             first_arg_is_request, p);
+                             first_arg_is_request, p, no_decode_context());
     }
 
     template <typename S, typename R,
@@ -310,7 +322,7 @@ template <typename T> class provider {
                                    R_IS_VOID r_is_void = R_IS_VOID()) {
         std::integral_constant<bool, false> first_arg_is_request;
         return define_member(std::forward<S>(name), func, r_is_void,
-                             first_arg_is_request, pool());
+                             first_arg_is_request, pool(), no_decode_context());
     }
 
     // ---
@@ -325,7 +337,7 @@ template <typename T> class provider {
                                    const pool& p,
                                    R_IS_VOID   r_is_void = R_IS_VOID()) {
         return define_member(std::forward<S>(name), func, r_is_void,
-                             FIRST_ARG_IS_REQUEST(), p);
+                             FIRST_ARG_IS_REQUEST(), p, no_decode_context());
     }
 
     template <typename S, typename R, typename A1, typename... Args,
@@ -335,7 +347,7 @@ template <typename T> class provider {
     inline remote_procedure define(S&& name, R (T::*func)(A1, Args...) const,
                                    R_IS_VOID r_is_void = R_IS_VOID()) {
         return define_member(std::forward<S>(name), func, r_is_void,
-                             FIRST_ARG_IS_REQUEST(), pool());
+                             FIRST_ARG_IS_REQUEST(), pool(), no_decode_context());
     }
 
     template <typename S, typename R,
@@ -345,7 +357,7 @@ template <typename T> class provider {
                                    R_IS_VOID   r_is_void = R_IS_VOID()) {
         std::integral_constant<bool, false> first_arg_is_request;
         return define_member(std::forward<S>(name), func, r_is_void,
-                             first_arg_is_request, p);
+                             first_arg_is_request, p, no_decode_context());
     }
 
     template <typename S, typename R,
@@ -354,7 +366,98 @@ template <typename T> class provider {
                                    R_IS_VOID r_is_void = R_IS_VOID()) {
         std::integral_constant<bool, false> first_arg_is_request;
         return define_member(std::forward<S>(name), func, r_is_void,
-                             first_arg_is_request, pool());
+                             first_arg_is_request, pool(), no_decode_context());
+    }
+
+    /**
+     * @brief Defines an RPC using a member function of the child class,
+     * decoding the arguments of each request with the serialization
+     * context created by the provided factory (see decode_context()).
+     *
+     * @param name name of the RPC
+     * @param T::*func member function
+     * @param p Argobots pool
+     * @param ctx factory of the context, called once per request
+     */
+    template <typename S, typename R, typename A1, typename... Args, typename F>
+    inline remote_procedure define(S&& name, R (T::*func)(A1, Args...),
+                                   const pool& p,
+                                   const decode_context_factory<F>& ctx) {
+        return define_member(std::forward<S>(name), func,
+                             typename std::is_void<R>::type(),
+                             typename std::is_same<A1, const request&>::type(),
+                             p, ctx);
+    }
+
+    template <typename S, typename R, typename A1, typename... Args, typename F>
+    inline remote_procedure define(S&& name, R (T::*func)(A1, Args...),
+                                   const decode_context_factory<F>& ctx) {
+        return define(std::forward<S>(name), func, pool(), ctx);
+    }
+
+    template <typename S, typename R, typename A1, typename... Args, typename F>
+    inline remote_procedure define(S&& name, R (T::*func)(A1, Args...) const,
+                                   const pool& p,
+                                   const decode_context_factory<F>& ctx) {
+        return define_member(std::forward<S>(name), func,
+                             typename std::is_void<R>::type(),
+                             typename std::is_same<A1, const request&>::type(),
+                             p, ctx);
+    }
+
+    template <typename S, typename R, typename A1, typename... Args, typename F>
+    inline remote_procedure define(S&& name, R (T::*func)(A1, Args...) const,
+                                   const decode_context_factory<F>& ctx) {
+        return define(std::forward<S>(name), func, pool(), ctx);
+    }
+
+    /**
+     * @brief Defines an RPC from its signature (see rpc_signature) using
+     * a member function of the child class, which takes the arguments of
+     * the RPC and returns its result.
+     *
+     * @param sig signature of the RPC
+     * @param T::*func member function
+     * @param p Argobots pool
+     */
+    template <typename R, typename... Args, typename R2, typename A1, typename... A>
+    inline typed_remote_procedure<R(Args...)>
+    define(const rpc_signature<R(Args...)>& sig, R2 (T::*func)(A1, A...),
+           const pool& p = pool()) {
+        return define_typed(sig, func, p);
+    }
+
+    template <typename R, typename... Args, typename R2>
+    inline typed_remote_procedure<R(Args...)>
+    define(const rpc_signature<R(Args...)>& sig, R2 (T::*func)(),
+           const pool& p = pool()) {
+        return define_typed(sig, func, p);
+    }
+
+    template <typename R, typename... Args, typename R2, typename A1, typename... A>
+    inline typed_remote_procedure<R(Args...)>
+    define(const rpc_signature<R(Args...)>& sig, R2 (T::*func)(A1, A...) const,
+           const pool& p = pool()) {
+        return define_typed(sig, func, p);
+    }
+
+    template <typename R, typename... Args, typename R2>
+    inline typed_remote_procedure<R(Args...)>
+    define(const rpc_signature<R(Args...)>& sig, R2 (T::*func)() const,
+           const pool& p = pool()) {
+        return define_typed(sig, func, p);
+    }
+
+  private:
+
+    template <typename R, typename... Args, typename F>
+    typed_remote_procedure<R(Args...)>
+    define_typed(const rpc_signature<R(Args...)>& sig, F func, const pool& p) {
+        T* self = static_cast<T*>(this);
+        return get_engine().define(sig,
+            [self, func](auto&&... args) -> decltype(auto) {
+                return (self->*func)(std::forward<decltype(args)>(args)...);
+            }, m_provider_id, p);
     }
 
   public:
@@ -373,6 +476,23 @@ template <typename T> class provider {
      * @return The provider id.
      */
     uint16_t get_provider_id() const { return m_provider_id; }
+
+    /**
+     * @brief Sets the admission limits shared by the RPCs of this
+     * provider (see engine::set_admission_limits()).
+     *
+     * @param limits Limits (0 for unlimited).
+     */
+    void set_admission_limits(const admission_limits& limits) {
+        get_engine().set_admission_limits(m_provider_id, limits);
+    }
+
+    /**
+     * @brief Returns the admission counters of this provider.
+     */
+    admission_stats get_admission_stats() const {
+        return get_engine().get_admission_stats(m_provider_id);
+    }
 };
 
 } // namespace thallium
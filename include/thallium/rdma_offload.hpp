@@ -0,0 +1,370 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_RDMA_OFFLOAD_HPP
+#define __THALLIUM_RDMA_OFFLOAD_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <margo.h>
+#include <mercury_proc.h>
+#include <cereal/cereal.hpp>
+#include <thallium/exception.hpp>
+#include <thallium/instance_data.hpp>
+#include <thallium/mutex.hpp>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Registers the RPC by which a client tells a server that it has
+ * pulled the offloaded data of a response (defined in engine.hpp).
+ */
+hg_id_t register_offload_ack_rpc(margo_instance_id mid);
+
+/**
+ * @brief Sends, without blocking, the acknowledgement of the offloaded
+ * data of the response received in the provided handle, once the data
+ * was pulled (defined in engine.hpp).
+ */
+void acknowledge_offload(margo_instance_id mid, hg_handle_t handle, uint64_t token);
+
+/**
+ * @brief Bit set in the size tag of a container whose content was
+ * offloaded: the tag is followed by a bulk handle exposing the content
+ * on the sender, instead of the content itself.
+ */
+constexpr uint64_t offloaded_size_flag = uint64_t(1) << 63;
+
+class offload_holder;
+
+/**
+ * @brief RDMA offload settings of a margo instance, and offloaded data
+ * of the responses that the clients have not pulled yet.
+ */
+class offload_state {
+
+  public:
+
+    offload_state(margo_instance_id mid)
+    : m_mid(mid)
+    , m_ack_id(register_offload_ack_rpc(mid))
+    , m_random(make_random()) {}
+
+    offload_state(const offload_state&)            = delete;
+    offload_state& operator=(const offload_state&) = delete;
+
+    void configure(size_t threshold, double ack_timeout_ms) {
+        std::lock_guard<mutex> lock(m_mutex);
+        m_ack_timeout_ms = ack_timeout_ms;
+        m_threshold.store(threshold, std::memory_order_release);
+    }
+
+    size_t threshold() const {
+        return m_threshold.load(std::memory_order_acquire);
+    }
+
+    hg_id_t ack_id() const {
+        return m_ack_id;
+    }
+
+    /**
+     * @brief Keeps the provided offloaded data exposed until the client
+     * at the requester address acknowledges the returned token or the
+     * acknowledgement timeout expires. The data whose timeout has expired
+     * is released. Tokens are random, so that other clients cannot guess
+     * them, and are only accepted from the requester (see release()).
+     */
+    uint64_t add_pending(std::shared_ptr<offload_holder> holder, hg_addr_t requester) {
+        std::vector<std::shared_ptr<offload_holder>> expired;
+        std::lock_guard<mutex> lock(m_mutex);
+        auto now = clock::now();
+        for(auto it = m_pending.begin(); it != m_pending.end();) {
+            if(it->second.m_deadline <= now) {
+                expired.push_back(std::move(it->second.m_holder));
+                margo_addr_free(m_mid, it->second.m_requester);
+                it = m_pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        uint64_t token = 0;
+        while(token == 0 || m_pending.count(token) != 0)
+            token = m_random();
+        hg_addr_t addr = HG_ADDR_NULL;
+        if(requester != HG_ADDR_NULL)
+            margo_addr_dup(m_mid, requester, &addr);
+        auto deadline = now + std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double, std::milli>(m_ack_timeout_ms));
+        m_pending.emplace(token, pending{std::move(holder), addr, deadline});
+        return token;
+    }
+
+    /**
+     * @brief Called when a client acknowledged the provided token. The
+     * data is only released if the client is the one it was sent to.
+     */
+    void release(uint64_t token, hg_addr_t sender) {
+        std::shared_ptr<offload_holder> holder;
+        std::lock_guard<mutex> lock(m_mutex);
+        auto it = m_pending.find(token);
+        if(it == m_pending.end()) return;
+        if(it->second.m_requester == HG_ADDR_NULL || sender == HG_ADDR_NULL
+        || !margo_addr_cmp(m_mid, it->second.m_requester, sender))
+            return;
+        holder = std::move(it->second.m_holder);
+        margo_addr_free(m_mid, it->second.m_requester);
+        m_pending.erase(it);
+    }
+
+    void on_finalize() {
+        std::unordered_map<uint64_t, pending> released;
+        std::lock_guard<mutex> lock(m_mutex);
+        released.swap(m_pending);
+        for(auto& p : released)
+            margo_addr_free(m_mid, p.second.m_requester);
+    }
+
+  private:
+
+    using clock = std::chrono::steady_clock;
+
+    struct pending {
+        std::shared_ptr<offload_holder> m_holder;
+        hg_addr_t                       m_requester;
+        clock::time_point               m_deadline;
+    };
+
+    static std::mt19937_64 make_random() {
+        std::random_device rd;
+        std::seed_seq      seed{rd(), rd(), rd(), rd(), rd(), rd(), rd(), rd()};
+        return std::mt19937_64(seed);
+    }
+
+    margo_instance_id                     m_mid;
+    hg_id_t                               m_ack_id;
+    std::atomic<size_t>                   m_threshold{0};
+    double                                m_ack_timeout_ms = 30000.0;
+    std::mt19937_64                       m_random;
+    std::unordered_map<uint64_t, pending> m_pending;
+    mutex                                 m_mutex;
+};
+
+/**
+ * @brief Memory exposed by the sender of an RPC or of a response for the
+ * receiver to pull the containers that were offloaded, rather than copied
+ * into the RPC buffer. The memory is deregistered when the holder is
+ * destroyed, so the holder must outlive the receiver's decoding. Holders
+ * are only passed to the archives of the RPCs and responses for which
+ * this is guaranteed: the caller of an RPC keeps its holder until the
+ * response arrives, and the holder of a response copies the offloaded
+ * containers and is kept by the offload_state until the client
+ * acknowledges them, so that respond() does not wait for the client.
+ */
+class offload_holder : public std::enable_shared_from_this<offload_holder> {
+
+  public:
+
+    /**
+     * @param mid Margo instance.
+     * @param state Offload state of the instance, looked up if null.
+     * @param copy Whether to expose copies of the offloaded containers.
+     * @param requester Address of the client the response is sent to,
+     * the only one allowed to acknowledge its token (see token()).
+     */
+    offload_holder(margo_instance_id mid,
+                   std::shared_ptr<offload_state> state = nullptr,
+                   bool copy = false,
+                   hg_addr_t requester = HG_ADDR_NULL)
+    : m_mid(mid)
+    , m_state(state ? std::move(state) : get_instance_data<offload_state>(mid))
+    , m_threshold(m_state->threshold())
+    , m_copy(copy)
+    , m_requester(requester) {}
+
+    offload_holder(const offload_holder&)            = delete;
+    offload_holder& operator=(const offload_holder&) = delete;
+
+    offload_holder(offload_holder&& other)
+    : m_mid(other.m_mid)
+    , m_state(std::move(other.m_state))
+    , m_threshold(other.m_threshold)
+    , m_copy(other.m_copy)
+    , m_requester(other.m_requester)
+    , m_exposed(std::move(other.m_exposed))
+    , m_token(std::exchange(other.m_token, 0)) {
+        other.m_exposed.clear();
+    }
+
+    ~offload_holder() {
+        for(auto& e : m_exposed)
+            margo_bulk_free(e.m_bulk);
+    }
+
+    /**
+     * @brief Returns whether offloading was enabled on the margo instance
+     * when the holder was created. The threshold is read once, so that
+     * all the containers of a call are checked against the same value.
+     */
+    bool enabled() const {
+        return m_threshold != 0;
+    }
+
+    /**
+     * @brief Returns whether a container of the provided size must be offloaded.
+     */
+    bool offloads(size_t size) const {
+        return size != 0 && enabled() && size >= m_threshold;
+    }
+
+    /**
+     * @brief Exposes the provided memory (or a copy of it) for reading.
+     * The same memory is exposed only once, since the data may be sized
+     * then encoded.
+     */
+    hg_bulk_t expose(const void* data, size_t size) {
+        for(auto& e : m_exposed)
+            if(e.m_data == data && e.m_size == size) return e.m_bulk;
+        std::unique_ptr<char[]> copy;
+        void* ptr = const_cast<void*>(data);
+        if(m_copy) {
+            copy.reset(new char[size]);
+            std::memcpy(copy.get(), data, size);
+            ptr = copy.get();
+        }
+        hg_size_t   hsize = size;
+        hg_bulk_t   bulk  = HG_BULK_NULL;
+        hg_return_t ret   = margo_bulk_create(m_mid, 1, &ptr, &hsize,
+                                              HG_BULK_READ_ONLY, &bulk);
+        if(ret != HG_SUCCESS) {
+            throw exception("Error during serialization, margo_bulk_create returned ",
+                            HG_Error_to_string(ret));
+        }
+        m_exposed.push_back(exposed{data, size, bulk, std::move(copy)});
+        return bulk;
+    }
+
+    bool empty() const {
+        return m_exposed.empty();
+    }
+
+    /**
+     * @brief Hands the holder of a response over to the offload_state,
+     * which keeps it until the client acknowledges the returned token.
+     * The holder must be owned by a std::shared_ptr.
+     */
+    uint64_t token() {
+        if(m_token == 0) m_token = m_state->add_pending(shared_from_this(), m_requester);
+        return m_token;
+    }
+
+  private:
+
+    struct exposed {
+        const void*             m_data;
+        size_t                  m_size;
+        hg_bulk_t               m_bulk;
+        std::unique_ptr<char[]> m_copy;
+    };
+
+    margo_instance_id              m_mid;
+    std::shared_ptr<offload_state> m_state;
+    size_t                         m_threshold;
+    bool                           m_copy;
+    hg_addr_t                      m_requester;
+    std::vector<exposed>           m_exposed;
+    uint64_t                       m_token = 0;
+};
+
+/**
+ * @brief Returns the address of the sender of the data in the
+ * provided handle, from which offloaded data can be pulled.
+ */
+inline hg_addr_t handle_origin(hg_handle_t handle) {
+    if(handle == HG_HANDLE_NULL) return HG_ADDR_NULL;
+    const struct hg_info* info = margo_get_info(handle);
+    return info ? info->addr : HG_ADDR_NULL;
+}
+
+/**
+ * @brief Encodes the size tag of a contiguous container followed by a
+ * bulk handle exposing its content, if the archive offloads containers
+ * of this size.
+ *
+ * @return false if the container must be encoded inline.
+ */
+template <typename Archive>
+bool save_offloaded(Archive& ar, const void* data, size_t count, size_t bytes) {
+    offload_holder* offload = ar.get_offload();
+    if(offload == nullptr || !offload->offloads(bytes))
+        return false;
+    hg_bulk_t bulk = offload->expose(data, bytes);
+    ar(cereal::make_size_tag(static_cast<cereal::size_type>(count | offloaded_size_flag)));
+    if(ar.is_sizing()) {
+        // hg_proc_hg_bulk_t encodes the size of the serialized handle, then the handle
+        ar.add_size(sizeof(hg_uint64_t) + HG_Bulk_get_serialize_size(bulk, 0));
+        return true;
+    }
+    hg_return_t ret = hg_proc_hg_bulk_t(ar.get_proc(), &bulk);
+    if(ret != HG_SUCCESS) {
+        throw exception("Error during serialization, hg_proc_hg_bulk_t returned ",
+                        HG_Error_to_string(ret));
+    }
+    return true;
+}
+
+inline bool is_offloaded(cereal::size_type size) {
+    return (size & offloaded_size_flag) != 0;
+}
+
+inline size_t offloaded_count(cereal::size_type size) {
+    return static_cast<size_t>(size & ~offloaded_size_flag);
+}
+
+/**
+ * @brief Decodes the bulk handle that follows the size tag of an
+ * offloaded container and pulls the content into the provided memory.
+ */
+template <typename Archive>
+void load_offloaded(Archive& ar, void* data, size_t bytes) {
+    hg_bulk_t   remote = HG_BULK_NULL;
+    hg_return_t ret    = hg_proc_hg_bulk_t(ar.get_proc(), &remote);
+    if(ret != HG_SUCCESS) {
+        throw exception("Error during deserialization, hg_proc_hg_bulk_t returned ",
+                        HG_Error_to_string(ret));
+    }
+    margo_instance_id mid    = ar.get_margo_instance();
+    hg_addr_t         origin = ar.get_origin();
+    hg_bulk_t         local  = HG_BULK_NULL;
+    hg_size_t         size   = bytes;
+    if(origin == HG_ADDR_NULL)
+        ret = HG_INVALID_ARG;
+    else
+        ret = margo_bulk_create(mid, 1, &data, &size, HG_BULK_WRITE_ONLY, &local);
+    if(ret == HG_SUCCESS) {
+        ret = margo_bulk_transfer(mid, HG_BULK_PULL, origin, remote, 0, local, 0, bytes);
+        margo_bulk_free(local);
+    }
+    margo_bulk_free(remote);
+    if(ret != HG_SUCCESS) {
+        throw exception("Error during deserialization, could not pull offloaded data: ",
+                        HG_Error_to_string(ret));
+    }
+}
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_REGISTRATION_CACHE_HPP
+#define __THALLIUM_REGISTRATION_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <margo.h>
+#include <thallium/mutex.hpp>
+
+namespace thallium {
+
+/**
+ * @brief Counters of the registration cache of an engine (see
+ * engine::get_registration_cache_stats()).
+ */
+struct registration_cache_stats {
+    uint64_t hits      = 0; // exposes served by a cached registration
+    uint64_t misses    = 0; // exposes that registered memory
+    uint64_t evictions = 0; // registrations evicted to make room
+    size_t   size      = 0; // registrations currently cached
+};
+
+namespace detail {
+
+/**
+ * @brief Cache of memory registrations (hg_bulk_t of a single segment)
+ * attached to a margo instance (see engine::set_registration_cache_size()).
+ * Registrations are indexed by bulk mode and address range, and evicted in
+ * least recently used order. The cache holds one reference to each handle,
+ * and the bulk objects created from it hold their own.
+ */
+class registration_cache {
+
+    struct entry {
+        uintptr_t   begin;
+        size_t      size;
+        hg_uint32_t mode;
+        hg_bulk_t   handle;
+    };
+
+    using lru_list = std::list<entry>;
+    using key_type = std::pair<hg_uint32_t, uintptr_t>;
+
+  public:
+
+    registration_cache(margo_instance_id) {}
+
+    registration_cache(const registration_cache&)            = delete;
+    registration_cache& operator=(const registration_cache&) = delete;
+
+    ~registration_cache() {
+        if(m_capacity != 0) enabled_caches()--;
+        clear();
+    }
+
+    /**
+     * @brief Returns whether the cache of any margo instance is enabled.
+     * When none is, memory can be exposed without looking up the cache
+     * of the instance, which locks the instance data.
+     */
+    static bool any_enabled() {
+        return enabled_caches().load(std::memory_order_acquire) != 0;
+    }
+
+    /**
+     * @brief Looks for a registration of the given mode containing
+     * [ptr, ptr+size) (or exactly matching it if exact is true).
+     *
+     * @param offset Set to the offset of ptr in the registration.
+     *
+     * @return the handle with an additional reference, or HG_BULK_NULL.
+     */
+    hg_bulk_t find(const void* ptr, size_t size, hg_uint32_t mode,
+                   bool exact, size_t& offset) {
+        uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+        std::lock_guard<mutex> lock(m_mutex);
+        auto it = m_index.upper_bound(key_type(mode, begin));
+        while(it != m_index.begin()) {
+            --it;
+            if(it->first.first != mode) break;
+            const entry& e = *it->second;
+            if(exact && (e.begin != begin || e.size != size)) break;
+            if(begin + size > e.begin + e.size) continue;
+            // move to the front of the LRU list
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            if(margo_bulk_ref_incr(e.handle) != HG_SUCCESS) break;
+            m_hits += 1;
+            offset = begin - e.begin;
+            return e.handle;
+        }
+        m_misses += 1;
+        return HG_BULK_NULL;
+    }
+
+    /**
+     * @brief Adds a registration to the cache (which takes its own
+     * reference to the handle), replacing any registration of the same
+     * mode starting at the same address and evicting the least recently
+     * used ones if the cache is full.
+     */
+    void insert(const void* ptr, size_t size, hg_uint32_t mode, hg_bulk_t handle) {
+        std::vector<hg_bulk_t> released;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            if(m_closed || m_capacity == 0) return;
+            if(margo_bulk_ref_incr(handle) != HG_SUCCESS) return;
+            key_type key(mode, reinterpret_cast<uintptr_t>(ptr));
+            auto it = m_index.find(key);
+            if(it != m_index.end()) {
+                released.push_back(it->second->handle);
+                m_lru.erase(it->second);
+                m_index.erase(it);
+            }
+            m_lru.push_front(entry{key.second, size, mode, handle});
+            m_index[key] = m_lru.begin();
+            while(m_lru.size() > m_capacity) {
+                released.push_back(evict_last());
+                m_evictions += 1;
+            }
+        }
+        for(auto h : released) margo_bulk_free(h);
+    }
+
+    /**
+     * @brief Removes the registrations overlapping [ptr, ptr+size),
+     * e.g. before freeing this memory.
+     */
+    void invalidate(const void* ptr, size_t size) {
+        uintptr_t              begin = reinterpret_cast<uintptr_t>(ptr);
+        std::vector<hg_bulk_t> released;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            for(auto it = m_lru.begin(); it != m_lru.end();) {
+                if(it->begin < begin + size && begin < it->begin + it->size) {
+                    released.push_back(it->handle);
+                    m_index.erase(key_type(it->mode, it->begin));
+                    it = m_lru.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        for(auto h : released) margo_bulk_free(h);
+    }
+
+    /**
+     * @brief Changes the maximum number of cached registrations,
+     * evicting the registrations in excess.
+     */
+    void set_capacity(size_t capacity) {
+        std::vector<hg_bulk_t> released;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            if(m_capacity == 0 && capacity != 0) enabled_caches()++;
+            if(m_capacity != 0 && capacity == 0) enabled_caches()--;
+            m_capacity = capacity;
+            while(m_lru.size() > m_capacity) released.push_back(evict_last());
+        }
+        for(auto h : released) margo_bulk_free(h);
+    }
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    registration_cache_stats stats() {
+        std::lock_guard<mutex> lock(m_mutex);
+        registration_cache_stats s;
+        s.hits      = m_hits;
+        s.misses    = m_misses;
+        s.evictions = m_evictions;
+        s.size      = m_lru.size();
+        return s;
+    }
+
+    /**
+     * @brief Releases all the cached registrations.
+     */
+    void clear() {
+        lru_list lru;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            lru.swap(m_lru);
+            m_index.clear();
+        }
+        for(auto& e : lru) margo_bulk_free(e.handle);
+    }
+
+    /**
+     * @brief Called when the margo instance is finalized.
+     */
+    void on_finalize() {
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        clear();
+    }
+
+  private:
+
+    // number of caches with a non-zero capacity, over all margo instances
+    static std::atomic<size_t>& enabled_caches() {
+        static std::atomic<size_t> count{0};
+        return count;
+    }
+
+    hg_bulk_t evict_last() {
+        entry&    e = m_lru.back();
+        hg_bulk_t h = e.handle;
+        m_index.erase(key_type(e.mode, e.begin));
+        m_lru.pop_back();
+        return h;
+    }
+
+    std::atomic<size_t>                    m_capacity{0};
+    bool                                   m_closed    = false;
+    uint64_t                               m_hits      = 0;
+    uint64_t                               m_misses    = 0;
+    uint64_t                               m_evictions = 0;
+    lru_list                               m_lru; // most recently used first
+    std::map<key_type, lru_list::iterator> m_index;
+    mutex                                  m_mutex;
+};
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
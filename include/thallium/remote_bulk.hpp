@@ -6,11 +6,15 @@
 #ifndef __THALLIUM_REMOTE_BULK_HPP
 #define __THALLIUM_REMOTE_BULK_HPP
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <deque>
 #include <margo.h>
 #include <string>
+#include <utility>
 #include <thallium/bulk.hpp>
+#include <thallium/bulk_mode.hpp>
 #include <thallium/margo_instance_ref.hpp>
 #include <vector>
 
@@ -115,6 +119,54 @@ class remote_bulk {
      */
     async_bulk_op push_from(const bulk_segment& src) const;
 
+    /**
+     * @brief Pulls the remote data in chunks of chunk_size bytes through
+     * a registered staging ring of depth chunks, keeping up to depth
+     * transfers in flight, and calls consumer(offset, data, size) on each
+     * chunk, in order, as soon as it has arrived. The consumer runs
+     * while the next chunks are being transferred, so that processing
+     * or storing the data overlaps with the network, and only
+     * chunk_size * depth bytes are registered regardless of the size of
+     * the remote region. The data passed to the consumer is only valid
+     * until it returns.
+     *
+     * @tparam F type of the consumer, invocable with (std::size_t offset,
+     * const char* data, std::size_t size).
+     * @param chunk_size Size of the chunks.
+     * @param depth Maximum number of transfers in flight.
+     * @param consumer Function called on each chunk.
+     *
+     * @return the size of data transfered.
+     */
+    template <typename F>
+    std::size_t pull_pipelined(std::size_t chunk_size, std::size_t depth,
+                               F&& consumer) const;
+
+    /**
+     * @brief Pulls data replicated in several remote bulk objects (e.g. on
+     * several servers) into a local segment, by splitting it into stripes
+     * of stripe_size bytes pulled concurrently from the replicas. Each
+     * replica has up to depth stripes in flight and is given the next
+     * pending stripe whenever one of its stripes completes, so that faster
+     * replicas end up transferring more stripes. If a transfer from a
+     * replica fails, the replica is no longer used and its stripes are
+     * pulled from the others. If the sizes don't match, the smallest
+     * size is used.
+     *
+     * @param replicas Remote bulk objects holding the same data.
+     * @param dest Local segment in which to pull the data.
+     * @param stripe_size Size of the stripes.
+     * @param depth Maximum number of stripes in flight per replica.
+     * @param bytes_per_replica If not null, set to the number of bytes
+     * pulled from each replica.
+     *
+     * @return the size of data transfered.
+     */
+    static std::size_t pull_striped(const std::vector<remote_bulk>& replicas,
+                                    const bulk_segment& dest, std::size_t stripe_size,
+                                    std::size_t depth = 2,
+                                    std::vector<std::size_t>* bytes_per_replica = nullptr);
+
     /**
      * @brief Creates a bulk_segment object by selecting a given portion
      * of the bulk object given an offset and a size.
@@ -207,17 +259,17 @@ inline async_bulk_op remote_bulk::pull_to(const bulk_segment& dest) const {
     hg_bulk_t         local_handle  = dest.m_bulk.m_bulk;
     size_t            local_offset  = dest.m_offset;
     size_t            size          = dest.m_size;
-    margo_request     req           = MARGO_REQUEST_NULL;
+    auto              completion    = std::make_shared<detail::completion_state>();
 
     if(size > m_segment.m_size)
         size = m_segment.m_size;
 
     hg_return_t ret =
-        margo_bulk_itransfer(mid, op, origin_addr, origin_handle, origin_offset,
-                             local_handle, local_offset, size, &req);
-    MARGO_ASSERT(ret, margo_bulk_itransfer);
+        detail::bulk_ctransfer(mid, op, origin_addr, origin_handle, origin_offset,
+                               local_handle, local_offset, size, -1.0, completion);
+    MARGO_ASSERT(ret, margo_bulk_ctransfer);
 
-    return async_bulk_op{size, req};
+    return async_bulk_op{mid, size, std::move(completion)};
 }
 
 inline std::size_t remote_bulk::operator<<(const bulk_segment& src) const {
@@ -252,17 +304,136 @@ inline async_bulk_op remote_bulk::push_from(const bulk_segment& src) const {
     hg_bulk_t         local_handle  = src.m_bulk.m_bulk;
     size_t            local_offset  = src.m_offset;
     size_t            size          = src.m_size;
-    margo_request     req           = MARGO_REQUEST_NULL;
+    auto              completion    = std::make_shared<detail::completion_state>();
 
     if(size > m_segment.m_size)
         size = m_segment.m_size;
 
     hg_return_t ret =
-        margo_bulk_itransfer(mid, op, origin_addr, origin_handle, origin_offset,
-                             local_handle, local_offset, size, &req);
-    MARGO_ASSERT(ret, margo_bulk_itransfer);
+        detail::bulk_ctransfer(mid, op, origin_addr, origin_handle, origin_offset,
+                               local_handle, local_offset, size, -1.0, completion);
+    MARGO_ASSERT(ret, margo_bulk_ctransfer);
+
+    return async_bulk_op{mid, size, std::move(completion)};
+}
 
-    return async_bulk_op{size, req};
+template <typename F>
+std::size_t remote_bulk::pull_pipelined(std::size_t chunk_size, std::size_t depth,
+                                        F&& consumer) const {
+    if(chunk_size == 0 || depth == 0)
+        throw exception("remote_bulk::pull_pipelined: chunk_size and depth must be positive");
+    std::size_t total   = m_segment.m_size;
+    std::size_t nchunks = total / chunk_size + (total % chunk_size != 0);
+    if(nchunks == 0)
+        return 0;
+    depth = std::min(depth, nchunks);
+
+    // the operations are declared after the staging ring
+    // so that they complete before it is released
+    std::vector<char> staging(depth * chunk_size);
+    std::vector<std::pair<void*, std::size_t>> segments{{staging.data(), staging.size()}};
+    margo_instance_id mid   = m_endpoint.m_mid;
+    bulk              local = detail::expose_uncached(mid, segments, bulk_mode::write_only);
+    std::vector<async_bulk_op> ops;
+    ops.reserve(depth);
+
+    auto issue = [&](std::size_t chunk) {
+        std::size_t offset = chunk * chunk_size;
+        std::size_t size   = std::min(chunk_size, total - offset);
+        return select(offset, size).pull_to(local.select((chunk % depth) * chunk_size, size));
+    };
+    for(std::size_t chunk = 0; chunk < depth; chunk++)
+        ops.push_back(issue(chunk));
+    for(std::size_t chunk = 0; chunk < nchunks; chunk++) {
+        async_bulk_op& op   = ops[chunk % depth];
+        std::size_t    size = op.wait();
+        const char*    data = staging.data() + (chunk % depth) * chunk_size;
+        consumer(chunk * chunk_size, data, size);
+        // the slot is free again, reuse it for the next chunk
+        if(chunk + depth < nchunks)
+            op = issue(chunk + depth);
+    }
+    return total;
+}
+
+inline std::size_t remote_bulk::pull_striped(const std::vector<remote_bulk>& replicas,
+                                             const bulk_segment& dest, std::size_t stripe_size,
+                                             std::size_t depth,
+                                             std::vector<std::size_t>* bytes_per_replica) {
+    if(replicas.empty())
+        throw exception("remote_bulk::pull_striped: no replica provided");
+    if(stripe_size == 0 || depth == 0)
+        throw exception("remote_bulk::pull_striped: stripe_size and depth must be positive");
+    std::size_t total = dest.m_size;
+    for(const auto& r : replicas) total = std::min(total, r.m_segment.m_size);
+    std::size_t nstripes = total / stripe_size + (total % stripe_size != 0);
+
+    std::deque<std::size_t>  pending;
+    std::vector<std::size_t> inflight(replicas.size(), 0);
+    std::vector<std::size_t> bytes(replicas.size(), 0);
+    std::vector<bool>        failed(replicas.size(), false);
+    for(std::size_t i = 0; i < nstripes; i++) pending.push_back(i);
+
+    // ops[i] pulls stripe owners[i].second from replica owners[i].first
+    std::vector<async_bulk_op>                        ops;
+    std::vector<std::pair<std::size_t, std::size_t>> owners;
+
+    auto issue = [&](std::size_t replica) {
+        std::size_t stripe = pending.front();
+        std::size_t offset = stripe * stripe_size;
+        std::size_t size   = std::min(stripe_size, total - offset);
+        try {
+            ops.push_back(replicas[replica].select(offset, size)
+                                           .pull_to(dest.select(offset, size)));
+        } catch(const std::exception&) {
+            failed[replica] = true;
+            return;
+        }
+        owners.emplace_back(replica, stripe);
+        inflight[replica] += 1;
+        pending.pop_front();
+    };
+    // give pending stripes to the replicas that have room for them
+    auto fill = [&]() {
+        bool progress = true;
+        while(progress && !pending.empty()) {
+            progress = false;
+            for(std::size_t r = 0; r < replicas.size() && !pending.empty(); r++) {
+                if(failed[r] || inflight[r] >= depth) continue;
+                issue(r);
+                progress = progress || !failed[r];
+            }
+        }
+    };
+
+    while(!pending.empty() || !ops.empty()) {
+        fill();
+        if(ops.empty())
+            throw exception("remote_bulk::pull_striped: transfers failed from all replicas");
+        auto done = async_bulk_op::wait_some(ops.begin(), ops.end(), 1);
+        std::vector<std::size_t> indices;
+        for(auto it : done) indices.push_back(it - ops.begin());
+        // remove completed operations from the back so the indices stay valid
+        std::sort(indices.rbegin(), indices.rend());
+        for(auto i : indices) {
+            std::size_t replica = owners[i].first;
+            std::size_t stripe  = owners[i].second;
+            try {
+                bytes[replica] += ops[i].wait();
+            } catch(const std::exception&) {
+                failed[replica] = true;
+                pending.push_front(stripe);
+            }
+            inflight[replica] -= 1;
+            ops[i]    = std::move(ops.back());
+            owners[i] = owners.back();
+            ops.pop_back();
+            owners.pop_back();
+        }
+    }
+    if(bytes_per_replica)
+        *bytes_per_replica = std::move(bytes);
+    return total;
 }
 
 } // namespace thallium
@@ -8,16 +8,30 @@
 
 #include <margo.h>
 #include <memory>
+#include <string>
+#include <vector>
 #include <thallium/margo_instance_ref.hpp>
+#include <thallium/admission.hpp>
+#include <thallium/compression.hpp>
+#include <thallium/handle_cache.hpp>
+#include <thallium/instance_data.hpp>
+#include <thallium/rdma_offload.hpp>
 
 namespace thallium {
 
 class engine;
 class endpoint;
 class provider_handle;
+class rpc_batcher;
+template <typename T> class reduction;
 template<typename ... CtxArg> class callable_remote_procedure_with_context;
 using callable_remote_procedure = callable_remote_procedure_with_context<>;
 
+namespace detail {
+struct collective_target;
+struct collective_result;
+}
+
 /**
  * @brief remote_procedure objects are produced by
  * engine::define() when defining an RPC.
@@ -27,12 +41,21 @@ using callable_remote_procedure = callable_remote_procedure_with_context<>;
  */
 class remote_procedure {
     friend class engine;
+    friend class rpc_batcher;
 
   private:
 
-    margo_instance_ref m_mid;
-    hg_id_t            m_id = 0;
-    bool               m_ignore_response;
+    margo_instance_ref                     m_mid;
+    hg_id_t                                m_id = 0;
+    hg_id_t                                m_header_id = 0; // see detail::rpc_header
+    bool                                   m_ignore_response;
+    bool                                   m_self_dispatch = false;
+    bool                                   m_busy_replies  = false;
+    bool                                   m_deadlines     = false;
+    uint32_t                               m_tree_arity    = 4;
+    std::shared_ptr<detail::handle_cache>  m_handle_cache;
+    std::shared_ptr<detail::compression>   m_compression;
+    std::shared_ptr<detail::offload_state> m_offload;
 
     /**
      * @brief Constructor. Made private because remote_procedure
@@ -40,11 +63,40 @@ class remote_procedure {
      *
      * @param mid Margo instance that created the remote_procedure.
      * @param id Mercury RPC id.
+     * @param header_id Mercury RPC id of the header variant of the RPC.
      */
-    remote_procedure(margo_instance_ref mid, hg_id_t id)
+    remote_procedure(margo_instance_ref mid, hg_id_t id, hg_id_t header_id)
     : m_mid{std::move(mid)}
     , m_id(id)
-    , m_ignore_response(false) {}
+    , m_header_id(header_id)
+    , m_ignore_response(false)
+    , m_handle_cache(detail::get_instance_data<detail::handle_cache>(m_mid))
+    , m_offload(detail::get_instance_data<detail::offload_state>(m_mid)) {}
+
+    /**
+     * @brief Returns whether all the calls sent through this
+     * remote_procedure accept a status in their response (see
+     * detail::rpc_status), which is the case if they accept busy replies.
+     * Other calls only do if they carry a header for another reason.
+     */
+    bool status_replies() const {
+        return m_busy_replies;
+    }
+
+    /**
+     * @brief Sends the call down the tree of targets and gathers
+     * the results (see broadcast() and reduce()).
+     */
+    template <typename... T>
+    detail::collective_result
+    collective(std::vector<detail::collective_target>&& targets,
+               const std::string& reduction_name, const T&... args) const;
+
+    static std::vector<detail::collective_target>
+    collective_targets(const std::vector<endpoint>& targets);
+
+    static std::vector<detail::collective_target>
+    collective_targets(const std::vector<provider_handle>& targets);
 
   public:
 
@@ -103,6 +155,166 @@ class remote_procedure {
     remote_procedure& disable_response() &;
     remote_procedure&& disable_response() &&;
 
+    /**
+     * @brief Tell the remote_procedure that calls targeting the
+     * calling process itself should be handed directly to the
+     * local handler, in a ULT of the pool the RPC was defined with,
+     * instead of going through Mercury. Arguments and responses are
+     * passed without serialization, provided the types passed by the
+     * caller match the types expected by the handler (C strings are
+     * passed as std::string); calls for which they do not match, as
+     * well as timed calls, are forwarded normally. A response read
+     * with a type different from the one provided to respond() throws
+     * an exception. Serialization contexts are ignored by such calls.
+     *
+     * Self-dispatched calls bypass the machinery of the Mercury path:
+     * they are not subject to the engine's admission limits (see
+     * engine::set_admission_limits()), do not carry a deadline even if
+     * enable_deadline_propagation() was called, and are neither offloaded
+     * to RDMA nor compressed. If the handler's ULT cannot be created, the
+     * call is forwarded normally.
+     *
+     * @return *this
+     */
+    remote_procedure& enable_self_dispatch() &;
+    remote_procedure&& enable_self_dispatch() &&;
+
+    /**
+     * @brief Tell the remote_procedure that its calls accept busy
+     * replies: a server whose admission limits they exceed rejects them
+     * (see set_admission_limits()) with a busy status in their response,
+     * and their caller gets a busy exception when reading the response.
+     * The other calls, except those propagating their deadline (see
+     * enable_deadline_propagation()), keep the wire format of plain margo
+     * RPCs, which cannot carry a status: they are rejected with
+     * HG_BUSY as the return code of the RPC, which thallium also reports
+     * as a busy exception. The server must run thallium.
+     *
+     * @return *this
+     */
+    remote_procedure& enable_busy_replies() &;
+    remote_procedure&& enable_busy_replies() &&;
+
+    /**
+     * @brief Tell the remote_procedure that its timed calls send their
+     * deadline to the server, which drops them without running their
+     * handler if the deadline has passed by the time they would start
+     * (see engine::get_expired_request_count()), and otherwise makes it
+     * visible to the handler (see request::deadline()). Deadlines are
+     * only meaningful if the clocks of the caller and of the server are
+     * synchronized. Without this, timed calls keep the wire format of
+     * plain margo RPCs. The server must run thallium.
+     *
+     * @return *this
+     */
+    remote_procedure& enable_deadline_propagation() &;
+    remote_procedure&& enable_deadline_propagation() &&;
+
+    /**
+     * @brief Sets the maximum number of children of each node in the
+     * tree used by broadcast() and reduce() (4 by default).
+     *
+     * @param arity Number of children.
+     *
+     * @return *this
+     */
+    remote_procedure& set_tree_arity(uint32_t arity) &;
+    remote_procedure&& set_tree_arity(uint32_t arity) &&;
+
+    /**
+     * @brief Sets the admission limits of this RPC, on the process
+     * that defined it with a handler. Requests exceeding them are
+     * rejected without creating a ULT, and their caller gets a busy
+     * exception. These limits apply in addition to those of the
+     * provider (see engine::set_admission_limits()).
+     *
+     * @param limits Limits (0 for unlimited).
+     *
+     * @return *this
+     */
+    remote_procedure& set_admission_limits(const admission_limits& limits) &;
+    remote_procedure&& set_admission_limits(const admission_limits& limits) &&;
+
+    /**
+     * @brief Returns the admission counters of this RPC
+     * (all zeros if no limits were set for it).
+     */
+    admission_stats get_admission_stats() const;
+
+    /**
+     * @brief Makes the calls sent through this remote_procedure compress
+     * their arguments with the provided codec when they serialize to at
+     * least threshold bytes and the codec makes them smaller. The server
+     * decompresses them before decoding them, and must have registered
+     * the codec (see engine::register_codec()) unless it is a built-in
+     * one such as lz_codec. Compressed arguments are never offloaded to
+     * RDMA. Responses are not compressed. Copies of this remote_procedure
+     * made before the call are not affected.
+     *
+     * @param c Codec (nullptr to disable compression).
+     * @param threshold Minimum size of the serialized arguments.
+     *
+     * @return *this
+     */
+    remote_procedure& set_compression(std::shared_ptr<const codec> c,
+                                      size_t threshold = 4096) &;
+    remote_procedure&& set_compression(std::shared_ptr<const codec> c,
+                                       size_t threshold = 4096) &&;
+
+    /**
+     * @brief Returns the compression counters of the calls sent through
+     * this remote_procedure and its copies since set_compression() was
+     * called (all zeros if compression is disabled).
+     */
+    compression_stats get_compression_stats() const;
+
+    /**
+     * @brief Invokes the RPC with the same arguments on all the targets.
+     * The caller sends the call to at most set_tree_arity() targets, each
+     * of which forwards it to a part of the remaining targets, and so on,
+     * so the call reaches all the targets in a number of steps logarithmic
+     * in their number. The function returns once the handler has responded
+     * on all the targets (the responses themselves are ignored), or once
+     * it has returned if responses are disabled. Each target must have
+     * defined the RPC and enabled collectives, with a policy letting it
+     * forward the call to the targets of its subtree (see
+     * engine::enable_collectives()).
+     *
+     * @param targets Endpoints or provider handles to invoke the RPC on.
+     * @param args Arguments of the RPC.
+     *
+     * @throws exception if the call failed on any of the targets.
+     */
+    template <typename... T>
+    void broadcast(const std::vector<endpoint>& targets, T&&... args) const;
+
+    template <typename... T>
+    void broadcast(const std::vector<provider_handle>& targets, T&&... args) const;
+
+    /**
+     * @brief Invokes the RPC with the same arguments on all the targets,
+     * like broadcast(), and combines their responses using the provided
+     * reduction. The responses are combined on the way up the tree, so
+     * each process only receives the combined response of its subtree.
+     * The order in which responses are combined is unspecified.
+     *
+     * @tparam R Type of the response.
+     * @param targets Endpoints or provider handles to invoke the RPC on.
+     * @param op Reduction defined by engine::define_reduction().
+     * @param args Arguments of the RPC.
+     *
+     * @return the combination of the responses.
+     *
+     * @throws exception if the call failed on any of the targets.
+     */
+    template <typename R, typename... T>
+    R reduce(const std::vector<endpoint>& targets, const reduction<R>& op,
+             T&&... args) const;
+
+    template <typename R, typename... T>
+    R reduce(const std::vector<provider_handle>& targets, const reduction<R>& op,
+             T&&... args) const;
+
     /**
      * @brief Deregisters this RPC from the engine.
      */
@@ -136,6 +348,7 @@ class auto_remote_procedure : public remote_procedure {
 } // namespace thallium
 
 #include <thallium/callable_remote_procedure.hpp>
+#include <thallium/collective.hpp>
 #include <thallium/engine.hpp>
 #include <thallium/provider_handle.hpp>
 
@@ -144,19 +357,27 @@ namespace thallium {
 inline callable_remote_procedure remote_procedure::on(const endpoint& ep) const {
     if(m_id == 0)
         throw exception("remote_procedure object isn't initialized");
-    return callable_remote_procedure(m_mid, m_id, ep, m_ignore_response, 0);
+    return callable_remote_procedure(m_mid, m_id, m_header_id, status_replies(), m_deadlines,
+                                     ep, m_ignore_response, 0,
+                                     std::tuple<>(), m_self_dispatch,
+                                     m_handle_cache, m_compression, m_offload);
 }
 
 inline callable_remote_procedure
 remote_procedure::on(const provider_handle& ph) const {
     if(m_id == 0)
         throw exception("remote_procedure object isn't initialized");
-    return callable_remote_procedure(m_mid, m_id, ph, m_ignore_response,
-                                     ph.provider_id());
+    return callable_remote_procedure(m_mid, m_id, m_header_id, status_replies(), m_deadlines,
+                                     ph, m_ignore_response,
+                                     ph.provider_id(), std::tuple<>(),
+                                     m_self_dispatch, m_handle_cache,
+                                     m_compression, m_offload);
 }
 
 inline void remote_procedure::deregister() {
     MARGO_INSTANCE_MUST_BE_VALID;
+    // the data of the header variant points to that of the RPC
+    margo_deregister(m_mid, m_header_id);
     margo_deregister(m_mid, m_id);
 }
 
@@ -168,9 +389,180 @@ inline remote_procedure& remote_procedure::disable_response() & {
     MARGO_INSTANCE_MUST_BE_VALID;
     m_ignore_response = true;
     margo_registered_disable_response(m_mid, m_id, HG_TRUE);
+    margo_registered_disable_response(m_mid, m_header_id, HG_TRUE);
+    return *this;
+}
+
+inline remote_procedure&& remote_procedure::enable_self_dispatch() && {
+    return std::move(enable_self_dispatch());
+}
+
+inline remote_procedure& remote_procedure::enable_self_dispatch() & {
+    m_self_dispatch = true;
+    return *this;
+}
+
+inline remote_procedure&& remote_procedure::enable_busy_replies() && {
+    return std::move(enable_busy_replies());
+}
+
+inline remote_procedure& remote_procedure::enable_busy_replies() & {
+    m_busy_replies = true;
+    return *this;
+}
+
+inline remote_procedure&& remote_procedure::enable_deadline_propagation() && {
+    return std::move(enable_deadline_propagation());
+}
+
+inline remote_procedure& remote_procedure::enable_deadline_propagation() & {
+    m_deadlines = true;
+    return *this;
+}
+
+inline remote_procedure&& remote_procedure::set_tree_arity(uint32_t arity) && {
+    return std::move(set_tree_arity(arity));
+}
+
+inline remote_procedure& remote_procedure::set_tree_arity(uint32_t arity) & {
+    if(arity == 0)
+        throw exception("The arity of a collective tree must be at least 1");
+    m_tree_arity = arity;
+    return *this;
+}
+
+inline remote_procedure&&
+remote_procedure::set_admission_limits(const admission_limits& limits) && {
+    return std::move(set_admission_limits(limits));
+}
+
+inline remote_procedure&
+remote_procedure::set_admission_limits(const admission_limits& limits) & {
+    MARGO_INSTANCE_MUST_BE_VALID;
+    detail::get_instance_data<detail::admission_control>(m_mid)
+        ->set_rpc_limits(m_id, limits);
     return *this;
 }
 
+inline remote_procedure&& remote_procedure::set_compression(
+        std::shared_ptr<const codec> c, size_t threshold) && {
+    return std::move(set_compression(std::move(c), threshold));
+}
+
+inline remote_procedure& remote_procedure::set_compression(
+        std::shared_ptr<const codec> c, size_t threshold) & {
+    if(c)
+        m_compression = std::make_shared<detail::compression>(std::move(c), threshold);
+    else
+        m_compression.reset();
+    return *this;
+}
+
+inline compression_stats remote_procedure::get_compression_stats() const {
+    return m_compression ? m_compression->stats() : compression_stats();
+}
+
+inline admission_stats remote_procedure::get_admission_stats() const {
+    MARGO_INSTANCE_MUST_BE_VALID;
+    return detail::get_instance_data<detail::admission_control>(m_mid)->rpc_stats(m_id);
+}
+
+inline std::vector<detail::collective_target>
+remote_procedure::collective_targets(const std::vector<endpoint>& targets) {
+    std::vector<detail::collective_target> result(targets.size());
+    for(size_t i = 0; i < targets.size(); i++)
+        result[i].m_address = static_cast<std::string>(targets[i]);
+    return result;
+}
+
+inline std::vector<detail::collective_target>
+remote_procedure::collective_targets(const std::vector<provider_handle>& targets) {
+    std::vector<detail::collective_target> result(targets.size());
+    for(size_t i = 0; i < targets.size(); i++) {
+        result[i].m_address     = static_cast<std::string>(targets[i]);
+        result[i].m_provider_id = targets[i].provider_id();
+    }
+    return result;
+}
+
+template <typename... T>
+detail::collective_result
+remote_procedure::collective(std::vector<detail::collective_target>&& targets,
+                             const std::string& reduction_name, const T&... args) const {
+    if(m_id == 0)
+        throw exception("remote_procedure object isn't initialized");
+    MARGO_INSTANCE_MUST_BE_VALID;
+    margo_instance_id          mid = m_mid;
+    detail::collective_request req;
+    req.m_id              = m_id;
+    req.m_expect_response = !m_ignore_response;
+    req.m_reduction       = reduction_name;
+    req.m_arity           = m_tree_arity;
+    auto         t        = std::make_tuple(std::cref(args)...);
+    std::tuple<> ctx;
+    meta_proc_fn mproc = [mid, &t, &ctx](hg_proc_t proc) {
+        return proc_object_encode(proc, t, mid, ctx);
+    };
+    hg_return_t ret = detail::proc_encode_to_buffer(mid, mproc, req.m_payload);
+    MARGO_ASSERT(ret, proc_encode_to_buffer);
+    detail::reduction_fn reduce;
+    if(!reduction_name.empty()) {
+        if(m_ignore_response)
+            throw exception("Cannot reduce the responses of an RPC whose responses are disabled");
+        reduce = detail::get_instance_data<detail::reduction_registry>(mid)->find(reduction_name);
+        if(!reduce)
+            throw exception("Reduction \"", reduction_name, "\" is not defined by this engine");
+    }
+    return detail::run_collective(mid, req, targets, std::move(reduce));
+}
+
+template <typename... T>
+void remote_procedure::broadcast(const std::vector<endpoint>& targets, T&&... args) const {
+    auto result = collective(collective_targets(targets), std::string(), args...);
+    if(result.m_failed != 0)
+        throw exception("Broadcast failed on ", result.m_failed, " of ",
+                        targets.size(), " targets");
+}
+
+template <typename... T>
+void remote_procedure::broadcast(const std::vector<provider_handle>& targets,
+                                 T&&... args) const {
+    auto result = collective(collective_targets(targets), std::string(), args...);
+    if(result.m_failed != 0)
+        throw exception("Broadcast failed on ", result.m_failed, " of ",
+                        targets.size(), " targets");
+}
+
+template <typename R, typename... T>
+R remote_procedure::reduce(const std::vector<endpoint>& targets,
+                           const reduction<R>& op, T&&... args) const {
+    if(targets.empty())
+        throw exception("Cannot reduce over an empty set of targets");
+    auto result = collective(collective_targets(targets), op.name(), args...);
+    if(result.m_failed != 0)
+        throw exception("Reduction failed on ", result.m_failed, " of ",
+                        targets.size(), " targets");
+    std::tuple<R> value;
+    hg_return_t   ret = detail::decode_collective_value(m_mid, result.m_payload, value);
+    MARGO_ASSERT(ret, proc_decode_from_buffer);
+    return std::move(std::get<0>(value));
+}
+
+template <typename R, typename... T>
+R remote_procedure::reduce(const std::vector<provider_handle>& targets,
+                           const reduction<R>& op, T&&... args) const {
+    if(targets.empty())
+        throw exception("Cannot reduce over an empty set of targets");
+    auto result = collective(collective_targets(targets), op.name(), args...);
+    if(result.m_failed != 0)
+        throw exception("Reduction failed on ", result.m_failed, " of ",
+                        targets.size(), " targets");
+    std::tuple<R> value;
+    hg_return_t   ret = detail::decode_collective_value(m_mid, result.m_payload, value);
+    MARGO_ASSERT(ret, proc_decode_from_buffer);
+    return std::move(std::get<0>(value));
+}
+
 } // namespace thallium
 
 
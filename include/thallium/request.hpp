@@ -6,6 +6,7 @@
 #ifndef __THALLIUM_REQUEST_HPP
 #define __THALLIUM_REQUEST_HPP
 
+#include <chrono>
 #include <margo.h>
 #include <thallium/margo_exception.hpp>
 #include <thallium/margo_instance_ref.hpp>
@@ -14,6 +15,9 @@
 #include <thallium/serialization/serialize.hpp>
 #include <thallium/endpoint.hpp>
 #include <thallium/packed_data.hpp>
+#include <thallium/self_dispatch.hpp>
+#include <thallium/batch_state.hpp>
+#include <thallium/proc_buffer.hpp>
 
 namespace thallium {
 
@@ -31,13 +35,26 @@ template<typename... CtxArg>
 class request_with_context {
     friend class engine;
     friend hg_return_t thallium_generic_rpc(hg_handle_t handle);
+    friend hg_return_t thallium_batch_rpc(hg_handle_t handle);
+    friend hg_return_t thallium_collective_rpc(hg_handle_t handle);
     template<typename ... CtxArg2> friend class request_with_context;
+    template <typename... T>
+    friend std::shared_ptr<detail::local_call>
+    detail::self_dispatch(margo_instance_id mid, hg_handle_t handle,
+                          uint16_t provider_id, std::tuple<T...>&& args);
 
   private:
-    margo_instance_ref            m_mid;
-    hg_handle_t                   m_handle;
-    bool                          m_disable_response;
-    mutable std::tuple<CtxArg...> m_context;
+    margo_instance_ref                   m_mid;
+    hg_handle_t                          m_handle;
+    bool                                 m_disable_response;
+    mutable std::tuple<CtxArg...>        m_context;
+    std::shared_ptr<detail::local_call>  m_local;
+    std::shared_ptr<detail::buffered_calls> m_batch;
+    size_t                                  m_batch_index = 0;
+    bool                                    m_has_header  = false; // see detail::rpc_header
+    mutable uint64_t                        m_deadline_us = 0;
+    mutable std::shared_ptr<const std::vector<char>> m_input_buffer; // decompressed arguments
+    std::shared_ptr<detail::offload_state>  m_offload; // set for calls sent with a header, see respond()
 
     /**
      * @brief Constructor. Made private since request_with_context are only created
@@ -59,6 +76,113 @@ class request_with_context {
         margo_ref_incr(m_handle);
     }
 
+    /**
+     * @brief Constructor used for RPCs dispatched locally
+     * (see remote_procedure::enable_self_dispatch()).
+     *
+     * @param mid Margo instance that created the request_with_context.
+     * @param local State shared with the caller.
+     * @param disable_resp whether responses are disabled.
+     * @param context Context.
+     */
+    request_with_context(margo_instance_ref mid,
+                         std::shared_ptr<detail::local_call> local,
+                         bool disable_resp = false,
+                         std::tuple<CtxArg...>&& context = std::tuple<CtxArg...>())
+    : m_mid(std::move(mid))
+    , m_handle(HG_HANDLE_NULL)
+    , m_disable_response(disable_resp)
+    , m_context(std::move(context))
+    , m_local(std::move(local)) {}
+
+    /**
+     * @brief Constructor used for calls received within a batch
+     * (see rpc_batcher) or a collective (see remote_procedure::broadcast()).
+     * The request_with_context holds a reference to the handle of the
+     * RPC that carried the call.
+     *
+     * @param mid Margo instance that created the request_with_context.
+     * @param batch Calls the call belongs to.
+     * @param index Index of the call.
+     * @param disable_resp whether responses are disabled.
+     * @param context Context.
+     */
+    request_with_context(margo_instance_ref mid,
+                         std::shared_ptr<detail::buffered_calls> batch,
+                         size_t index,
+                         bool disable_resp = false,
+                         std::tuple<CtxArg...>&& context = std::tuple<CtxArg...>())
+    : m_mid(std::move(mid))
+    , m_handle(batch->handle())
+    , m_disable_response(disable_resp)
+    , m_context(std::move(context))
+    , m_batch(std::move(batch))
+    , m_batch_index(index) {
+        margo_ref_incr(m_handle);
+    }
+
+    /**
+     * @brief Decodes the arguments of the RPC using the provided function,
+     * from the request's handle or from the batch it belongs to. The
+     * rpc_header of the call, if any, is read in the same pass: unless
+     * drop_expired is false, the function is not called if the deadline
+     * of the call has passed (HG_TIMEOUT is returned), and compressed
+     * arguments are decompressed into a buffer that later decodes read from.
+     */
+    hg_return_t decode_input(meta_proc_fn& mproc, bool drop_expired = true) const {
+        if(m_input_buffer)
+            return detail::proc_decode_from_buffer(m_mid, mproc, *m_input_buffer);
+        if(m_batch) {
+            return detail::proc_decode_from_buffer(m_mid, mproc,
+                *detail::buffered_calls::input(m_batch, m_batch_index));
+        }
+        if(!m_has_header) {
+            hg_return_t ret = margo_get_input(m_handle, &mproc);
+            if(ret != HG_SUCCESS)
+                return ret;
+            return margo_free_input(m_handle, &mproc);
+        }
+        std::shared_ptr<std::vector<char>> buffer;
+        meta_proc_fn with_header = [this, &mproc, &buffer, drop_expired](hg_proc_t proc) {
+            detail::rpc_header header;
+            hg_return_t        ret = detail::proc_rpc_header(proc, header);
+            if(ret != HG_SUCCESS)
+                return ret;
+            if(hg_proc_get_op(proc) != HG_DECODE)
+                return mproc(proc);
+            m_deadline_us = header.m_deadline_us;
+            if(drop_expired && header.expired())
+                return HG_TIMEOUT;
+            if(header.m_codec == 0)
+                return mproc(proc);
+            buffer = std::make_shared<std::vector<char>>();
+            ret    = detail::proc_decompress_input(m_mid, proc, header.m_codec, *buffer);
+            if(ret != HG_SUCCESS)
+                return ret;
+            return detail::proc_decode_from_buffer(m_mid, mproc, *buffer);
+        };
+        hg_return_t ret = margo_get_input(m_handle, &with_header);
+        if(ret != HG_SUCCESS)
+            return ret;
+        if(buffer)
+            m_input_buffer = std::move(buffer);
+        return margo_free_input(m_handle, &with_header);
+    }
+
+    /**
+     * @brief Responds to a request whose arguments could not be decoded,
+     * so that its caller gets an exception instead of a response. Calls
+     * received within a batch or a collective get an empty response.
+     */
+    void respond_error() const {
+        if(m_disable_response || m_local)
+            return;
+        if(m_batch)
+            m_batch->respond(m_batch_index, std::vector<char>());
+        else if(m_handle != HG_HANDLE_NULL)
+            detail::respond_with_error(m_handle, m_has_header);
+    }
+
   public:
     /**
      * @brief Copy constructor.
@@ -67,7 +191,16 @@ class request_with_context {
     : m_mid(other.m_mid)
     , m_handle(other.m_handle)
     , m_disable_response(other.m_disable_response)
-    , m_context(other.m_context) {
+    , m_context(other.m_context)
+    , m_local(other.m_local)
+    , m_batch(other.m_batch)
+    , m_batch_index(other.m_batch_index)
+    , m_has_header(other.m_has_header)
+    , m_deadline_us(other.m_deadline_us)
+    , m_input_buffer(other.m_input_buffer)
+    , m_offload(other.m_offload) {
+        if(m_handle == HG_HANDLE_NULL)
+            return;
         hg_return_t ret = margo_ref_incr(m_handle);
         MARGO_ASSERT(ret, margo_ref_incr);
     }
@@ -79,23 +212,42 @@ class request_with_context {
     : m_mid(std::move(other.m_mid))
     , m_handle(std::exchange(other.m_handle, HG_HANDLE_NULL))
     , m_disable_response(other.m_disable_response)
-    , m_context(std::move(other.m_context)) {}
+    , m_context(std::move(other.m_context))
+    , m_local(std::move(other.m_local))
+    , m_batch(std::move(other.m_batch))
+    , m_batch_index(other.m_batch_index)
+    , m_has_header(other.m_has_header)
+    , m_deadline_us(other.m_deadline_us)
+    , m_input_buffer(std::move(other.m_input_buffer))
+    , m_offload(std::move(other.m_offload)) {}
 
     /**
      * @brief Copy-assignment operator.
      */
     request_with_context& operator=(const request_with_context& other) {
-        if(m_handle == other.m_handle)
+        if(m_handle == other.m_handle && m_local == other.m_local
+        && m_batch == other.m_batch && m_batch_index == other.m_batch_index)
             return *this;
         hg_return_t ret;
-        ret = margo_destroy(m_handle);
-        MARGO_ASSERT(ret, margo_destroy);
+        if(m_handle != HG_HANDLE_NULL) {
+            ret = margo_destroy(m_handle);
+            MARGO_ASSERT(ret, margo_destroy);
+        }
         m_mid              = other.m_mid;
         m_handle           = other.m_handle;
         m_disable_response = other.m_disable_response;
         m_context          = other.m_context;
-        ret                = margo_ref_incr(m_handle);
-        MARGO_ASSERT(ret, margo_ref_incr);
+        m_local            = other.m_local;
+        m_batch            = other.m_batch;
+        m_batch_index      = other.m_batch_index;
+        m_has_header       = other.m_has_header;
+        m_deadline_us      = other.m_deadline_us;
+        m_input_buffer     = other.m_input_buffer;
+        m_offload          = other.m_offload;
+        if(m_handle != HG_HANDLE_NULL) {
+            ret = margo_ref_incr(m_handle);
+            MARGO_ASSERT(ret, margo_ref_incr);
+        }
         return *this;
     }
 
@@ -103,13 +255,22 @@ class request_with_context {
      * @brief Move-assignment operator.
      */
     request_with_context& operator=(request_with_context&& other) noexcept {
-        if(m_handle == other.m_handle)
+        if(m_handle == other.m_handle && m_local == other.m_local
+        && m_batch == other.m_batch && m_batch_index == other.m_batch_index)
             return *this;
-        margo_destroy(m_handle);
+        if(m_handle != HG_HANDLE_NULL)
+            margo_destroy(m_handle);
         m_mid              = std::move(other.m_mid);
         m_handle           = std::exchange(other.m_handle, HG_HANDLE_NULL);
         m_disable_response = other.m_disable_response;
         m_context          = std::move(other.m_context);
+        m_local            = std::move(other.m_local);
+        m_batch            = std::move(other.m_batch);
+        m_batch_index      = other.m_batch_index;
+        m_has_header       = other.m_has_header;
+        m_deadline_us      = other.m_deadline_us;
+        m_input_buffer     = std::move(other.m_input_buffer);
+        m_offload          = std::move(other.m_offload);
         return *this;
     }
 
@@ -117,28 +278,78 @@ class request_with_context {
      * @brief Destructor.
      */
     ~request_with_context() {
+        if(m_handle == HG_HANDLE_NULL)
+            return;
         auto ret = margo_destroy(m_handle);
         MARGO_ASSERT_TERMINATE(ret, margo_destroy);
     }
 
     /**
-     * @brief Return the request's underlying hg_handle_t.
+     * @brief Return the request's underlying hg_handle_t
+     * (for a call received within a batch, the handle of the batch).
      */
     hg_handle_t native_handle() const {
         return m_handle;
     }
 
+    /**
+     * @brief Returns whether the RPC was dispatched locally
+     * (see remote_procedure::enable_self_dispatch()), in which case
+     * it has no underlying hg_handle_t.
+     */
+    bool is_local() const {
+        return static_cast<bool>(m_local);
+    }
+
     /**
      * @brief Get the input of the RPC as a packed_data object.
      */
     auto get_input() const {
+        if(m_local)
+            return packed_data<>(m_mid, m_local->m_input);
+        if(m_batch)
+            return packed_data<>(m_mid, detail::buffered_calls::input(m_batch, m_batch_index));
+        if(m_has_header && !m_input_buffer) {
+            // reads the header, decompressing the arguments if needed
+            meta_proc_fn skip = [](hg_proc_t) { return HG_SUCCESS; };
+            hg_return_t  ret  = decode_input(skip, false);
+            MARGO_ASSERT(ret, margo_get_input);
+        }
+        if(m_input_buffer)
+            return packed_data<>(m_mid, m_input_buffer);
         return packed_data<>(
-            margo_get_input,
-            margo_free_input,
+            m_has_header ? detail::get_rpc_input : margo_get_input,
+            m_has_header ? detail::free_rpc_input : margo_free_input,
             m_handle,
             m_mid);
     }
 
+    /**
+     * @brief Returns the point in time after which the caller no longer
+     * waits for the response, if the RPC was sent with a timeout
+     * (see callable_remote_procedure::timed()) by a remote_procedure
+     * propagating deadlines (see
+     * remote_procedure::enable_deadline_propagation()), or
+     * time_point::max() otherwise. Handlers performing long computations can check it
+     * to abandon work whose result would be discarded.
+     */
+    std::chrono::system_clock::time_point deadline() const {
+        if(m_deadline_us == 0)
+            return std::chrono::system_clock::time_point::max();
+        return std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::microseconds(m_deadline_us)));
+    }
+
+    /**
+     * @brief Returns whether the deadline of the RPC has passed.
+     */
+    bool expired() const {
+        detail::rpc_header header;
+        header.m_deadline_us = m_deadline_us;
+        return header.expired();
+    }
+
     /**
      * @brief Create a new request_with_context object with a new
      * context bound to it for response serialization.
@@ -148,17 +359,46 @@ class request_with_context {
      */
     template<typename ... NewCtxArg>
     auto with_serialization_context(NewCtxArg&&... args) const {
-        return request_with_context<unwrap_decay_t<NewCtxArg>...>(
+        if(m_local) {
+            return request_with_context<unwrap_decay_t<NewCtxArg>...>(
+                m_mid,
+                m_local,
+                m_disable_response,
+                std::make_tuple<NewCtxArg...>(std::forward<NewCtxArg>(args)...));
+        }
+        if(m_batch) {
+            return request_with_context<unwrap_decay_t<NewCtxArg>...>(
+                m_mid,
+                m_batch,
+                m_batch_index,
+                m_disable_response,
+                std::make_tuple<NewCtxArg...>(std::forward<NewCtxArg>(args)...));
+        }
+        auto req = request_with_context<unwrap_decay_t<NewCtxArg>...>(
                 m_mid,
                 m_handle,
                 m_disable_response,
                 std::make_tuple<NewCtxArg...>(std::forward<NewCtxArg>(args)...));
+        req.m_has_header   = m_has_header;
+        req.m_deadline_us  = m_deadline_us;
+        req.m_input_buffer = m_input_buffer;
+        req.m_offload      = m_offload;
+        return req;
     }
 
     /**
      * @brief Responds to the sender of the RPC.
      * Serializes the series of arguments provided and
-     * send the resulting buffer to the sender.
+     * send the resulting buffer to the sender. If the RPC was dispatched
+     * locally, the arguments are handed to the caller without serialization
+     * (moved if they are passed as rvalues, copied otherwise). If it was
+     * received within a batch, the response is sent along with the
+     * responses of the other calls of the batch. If the call was sent
+     * to the header variant of the RPC (a call propagating its deadline,
+     * a compressed call, or a call to an RPC accepting busy replies), the
+     * response can offload data to RDMA (see
+     * engine::set_rdma_offload_threshold()), whether or not the client
+     * enabled offloading itself.
      *
      * @tparam T Types of parameters to serialize.
      * @param t Parameters to serialize.
@@ -169,11 +409,40 @@ class request_with_context {
             throw exception(
                 "Calling respond from an RPC that has disabled responses");
         }
-        if(m_handle != HG_HANDLE_NULL) {
+        if(m_local) {
+            using output_type = std::tuple<detail::local_type_t<T1>,
+                                           detail::local_type_t<T>...>;
+            m_local->m_output = detail::make_local_value<output_type>(
+                std::is_constructible<output_type, T1&&, T&&...>(),
+                std::forward<T1>(t1), std::forward<T>(t)...);
+            if(!m_local->m_output) {
+                throw exception(
+                    "Cannot respond to a self-dispatched RPC with values that "
+                    "cannot be copied (consider passing them using std::move)");
+            }
+            m_local->m_completed.complete(HG_SUCCESS);
+        } else if(m_batch) {
             auto args = std::make_tuple(std::cref(t1), std::cref(t)...);
             meta_proc_fn mproc = [this, &args](hg_proc_t proc) {
                 return proc_object_encode(proc, args, m_mid, m_context);
             };
+            std::vector<char> output;
+            hg_return_t ret = detail::proc_encode_to_buffer(m_mid, mproc, output);
+            MARGO_ASSERT(ret, proc_encode_to_buffer);
+            ret = m_batch->respond(m_batch_index, std::move(output));
+            MARGO_ASSERT(ret, margo_respond);
+        } else if(m_handle != HG_HANDLE_NULL) {
+            auto args = std::make_tuple(std::cref(t1), std::cref(t)...);
+            // the holder exposes copies of the offloaded containers, kept by
+            // the offload_state until the client pulled them
+            std::shared_ptr<detail::offload_holder> offload;
+            if(m_offload && m_offload->threshold() != 0)
+                offload = std::make_shared<detail::offload_holder>(
+                    m_mid, m_offload, true, detail::handle_origin(m_handle));
+            meta_proc_fn mproc = [this, &args, &offload](hg_proc_t proc) {
+                return proc_rpc_output_encode(proc, args, m_mid, m_context,
+                                              m_has_header, offload.get());
+            };
             hg_return_t ret = margo_respond(m_handle, &mproc);
             MARGO_ASSERT(ret, margo_respond);
         } else {
@@ -186,9 +455,15 @@ class request_with_context {
             throw exception(
                 "Calling respond from an RPC that has disabled responses");
         }
-        if(m_handle != HG_HANDLE_NULL) {
+        if(m_local) {
+            m_local->m_output = detail::local_value::make(std::tuple<>());
+            m_local->m_completed.complete(HG_SUCCESS);
+        } else if(m_batch) {
+            auto ret = m_batch->respond(m_batch_index, std::vector<char>());
+            MARGO_ASSERT(ret, margo_respond);
+        } else if(m_handle != HG_HANDLE_NULL) {
             meta_proc_fn mproc = [this](hg_proc_t proc) {
-                return proc_void_object(proc, m_context);
+                return proc_rpc_void_output(proc, m_context, m_has_header);
             };
             auto ret = margo_respond(m_handle, &mproc);
             MARGO_ASSERT(ret, margo_respond);
@@ -203,9 +478,15 @@ class request_with_context {
      * @return endpoint corresponding to the sender of the RPC.
      */
     endpoint get_endpoint() const {
+        hg_addr_t   addr;
+        hg_return_t ret;
+        if(m_local) {
+            ret = margo_addr_self(m_mid, &addr);
+            MARGO_ASSERT(ret, margo_addr_self);
+            return endpoint(m_mid, addr);
+        }
         const struct hg_info* info = margo_get_info(m_handle);
-        hg_addr_t             addr;
-        hg_return_t ret = margo_addr_dup(m_mid, info->addr, &addr);
+        ret = margo_addr_dup(m_mid, info->addr, &addr);
         MARGO_ASSERT(ret, margo_addr_dup);
         return endpoint(m_mid, addr);
     }
@@ -0,0 +1,299 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_RPC_BATCHER_HPP
+#define __THALLIUM_RPC_BATCHER_HPP
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <margo.h>
+#include <thallium/async_response.hpp>
+#include <thallium/batch_state.hpp>
+#include <thallium/engine.hpp>
+#include <thallium/endpoint.hpp>
+#include <thallium/exception.hpp>
+#include <thallium/mutex.hpp>
+#include <thallium/proc_buffer.hpp>
+#include <thallium/provider_handle.hpp>
+#include <thallium/remote_procedure.hpp>
+#include <thallium/thread.hpp>
+#include <thallium/timed_callback.hpp>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief State of an rpc_batcher: the queues of calls (one per endpoint
+ * and provider id) and the timer flushing them after a delay.
+ */
+class batcher_state {
+
+  public:
+
+    batcher_state(const engine& e, size_t max_calls, size_t max_bytes,
+                  double max_delay_ms)
+    : m_mid(e)
+    , m_batch_id(register_batch_rpc(e.get_margo_instance()))
+    , m_max_calls(max_calls)
+    , m_max_bytes(max_bytes)
+    , m_max_delay_ms(max_delay_ms) {
+        if(m_max_delay_ms > 0.0) {
+            m_timer.reset(new timed_callback(
+                e.create_timed_callback([this]() { on_timer(); })));
+        }
+    }
+
+    batcher_state(const batcher_state&)            = delete;
+    batcher_state& operator=(const batcher_state&) = delete;
+
+    ~batcher_state() {
+        // the timer may have fired already, in which case its callback
+        // cannot be cancelled and we wait for it to return. The mutex is
+        // not held while cancelling, since margo_timer_cancel waits for
+        // a callback in progress, which needs the mutex.
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            m_closing = true;
+        }
+        while(true) {
+            bool armed, running;
+            {
+                std::lock_guard<mutex> lock(m_mutex);
+                armed   = m_timer_armed;
+                running = m_timer_running;
+            }
+            if(!armed && !running)
+                break;
+            if(armed) {
+                try {
+                    m_timer->cancel();
+                    std::lock_guard<mutex> lock(m_mutex);
+                    m_timer_armed = false;
+                    continue;
+                } catch(const exception&) {}
+            }
+            thread::yield();
+        }
+        for(auto& q : m_queues) q->drain();
+    }
+
+    /**
+     * @brief Returns the queue associated with the endpoint and
+     * provider id, creating it if needed.
+     */
+    std::shared_ptr<batch_queue> get_queue(const endpoint& ep, uint16_t provider_id) {
+        std::lock_guard<mutex> lock(m_mutex);
+        for(auto& q : m_queues) {
+            if(q->provider_id() == provider_id && q->get_endpoint() == ep)
+                return q;
+        }
+        m_queues.push_back(std::make_shared<batch_queue>(
+            m_mid, ep, provider_id, m_batch_id, m_max_calls, m_max_bytes));
+        return m_queues.back();
+    }
+
+    /**
+     * @brief Encodes a call and adds it to the corresponding queue.
+     */
+    template <typename... T>
+    std::shared_ptr<batched_call> push(const endpoint& ep, uint16_t provider_id,
+                                       hg_id_t rpc_id, bool expect_response,
+                                       const T&... args) {
+        batch_entry entry;
+        // margo encodes the provider id in the lower 16 bits of the RPC id
+        entry.m_id              = ((rpc_id >> 16) << 16) | provider_id;
+        entry.m_expect_response = expect_response;
+        auto         t          = std::make_tuple(std::cref(args)...);
+        std::tuple<> ctx;
+        meta_proc_fn mproc = [this, &t, &ctx](hg_proc_t proc) {
+            return proc_object_encode(proc, t, m_mid, ctx);
+        };
+        hg_return_t ret = proc_encode_to_buffer(m_mid, mproc, entry.m_payload);
+        MARGO_ASSERT(ret, proc_encode_to_buffer);
+        auto queue = get_queue(ep, provider_id);
+        auto call  = queue->push(queue, std::move(entry));
+        if(m_timer) arm_timer();
+        return call;
+    }
+
+    void flush() {
+        std::vector<std::shared_ptr<batch_queue>> queues;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            queues = m_queues;
+        }
+        for(auto& q : queues) q->flush();
+    }
+
+    const margo_instance_ref& get_margo_instance_ref() const {
+        return m_mid;
+    }
+
+  private:
+
+    void arm_timer() {
+        std::lock_guard<mutex> lock(m_mutex);
+        if(m_timer_armed)
+            return;
+        m_timer->start(m_max_delay_ms);
+        m_timer_armed = true;
+    }
+
+    void on_timer() {
+        std::vector<std::shared_ptr<batch_queue>> queues;
+        {
+            std::lock_guard<mutex> lock(m_mutex);
+            // the timer can be re-armed while the queues are flushed
+            m_timer_armed = false;
+            if(m_closing)
+                return;
+            m_timer_running = true;
+            queues          = m_queues;
+        }
+        for(auto& q : queues) q->flush();
+        std::lock_guard<mutex> lock(m_mutex);
+        m_timer_running = false;
+    }
+
+    margo_instance_ref                        m_mid;
+    hg_id_t                                   m_batch_id;
+    size_t                                    m_max_calls;
+    size_t                                    m_max_bytes;
+    double                                    m_max_delay_ms;
+    std::vector<std::shared_ptr<batch_queue>> m_queues;
+    std::unique_ptr<timed_callback>           m_timer;
+    bool                                      m_timer_armed   = false;
+    bool                                      m_timer_running = false;
+    bool                                      m_closing       = false;
+    mutex                                     m_mutex;
+};
+
+} // namespace detail
+
+/**
+ * @brief An rpc_batcher buffers calls to small RPCs and sends the calls
+ * targeting the same endpoint and provider id together, as a single
+ * Mercury RPC, amortizing the per-RPC cost of Mercury. Each call gets its
+ * own async_response. Buffered calls are sent when their number reaches
+ * max_calls, when their serialized size reaches max_bytes, max_delay_ms
+ * after the first of them was buffered, when flush() is called, or when
+ * a caller waits on one of their async_response.
+ *
+ * On the server, which must have called engine::enable_batching(), the
+ * calls are demultiplexed and handed to the functions registered with
+ * engine::define(), each with its own request. Handlers
+ * cannot tell a batched call from a regular one, except that
+ * request::native_handle() returns the handle of the batch.
+ *
+ * Calls made through an rpc_batcher do not support timeouts, nor
+ * serialization contexts, and are never dispatched locally (see
+ * remote_procedure::enable_self_dispatch()).
+ *
+ * Example:
+ * @code
+ * tl::rpc_batcher batcher(engine);
+ * std::vector<tl::async_response> responses;
+ * for(int i = 0; i < 100; i++)
+ *     responses.push_back(batcher.async(put, ph, i));
+ * for(auto& r : responses)
+ *     int ret = r.wait();
+ * @endcode
+ */
+class rpc_batcher {
+
+  public:
+
+    rpc_batcher() = default;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param e Engine used to send the calls.
+     * @param max_calls Maximum number of calls in a batch.
+     * @param max_bytes Size of serialized arguments at which a batch is sent.
+     * @param max_delay_ms Maximum time a call is buffered (0 to disable,
+     * in which case calls are sent only when a threshold is reached, when
+     * flush() is called, or when a caller waits on a response).
+     */
+    rpc_batcher(const engine& e, size_t max_calls = 64,
+                size_t max_bytes = 64*1024, double max_delay_ms = 1.0)
+    : m_state(new detail::batcher_state(
+                e, max_calls, max_bytes, max_delay_ms)) {}
+
+    rpc_batcher(const rpc_batcher&)            = delete;
+    rpc_batcher& operator=(const rpc_batcher&) = delete;
+    rpc_batcher(rpc_batcher&&)                 = default;
+    rpc_batcher& operator=(rpc_batcher&&)      = default;
+
+    /**
+     * @brief Destructor. Sends the buffered calls and waits
+     * for all the batches sent to complete.
+     */
+    ~rpc_batcher() = default;
+
+    /**
+     * @brief Buffers a call to the RPC with the provided arguments,
+     * targeting the provider with id 0 at the specified endpoint.
+     *
+     * @param rpc RPC to call.
+     * @param ep Endpoint to send the call to.
+     * @param args Arguments of the call.
+     *
+     * @return an async_response to wait on for the response.
+     */
+    template <typename... T>
+    async_response async(const remote_procedure& rpc, const endpoint& ep,
+                         T&&... args) {
+        return push(rpc, ep, 0, args...);
+    }
+
+    /**
+     * @brief Buffers a call to the RPC with the provided arguments,
+     * targeting the specified provider.
+     *
+     * @param rpc RPC to call.
+     * @param ph Provider to send the call to.
+     * @param args Arguments of the call.
+     *
+     * @return an async_response to wait on for the response.
+     */
+    template <typename... T>
+    async_response async(const remote_procedure& rpc, const provider_handle& ph,
+                         T&&... args) {
+        return push(rpc, ph, ph.provider_id(), args...);
+    }
+
+    /**
+     * @brief Sends all the buffered calls.
+     */
+    void flush() {
+        if(!m_state)
+            throw exception("Calling flush on an invalid rpc_batcher");
+        m_state->flush();
+    }
+
+  private:
+
+    template <typename... T>
+    async_response push(const remote_procedure& rpc, const endpoint& ep,
+                        uint16_t provider_id, const T&... args) {
+        if(!m_state)
+            throw exception("Calling async on an invalid rpc_batcher");
+        if(rpc.m_id == 0)
+            throw exception("remote_procedure object isn't initialized");
+        auto call = m_state->push(ep, provider_id, rpc.m_id,
+                                  !rpc.m_ignore_response, args...);
+        return async_response(m_state->get_margo_instance_ref(),
+                              std::move(call), rpc.m_ignore_response);
+    }
+
+    std::unique_ptr<detail::batcher_state> m_state;
+};
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_RPC_REGISTRY_HPP
+#define __THALLIUM_RPC_REGISTRY_HPP
+
+#include <mutex>
+#include <unordered_set>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Set of the data registered with margo for the RPCs defined by
+ * an engine (see engine::find_rpc()). The ids of the calls received
+ * within a batch or a collective come from the network, and the data
+ * margo holds for them may belong to an RPC registered by another
+ * library, or to the header variant of an RPC: only the data found here
+ * can be used as an engine::rpc_callback_data.
+ */
+class rpc_registry {
+
+  public:
+
+    static void add(const void* data) {
+        auto& r = instance();
+        std::lock_guard<std::mutex> lock(r.m_mutex);
+        r.m_data.insert(data);
+    }
+
+    static void remove(const void* data) {
+        auto& r = instance();
+        std::lock_guard<std::mutex> lock(r.m_mutex);
+        r.m_data.erase(data);
+    }
+
+    static bool contains(const void* data) {
+        if(data == nullptr)
+            return false;
+        auto& r = instance();
+        std::lock_guard<std::mutex> lock(r.m_mutex);
+        return r.m_data.count(data) != 0;
+    }
+
+  private:
+
+    static rpc_registry& instance() {
+        // never destroyed, since RPCs may be deregistered by
+        // engines finalized during static destruction
+        static rpc_registry* r = new rpc_registry;
+        return *r;
+    }
+
+    std::unordered_set<const void*> m_data;
+    std::mutex                      m_mutex;
+};
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
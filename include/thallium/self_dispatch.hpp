@@ -0,0 +1,114 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_SELF_DISPATCH_HPP
+#define __THALLIUM_SELF_DISPATCH_HPP
+
+#include <margo.h>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <thallium/completion_state.hpp>
+
+namespace thallium {
+
+namespace detail {
+
+/**
+ * @brief Type under which a value exchanged with a self-dispatched
+ * RPC is stored. C strings are stored as std::string so that a caller
+ * passing a literal matches a handler expecting an std::string.
+ */
+template <typename T> struct local_type { using type = T; };
+template <> struct local_type<const char*> { using type = std::string; };
+template <> struct local_type<char*> { using type = std::string; };
+
+template <typename T>
+using local_type_t = typename local_type<typename std::decay<T>::type>::type;
+
+/**
+ * @brief Type-erased tuple of values exchanged between a caller
+ * and a handler living in the same process.
+ */
+struct local_value {
+
+    std::shared_ptr<void> m_data;
+    const std::type_info* m_type = nullptr;
+
+    template <typename Tuple>
+    static local_value make(Tuple&& t) {
+        using tuple_type = typename std::decay<Tuple>::type;
+        local_value v;
+        v.m_data = std::make_shared<tuple_type>(std::forward<Tuple>(t));
+        v.m_type = &typeid(tuple_type);
+        return v;
+    }
+
+    /**
+     * @brief Returns a pointer to the stored tuple if it is
+     * of type Tuple, nullptr otherwise.
+     */
+    template <typename Tuple>
+    Tuple* get() const {
+        if(m_type == nullptr || *m_type != typeid(Tuple))
+            return nullptr;
+        return static_cast<Tuple*>(m_data.get());
+    }
+
+    explicit operator bool() const {
+        return m_type != nullptr;
+    }
+};
+
+/**
+ * @brief Builds a local_value holding a Tuple constructed from args,
+ * or an empty local_value if Tuple cannot be constructed from them
+ * (e.g. non-copyable objects passed as lvalues).
+ */
+template <typename Tuple, typename... Args>
+local_value make_local_value(std::true_type, Args&&... args) {
+    return local_value::make(Tuple(std::forward<Args>(args)...));
+}
+
+template <typename Tuple, typename... Args>
+local_value make_local_value(std::false_type, Args&&...) {
+    return local_value();
+}
+
+/**
+ * @brief State shared by the caller and the handler of an RPC that
+ * has been dispatched locally instead of going through Mercury.
+ * The handler's request_with_context fills m_output and completes
+ * m_completed when it responds.
+ */
+struct local_call {
+    local_value      m_input;
+    local_value      m_output;
+    completion_state m_completed;
+};
+
+/**
+ * @brief Tries to dispatch an RPC targeting the calling process directly
+ * to the handler registered for it, bypassing serialization. Returns a
+ * null pointer if no handler is registered for the RPC or if the handler
+ * expects argument types that differ from those provided, in which case
+ * the caller should fall back to sending the RPC through Mercury (args
+ * is left untouched in that case). Elements of args that are rvalue
+ * references are moved into the handler's input, the others are copied.
+ * Defined in engine.hpp.
+ */
+template <typename... T>
+std::shared_ptr<local_call> self_dispatch(margo_instance_id mid,
+                                          hg_handle_t handle,
+                                          uint16_t provider_id,
+                                          std::tuple<T...>&& args);
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_BITWISE_SERIALIZATION_HPP
+#define __THALLIUM_BITWISE_SERIALIZATION_HPP
+
+#include <type_traits>
+
+namespace thallium {
+
+namespace detail {
+
+template <typename T>
+struct trivially_copyable_class
+: std::integral_constant<bool, std::is_class<T>::value
+                            && std::is_trivially_copyable<T>::value> {};
+
+} // namespace detail
+
+/**
+ * @brief Trait telling whether objects of type T can be serialized by
+ * copying their bytes. An std::vector or std::array of such objects is
+ * serialized with a single hg_proc_memcpy rather than element by element
+ * and field by field. By default the trait holds for trivially copyable
+ * classes.
+ *
+ * Specialize it to std::false_type for a trivially copyable class whose
+ * serialize function does more than copying its fields (e.g. one holding
+ * pointers). Specialize it to std::true_type for a trivially copyable
+ * class that has no serialize function to make the class itself
+ * serializable with a single hg_proc_memcpy.
+ *
+ * Since the bytes are copied as they are, both sides of an RPC must
+ * agree on the layout and endianness of the type.
+ */
+template <typename T>
+struct is_bitwise_serializable : detail::trivially_copyable_class<T> {};
+
+namespace detail {
+
+/**
+ * @brief True for elements of containers serialized with a single copy
+ * (and that can be offloaded to RDMA, see engine::set_rdma_offload_threshold()).
+ */
+template <typename T>
+struct bitwise_element
+: std::integral_constant<bool, (is_bitwise_serializable<T>::value
+                             || std::is_arithmetic<T>::value)
+                            && !std::is_same<T, bool>::value> {};
+
+/**
+ * @brief True for the types explicitly declared bitwise-serializable
+ * by a specialization of is_bitwise_serializable, which get their own
+ * save and load functions.
+ */
+template <typename T>
+struct bitwise_opt_in
+: std::integral_constant<bool, is_bitwise_serializable<T>::value
+                            && !std::is_base_of<trivially_copyable_class<T>,
+                                                is_bitwise_serializable<T>>::value> {};
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
@@ -12,6 +12,8 @@
 #include <cereal/cereal.hpp>
 #include <margo.h>
 #include <thallium/exception.hpp>
+#include <thallium/serialization/bitwise.hpp>
+#include <thallium/serialization/varint.hpp>
 
 namespace thallium {
 
@@ -19,6 +21,10 @@ namespace thallium {
 
     class engine;
 
+    namespace detail {
+        class offload_holder;
+    }
+
     template<typename ... CtxArg>
     class proc_output_archive :
         public cereal::OutputArchive<
@@ -29,11 +35,13 @@ namespace thallium {
     public:
 
         proc_output_archive(hg_proc_t p, std::tuple<CtxArg...>& context,
-                            margo_instance_id mid)
+                            margo_instance_id mid,
+                            detail::offload_holder* offload = nullptr)
         : cereal::OutputArchive<proc_output_archive, cereal::AllowEmptyClassElision>(this)
         , m_proc(p)
         , m_context(context)
         , m_mid(mid)
+        , m_offload(offload)
         {}
 
         proc_output_archive(hg_proc_t p, std::tuple<CtxArg...>& context)
@@ -42,9 +50,31 @@ namespace thallium {
         , m_context(context)
         {}
 
+        /**
+         * @brief Constructor of a sizing archive. The serialization
+         * functions run as usual, but the data is not copied anywhere:
+         * the archive only adds the size of what would be encoded to
+         * the provided counter. The hg_proc_t of a sizing archive is
+         * HG_PROC_NULL (see is_sizing()).
+         */
+        proc_output_archive(size_t& size, std::tuple<CtxArg...>& context,
+                            margo_instance_id mid,
+                            detail::offload_holder* offload = nullptr)
+        : cereal::OutputArchive<proc_output_archive, cereal::AllowEmptyClassElision>(this)
+        , m_proc(HG_PROC_NULL)
+        , m_context(context)
+        , m_mid(mid)
+        , m_size(&size)
+        , m_offload(offload)
+        {}
+
         ~proc_output_archive() = default;
 
         inline void write(const void* data, size_t size) {
+            if(m_size) {
+                *m_size += size;
+                return;
+            }
             hg_return_t ret = hg_proc_memcpy(m_proc, const_cast<void*>(data), size);
             if(ret != HG_SUCCESS) {
                 throw exception(
@@ -58,6 +88,28 @@ namespace thallium {
             return m_proc;
         }
 
+        /**
+         * @brief Returns whether this archive only computes the size
+         * of the data. Serialization functions that use get_proc()
+         * directly must then call add_size() instead.
+         */
+        bool is_sizing() const {
+            return m_size != nullptr;
+        }
+
+        void add_size(size_t size) {
+            if(m_size) *m_size += size;
+        }
+
+        /**
+         * @brief Returns the holder of the memory exposed for the
+         * containers offloaded to RDMA (null if offloading is not
+         * possible for the data being encoded).
+         */
+        detail::offload_holder* get_offload() const {
+            return m_offload;
+        }
+
         auto& get_context() {
             return m_context;
         }
@@ -75,6 +127,8 @@ namespace thallium {
         hg_proc_t              m_proc;
         std::tuple<CtxArg...>& m_context;
         margo_instance_id      m_mid = MARGO_INSTANCE_NULL;
+        size_t*                m_size = nullptr;
+        detail::offload_holder* m_offload = nullptr;
 
     };
 
@@ -88,11 +142,12 @@ namespace thallium {
     public:
 
         proc_input_archive(hg_proc_t p, std::tuple<CtxArg...>& context,
-                           margo_instance_id mid)
+                           margo_instance_id mid, hg_addr_t origin = HG_ADDR_NULL)
         : cereal::InputArchive<proc_input_archive<CtxArg...>, cereal::AllowEmptyClassElision>(this)
         , m_proc(p)
         , m_context(context)
         , m_mid(mid)
+        , m_origin(origin)
         {}
 
         proc_input_archive(hg_proc_t p, std::tuple<CtxArg...>& context)
@@ -116,6 +171,19 @@ namespace thallium {
             return m_proc;
         }
 
+        margo_instance_id get_margo_instance() const {
+            return m_mid;
+        }
+
+        /**
+         * @brief Returns the address of the sender of the data, from
+         * which containers offloaded to RDMA are pulled (HG_ADDR_NULL if
+         * the data does not come from an hg_handle_t).
+         */
+        hg_addr_t get_origin() const {
+            return m_origin;
+        }
+
         auto& get_context() {
             return m_context;
         }
@@ -132,24 +200,62 @@ namespace thallium {
 
         hg_proc_t              m_proc;
         std::tuple<CtxArg...>& m_context;
-        margo_instance_id      m_mid;
+        margo_instance_id      m_mid = MARGO_INSTANCE_NULL;
+        hg_addr_t              m_origin = HG_ADDR_NULL;
     };
 
+    // integers are encoded as varints if the serialization
+    // context contains a compact_encoding (see varint.hpp)
+
     template<class T, class... CtxArg> inline
-    typename std::enable_if<std::is_arithmetic<T>::value, void>::type
+    typename std::enable_if<std::is_arithmetic<T>::value
+                         && !detail::compact_integer<T, CtxArg...>::value, void>::type
     CEREAL_SAVE_FUNCTION_NAME(proc_output_archive<CtxArg...> & ar, T const & t)
     {
         ar.write(std::addressof(t), sizeof(t));
     }
 
     template<class T, class... CtxArg> inline
-    typename std::enable_if<std::is_arithmetic<T>::value, void>::type
+    typename std::enable_if<std::is_arithmetic<T>::value
+                         && !detail::compact_integer<T, CtxArg...>::value, void>::type
     CEREAL_LOAD_FUNCTION_NAME(proc_input_archive<CtxArg...>& ar, T & t)
     {
         t = T{};
         ar.read(std::addressof(t), sizeof(t));
     }
 
+    template<class T, class... CtxArg> inline
+    typename std::enable_if<detail::compact_integer<T, CtxArg...>::value, void>::type
+    CEREAL_SAVE_FUNCTION_NAME(proc_output_archive<CtxArg...> & ar, T const & t)
+    {
+        detail::save_varint(ar, t);
+    }
+
+    template<class T, class... CtxArg> inline
+    typename std::enable_if<detail::compact_integer<T, CtxArg...>::value, void>::type
+    CEREAL_LOAD_FUNCTION_NAME(proc_input_archive<CtxArg...>& ar, T & t)
+    {
+        detail::load_varint(ar, t);
+    }
+
+    template<class T, class... CtxArg> inline
+    typename std::enable_if<detail::bitwise_opt_in<T>::value, void>::type
+    CEREAL_SAVE_FUNCTION_NAME(proc_output_archive<CtxArg...>& ar, T const & t)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "bitwise-serializable types must be trivially copyable");
+        ar.write(std::addressof(t), sizeof(t));
+    }
+
+    template<class T, class... CtxArg> inline
+    typename std::enable_if<detail::bitwise_opt_in<T>::value, void>::type
+    CEREAL_LOAD_FUNCTION_NAME(proc_input_archive<CtxArg...>& ar, T & t)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "bitwise-serializable types must be trivially copyable");
+        ar.read(std::addressof(t), sizeof(t));
+    }
+
     template <class T, class... CtxArg> inline
     void CEREAL_SERIALIZE_FUNCTION_NAME(proc_output_archive<CtxArg...>& ar, cereal::NameValuePair<T>& t)
     {
@@ -6,6 +6,28 @@
 #ifndef __THALLIUM_ARRAY_SERIALIZATION_HPP
 #define __THALLIUM_ARRAY_SERIALIZATION_HPP
 
+#include <array>
 #include <cereal/types/array.hpp>
+#include <thallium/serialization/cereal/archives.hpp>
+
+namespace thallium {
+
+    // arrays of bitwise-serializable objects are copied in one go
+    // (these overloads are more specialized than cereal's generic ones)
+
+    template<class T, size_t N, class... CtxArg> inline
+    typename std::enable_if<detail::bitwise_element<T>::value, void>::type
+    CEREAL_SAVE_FUNCTION_NAME(proc_output_archive<CtxArg...>& ar, std::array<T, N> const & a)
+    {
+        ar.write(a.data(), sizeof(a));
+    }
+
+    template<class T, size_t N, class... CtxArg> inline
+    typename std::enable_if<detail::bitwise_element<T>::value, void>::type
+    CEREAL_LOAD_FUNCTION_NAME(proc_input_archive<CtxArg...>& ar, std::array<T, N>& a)
+    {
+        ar.read(a.data(), sizeof(a));
+    }
+}
 
 #endif
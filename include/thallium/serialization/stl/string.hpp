@@ -1,6 +1,42 @@
 #ifndef __THALLIUM_STRING_SERIALIZATION_HPP
 #define __THALLIUM_STRING_SERIALIZATION_HPP
 
+#include <string>
 #include <cereal/types/string.hpp>
+#include <thallium/serialization/cereal/archives.hpp>
+#include <thallium/rdma_offload.hpp>
+
+namespace thallium {
+
+    // large strings are offloaded to RDMA (see engine::set_rdma_offload_threshold());
+    // these overloads are more specialized than cereal's
+
+    template<class CharT, class Traits, class Alloc, class... CtxArg> inline
+    typename std::enable_if<std::is_arithmetic<CharT>::value, void>::type
+    CEREAL_SAVE_FUNCTION_NAME(proc_output_archive<CtxArg...>& ar,
+                              std::basic_string<CharT, Traits, Alloc> const & str)
+    {
+        if(detail::save_offloaded(ar, str.data(), str.size(), str.size() * sizeof(CharT)))
+            return;
+        ar(cereal::make_size_tag(static_cast<cereal::size_type>(str.size())));
+        ar.write(str.data(), str.size() * sizeof(CharT));
+    }
+
+    template<class CharT, class Traits, class Alloc, class... CtxArg> inline
+    typename std::enable_if<std::is_arithmetic<CharT>::value, void>::type
+    CEREAL_LOAD_FUNCTION_NAME(proc_input_archive<CtxArg...>& ar,
+                              std::basic_string<CharT, Traits, Alloc>& str)
+    {
+        cereal::size_type size;
+        ar(cereal::make_size_tag(size));
+        if(detail::is_offloaded(size)) {
+            str.resize(detail::offloaded_count(size));
+            detail::load_offloaded(ar, &str[0], str.size() * sizeof(CharT));
+            return;
+        }
+        str.resize(static_cast<std::size_t>(size));
+        ar.read(&str[0], str.size() * sizeof(CharT));
+    }
+}
 
 #endif
@@ -0,0 +1,41 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_STRING_VIEW_SERIALIZATION_HPP
+#define __THALLIUM_STRING_VIEW_SERIALIZATION_HPP
+
+#if __cplusplus >= 201703L
+
+#include <string_view>
+#include <thallium/span.hpp>
+
+namespace thallium {
+
+    // string_views have the wire format of std::string; when deserialized,
+    // they point into the buffer in which the RPC was received, and remain
+    // valid only as long as the request or packed_data they come from
+
+    template<class CharT, class Traits, class... CtxArg> inline
+    typename std::enable_if<std::is_arithmetic<CharT>::value, void>::type
+    CEREAL_SAVE_FUNCTION_NAME(proc_output_archive<CtxArg...>& ar,
+                              std::basic_string_view<CharT, Traits> const & str)
+    {
+        detail::save_view(ar, str.data(), str.size());
+    }
+
+    template<class CharT, class Traits, class... CtxArg> inline
+    typename std::enable_if<std::is_arithmetic<CharT>::value, void>::type
+    CEREAL_LOAD_FUNCTION_NAME(proc_input_archive<CtxArg...>& ar,
+                              std::basic_string_view<CharT, Traits>& str)
+    {
+        size_t count = 0;
+        auto   data  = detail::load_view<CharT>(ar, count);
+        str = std::basic_string_view<CharT, Traits>(data, count);
+    }
+}
+
+#endif
+
+#endif
@@ -6,6 +6,71 @@
 #ifndef __THALLIUM_VECTOR_SERIALIZATION_HPP
 #define __THALLIUM_VECTOR_SERIALIZATION_HPP
 
+#include <vector>
 #include <cereal/types/vector.hpp>
+#include <thallium/serialization/cereal/archives.hpp>
+#include <thallium/rdma_offload.hpp>
+
+namespace thallium {
+
+    // vectors of bitwise-serializable objects are copied in one go, or
+    // offloaded to RDMA if they are large enough (these overloads are
+    // more specialized than cereal's generic ones)
+
+    template<class T, class A, class... CtxArg> inline
+    typename std::enable_if<detail::bitwise_element<T>::value
+                         && !detail::compact_integer<T, CtxArg...>::value, void>::type
+    CEREAL_SAVE_FUNCTION_NAME(proc_output_archive<CtxArg...>& ar, std::vector<T, A> const & v)
+    {
+        if(detail::save_offloaded(ar, v.data(), v.size(), v.size() * sizeof(T)))
+            return;
+        ar(cereal::make_size_tag(static_cast<cereal::size_type>(v.size())));
+        ar.write(v.data(), v.size() * sizeof(T));
+    }
+
+    template<class T, class A, class... CtxArg> inline
+    typename std::enable_if<detail::bitwise_element<T>::value
+                         && !detail::compact_integer<T, CtxArg...>::value, void>::type
+    CEREAL_LOAD_FUNCTION_NAME(proc_input_archive<CtxArg...>& ar, std::vector<T, A>& v)
+    {
+        cereal::size_type size;
+        ar(cereal::make_size_tag(size));
+        if(detail::is_offloaded(size)) {
+            v.resize(detail::offloaded_count(size));
+            detail::load_offloaded(ar, v.data(), v.size() * sizeof(T));
+            return;
+        }
+        v.resize(static_cast<std::size_t>(size));
+        ar.read(v.data(), v.size() * sizeof(T));
+    }
+
+    // in compact mode, vectors of integers are encoded as varints,
+    // unless they are offloaded to RDMA as they are in memory
+
+    template<class T, class A, class... CtxArg> inline
+    typename std::enable_if<detail::compact_integer<T, CtxArg...>::value, void>::type
+    CEREAL_SAVE_FUNCTION_NAME(proc_output_archive<CtxArg...>& ar, std::vector<T, A> const & v)
+    {
+        if(detail::save_offloaded(ar, v.data(), v.size(), v.size() * sizeof(T)))
+            return;
+        ar(cereal::make_size_tag(static_cast<cereal::size_type>(v.size())));
+        detail::save_varints(ar, v.data(), v.size());
+    }
+
+    template<class T, class A, class... CtxArg> inline
+    typename std::enable_if<detail::compact_integer<T, CtxArg...>::value, void>::type
+    CEREAL_LOAD_FUNCTION_NAME(proc_input_archive<CtxArg...>& ar, std::vector<T, A>& v)
+    {
+        cereal::size_type size;
+        ar(cereal::make_size_tag(size));
+        if(detail::is_offloaded(size)) {
+            v.resize(detail::offloaded_count(size));
+            detail::load_offloaded(ar, v.data(), v.size() * sizeof(T));
+            return;
+        }
+        v.resize(static_cast<std::size_t>(size));
+        detail::load_varints(ar, v.data(), v.size());
+    }
+}
 
 #endif
@@ -0,0 +1,259 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_VARINT_SERIALIZATION_HPP
+#define __THALLIUM_VARINT_SERIALIZATION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <thallium/exception.hpp>
+
+namespace thallium {
+
+/**
+ * @brief Marker enabling the compact encoding of integers when placed
+ * in the serialization context of an RPC, for instance:
+ *
+ * rpc.on(ep).with_serialization_context(tl::compact_encoding{})(ids);
+ *
+ * Integers wider than one byte, including the size tags of containers,
+ * are then encoded as LEB128 varints (zigzag-encoded for signed types),
+ * so that small values take a single byte. Vectors (and spans) of such
+ * integers are encoded as their size, the number of bytes of their
+ * encoded elements, then the varint of each element. Other types,
+ * including floating-point values, std::array and bitwise-serializable
+ * classes, are encoded as usual.
+ *
+ * Both sides must use the same encoding: the server selects it for an
+ * RPC by defining it with tl::decode_context() returning a context that
+ * contains a compact_encoding, and responds with
+ * req.with_serialization_context(tl::compact_encoding{}); the client
+ * then decodes the response with
+ * response.with_serialization_context(tl::compact_encoding{}).
+ * Spans over integers cannot be deserialized in this mode, since their
+ * elements are not stored as they are in memory.
+ */
+struct compact_encoding {};
+
+namespace detail {
+
+template <typename... CtxArg>
+struct is_compact_context : std::false_type {};
+
+template <typename C, typename... CtxArg>
+struct is_compact_context<C, CtxArg...>
+: std::integral_constant<bool,
+      std::is_same<typename std::decay<C>::type, compact_encoding>::value
+   || is_compact_context<CtxArg...>::value> {};
+
+/**
+ * @brief True for the integer types encoded as varints by archives
+ * whose serialization context contains a compact_encoding.
+ */
+template <typename T, typename... CtxArg>
+struct compact_integer
+: std::integral_constant<bool, is_compact_context<CtxArg...>::value
+                            && std::is_integral<T>::value
+                            && !std::is_same<T, bool>::value
+                            && (sizeof(T) > 1)> {};
+
+constexpr size_t max_varint_size = 10;
+
+template <typename T>
+inline typename std::enable_if<std::is_signed<T>::value, uint64_t>::type
+to_varint_value(T t) {
+    auto v = static_cast<int64_t>(t);
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_signed<T>::value, uint64_t>::type
+to_varint_value(T t) {
+    return static_cast<uint64_t>(t);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_signed<T>::value, T>::type
+cast_varint_value(uint64_t v) {
+    return static_cast<T>(static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1));
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_signed<T>::value, T>::type
+cast_varint_value(uint64_t v) {
+    return static_cast<T>(v);
+}
+
+/**
+ * @brief True if the decoded varint v is representable as a T.
+ */
+template <typename T>
+inline typename std::enable_if<std::is_signed<T>::value, bool>::type
+varint_fits(uint64_t v) {
+    auto d = cast_varint_value<int64_t>(v);
+    return d >= static_cast<int64_t>(std::numeric_limits<T>::min())
+        && d <= static_cast<int64_t>(std::numeric_limits<T>::max());
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_signed<T>::value, bool>::type
+varint_fits(uint64_t v) {
+    return v <= static_cast<uint64_t>(std::numeric_limits<T>::max());
+}
+
+/**
+ * @brief Converts a decoded varint back to a T, throwing if the
+ * value does not fit (e.g. a 64-bit value read as an uint16_t).
+ */
+template <typename T>
+inline T from_varint_value(uint64_t v) {
+    if(!varint_fits<T>(v))
+        throw exception("Error during deserialization, varint out of range");
+    return cast_varint_value<T>(v);
+}
+
+inline size_t varint_size(uint64_t v) {
+    size_t n = 1;
+    while(v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Writes v as a LEB128 varint and returns the number of bytes
+ * written (at most max_varint_size).
+ */
+inline size_t encode_varint(uint64_t v, uint8_t* out) {
+    size_t n = 0;
+    while(v >= 0x80) {
+        out[n++] = static_cast<uint8_t>(v) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(v);
+    return n;
+}
+
+/**
+ * @brief Reads a LEB128 varint from [p, end) and advances p past it.
+ *
+ * @return false if the varint is truncated or longer than 64 bits.
+ */
+inline bool decode_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for(unsigned shift = 0; shift < 64 && p != end; shift += 7) {
+        uint8_t b = *p++;
+        // the 10th byte only holds bit 63
+        if(shift == 63 && b > 1) return false;
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if((b & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Decodes count varints from [p, end) into out. Runs of eight
+ * single-byte varints, which are the common case for small integers,
+ * are detected with a single test on a 64-bit word and widened by a
+ * loop the compiler can vectorize.
+ *
+ * @return the position after the last varint, or nullptr if the
+ * input is malformed or holds a value that does not fit in a T.
+ */
+template <typename T>
+const uint8_t* decode_varints(const uint8_t* p, const uint8_t* end, T* out, size_t count) {
+    size_t i = 0;
+    while(i < count) {
+        if(count - i >= 8 && end - p >= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            if((word & 0x8080808080808080ull) == 0) {
+                // single-byte varints fit in any T wider than a byte
+                for(size_t k = 0; k < 8; k++)
+                    out[i + k] = cast_varint_value<T>(p[k]);
+                p += 8;
+                i += 8;
+                continue;
+            }
+        }
+        uint64_t v;
+        if(!decode_varint(p, end, v) || !varint_fits<T>(v)) return nullptr;
+        out[i++] = cast_varint_value<T>(v);
+    }
+    return p;
+}
+
+template <typename Archive, typename T>
+void save_varint(Archive& ar, T t) {
+    uint8_t buf[max_varint_size];
+    ar.write(buf, encode_varint(to_varint_value(t), buf));
+}
+
+template <typename Archive, typename T>
+void load_varint(Archive& ar, T& t) {
+    uint64_t v = 0;
+    for(unsigned shift = 0;; shift += 7) {
+        if(shift >= 64)
+            throw exception("Error during deserialization, malformed varint");
+        uint8_t b;
+        ar.read(&b, 1);
+        if(shift == 63 && b > 1)
+            throw exception("Error during deserialization, malformed varint");
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if((b & 0x80) == 0) break;
+    }
+    t = from_varint_value<T>(v);
+}
+
+/**
+ * @brief Encodes count integers as their number of bytes followed by
+ * their varints (the size tag is written by the caller).
+ */
+template <typename Archive, typename T>
+void save_varints(Archive& ar, const T* data, size_t count) {
+    size_t bytes = 0;
+    for(size_t i = 0; i < count; i++)
+        bytes += varint_size(to_varint_value(data[i]));
+    save_varint(ar, static_cast<uint64_t>(bytes));
+    if(bytes == 0) return;
+    if(ar.is_sizing()) {
+        ar.add_size(bytes);
+        return;
+    }
+    void* ptr = ar.save_ptr(bytes);
+    if(ptr == nullptr)
+        throw exception("Error during serialization, hg_proc_save_ptr returned null");
+    auto out = static_cast<uint8_t*>(ptr);
+    for(size_t i = 0; i < count; i++)
+        out += encode_varint(to_varint_value(data[i]), out);
+    ar.restore_ptr(ptr, bytes);
+}
+
+template <typename Archive, typename T>
+void load_varints(Archive& ar, T* data, size_t count) {
+    uint64_t bytes = 0;
+    load_varint(ar, bytes);
+    if(bytes == 0 && count == 0) return;
+    void* ptr = ar.save_ptr(static_cast<size_t>(bytes));
+    if(ptr == nullptr)
+        throw exception("Error during deserialization, hg_proc_save_ptr returned null");
+    auto begin = static_cast<const uint8_t*>(ptr);
+    auto end   = begin + bytes;
+    auto last  = decode_varints(begin, end, data, count);
+    ar.restore_ptr(ptr, static_cast<size_t>(bytes));
+    if(last != end)
+        throw exception("Error during deserialization, malformed varint sequence");
+}
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
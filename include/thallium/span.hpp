@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_SPAN_HPP
+#define __THALLIUM_SPAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <cereal/cereal.hpp>
+#include <thallium/exception.hpp>
+#include <thallium/rdma_offload.hpp>
+#include <thallium/serialization/cereal/archives.hpp>
+
+namespace thallium {
+
+template <typename T> class span;
+
+namespace detail {
+
+template <typename T> struct is_span : std::false_type {};
+template <typename T> struct is_span<span<T>> : std::true_type {};
+
+struct span_access;
+
+} // namespace detail
+
+/**
+ * @brief Non-owning view over a contiguous sequence of T (a subset of
+ * C++20's std::span, usable in C++14).
+ *
+ * A span<const T> can be used as an RPC argument or response in place of
+ * a std::vector<T> (with T an arithmetic or bitwise-serializable type):
+ * both have the same wire format. When deserialized, the span points
+ * directly into the buffer in which the RPC was received instead of
+ * copying its content, so the span remains valid only as long as the
+ * request (on the server) or the packed_data (on the client) it was
+ * decoded from. If the content is not suitably aligned for T in that
+ * buffer, the span instead points to an aligned copy of it, which it
+ * shares with the spans copied from it.
+ */
+template <typename T>
+class span {
+
+  public:
+
+    using element_type    = T;
+    using value_type      = typename std::remove_cv<T>::type;
+    using size_type       = std::size_t;
+    using pointer         = T*;
+    using reference       = T&;
+    using iterator        = T*;
+
+    constexpr span() noexcept = default;
+
+    constexpr span(T* data, size_type size) noexcept
+    : m_data(data)
+    , m_size(size) {}
+
+    /**
+     * @brief Converting constructor (e.g. from span<T> to span<const T>).
+     */
+    template <typename U,
+              typename = typename std::enable_if<
+                  std::is_convertible<U(*)[], T(*)[]>::value>::type>
+    constexpr span(const span<U>& other) noexcept
+    : m_data(other.data())
+    , m_size(other.size())
+    , m_copy(other.m_copy) {}
+
+    /**
+     * @brief Constructor from a contiguous container (e.g. std::vector,
+     * std::array, std::string).
+     */
+    template <typename Container,
+              typename = typename std::enable_if<
+                  !detail::is_span<typename std::remove_cv<Container>::type>::value
+               && std::is_convertible<
+                      decltype(std::declval<Container&>().data()), T*>::value>::type>
+    constexpr span(Container& container) noexcept
+    : m_data(container.data())
+    , m_size(container.size()) {}
+
+    constexpr T* data() const noexcept { return m_data; }
+
+    constexpr size_type size() const noexcept { return m_size; }
+
+    constexpr size_type size_bytes() const noexcept { return m_size * sizeof(T); }
+
+    constexpr bool empty() const noexcept { return m_size == 0; }
+
+    constexpr iterator begin() const noexcept { return m_data; }
+
+    constexpr iterator end() const noexcept { return m_data + m_size; }
+
+    constexpr T& operator[](size_type i) const { return m_data[i]; }
+
+    constexpr T& front() const { return m_data[0]; }
+
+    constexpr T& back() const { return m_data[m_size - 1]; }
+
+    /**
+     * @brief Returns a view over count elements starting at offset
+     * (or over the rest of the span if count is not provided).
+     */
+    span subspan(size_type offset, size_type count = size_type(-1)) const {
+        if(offset > m_size)
+            throw exception("span::subspan: offset out of range");
+        if(count > m_size - offset)
+            count = m_size - offset;
+        span result(m_data + offset, count);
+        result.m_copy = m_copy;
+        return result;
+    }
+
+  private:
+
+    template <typename U> friend class span;
+    friend struct detail::span_access;
+
+    T*                                 m_data = nullptr;
+    size_type                          m_size = 0;
+    std::shared_ptr<const value_type> m_copy; // aligned copy of deserialized data
+};
+
+/**
+ * @brief View over raw bytes, e.g. a payload received as a
+ * std::vector<char> or a std::string by the caller.
+ */
+using buffer_view = span<const char>;
+
+namespace detail {
+
+/**
+ * @brief Encodes a contiguous sequence with the wire format of a
+ * std::vector or a std::string (size tag followed by the content).
+ */
+template <typename T, typename Archive>
+void save_view(Archive& ar, const T* data, size_t count) {
+    if(detail::save_offloaded(ar, data, count, count * sizeof(T)))
+        return;
+    ar(cereal::make_size_tag(static_cast<cereal::size_type>(count)));
+    ar.write(data, count * sizeof(T));
+}
+
+/**
+ * @brief Encodes a sequence of integers with the wire format of a
+ * std::vector in compact mode (see compact_encoding).
+ */
+template <typename T, typename Archive>
+void save_view(Archive& ar, const T* data, size_t count, std::true_type) {
+    if(detail::save_offloaded(ar, data, count, count * sizeof(T)))
+        return;
+    ar(cereal::make_size_tag(static_cast<cereal::size_type>(count)));
+    detail::save_varints(ar, data, count);
+}
+
+template <typename T, typename Archive>
+void save_view(Archive& ar, const T* data, size_t count, std::false_type) {
+    save_view(ar, data, count);
+}
+
+/**
+ * @brief Decodes the size tag of a contiguous sequence and returns a
+ * pointer to its content in the buffer of the archive, without copy.
+ * If the content is misaligned for T, it is copied into the provided
+ * storage if any, otherwise an exception is thrown.
+ */
+template <typename T, typename Archive>
+const T* load_view(Archive& ar, size_t& count,
+                   std::shared_ptr<const T>* storage = nullptr) {
+    cereal::size_type size;
+    ar(cereal::make_size_tag(size));
+    if(detail::is_offloaded(size)) {
+        throw exception(
+            "Cannot deserialize data offloaded to RDMA into a view, "
+            "set a higher RDMA offload threshold on the sender");
+    }
+    count = static_cast<size_t>(size);
+    if(count == 0)
+        return nullptr;
+    size_t bytes = count * sizeof(T);
+    void*  ptr   = ar.save_ptr(bytes);
+    if(ptr == nullptr)
+        throw exception("Error during deserialization, hg_proc_save_ptr returned null");
+    ar.restore_ptr(ptr, bytes);
+    if(reinterpret_cast<std::uintptr_t>(ptr) % alignof(T) != 0) {
+        if(storage != nullptr) {
+            std::shared_ptr<T> copy(new T[count], std::default_delete<T[]>());
+            std::memcpy(copy.get(), ptr, bytes);
+            *storage = std::move(copy);
+            return storage->get();
+        }
+        throw exception(
+            "Cannot deserialize into a view: the data is not suitably "
+            "aligned in the RPC buffer (use a buffer_view or a container)");
+    }
+    return static_cast<const T*>(ptr);
+}
+
+/**
+ * @brief Deserializes a span, keeping the aligned copy of its content
+ * made by load_view if the content was misaligned in the RPC buffer.
+ */
+struct span_access {
+
+    template <typename T, typename Archive>
+    static void load(Archive& ar, span<T>& s) {
+        using value_type = typename std::remove_cv<T>::type;
+        std::shared_ptr<const value_type> copy;
+        size_t count = 0;
+        auto   data  = load_view<value_type>(ar, count, &copy);
+        s = span<T>(data, count);
+        s.m_copy = std::move(copy);
+    }
+};
+
+} // namespace detail
+
+template <class T, class... CtxArg> inline
+typename std::enable_if<detail::bitwise_element<typename std::remove_cv<T>::type>::value, void>::type
+CEREAL_SAVE_FUNCTION_NAME(proc_output_archive<CtxArg...>& ar, span<T> const & s)
+{
+    detail::save_view(ar, s.data(), s.size(),
+        detail::compact_integer<typename std::remove_cv<T>::type, CtxArg...>());
+}
+
+template <class T, class... CtxArg> inline
+typename std::enable_if<detail::bitwise_element<typename std::remove_cv<T>::type>::value, void>::type
+CEREAL_LOAD_FUNCTION_NAME(proc_input_archive<CtxArg...>& ar, span<T>& s)
+{
+    static_assert(std::is_const<T>::value,
+                  "only views over constant data (span<const T>) can be deserialized");
+    static_assert(!detail::compact_integer<typename std::remove_cv<T>::type, CtxArg...>::value,
+                  "views over integers cannot be deserialized with a compact_encoding");
+    detail::span_access::load(ar, s);
+}
+
+} // namespace thallium
+
+#endif
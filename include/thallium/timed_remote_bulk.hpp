@@ -130,17 +130,17 @@ inline async_bulk_op remote_bulk::itransfer_timed(const bulk_segment& local,
     hg_bulk_t         local_handle  = local.m_bulk.m_bulk;
     size_t            local_offset  = local.m_offset;
     size_t            size          = local.m_size;
-    margo_request     req           = MARGO_REQUEST_NULL;
+    auto              completion    = std::make_shared<detail::completion_state>();
 
     if(size > m_segment.m_size)
         size = m_segment.m_size;
 
     hg_return_t ret =
-        margo_bulk_itransfer_timed(mid, op, origin_addr, origin_handle, origin_offset,
-                                   local_handle, local_offset, size, timeout_ms, &req);
+        detail::bulk_ctransfer(mid, op, origin_addr, origin_handle, origin_offset,
+                               local_handle, local_offset, size, timeout_ms, completion);
     if(ret == HG_TIMEOUT) throw timeout{};
-    MARGO_ASSERT(ret, margo_bulk_itransfer_timed);
-    return async_bulk_op{size, req};
+    MARGO_ASSERT(ret, margo_bulk_ctransfer_timed);
+    return async_bulk_op{mid, size, std::move(completion)};
 }
 
 inline timed_remote_bulk remote_bulk::timed(double timeout_ms) const noexcept {
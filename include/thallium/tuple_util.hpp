@@ -6,7 +6,10 @@
 #ifndef __THALLIUM_TUPLE_UTIL_HPP
 #define __THALLIUM_TUPLE_UTIL_HPP
 
+#include <cstddef>
+#include <functional>
 #include <tuple>
+#include <utility>
 
 namespace thallium {
 
@@ -38,6 +41,38 @@ template <> struct apply_f_to_t_impl<0> {
     }
 };
 
+/**
+ * @private
+ */
+template <typename... Params, typename F, typename Tuple, size_t... I,
+          typename... Prefix>
+decltype(auto) apply_forwarding_impl(F&& f, Tuple& t, std::index_sequence<I...>,
+                                     Prefix&&... prefix) {
+    (void)t;
+    return std::forward<F>(f)(std::forward<Prefix>(prefix)...,
+                              std::forward<Params>(std::get<I>(t))...);
+}
+
+/**
+ * Calls f(prefix..., args...) where args are the elements of t, each
+ * passed as the corresponding type in Params: elements bound to by-value
+ * or rvalue-reference parameters are moved out of the tuple and the
+ * others are passed by reference, so that no element is copied.
+ *
+ * \param f : function to call.
+ * \param t : tuple of decayed Params, left in a moved-from state.
+ * \param prefix : arguments passed before the elements of t.
+ * \return the value returned by f.
+ */
+template <typename... Params, typename F, typename Tuple, typename... Prefix>
+decltype(auto) apply_forwarding(F&& f, Tuple& t, Prefix&&... prefix) {
+    static_assert(sizeof...(Params) == std::tuple_size<Tuple>::value,
+                  "apply_forwarding: number of parameters and tuple size differ");
+    return apply_forwarding_impl<Params...>(std::forward<F>(f), t,
+                                            std::index_sequence_for<Params...>(),
+                                            std::forward<Prefix>(prefix)...);
+}
+
 } // namespace detail
 
 /**
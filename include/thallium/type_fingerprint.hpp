@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_TYPE_FINGERPRINT_HPP
+#define __THALLIUM_TYPE_FINGERPRINT_HPP
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace thallium {
+
+template <typename T> class span;
+
+namespace detail {
+
+/**
+ * @brief Stands for all the types serialized as a size followed by
+ * contiguous elements of type T.
+ */
+template <typename T> struct contiguous_sequence {};
+
+} // namespace detail
+
+/**
+ * @brief Type whose name is hashed in place of T to compute type
+ * fingerprints (see THALLIUM_HASH_RPC_TYPES). Types with the same wire
+ * format can be declared equivalent by specializing wire_type, so that
+ * a caller sending a std::string is accepted by a handler expecting a
+ * buffer_view, for instance.
+ */
+template <typename T> struct wire_type { using type = T; };
+
+template <typename T, typename A>
+struct wire_type<std::vector<T, A>> { using type = detail::contiguous_sequence<T>; };
+
+template <typename C, typename Tr, typename A>
+struct wire_type<std::basic_string<C, Tr, A>> { using type = detail::contiguous_sequence<C>; };
+
+template <typename T>
+struct wire_type<span<T>> {
+    using type = detail::contiguous_sequence<typename std::remove_cv<T>::type>;
+};
+
+#if __cplusplus >= 201703L
+template <typename C, typename Tr>
+struct wire_type<std::basic_string_view<C, Tr>> { using type = detail::contiguous_sequence<C>; };
+#endif
+
+namespace detail {
+
+constexpr uint64_t fnv1a_offset = 14695981039346656037ull;
+constexpr uint64_t fnv1a_prime  = 1099511628211ull;
+
+/**
+ * @brief FNV-1a hash of the compiler-generated signature of this
+ * function, which contains the name of T. The signature differs between
+ * compilers, so clients and servers must be built with the same one.
+ */
+template <typename T>
+constexpr uint64_t type_name_hash() {
+#if defined(_MSC_VER)
+    const char* s = __FUNCSIG__;
+#else
+    const char* s = __PRETTY_FUNCTION__;
+#endif
+    uint64_t h = fnv1a_offset;
+    for(; *s != '\0'; ++s) {
+        h ^= static_cast<unsigned char>(*s);
+        h *= fnv1a_prime;
+    }
+    return h;
+}
+
+template <typename... T>
+constexpr uint64_t combine_type_hashes() {
+    const uint64_t hashes[] = {0, type_name_hash<
+        typename wire_type<typename std::decay<T>::type>::type>()...};
+    uint64_t h = fnv1a_offset;
+    for(size_t i = 1; i < sizeof...(T) + 1; i++) {
+        h ^= hashes[i];
+        h *= fnv1a_prime;
+    }
+    return h;
+}
+
+/**
+ * @brief 64-bit fingerprint of a list of RPC argument (or response)
+ * types, computed at compile time. References and cv-qualifiers are
+ * ignored, so that std::tuple<const int&> (sent) and std::tuple<int>
+ * (received) have the same fingerprint; a single type T has the
+ * fingerprint of std::tuple<T>.
+ */
+template <typename T>
+struct type_fingerprint {
+    static constexpr uint64_t value = combine_type_hashes<T>();
+};
+
+template <typename... T>
+struct type_fingerprint<std::tuple<T...>> {
+    static constexpr uint64_t value = combine_type_hashes<T...>();
+};
+
+template <>
+struct type_fingerprint<void> {
+    static constexpr uint64_t value = combine_type_hashes<>();
+};
+
+/**
+ * @brief std::tuple of the decayed types of an RPC's arguments
+ * (T itself is considered a single argument if not a std::tuple).
+ */
+template <typename T>
+struct decayed_tuple { using type = std::tuple<typename std::decay<T>::type>; };
+
+template <typename... T>
+struct decayed_tuple<std::tuple<T...>> { using type = std::tuple<typename std::decay<T>::type...>; };
+
+template <>
+struct decayed_tuple<void> { using type = void; };
+
+} // namespace detail
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * (C) 2017 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __THALLIUM_TYPED_RPC_HPP
+#define __THALLIUM_TYPED_RPC_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <margo.h>
+#include <thallium/async_response.hpp>
+#include <thallium/callable_remote_procedure.hpp>
+#include <thallium/decode_context.hpp>
+#include <thallium/engine.hpp>
+#include <thallium/packed_data.hpp>
+#include <thallium/remote_procedure.hpp>
+#include <thallium/tuple_util.hpp>
+
+namespace thallium {
+
+class endpoint;
+class provider_handle;
+
+/**
+ * @brief Name and type of an RPC, meant to be declared once in a header
+ * shared by the clients and the servers of the RPC, for instance:
+ *
+ * constexpr tl::rpc_signature<int(int, int)> sum_rpc{"sum"};
+ *
+ * The server defines the RPC with engine::define(sum_rpc, handler) and
+ * the client with engine::define(sum_rpc). Both then use the same
+ * argument and result types, and the client gets the result of a call
+ * as an R instead of a packed_data.
+ *
+ * @tparam Signature R(Args...), where Args are the arguments of the RPC
+ * and R its result (void if the RPC has none).
+ */
+template <typename Signature> class rpc_signature;
+
+template <typename R, typename... Args>
+class rpc_signature<R(Args...)> {
+
+    static_assert(!std::is_reference<R>::value,
+                  "The result of an RPC cannot be a reference");
+
+    const char* m_name;
+
+  public:
+
+    using result_type = R;
+
+    constexpr explicit rpc_signature(const char* name)
+    : m_name(name) {}
+
+    /**
+     * @brief Name of the RPC.
+     */
+    constexpr const char* name() const {
+        return m_name;
+    }
+};
+
+namespace detail {
+
+/**
+ * @brief Converts the response of a typed RPC into its result type.
+ */
+template <typename R> struct typed_result {
+    static R get(const packed_data<>& data) {
+        return data.template as<R>();
+    }
+};
+
+template <> struct typed_result<void> {
+    static void get(const packed_data<>&) {}
+};
+
+} // namespace detail
+
+/**
+ * @brief Handle on a typed RPC sent without blocking, returned by
+ * typed_callable_remote_procedure::async().
+ */
+template <typename R> class typed_async_response {
+
+    template <typename Signature> friend class typed_callable_remote_procedure;
+
+    async_response m_response;
+
+    explicit typed_async_response(async_response&& response)
+    : m_response(std::move(response)) {}
+
+  public:
+
+    typed_async_response() = default;
+
+    /**
+     * @brief Waits for the response and returns the result of the RPC.
+     */
+    R wait() {
+        return detail::typed_result<R>::get(m_response.wait());
+    }
+
+    /**
+     * @brief Returns whether the response has been received.
+     */
+    bool received() const {
+        return m_response.received();
+    }
+};
+
+/**
+ * @brief typed_remote_procedure associated with a target, created by
+ * typed_remote_procedure::on(). Arguments are converted to the types
+ * of the signature before being sent.
+ */
+template <typename Signature> class typed_callable_remote_procedure;
+
+template <typename R, typename... Args>
+class typed_callable_remote_procedure<R(Args...)> {
+
+    template <typename Signature> friend class typed_remote_procedure;
+
+    callable_remote_procedure m_callable;
+
+    explicit typed_callable_remote_procedure(callable_remote_procedure&& callable)
+    : m_callable(std::move(callable)) {}
+
+  public:
+
+    /**
+     * @brief Sends the RPC and waits for its result.
+     */
+    R operator()(const typename std::decay<Args>::type&... args) {
+        return detail::typed_result<R>::get(m_callable(args...));
+    }
+
+    /**
+     * @brief Sends the RPC and waits for its result, throwing a
+     * thallium::timeout exception if it does not arrive in time.
+     */
+    template <typename Rep, typename Period>
+    R timed(const std::chrono::duration<Rep, Period>& t,
+            const typename std::decay<Args>::type&... args) {
+        return detail::typed_result<R>::get(m_callable.timed(t, args...));
+    }
+
+    /**
+     * @brief Sends the RPC without blocking.
+     */
+    typed_async_response<R> async(const typename std::decay<Args>::type&... args) {
+        return typed_async_response<R>(m_callable.async(args...));
+    }
+};
+
+/**
+ * @brief RPC defined from an rpc_signature by engine::define()
+ * or provider::define().
+ */
+template <typename Signature> class typed_remote_procedure;
+
+template <typename R, typename... Args>
+class typed_remote_procedure<R(Args...)> {
+
+    friend class engine;
+
+    remote_procedure m_rpc;
+
+    explicit typed_remote_procedure(remote_procedure&& rpc)
+    : m_rpc(std::move(rpc)) {}
+
+  public:
+
+    typed_remote_procedure() = default;
+
+    /**
+     * @brief Associates the RPC with an endpoint.
+     */
+    typed_callable_remote_procedure<R(Args...)> on(const endpoint& ep) const {
+        return typed_callable_remote_procedure<R(Args...)>(m_rpc.on(ep));
+    }
+
+    /**
+     * @brief Associates the RPC with a provider.
+     */
+    typed_callable_remote_procedure<R(Args...)> on(const provider_handle& ph) const {
+        return typed_callable_remote_procedure<R(Args...)>(m_rpc.on(ph));
+    }
+
+    /**
+     * @brief Underlying remote_procedure, e.g. to enable self-dispatch
+     * or compression, or to deregister the RPC.
+     */
+    remote_procedure& get_remote_procedure() {
+        return m_rpc;
+    }
+
+    const remote_procedure& get_remote_procedure() const {
+        return m_rpc;
+    }
+};
+
+namespace detail {
+
+/**
+ * @brief Mercury callbacks of an RPC defined from an rpc_signature with
+ * a handler of type Handler. They are generated for each signature and
+ * handler type, and call the handler directly.
+ */
+template <typename R, typename... Args, typename Handler>
+struct typed_rpc<R(Args...), Handler> {
+
+    using input_type = std::tuple<typename std::decay<Args>::type...>;
+
+    struct callback_data : engine::rpc_callback_data {
+        template <typename H>
+        explicit callback_data(H&& h)
+        : m_handler(std::forward<H>(h)) {}
+
+        Handler m_handler;
+    };
+
+    static void free_callback_data(void* data) noexcept {
+        delete static_cast<callback_data*>(data);
+    }
+
+    static void respond(Handler& h, const request& r, input_type& args, std::true_type) {
+        apply_forwarding<Args...>(h, args);
+        r.respond();
+    }
+
+    static void respond(Handler& h, const request& r, input_type& args, std::false_type) {
+        R result = apply_forwarding<Args...>(h, args);
+        r.respond(std::move(result));
+    }
+
+    /**
+     * @brief Decodes the arguments of the request, calls the handler
+     * and sends its result back.
+     */
+    static hg_return_t invoke(callback_data* data, const request& r) {
+        return engine::decode_and_call<input_type>(
+            r, empty_decode_context(),
+            [data, &r](input_type& args) {
+                respond(data->m_handler, r, args, std::is_void<R>());
+            });
+    }
+
+    /**
+     * @brief Body of the ULT created for each request received
+     * through Mercury.
+     */
+    static hg_return_t call(hg_handle_t handle) {
+        engine::handle_rpc(handle, [](engine::rpc_callback_data* data, const request& r) {
+            invoke(static_cast<callback_data*>(data), r);
+        });
+        return HG_SUCCESS;
+    }
+
+    static __MARGO_INTERNAL_RPC_WRAPPER(call)
+    static __MARGO_INTERNAL_RPC_HANDLER(call)
+
+    /**
+     * @brief Callback registered with Mercury, applying admission
+     * control in the progress loop before creating the ULT.
+     */
+    static hg_return_t admission_handler(hg_handle_t handle) {
+        if(!engine::admit(handle))
+            return HG_SUCCESS;
+        hg_return_t ret = call_handler(handle);
+        if(ret != HG_SUCCESS)
+            engine::cancel_admission(handle);
+        return ret;
+    }
+};
+
+} // namespace detail
+
+template <typename R, typename... Args, typename F>
+typed_remote_procedure<R(Args...)>
+engine::define(const rpc_signature<R(Args...)>& sig, F&& handler,
+               uint16_t provider_id, const pool& p) {
+    MARGO_INSTANCE_MUST_BE_VALID;
+    using rpc = detail::typed_rpc<R(Args...), typename std::decay<F>::type>;
+    hg_id_t id = MARGO_REGISTER_PROVIDER(
+        m_mid, sig.name(), meta_serialization, meta_serialization,
+        rpc::admission, provider_id, p.native_handle());
+
+    auto cb_data = new typename rpc::callback_data(std::forward<F>(handler));
+    cb_data->m_input_type  = &typeid(typename rpc::input_type);
+    cb_data->m_pool        = p.native_handle();
+    cb_data->m_provider_id = provider_id;
+    cb_data->m_id          = id;
+    cb_data->m_admission   = detail::get_instance_data<detail::admission_control>(m_mid);
+    cb_data->m_offload     = detail::get_instance_data<detail::offload_state>(m_mid);
+    // used by the calls that do not come from Mercury
+    // (batched, collective and self-dispatched calls)
+    cb_data->m_function = [cb_data](const request& r) {
+        rpc::invoke(cb_data, r);
+    };
+
+    auto ret = margo_register_data(m_mid, id, (void*)cb_data, rpc::free_callback_data);
+    MARGO_ASSERT(ret, margo_register_data);
+
+    hg_id_t header_id = MARGO_REGISTER_PROVIDER(
+        m_mid, detail::header_rpc_name(sig.name()).c_str(), meta_serialization,
+        meta_serialization, rpc::admission, provider_id, p.native_handle());
+    register_header_variant(header_id, cb_data);
+
+    return typed_remote_procedure<R(Args...)>(remote_procedure(m_mid, id, header_id));
+}
+
+template <typename R, typename... Args, typename F>
+typed_remote_procedure<R(Args...)>
+engine::define(const rpc_signature<R(Args...)>& sig, F&& handler,
+               uint16_t provider_id) {
+    return define(sig, std::forward<F>(handler), provider_id, pool());
+}
+
+template <typename R, typename... Args>
+typed_remote_procedure<R(Args...)>
+engine::define(const rpc_signature<R(Args...)>& sig) {
+    return typed_remote_procedure<R(Args...)>(define(sig.name()));
+}
+
+} // namespace thallium
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for Thallium per-provider and per-RPC admission control
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <functional>
+#include <vector>
+
+namespace tl = thallium;
+
+TEST_SUITE("Admission Control") {
+
+// waits until the server has either admitted or rejected n requests
+static bool wait_for_decisions(tl::engine& server, std::function<tl::admission_stats()> stats,
+                               uint64_t n) {
+    for(int i = 0; i < 500; i++) {
+        auto s = stats();
+        if(s.admitted + s.rejected >= n) return true;
+        tl::thread::sleep(server, 10);
+    }
+    return false;
+}
+
+// waits for all the responses, returning the number of busy rejections
+static int count_busy(std::vector<tl::async_response>& responses, int& succeeded) {
+    int busy = 0;
+    for(auto& r : responses) {
+        try {
+            int x = r.wait();
+            if(x == 42) succeeded++;
+        } catch(const tl::busy&) {
+            busy++;
+        }
+    }
+    return busy;
+}
+
+TEST_CASE("provider limits reject excess requests") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    tl::eventual<void> gate;
+    server.define("adm_block", [&gate](const tl::request& req) {
+        gate.wait();
+        req.respond(42);
+    }, 5);
+    tl::admission_limits limits;
+    limits.max_in_flight = 1;
+    limits.max_queued    = 2;
+    server.set_admission_limits(5, limits);
+
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc = client.define("adm_block").enable_busy_replies();
+    tl::provider_handle ph(client.lookup(static_cast<std::string>(server.self())), 5);
+
+    std::vector<tl::async_response> responses;
+    for(int i = 0; i < 6; i++)
+        responses.push_back(rpc.on(ph).async());
+    REQUIRE(wait_for_decisions(server, [&]() { return server.get_admission_stats(5); }, 6));
+
+    auto stats = server.get_admission_stats(5);
+    REQUIRE(stats.admitted == 3);
+    REQUIRE(stats.rejected == 3);
+    REQUIRE(stats.in_flight <= 1);
+    REQUIRE(stats.max_queued <= 2);
+
+    gate.set_value();
+    int succeeded = 0;
+    REQUIRE(count_busy(responses, succeeded) == 3);
+    REQUIRE(succeeded == 3);
+
+    // the provider accepts requests again once the burst is over
+    int x = rpc.on(ph)();
+    REQUIRE(x == 42);
+    stats = server.get_admission_stats(5);
+    REQUIRE(stats.in_flight == 0);
+    REQUIRE(stats.queued == 0);
+    REQUIRE(stats.admitted == 4);
+
+    client.finalize();
+    server.finalize();
+}
+
+TEST_CASE("rpc limits apply to a single rpc") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    tl::eventual<void> gate;
+    auto limited = server.define("adm_limited", [&gate](const tl::request& req) {
+        gate.wait();
+        req.respond(42);
+    });
+    server.define("adm_free", [](const tl::request& req) {
+        req.respond(42);
+    });
+    tl::admission_limits limits;
+    limits.max_in_flight = 1;
+    limited.set_admission_limits(limits);
+
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc   = client.define("adm_limited").enable_busy_replies();
+    auto other = client.define("adm_free");
+    tl::endpoint ep = client.lookup(static_cast<std::string>(server.self()));
+
+    std::vector<tl::async_response> responses;
+    for(int i = 0; i < 4; i++)
+        responses.push_back(rpc.on(ep).async());
+    REQUIRE(wait_for_decisions(server, [&]() { return limited.get_admission_stats(); }, 4));
+
+    // other RPCs are not affected by the limits of this one
+    int x = other.on(ep)();
+    REQUIRE(x == 42);
+
+    gate.set_value();
+    int succeeded = 0;
+    REQUIRE(count_busy(responses, succeeded) == 3);
+    REQUIRE(succeeded == 1);
+    REQUIRE(limited.get_admission_stats().max_queued <= 1);
+
+    // a rejected request must not leak its admission
+    x = rpc.on(ep)();
+    REQUIRE(x == 42);
+    REQUIRE(limited.get_admission_stats().in_flight == 0);
+
+    client.finalize();
+    server.finalize();
+}
+
+TEST_CASE("calls without busy replies are rejected with HG_BUSY") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    tl::eventual<void> gate;
+    auto limited = server.define("adm_plain", [&gate](const tl::request& req) {
+        gate.wait();
+        req.respond(42);
+    });
+    tl::admission_limits limits;
+    limits.max_in_flight = 1;
+    limits.max_queued    = 1;
+    limited.set_admission_limits(limits);
+
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc = client.define("adm_plain");
+    tl::endpoint ep = client.lookup(static_cast<std::string>(server.self()));
+
+    std::vector<tl::async_response> responses;
+    for(int i = 0; i < 4; i++)
+        responses.push_back(rpc.on(ep).async());
+    REQUIRE(wait_for_decisions(server, [&]() { return limited.get_admission_stats(); }, 4));
+    REQUIRE(limited.get_admission_stats().rejected == 2);
+    // timed calls keep the plain wire format, and are rejected the same way
+    REQUIRE_THROWS_AS(rpc.on(ep).timed(std::chrono::seconds(5)), tl::busy);
+    REQUIRE(limited.get_admission_stats().rejected == 3);
+
+    gate.set_value();
+    int succeeded = 0;
+    REQUIRE(count_busy(responses, succeeded) == 2);
+    REQUIRE(succeeded == 2);
+
+    client.finalize();
+    server.finalize();
+}
+
+TEST_CASE("rejections are counted by the limiter that rejected them") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    tl::eventual<void> gate;
+    auto limited = server.define("adm_both", [&gate](const tl::request& req) {
+        gate.wait();
+        req.respond(42);
+    }, 3);
+    tl::admission_limits provider_limits;
+    provider_limits.max_in_flight = 4;
+    server.set_admission_limits(3, provider_limits);
+    tl::admission_limits rpc_limits;
+    rpc_limits.max_in_flight = 1;
+    limited.set_admission_limits(rpc_limits);
+
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc = client.define("adm_both").enable_busy_replies();
+    tl::provider_handle ph(client.lookup(static_cast<std::string>(server.self())), 3);
+
+    std::vector<tl::async_response> responses;
+    for(int i = 0; i < 3; i++)
+        responses.push_back(rpc.on(ph).async());
+    REQUIRE(wait_for_decisions(server, [&]() { return limited.get_admission_stats(); }, 3));
+
+    // the rpc limit rejected two calls, which the provider had admitted
+    auto rpc_stats      = limited.get_admission_stats();
+    auto provider_stats = server.get_admission_stats(3);
+    REQUIRE(rpc_stats.rejected == 2);
+    REQUIRE(provider_stats.rejected == 0);
+    REQUIRE(provider_stats.admitted == 1);
+
+    gate.set_value();
+    int succeeded = 0;
+    REQUIRE(count_busy(responses, succeeded) == 2);
+    REQUIRE(succeeded == 1);
+
+    client.finalize();
+    server.finalize();
+}
+
+}
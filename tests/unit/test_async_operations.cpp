@@ -272,4 +272,154 @@ TEST_CASE("async_response received() polls completion") {
     myEngine.finalize();
 }
 
+TEST_CASE("async response then") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("then_square", [](const tl::request& req, int x) {
+        req.respond(x * x);
+    });
+
+    auto rpc = myEngine.define("then_square");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::vector<tl::eventual<int>> results(10);
+    for(int i = 0; i < 10; i++) {
+        auto response = rpc.on(self_ep).async(i);
+        response.then(myEngine.get_handler_pool(), [&results, i](tl::packed_data<> data) {
+            int r = data;
+            results[i].set_value(r);
+        });
+    }
+    for(int i = 0; i < 10; i++) {
+        REQUIRE(results[i].wait() == i * i);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("async response then with error callback") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("then_timeout", [&myEngine](const tl::request& req) {
+        tl::thread::sleep(myEngine, 500);
+        req.respond();
+    });
+
+    auto rpc = myEngine.define("then_timeout");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    tl::eventual<bool> timed_out;
+    auto response = rpc.on(self_ep).timed_async(std::chrono::milliseconds(50));
+    response.then(myEngine.get_handler_pool(),
+        [&timed_out](tl::packed_data<>) { timed_out.set_value(false); },
+        [&timed_out](const std::exception& ex) {
+            timed_out.set_value(dynamic_cast<const tl::timeout*>(&ex) != nullptr);
+        });
+    REQUIRE(timed_out.wait() == true);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("async response then callback throwing") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("then_throw", [](const tl::request& req, int x) {
+        req.respond(x + 1);
+    });
+
+    auto rpc = myEngine.define("then_throw");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    // the exception is logged by the watcher and does not prevent
+    // the following continuations from running
+    tl::eventual<int> first;
+    rpc.on(self_ep).async(1).then(myEngine.get_handler_pool(),
+        [&first](tl::packed_data<> data) {
+            first.set_value(data.as<int>());
+            throw tl::exception("continuation failure");
+        });
+    REQUIRE(first.wait() == 2);
+
+    tl::eventual<int> second;
+    rpc.on(self_ep).async(2).then(myEngine.get_handler_pool(),
+        [&second](tl::packed_data<> data) { second.set_value(data.as<int>()); });
+    REQUIRE(second.wait() == 3);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("async response when_all and wait_all") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("fanout_double", [](const tl::request& req, int x) {
+        req.respond(2 * x);
+    });
+
+    auto rpc = myEngine.define("fanout_double");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::vector<tl::async_response> responses;
+    for(int i = 0; i < 64; i++)
+        responses.push_back(rpc.on(self_ep).async(i));
+    auto results = tl::async_response::when_all(responses.begin(), responses.end());
+    REQUIRE(results.size() == 64);
+    for(int i = 0; i < 64; i++) {
+        int r = results[i];
+        REQUIRE(r == 2 * i);
+    }
+
+    responses.clear();
+    for(int i = 0; i < 16; i++)
+        responses.push_back(rpc.on(self_ep).async(i));
+    tl::async_response::wait_all(responses.begin(), responses.end());
+    for(int i = 0; i < 16; i++) {
+        REQUIRE(responses[i].received());
+        int r = responses[i].wait();
+        REQUIRE(r == 2 * i);
+    }
+
+    std::vector<tl::async_response> none;
+    REQUIRE(tl::async_response::when_all(none.begin(), none.end()).empty());
+
+    myEngine.finalize();
+}
+
+TEST_CASE("async response wait_some") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("fanout_delay", [&myEngine](const tl::request& req, int ms) {
+        if(ms) tl::thread::sleep(myEngine, ms);
+        req.respond(ms);
+    });
+
+    auto rpc = myEngine.define("fanout_delay");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::vector<tl::async_response> responses;
+    responses.push_back(rpc.on(self_ep).async(0));
+    responses.push_back(rpc.on(self_ep).async(0));
+    responses.push_back(rpc.on(self_ep).async(300));
+
+    auto completed = tl::async_response::wait_some(responses.begin(), responses.end(), 2);
+    REQUIRE(completed.size() >= 2);
+    for(auto& it : completed) {
+        REQUIRE(it->received());
+    }
+    // waiting again on the same responses, including the pending one
+    completed = tl::async_response::wait_some(responses.begin(), responses.end(), 3);
+    REQUIRE(completed.size() == 3);
+    REQUIRE(responses[2].received());
+    for(auto& r : responses) {
+        int x = r.wait();
+        (void)x;
+    }
+
+    myEngine.finalize();
+}
+
 } // TEST_SUITE
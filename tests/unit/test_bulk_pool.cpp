@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for thallium::bulk_pool
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <cstring>
+#include <vector>
+
+namespace tl = thallium;
+
+TEST_SUITE("Bulk Pool") {
+
+TEST_CASE("bulk pool leases") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    tl::bulk_pool pool(myEngine, {{1 << 20, 1}, {4096, 2}});
+
+    auto stats = pool.stats();
+    REQUIRE(stats.capacity == 3);
+    REQUIRE(stats.capacity_bytes == 2 * 4096 + (1 << 20));
+
+    SUBCASE("smallest fitting class") {
+        auto a = pool.acquire(100);
+        auto b = pool.acquire(4096);
+        REQUIRE(a.is_pooled());
+        REQUIRE(b.is_pooled());
+        REQUIRE(a.size() == 100);
+        REQUIRE(a.data() != b.data());
+        REQUIRE(pool.stats().leased_bytes == 2 * 4096);
+        // the small class is exhausted, a larger buffer is used
+        auto c = pool.acquire(10);
+        REQUIRE(c.is_pooled());
+        REQUIRE(pool.stats().leased_bytes == 2 * 4096 + (1 << 20));
+        REQUIRE(pool.stats().occupancy() == doctest::Approx(1.0));
+    }
+
+    SUBCASE("buffers are recycled") {
+        char* first = nullptr;
+        {
+            auto a = pool.acquire(4000);
+            first  = a.data();
+        }
+        REQUIRE(pool.stats().leased == 0);
+        auto b = pool.acquire(4000);
+        REQUIRE(b.data() == first);
+        b.release();
+        REQUIRE_FALSE(b);
+        REQUIRE(pool.stats().leased == 0);
+        REQUIRE(pool.stats().peak_leased == 1);
+    }
+
+    SUBCASE("misses") {
+        auto big = pool.acquire(2 << 20);
+        REQUIRE(big);
+        REQUIRE_FALSE(big.is_pooled());
+        stats = pool.stats();
+        REQUIRE(stats.misses == 1);
+        REQUIRE(stats.hits == 0);
+        REQUIRE(stats.leased == 0);
+        REQUIRE(stats.hit_rate() == doctest::Approx(0.0));
+    }
+
+    SUBCASE("moved leases") {
+        auto a = pool.acquire(10);
+        tl::bulk_pool::lease b = std::move(a);
+        REQUIRE_FALSE(a);
+        REQUIRE(b);
+        REQUIRE(pool.stats().leased == 1);
+        b = pool.acquire(20);
+        REQUIRE(pool.stats().leased == 1);
+    }
+
+    SUBCASE("moved pools") {
+        auto a = pool.acquire(10);
+        tl::bulk_pool other = std::move(pool);
+        REQUIRE(other.stats().leased == 1);
+        // the moved-from pool has no buffers left but can still lease
+        REQUIRE(pool.stats().capacity == 0);
+        auto b = pool.acquire(10);
+        REQUIRE(b);
+        REQUIRE_FALSE(b.is_pooled());
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("bulk pool transfers") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+    tl::bulk_pool pool(myEngine, {{4096, 4}});
+
+    myEngine.define("pool_pull", [&pool](const tl::request& req, tl::bulk& b) {
+        auto lease = pool.acquire(b.size());
+        lease.segment() << b.on(req.get_endpoint());
+        req.respond(std::vector<char>(lease.data(), lease.data() + lease.size()));
+    });
+
+    std::vector<char> data(3000);
+    for(size_t i = 0; i < data.size(); i++) data[i] = 'a' + (i % 26);
+    std::vector<std::pair<void*, size_t>> segments = {{data.data(), data.size()}};
+    tl::bulk b = myEngine.expose(segments, tl::bulk_mode::read_only);
+
+    auto rpc = myEngine.define("pool_pull");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+    for(int i = 0; i < 10; i++) {
+        std::vector<char> result = rpc.on(self_ep)(b);
+        REQUIRE(result == data);
+    }
+    auto stats = pool.stats();
+    REQUIRE(stats.hits == 10);
+    REQUIRE(stats.misses == 0);
+    REQUIRE(stats.leased == 0);
+
+    myEngine.finalize();
+}
+
+}
@@ -10,6 +10,7 @@
 #include <thallium/serialization/stl/string.hpp>
 #include <thallium/serialization/stl/vector.hpp>
 #include <vector>
+#include <algorithm>
 #include <cstring>
 
 namespace tl = thallium;
@@ -730,4 +731,338 @@ TEST_CASE("bulk async timed transfer timeout exception") {
     myEngine.finalize();
 }
 
+TEST_CASE("bulk async transfer then") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("bulk_then_pull",
+        [&myEngine](const tl::request& req, tl::bulk& remote_bulk) {
+            auto local_buffer = std::make_shared<std::vector<char>>(remote_bulk.size());
+            std::vector<std::pair<void*, size_t>> segments = {
+                {local_buffer->data(), local_buffer->size()}
+            };
+            tl::bulk local = myEngine.expose(segments, tl::bulk_mode::write_only);
+            // the handler returns without waiting for the transfer
+            remote_bulk.on(req.get_endpoint()).pull_to(local).then(
+                myEngine.get_handler_pool(),
+                [req, local, local_buffer](std::size_t n) {
+                    if(n != local_buffer->size()) local_buffer->clear();
+                    req.respond(*local_buffer);
+                });
+        });
+
+    std::vector<char> send_buffer(256, 'T');
+    std::vector<std::pair<void*, size_t>> segments = {
+        {send_buffer.data(), send_buffer.size()}
+    };
+    tl::bulk bulk_handle = myEngine.expose(segments, tl::bulk_mode::read_only);
+
+    auto rpc = myEngine.define("bulk_then_pull");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::vector<char> result = rpc.on(self_ep)(bulk_handle);
+    REQUIRE(result == send_buffer);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("bulk async transfer when_all") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("bulk_when_all",
+        [&myEngine](const tl::request& req, tl::bulk& remote_bulk) {
+            const size_t chunk = remote_bulk.size() / 4;
+            std::vector<char> local_buffer(remote_bulk.size());
+            std::vector<std::pair<void*, size_t>> segments = {
+                {local_buffer.data(), local_buffer.size()}
+            };
+            tl::bulk local = myEngine.expose(segments, tl::bulk_mode::write_only);
+            std::vector<tl::async_bulk_op> ops;
+            for(size_t i = 0; i < 4; i++) {
+                ops.push_back(remote_bulk(i * chunk, chunk).on(req.get_endpoint())
+                              .pull_to(local(i * chunk, chunk)));
+            }
+            auto sizes = tl::async_bulk_op::when_all(ops.begin(), ops.end());
+            for(auto n : sizes) {
+                if(n != chunk) local_buffer.clear();
+            }
+            req.respond(local_buffer);
+        });
+
+    std::vector<char> send_buffer(256);
+    for(size_t i = 0; i < send_buffer.size(); i++) send_buffer[i] = 'a' + (i % 26);
+    std::vector<std::pair<void*, size_t>> segments = {
+        {send_buffer.data(), send_buffer.size()}
+    };
+    tl::bulk bulk_handle = myEngine.expose(segments, tl::bulk_mode::read_only);
+
+    auto rpc = myEngine.define("bulk_when_all");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::vector<char> result = rpc.on(self_ep)(bulk_handle);
+    REQUIRE(result == send_buffer);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("bulk pipelined pull") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("bulk_pipelined",
+        [](const tl::request& req, tl::bulk& remote_bulk, size_t chunk, size_t depth) {
+            std::vector<char> received;
+            bool in_order = true;
+            size_t total = remote_bulk.on(req.get_endpoint()).pull_pipelined(chunk, depth,
+                [&](size_t offset, const char* data, size_t size) {
+                    if(offset != received.size() || size > chunk) in_order = false;
+                    received.insert(received.end(), data, data + size);
+                });
+            if(!in_order || total != received.size()) received.clear();
+            req.respond(received);
+        });
+
+    std::vector<char> send_buffer(10007);
+    for(size_t i = 0; i < send_buffer.size(); i++) send_buffer[i] = 'a' + (i % 23);
+    std::vector<std::pair<void*, size_t>> segments = {
+        {send_buffer.data(), send_buffer.size()}
+    };
+    tl::bulk bulk_handle = myEngine.expose(segments, tl::bulk_mode::read_only);
+
+    auto rpc = myEngine.define("bulk_pipelined");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    SUBCASE("partial last chunk") {
+        std::vector<char> result = rpc.on(self_ep)(bulk_handle, size_t(1000), size_t(3));
+        REQUIRE(result == send_buffer);
+    }
+
+    SUBCASE("depth larger than the number of chunks") {
+        std::vector<char> result = rpc.on(self_ep)(bulk_handle, size_t(4096), size_t(8));
+        REQUIRE(result == send_buffer);
+    }
+
+    SUBCASE("chunk larger than the region") {
+        std::vector<char> result = rpc.on(self_ep)(bulk_handle, size_t(1 << 20), size_t(2));
+        REQUIRE(result == send_buffer);
+    }
+
+    SUBCASE("invalid parameters") {
+        REQUIRE_THROWS_AS(bulk_handle.on(self_ep).pull_pipelined(0, 1,
+                              [](size_t, const char*, size_t) {}),
+                          tl::exception);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("bulk registration cache") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+    REQUIRE(myEngine.get_registration_cache_size() == 0);
+    myEngine.set_registration_cache_size(2);
+    REQUIRE(myEngine.get_registration_cache_size() == 2);
+
+    std::vector<char> buffer(4096);
+    for(size_t i = 0; i < buffer.size(); i++) buffer[i] = 'a' + (i % 26);
+    std::vector<std::pair<void*, size_t>> segments = {
+        {buffer.data(), buffer.size()}
+    };
+
+    SUBCASE("repeated exposes share the registration") {
+        tl::bulk b1 = myEngine.expose(segments, tl::bulk_mode::read_only);
+        tl::bulk b2 = myEngine.expose(segments, tl::bulk_mode::read_only);
+        REQUIRE(b1.get_bulk() == b2.get_bulk());
+        // a different mode is a different registration
+        tl::bulk b3 = myEngine.expose(segments, tl::bulk_mode::read_write);
+        REQUIRE(b3.get_bulk() != b1.get_bulk());
+        auto stats = myEngine.get_registration_cache_stats();
+        REQUIRE(stats.hits == 1);
+        REQUIRE(stats.misses == 2);
+        REQUIRE(stats.size == 2);
+    }
+
+    SUBCASE("contained regions") {
+        tl::bulk whole = myEngine.expose(segments, tl::bulk_mode::read_write);
+        myEngine.define("cached_pull", [&myEngine](const tl::request& req, tl::bulk& b) {
+            std::vector<char> local(2 * b.size());
+            // the region is part of a cached registration of local
+            myEngine.expose_cached(local.data(), local.size(), tl::bulk_mode::write_only);
+            auto seg = myEngine.expose_cached(local.data() + b.size(), b.size(),
+                                              tl::bulk_mode::write_only);
+            seg << b.on(req.get_endpoint());
+            myEngine.invalidate_registrations(local.data(), local.size());
+            req.respond(std::vector<char>(local.begin() + b.size(), local.end()));
+        });
+        auto seg = myEngine.expose_cached(buffer.data() + 100, 1000, tl::bulk_mode::read_write);
+        REQUIRE(myEngine.get_registration_cache_stats().hits == 1);
+
+        tl::endpoint self_ep = myEngine.lookup(addr);
+        auto before = myEngine.get_registration_cache_stats();
+        std::vector<char> result = myEngine.define("cached_pull").on(self_ep)(whole);
+        REQUIRE(result == buffer);
+        auto after = myEngine.get_registration_cache_stats();
+        REQUIRE(after.hits == before.hits + 1);
+    }
+
+    SUBCASE("internal buffers are not cached") {
+        std::vector<std::string> values = {"single element"};
+        myEngine.define("pull_single", [](const tl::request& req, const tl::exposed_container& c) {
+            std::vector<std::string> result;
+            c.pull_to(req.get_endpoint(), result);
+            req.respond(result);
+        });
+        tl::endpoint self_ep = myEngine.lookup(addr);
+        auto exposed = myEngine.expose_container(values, tl::bulk_mode::read_only);
+        std::vector<std::string> result = myEngine.define("pull_single").on(self_ep)(exposed);
+        REQUIRE(result == values);
+        tl::bulk_pool pool(myEngine, {{4096, 1}});
+        auto lease = pool.acquire(8192);
+        REQUIRE_FALSE(lease.is_pooled());
+        auto stats = myEngine.get_registration_cache_stats();
+        REQUIRE(stats.size == 0);
+        REQUIRE(stats.misses == 0);
+    }
+
+    SUBCASE("eviction and invalidation") {
+        std::vector<char> other1(100), other2(100);
+        myEngine.expose(segments, tl::bulk_mode::read_only);
+        myEngine.expose({{other1.data(), other1.size()}}, tl::bulk_mode::read_only);
+        myEngine.expose({{other2.data(), other2.size()}}, tl::bulk_mode::read_only);
+        auto stats = myEngine.get_registration_cache_stats();
+        REQUIRE(stats.evictions == 1);
+        REQUIRE(stats.size == 2);
+        myEngine.invalidate_registrations(other1.data(), 1);
+        REQUIRE(myEngine.get_registration_cache_stats().size == 1);
+        myEngine.set_registration_cache_size(0);
+        REQUIRE(myEngine.get_registration_cache_stats().size == 0);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("bulk exposed containers") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("pull_strings", [](const tl::request& req, const tl::exposed_container& c) {
+        std::vector<std::string> values;
+        size_t n = c.pull_to(req.get_endpoint(), values);
+        req.respond(values, n);
+    });
+    myEngine.define("pull_arrays", [](const tl::request& req, const tl::exposed_container& c) {
+        std::vector<std::vector<double>> values;
+        c.pull_to(req.get_endpoint(), values);
+        req.respond(values);
+    });
+    myEngine.define("pull_mismatch", [](const tl::request& req, const tl::exposed_container& c) {
+        std::vector<std::vector<double>> values;
+        bool thrown = false;
+        try {
+            c.pull_to(req.get_endpoint(), values);
+        } catch(const tl::exception&) {
+            thrown = true;
+        }
+        req.respond(thrown);
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    SUBCASE("strings of various lengths") {
+        std::vector<std::string> values = {"alpha", "", "a much longer string value", "z"};
+        auto exposed = myEngine.expose_container(values, tl::bulk_mode::read_only);
+        REQUIRE(exposed.count() == 4);
+        REQUIRE(exposed.sizes()[2] == values[2].size());
+        auto result = myEngine.define("pull_strings").on(self_ep)(exposed)
+                          .as<std::vector<std::string>, size_t>();
+        REQUIRE(std::get<0>(result) == values);
+        REQUIRE(std::get<1>(result) == 32);
+    }
+
+    SUBCASE("nested vectors") {
+        std::vector<std::vector<double>> values(100);
+        for(size_t i = 0; i < values.size(); i++)
+            values[i].assign(i, static_cast<double>(i));
+        auto exposed = myEngine.expose_container(values, tl::bulk_mode::read_only);
+        std::vector<std::vector<double>> result = myEngine.define("pull_arrays").on(self_ep)(exposed);
+        REQUIRE(result == values);
+    }
+
+    SUBCASE("empty container") {
+        std::vector<std::vector<double>> values;
+        auto exposed = myEngine.expose_container(values, tl::bulk_mode::read_only);
+        std::vector<std::vector<double>> result = myEngine.define("pull_arrays").on(self_ep)(exposed);
+        REQUIRE(result.empty());
+    }
+
+    SUBCASE("mismatched value types") {
+        std::vector<std::string> values = {"abc"};
+        auto exposed = myEngine.expose_container(values, tl::bulk_mode::read_only);
+        bool thrown = myEngine.define("pull_mismatch").on(self_ep)(exposed);
+        REQUIRE(thrown);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("bulk striped pull from replicas") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::vector<char> data(100003);
+    for(size_t i = 0; i < data.size(); i++) data[i] = 'a' + (i % 19);
+    std::vector<std::vector<char>> copies(3, data);
+    std::vector<tl::bulk> exposed;
+    for(auto& c : copies)
+        exposed.push_back(myEngine.expose({{c.data(), c.size()}}, tl::bulk_mode::read_only));
+
+    std::vector<char> result(data.size());
+    tl::bulk local = myEngine.expose({{result.data(), result.size()}}, tl::bulk_mode::write_only);
+
+    SUBCASE("all replicas contribute") {
+        std::vector<tl::remote_bulk> replicas;
+        for(auto& b : exposed) replicas.push_back(b.on(self_ep));
+        std::vector<size_t> per_replica;
+        size_t n = tl::remote_bulk::pull_striped(replicas, local, 4096, 2, &per_replica);
+        REQUIRE(n == data.size());
+        REQUIRE(result == data);
+        REQUIRE(per_replica.size() == 3);
+        REQUIRE(per_replica[0] + per_replica[1] + per_replica[2] == data.size());
+        for(auto bytes : per_replica) REQUIRE(bytes > 0);
+    }
+
+    SUBCASE("smaller destination") {
+        std::vector<tl::remote_bulk> replicas = {exposed[0].on(self_ep)};
+        size_t n = tl::remote_bulk::pull_striped(replicas, local.select(0, 5000), 1024);
+        REQUIRE(n == 5000);
+        REQUIRE(std::equal(data.begin(), data.begin() + 5000, result.begin()));
+    }
+
+    SUBCASE("failed replica") {
+        // pulling from a write-only bulk fails
+        std::vector<char> unreadable(data);
+        tl::bulk bad = myEngine.expose({{unreadable.data(), unreadable.size()}},
+                                       tl::bulk_mode::write_only);
+        std::vector<tl::remote_bulk> replicas = {bad.on(self_ep), exposed[1].on(self_ep)};
+        std::vector<size_t> per_replica;
+        size_t n = tl::remote_bulk::pull_striped(replicas, local, 8192, 2, &per_replica);
+        REQUIRE(n == data.size());
+        REQUIRE(result == data);
+        REQUIRE(per_replica[0] == 0);
+        REQUIRE(per_replica[1] == data.size());
+
+        std::vector<tl::remote_bulk> all_bad = {bad.on(self_ep)};
+        REQUIRE_THROWS_AS(tl::remote_bulk::pull_striped(all_bad, local, 8192), tl::exception);
+    }
+
+    SUBCASE("invalid parameters") {
+        REQUIRE_THROWS_AS(tl::remote_bulk::pull_striped({}, local, 1024), tl::exception);
+        std::vector<tl::remote_bulk> replicas = {exposed[0].on(self_ep)};
+        REQUIRE_THROWS_AS(tl::remote_bulk::pull_striped(replicas, local, 0), tl::exception);
+    }
+
+    myEngine.finalize();
+}
+
 } // TEST_SUITE
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for the compact (varint) encoding of integers
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace tl = thallium;
+
+TEST_SUITE("Compact Encoding") {
+
+TEST_CASE("varint codec") {
+    SUBCASE("zigzag round trip") {
+        for(int64_t v : {int64_t(0), int64_t(-1), int64_t(1), int64_t(-64), int64_t(63),
+                         std::numeric_limits<int64_t>::min(),
+                         std::numeric_limits<int64_t>::max()}) {
+            REQUIRE(tl::detail::from_varint_value<int64_t>(tl::detail::to_varint_value(v)) == v);
+        }
+        REQUIRE(tl::detail::to_varint_value(int32_t(-1)) == 1);
+        REQUIRE(tl::detail::to_varint_value(int32_t(1)) == 2);
+    }
+
+    SUBCASE("encoded sizes") {
+        uint8_t buf[tl::detail::max_varint_size];
+        REQUIRE(tl::detail::encode_varint(0, buf) == 1);
+        REQUIRE(tl::detail::encode_varint(127, buf) == 1);
+        REQUIRE(tl::detail::encode_varint(128, buf) == 2);
+        REQUIRE(tl::detail::encode_varint(std::numeric_limits<uint64_t>::max(), buf)
+                == tl::detail::max_varint_size);
+    }
+
+    SUBCASE("batch decoder") {
+        std::vector<int64_t> values;
+        for(int i = 0; i < 100; i++)
+            values.push_back(i % 7 == 0 ? -(int64_t(1) << (i % 60)) : i % 50);
+        std::vector<uint8_t> buf(values.size() * tl::detail::max_varint_size);
+        size_t n = 0;
+        for(auto v : values)
+            n += tl::detail::encode_varint(tl::detail::to_varint_value(v), buf.data() + n);
+        std::vector<int64_t> decoded(values.size());
+        auto end = tl::detail::decode_varints(buf.data(), buf.data() + n,
+                                              decoded.data(), decoded.size());
+        REQUIRE(end == buf.data() + n);
+        REQUIRE(decoded == values);
+        // truncated input
+        REQUIRE(tl::detail::decode_varints(buf.data(), buf.data() + n - 1,
+                                           decoded.data(), decoded.size()) == nullptr);
+    }
+
+    SUBCASE("overlong varints") {
+        uint8_t buf[tl::detail::max_varint_size];
+        size_t  n = tl::detail::encode_varint(std::numeric_limits<uint64_t>::max(), buf);
+        const uint8_t* p = buf;
+        uint64_t v;
+        REQUIRE(tl::detail::decode_varint(p, buf + n, v));
+        REQUIRE(v == std::numeric_limits<uint64_t>::max());
+        // a 10th byte with bits set beyond bit 63
+        buf[n - 1] = 0x02;
+        p = buf;
+        REQUIRE_FALSE(tl::detail::decode_varint(p, buf + n, v));
+        uint64_t out;
+        REQUIRE(tl::detail::decode_varints(buf, buf + n, &out, 1) == nullptr);
+    }
+
+    SUBCASE("out-of-range values") {
+        REQUIRE(tl::detail::from_varint_value<uint16_t>(65535) == 65535);
+        REQUIRE_THROWS_AS(tl::detail::from_varint_value<uint16_t>(65536), tl::exception);
+        REQUIRE(tl::detail::from_varint_value<int32_t>(
+                    tl::detail::to_varint_value(std::numeric_limits<int32_t>::min()))
+                == std::numeric_limits<int32_t>::min());
+        REQUIRE_THROWS_AS(tl::detail::from_varint_value<int32_t>(
+                    tl::detail::to_varint_value(int64_t(std::numeric_limits<int32_t>::max()) + 1)),
+                tl::exception);
+        REQUIRE_THROWS_AS(tl::detail::from_varint_value<int32_t>(
+                    tl::detail::to_varint_value(int64_t(std::numeric_limits<int32_t>::min()) - 1)),
+                tl::exception);
+        uint8_t buf[tl::detail::max_varint_size];
+        size_t  n = tl::detail::encode_varint(70000, buf);
+        uint16_t out;
+        REQUIRE(tl::detail::decode_varints(buf, buf + n, &out, 1) == nullptr);
+    }
+}
+
+TEST_CASE("compact messages are smaller") {
+    std::vector<uint64_t> ids(1000);
+    for(size_t i = 0; i < ids.size(); i++) ids[i] = i % 100;
+    auto args = std::make_tuple(uint64_t(42), ids);
+
+    std::tuple<> plain;
+    std::tuple<tl::compact_encoding> compact;
+    size_t plain_size   = tl::detail::encoded_size(args, MARGO_INSTANCE_NULL, plain);
+    size_t compact_size = tl::detail::encoded_size(args, MARGO_INSTANCE_NULL, compact);
+    REQUIRE(plain_size >= ids.size() * sizeof(uint64_t));
+    REQUIRE(compact_size < ids.size() + 32);
+
+    // spans have the same wire format as vectors
+    auto view_args = std::make_tuple(uint64_t(42), tl::span<const uint64_t>(ids));
+    REQUIRE(tl::detail::encoded_size(view_args, MARGO_INSTANCE_NULL, compact) == compact_size);
+}
+
+TEST_CASE("RPC with compact encoding") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    auto compact = tl::decode_context([]() { return std::make_tuple(tl::compact_encoding{}); });
+
+    myEngine.define("compact_negate",
+        [](const tl::request& req, int32_t x, const std::vector<int64_t>& v,
+           const std::string& s) {
+            std::vector<int64_t> r;
+            for(auto e : v) r.push_back(-e);
+            req.with_serialization_context(tl::compact_encoding{}).respond(-x, r, s);
+        }, 0, compact);
+
+    auto rpc = myEngine.define("compact_negate");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::vector<int64_t> v = {0, 1, -1, 300, -300,
+                              std::numeric_limits<int64_t>::min() + 1,
+                              std::numeric_limits<int64_t>::max()};
+    for(int i = 0; i < 50; i++) v.push_back(i);
+
+    auto response = rpc.on(self_ep)
+                       .with_serialization_context(tl::compact_encoding{})
+                       (int32_t(-12345), v, std::string("hello"));
+    auto result = response.with_serialization_context(tl::compact_encoding{})
+                          .as<int32_t, std::vector<int64_t>, std::string>();
+
+    REQUIRE(std::get<0>(result) == 12345);
+    REQUIRE(std::get<1>(result).size() == v.size());
+    for(size_t i = 0; i < v.size(); i++)
+        REQUIRE(std::get<1>(result)[i] == -v[i]);
+    REQUIRE(std::get<2>(result) == "hello");
+
+    myEngine.finalize();
+}
+
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for the compression of RPC arguments and bulk transfers
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace tl = thallium;
+
+namespace {
+
+std::vector<char> lz_round_trip(const std::vector<char>& data, size_t& compressed_size) {
+    tl::lz_codec      c;
+    std::vector<char> compressed(c.max_compressed_size(data.size()));
+    compressed_size = c.compress(data.data(), data.size(), compressed.data(), compressed.size());
+    std::vector<char> result(data.size());
+    if(compressed_size == 0
+    || !c.decompress(compressed.data(), compressed_size, result.data(), result.size()))
+        result.clear();
+    return result;
+}
+
+std::vector<char> random_bytes(size_t size) {
+    std::mt19937      gen(42);
+    std::vector<char> data(size);
+    for(auto& b : data) b = static_cast<char>(gen());
+    return data;
+}
+
+// Codec storing each byte once followed by its repeat count
+class run_length_codec : public tl::codec {
+
+  public:
+
+    uint8_t id() const override { return 100; }
+
+    size_t max_compressed_size(size_t size) const override { return 2 * size; }
+
+    size_t compress(const void* in, size_t in_size,
+                    void* out, size_t out_size) const override {
+        auto   src = static_cast<const uint8_t*>(in);
+        auto   dst = static_cast<uint8_t*>(out);
+        size_t op  = 0;
+        for(size_t i = 0; i < in_size;) {
+            size_t run = 1;
+            while(i + run < in_size && run < 255 && src[i + run] == src[i]) run++;
+            if(out_size - op < 2) return 0;
+            dst[op++] = src[i];
+            dst[op++] = static_cast<uint8_t>(run);
+            i += run;
+        }
+        return op;
+    }
+
+    bool decompress(const void* in, size_t in_size,
+                    void* out, size_t out_size) const override {
+        auto   src = static_cast<const uint8_t*>(in);
+        auto   dst = static_cast<uint8_t*>(out);
+        size_t op  = 0;
+        for(size_t i = 0; i + 1 < in_size; i += 2) {
+            if(src[i + 1] > out_size - op) return false;
+            std::memset(dst + op, src[i], src[i + 1]);
+            op += src[i + 1];
+        }
+        return op == out_size;
+    }
+};
+
+// Same codec, under an id that the server does not know
+class unknown_codec : public run_length_codec {
+
+  public:
+
+    uint8_t id() const override { return 101; }
+};
+
+// Codec having the id of run_length_codec but producing data it cannot decompress
+class corrupting_codec : public run_length_codec {
+
+  public:
+
+    size_t compress(const void*, size_t in_size,
+                    void* out, size_t) const override {
+        std::memset(out, 0, in_size / 4);
+        return in_size / 4;
+    }
+};
+
+// Same codec, under another id, with a server refusing payloads that expand
+class bounded_codec : public run_length_codec {
+
+  public:
+
+    uint8_t id() const override { return 102; }
+
+    size_t max_decompressed_size(size_t in_size) const override { return in_size; }
+};
+
+} // namespace
+
+TEST_SUITE("Compression") {
+
+TEST_CASE("lz codec") {
+    size_t csize = 0;
+
+    SUBCASE("zeros") {
+        std::vector<char> data(100000, 0);
+        REQUIRE(lz_round_trip(data, csize) == data);
+        REQUIRE(csize < data.size() / 100);
+    }
+
+    SUBCASE("repeated text") {
+        std::string text;
+        for(int i = 0; i < 2000; i++)
+            text += "INFO request " + std::to_string(i % 17) + " completed\n";
+        std::vector<char> data(text.begin(), text.end());
+        REQUIRE(lz_round_trip(data, csize) == data);
+        REQUIRE(csize < data.size() / 4);
+    }
+
+    SUBCASE("sparse array") {
+        std::vector<double> values(10000, 0.0);
+        for(size_t i = 0; i < values.size(); i += 97) values[i] = static_cast<double>(i);
+        std::vector<char> data(reinterpret_cast<const char*>(values.data()),
+                               reinterpret_cast<const char*>(values.data() + values.size()));
+        REQUIRE(lz_round_trip(data, csize) == data);
+        REQUIRE(csize < data.size() / 4);
+    }
+
+    SUBCASE("random data") {
+        std::vector<char> data = random_bytes(10000);
+        REQUIRE(lz_round_trip(data, csize) == data);
+        REQUIRE(csize > data.size());
+    }
+
+    SUBCASE("short inputs") {
+        for(size_t n : {0, 1, 3, 4, 5, 17}) {
+            std::vector<char> data(n, 'x');
+            REQUIRE(lz_round_trip(data, csize) == data);
+        }
+    }
+
+    SUBCASE("malformed input") {
+        tl::lz_codec      c;
+        std::vector<char> data(1000, 'a');
+        std::vector<char> compressed(c.max_compressed_size(data.size()));
+        csize = c.compress(data.data(), data.size(), compressed.data(), compressed.size());
+        std::vector<char> out(data.size());
+        REQUIRE_FALSE(c.decompress(compressed.data(), csize - 1, out.data(), out.size()));
+        REQUIRE_FALSE(c.decompress(compressed.data(), csize, out.data(), out.size() - 1));
+    }
+}
+
+TEST_CASE("compressed RPC arguments") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    server.define("compressed_sum", [](const tl::request& req,
+                                       const std::vector<char>& v, const std::string& s) {
+        uint64_t sum = 0;
+        for(auto c : v) sum += static_cast<unsigned char>(c);
+        req.respond(sum, s);
+    });
+    server.register_codec(std::make_shared<run_length_codec>());
+    server.register_codec(std::make_shared<bounded_codec>());
+
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    tl::endpoint ep = client.lookup(static_cast<std::string>(server.self()));
+
+    SUBCASE("built-in codec") {
+        auto rpc = client.define("compressed_sum")
+                         .set_compression(std::make_shared<tl::lz_codec>(), 1024);
+        std::vector<char> v(100000, 1);
+        auto result = rpc.on(ep)(v, std::string("big")).as<uint64_t, std::string>();
+        REQUIRE(std::get<0>(result) == v.size());
+        REQUIRE(std::get<1>(result) == "big");
+
+        // below the threshold
+        std::vector<char> small(10, 1);
+        result = rpc.on(ep)(small, std::string("small")).as<uint64_t, std::string>();
+        REQUIRE(std::get<0>(result) == small.size());
+
+        // incompressible
+        std::vector<char> noise = random_bytes(10000);
+        uint64_t expected = 0;
+        for(auto c : noise) expected += static_cast<unsigned char>(c);
+        result = rpc.on(ep).async(noise, std::string("noise")).wait()
+                    .as<uint64_t, std::string>();
+        REQUIRE(std::get<0>(result) == expected);
+
+        auto stats = rpc.get_compression_stats();
+        REQUIRE(stats.compressed == 1);
+        REQUIRE(stats.uncompressed == 2);
+        REQUIRE(stats.raw_bytes > v.size());
+        REQUIRE(stats.compressed_bytes < stats.raw_bytes / 100);
+    }
+
+    SUBCASE("user codec") {
+        auto rpc = client.define("compressed_sum")
+                         .set_compression(std::make_shared<run_length_codec>(), 0);
+        std::vector<char> v(50000, 3);
+        auto result = rpc.on(ep)(v, std::string("rle")).as<uint64_t, std::string>();
+        REQUIRE(std::get<0>(result) == 3 * v.size());
+        REQUIRE(std::get<1>(result) == "rle");
+        REQUIRE(rpc.get_compression_stats().compressed == 1);
+    }
+
+    SUBCASE("codec unknown to the server") {
+        auto rpc = client.define("compressed_sum")
+                         .set_compression(std::make_shared<unknown_codec>(), 0);
+        std::vector<char> v(10000, 2);
+        REQUIRE_THROWS_AS(rpc.on(ep)(v, std::string()).as<uint64_t>(),
+                          tl::exception);
+    }
+
+    SUBCASE("uncompressed size above the codec's bound") {
+        auto rpc = client.define("compressed_sum")
+                         .set_compression(std::make_shared<bounded_codec>(), 0);
+        std::vector<char> v(10000, 2);
+        REQUIRE_THROWS_AS(rpc.on(ep)(v, std::string()).as<uint64_t>(),
+                          tl::exception);
+    }
+
+    SUBCASE("decompression failure") {
+        auto rpc = client.define("compressed_sum")
+                         .set_compression(std::make_shared<corrupting_codec>(), 0);
+        std::vector<char> v(10000, 2);
+        REQUIRE_THROWS_AS(rpc.on(ep)(v, std::string()).as<uint64_t>(),
+                          tl::exception);
+    }
+
+    SUBCASE("compression disabled") {
+        auto rpc = client.define("compressed_sum");
+        rpc.set_compression(std::make_shared<tl::lz_codec>(), 0);
+        rpc.set_compression(nullptr);
+        std::vector<char> v(10000, 1);
+        uint64_t sum = std::get<0>(rpc.on(ep)(v, std::string()).as<uint64_t, std::string>());
+        REQUIRE(sum == v.size());
+        REQUIRE(rpc.get_compression_stats().compressed == 0);
+    }
+
+    client.finalize();
+    server.finalize();
+}
+
+TEST_CASE("compressed bulk") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    server.define("pull_compressed", [](const tl::request& req, const tl::compressed_bulk& b) {
+        std::vector<char> data(b.raw_size());
+        b.pull_to(req.get_endpoint(), data.data(), data.size());
+        uint64_t sum = 0;
+        for(auto c : data) sum += static_cast<unsigned char>(c);
+        req.respond(sum);
+    });
+
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    tl::endpoint ep = client.lookup(static_cast<std::string>(server.self()));
+    auto rpc = client.define("pull_compressed");
+
+    SUBCASE("compressible data") {
+        std::vector<char> data(1 << 20, 2);
+        tl::compressed_bulk b(client, data.data(), data.size());
+        REQUIRE(b.is_compressed());
+        REQUIRE(b.raw_size() == data.size());
+        REQUIRE(b.transfer_size() < data.size() / 100);
+        uint64_t sum = rpc.on(ep)(b);
+        REQUIRE(sum == 2 * data.size());
+    }
+
+    SUBCASE("incompressible data") {
+        std::vector<char> data = random_bytes(100000);
+        uint64_t expected = 0;
+        for(auto c : data) expected += static_cast<unsigned char>(c);
+        tl::compressed_bulk b(client, data.data(), data.size());
+        REQUIRE_FALSE(b.is_compressed());
+        REQUIRE(b.transfer_size() == data.size());
+        uint64_t sum = rpc.on(ep)(b);
+        REQUIRE(sum == expected);
+    }
+
+    SUBCASE("below the threshold") {
+        std::vector<char> data(100, 5);
+        tl::compressed_bulk b(client, data.data(), data.size(), tl::lz_codec(), 1024);
+        REQUIRE_FALSE(b.is_compressed());
+        uint64_t sum = rpc.on(ep)(b);
+        REQUIRE(sum == 500);
+    }
+
+    client.finalize();
+    server.finalize();
+}
+
+}
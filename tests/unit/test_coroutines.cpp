@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for the C++20 coroutine awaitables in Thallium
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <vector>
+
+namespace tl = thallium;
+
+TEST_SUITE("Coroutines") {
+
+static tl::co_task<int> add(tl::remote_procedure& rpc, tl::endpoint ep,
+                            tl::pool p, int a, int b) {
+    int r = co_await tl::co_wait(rpc.on(ep).async(a, b), p);
+    co_return r;
+}
+
+static tl::co_task<int> add_all(tl::remote_procedure& rpc, tl::endpoint ep,
+                                tl::pool p, int n) {
+    int sum = 0;
+    for(int i = 0; i < n; i++)
+        sum += co_await add(rpc, ep, p, i, 1);
+    co_return sum;
+}
+
+TEST_CASE("co_await async_response") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    auto rpc = myEngine.define("co_add", [](const tl::request& req, int a, int b) {
+        req.respond(a + b);
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+    tl::pool     pool    = myEngine.get_handler_pool();
+
+    REQUIRE(add(rpc, self_ep, pool, 40, 2).wait() == 42);
+    REQUIRE(add_all(rpc, self_ep, pool, 10).wait() == 55);
+
+    std::vector<tl::co_task<int>> tasks;
+    for(int i = 0; i < 20; i++) {
+        tasks.push_back(add(rpc, self_ep, pool, i, i));
+        tasks.back().start(pool);
+    }
+    for(int i = 0; i < 20; i++)
+        REQUIRE(tasks[i].wait() == 2 * i);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("co_await propagates errors") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    auto rpc = myEngine.define("co_slow", [&myEngine](const tl::request& req) {
+        tl::thread::sleep(myEngine, 500);
+        req.respond();
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+    tl::pool     pool    = myEngine.get_handler_pool();
+
+    auto task = [&]() -> tl::co_task<void> {
+        co_await tl::co_wait(
+            rpc.on(self_ep).timed_async(std::chrono::milliseconds(50)), pool);
+    }();
+    REQUIRE_THROWS_AS(task.wait(), tl::timeout);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("co_await bulk transfer") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+    tl::pool    pool = myEngine.get_handler_pool();
+
+    myEngine.define("co_pull", [&myEngine, pool](const tl::request& req, tl::bulk& remote) {
+        std::vector<char> buffer(remote.size());
+        std::vector<std::pair<void*, size_t>> segments = {{buffer.data(), buffer.size()}};
+        tl::bulk local = myEngine.expose(segments, tl::bulk_mode::write_only);
+        auto task = [&]() -> tl::co_task<std::size_t> {
+            std::size_t n = co_await tl::co_wait(
+                remote.on(req.get_endpoint()).pull_to(local), pool);
+            co_return n;
+        }();
+        std::size_t n = task.wait();
+        if(n != buffer.size()) buffer.clear();
+        req.respond(buffer);
+    });
+
+    std::vector<char> data(64, 'C');
+    std::vector<std::pair<void*, size_t>> segments = {{data.data(), data.size()}};
+    tl::bulk bulk_handle = myEngine.expose(segments, tl::bulk_mode::read_only);
+    auto rpc = myEngine.define("co_pull");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::vector<char> result = rpc.on(self_ep)(bulk_handle);
+    REQUIRE(result == data);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("co_await eventual and co_sleep") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    tl::pool   pool = myEngine.get_handler_pool();
+
+    tl::eventual<int> ev;
+    auto task = [&]() -> tl::co_task<int> {
+        co_await tl::co_sleep(myEngine, 10.0, pool);
+        int x = co_await tl::co_wait(ev, pool);
+        co_return x + 1;
+    }();
+    task.start(pool);
+    REQUIRE(!task.completed());
+    ev.set_value(41);
+    REQUIRE(task.wait() == 42);
+
+    myEngine.finalize();
+}
+
+}
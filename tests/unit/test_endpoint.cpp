@@ -186,4 +186,52 @@ TEST_CASE("endpoint copy constructor from non-null") {
     myEngine.finalize();
 }
 
+TEST_CASE("endpoint lookup cache") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    REQUIRE(!myEngine.lookup_cache_enabled());
+    myEngine.enable_lookup_cache();
+    REQUIRE(myEngine.lookup_cache_enabled());
+
+    tl::endpoint ep1 = myEngine.lookup(addr);
+    tl::endpoint ep2 = myEngine.lookup(addr);
+    REQUIRE(ep1 == ep2);
+    REQUIRE(static_cast<std::string>(ep2) == addr);
+
+    myEngine.invalidate_lookup_cache(addr);
+    tl::endpoint ep3 = myEngine.lookup(addr);
+    REQUIRE(ep3 == ep1);
+
+    myEngine.invalidate_lookup_cache();
+    myEngine.enable_lookup_cache(false);
+    REQUIRE(!myEngine.lookup_cache_enabled());
+
+    myEngine.finalize();
+}
+
+TEST_CASE("endpoint lookup_many") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    std::vector<std::string> addrs(8, addr);
+    std::vector<tl::endpoint> eps = myEngine.lookup_many(addrs);
+    REQUIRE(eps.size() == addrs.size());
+    for(auto& ep : eps) {
+        REQUIRE(!ep.is_null());
+        REQUIRE(static_cast<std::string>(ep) == addr);
+    }
+
+    myEngine.enable_lookup_cache();
+    eps = myEngine.lookup_many(addrs);
+    REQUIRE(eps.size() == addrs.size());
+
+    REQUIRE(myEngine.lookup_many({}).empty());
+
+    std::vector<std::string> bad = { addr, "invalid://address" };
+    REQUIRE_THROWS(myEngine.lookup_many(bad));
+
+    myEngine.finalize();
+}
+
 } // TEST_SUITE
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for Thallium RDMA offloading of large arguments and responses
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace tl = thallium;
+
+TEST_SUITE("RDMA Offload") {
+
+TEST_CASE("threshold configuration") {
+    tl::engine engine("tcp", THALLIUM_CLIENT_MODE);
+    REQUIRE(engine.get_rdma_offload_threshold() == 0);
+    engine.set_rdma_offload_threshold(4096);
+    REQUIRE(engine.get_rdma_offload_threshold() == 4096);
+    engine.set_rdma_offload_threshold(0);
+    REQUIRE(engine.get_rdma_offload_threshold() == 0);
+    engine.finalize();
+}
+
+TEST_CASE("large arguments and responses are offloaded") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    server.set_rdma_offload_threshold(1024);
+    server.define("offload_reverse", [](const tl::request& req, const std::vector<double>& v) {
+        std::vector<double> r(v.rbegin(), v.rend());
+        req.respond(r);
+    });
+    server.define("offload_concat", [](const tl::request& req,
+                                       const std::string& a, const std::string& b) {
+        req.respond(a + b);
+    });
+
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    client.set_rdma_offload_threshold(1024);
+    auto reverse = client.define("offload_reverse");
+    auto concat  = client.define("offload_concat");
+    tl::endpoint ep = client.lookup(static_cast<std::string>(server.self()));
+
+    SUBCASE("vector above the threshold") {
+        std::vector<double> v(100000);
+        std::iota(v.begin(), v.end(), 0.0);
+        std::vector<double> r = reverse.on(ep)(v);
+        REQUIRE(r.size() == v.size());
+        REQUIRE(std::equal(v.rbegin(), v.rend(), r.begin()));
+    }
+
+    SUBCASE("timed call with an offloaded response") {
+        std::vector<double> v(100000);
+        std::iota(v.begin(), v.end(), 0.0);
+        std::vector<double> r = reverse.on(ep).timed(std::chrono::seconds(10), v);
+        REQUIRE(std::equal(v.rbegin(), v.rend(), r.begin()));
+    }
+
+    SUBCASE("vector below the threshold") {
+        std::vector<double> v = {1.0, 2.0, 3.0};
+        std::vector<double> r = reverse.on(ep)(v);
+        REQUIRE(r == std::vector<double>{3.0, 2.0, 1.0});
+    }
+
+    SUBCASE("empty vector") {
+        std::vector<double> r = reverse.on(ep)(std::vector<double>());
+        REQUIRE(r.empty());
+    }
+
+    SUBCASE("strings mixing offloaded and inline data") {
+        std::string a(50000, 'a');
+        std::string b = "small";
+        std::string r = concat.on(ep)(a, b);
+        REQUIRE(r == a + b);
+    }
+
+    SUBCASE("asynchronous calls") {
+        std::vector<std::vector<double>> inputs;
+        std::vector<tl::async_response> responses;
+        for(int i = 0; i < 4; i++) {
+            inputs.emplace_back(10000 * (i + 1), static_cast<double>(i));
+            responses.push_back(reverse.on(ep).async(inputs.back()));
+        }
+        for(int i = 0; i < 4; i++) {
+            std::vector<double> r = responses[i].wait();
+            REQUIRE(r == inputs[i]);
+        }
+    }
+
+    SUBCASE("unconsumed responses do not block the server") {
+        std::vector<double> v(10000, 1.0);
+        {
+            auto response = reverse.on(ep).async(v);
+            response.wait();
+        }
+        std::vector<double> r = reverse.on(ep)(v);
+        REQUIRE(r == v);
+    }
+
+    client.finalize();
+    server.finalize();
+}
+
+TEST_CASE("respond does not wait for the client to pull offloaded data") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    server.set_rdma_offload_threshold(1024);
+    std::atomic<bool> responded{false};
+    server.define("offload_fill", [&responded](const tl::request& req, size_t n) {
+        std::vector<double> r(n);
+        std::iota(r.begin(), r.end(), 0.0);
+        req.respond(r);
+        // the response outlives the vector it was made from
+        responded = true;
+    });
+
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    client.set_rdma_offload_threshold(1024);
+    auto fill = client.define("offload_fill");
+    tl::endpoint ep = client.lookup(static_cast<std::string>(server.self()));
+
+    // timed calls carry a header, so their response can be offloaded
+    auto response = fill.on(ep).timed_async(std::chrono::seconds(10), size_t(100000));
+    for(int i = 0; i < 500 && !responded; i++)
+        tl::thread::sleep(client, 10);
+    REQUIRE(responded);
+    std::vector<double> r = response.wait();
+    REQUIRE(r.size() == 100000);
+    REQUIRE(r.back() == 99999.0);
+
+    client.finalize();
+    server.finalize();
+}
+
+TEST_CASE("offload tokens are only accepted from the requester") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE);
+    tl::engine client("tcp", THALLIUM_SERVER_MODE);
+    server.set_rdma_offload_threshold(1024);
+    margo_instance_id mid = server.get_margo_instance();
+    auto state = tl::detail::get_instance_data<tl::detail::offload_state>(mid);
+    tl::endpoint requester = server.lookup(static_cast<std::string>(client.self()));
+    tl::endpoint other     = server.self();
+
+    std::weak_ptr<tl::detail::offload_holder> weak;
+    uint64_t token = 0;
+    {
+        auto holder = std::make_shared<tl::detail::offload_holder>(
+            mid, state, true, requester.get_addr());
+        token = holder->token();
+        weak  = holder;
+    }
+    REQUIRE(token != 0);
+    state->release(token + 1, requester.get_addr());
+    state->release(token, other.get_addr());
+    REQUIRE(!weak.expired());
+    state->release(token, requester.get_addr());
+    REQUIRE(weak.expired());
+
+    client.finalize();
+    server.finalize();
+}
+
+TEST_CASE("serialized_size is not affected by offloading") {
+    tl::engine engine("tcp", THALLIUM_CLIENT_MODE);
+    std::vector<double> v(10000, 2.0);
+    size_t before = tl::serialized_size(v);
+    engine.set_rdma_offload_threshold(1024);
+    REQUIRE(tl::serialized_size(v) == before);
+    REQUIRE(before >= v.size() * sizeof(double));
+    engine.finalize();
+}
+
+}
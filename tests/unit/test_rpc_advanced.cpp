@@ -8,10 +8,38 @@
 #include "test_helpers.hpp"
 #include <thallium.hpp>
 #include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <vector>
 
 namespace tl = thallium;
 
+namespace {
+
+// Payload counting how many times it is copied
+struct copy_counter {
+    static std::atomic<int> copies;
+    std::vector<int>        values;
+
+    copy_counter() = default;
+    copy_counter(const copy_counter& other) : values(other.values) { copies++; }
+    copy_counter(copy_counter&&) = default;
+    copy_counter& operator=(const copy_counter& other) {
+        values = other.values;
+        copies++;
+        return *this;
+    }
+    copy_counter& operator=(copy_counter&&) = default;
+
+    template <typename A> void serialize(A& ar) { ar & values; }
+};
+
+std::atomic<int> copy_counter::copies{0};
+
+} // namespace
+
 TEST_SUITE("RPC Advanced") {
 
 TEST_CASE("rpc async call") {
@@ -318,4 +346,309 @@ TEST_CASE("rpc async no response") {
     myEngine.finalize();
 }
 
+TEST_CASE("rpc self dispatch") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    std::atomic<bool> was_local{false};
+
+    myEngine.define("local_add", [&](const tl::request& req, int x, int y) {
+        was_local.store(req.is_local());
+        req.respond(x + y);
+    });
+
+    auto rpc = myEngine.define("local_add").enable_self_dispatch();
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    int result = rpc.on(self_ep)(20, 22);
+    REQUIRE(result == 42);
+    REQUIRE(was_local.load());
+
+    auto response = rpc.on(self_ep).async(1, 2);
+    REQUIRE(static_cast<int>(response.wait()) == 3);
+
+    // timed calls go through Mercury
+    result = rpc.on(self_ep).timed(std::chrono::seconds(5), 3, 4);
+    REQUIRE(result == 7);
+    REQUIRE(!was_local.load());
+
+    myEngine.finalize();
+}
+
+TEST_CASE("rpc self dispatch strings") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    std::atomic<bool> was_local{false};
+
+    myEngine.define("local_greet", [&](const tl::request& req, const std::string& name) {
+        was_local.store(req.is_local());
+        req.respond("Hello " + name);
+    });
+
+    auto rpc = myEngine.define("local_greet").enable_self_dispatch();
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::string result = rpc.on(self_ep)(std::string("Matthieu"));
+    REQUIRE(result == "Hello Matthieu");
+    REQUIRE(was_local.load());
+
+    // requesting a type other than the one responded with throws
+    REQUIRE_THROWS_AS(rpc.on(self_ep)(std::string("Phil")).as<int>(), tl::exception);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("rpc self dispatch type mismatch falls back") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    std::atomic<bool> was_local{false};
+
+    myEngine.define("local_size", [&](const tl::request& req, const std::vector<char>& v) {
+        was_local.store(req.is_local());
+        req.respond(v.size());
+    });
+
+    auto rpc = myEngine.define("local_size").enable_self_dispatch();
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    // std::string and std::vector<char> serialize the same way,
+    // but the types differ so the call goes through Mercury
+    size_t result = rpc.on(self_ep)(std::string("abc"));
+    REQUIRE(result == 3);
+    REQUIRE(!was_local.load());
+
+    std::vector<char> v = {'a', 'b', 'c', 'd'};
+    result = rpc.on(self_ep)(v);
+    REQUIRE(result == 4);
+    REQUIRE(was_local.load());
+
+    myEngine.finalize();
+}
+
+TEST_CASE("rpc self dispatch moves rvalue arguments") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("local_count", [](const tl::request& req, const copy_counter& c) {
+        req.respond(c.values.size());
+    });
+
+    auto rpc = myEngine.define("local_count").enable_self_dispatch();
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    copy_counter c;
+    c.values.resize(16);
+    copy_counter::copies = 0;
+    size_t size = rpc.on(self_ep)(std::move(c));
+    REQUIRE(size == 16);
+    REQUIRE(copy_counter::copies == 0);
+
+    // lvalues may still be used by the caller, so they are copied
+    copy_counter d;
+    d.values.resize(8);
+    size = rpc.on(self_ep)(d);
+    REQUIRE(size == 8);
+    REQUIRE(copy_counter::copies == 1);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("rpc self dispatch with provider id") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+
+    std::atomic<int> called_provider{-1};
+
+    myEngine.define("local_whoami", [&](const tl::request& req) {
+        called_provider.store(1);
+        req.respond(1);
+    }, 1);
+    myEngine.define("local_whoami", [&](const tl::request& req) {
+        called_provider.store(2);
+        req.respond(2);
+    }, 2);
+
+    auto rpc = myEngine.define("local_whoami").enable_self_dispatch();
+    tl::provider_handle ph(myEngine.self(), 2);
+
+    int result = rpc.on(ph)();
+    REQUIRE(result == 2);
+    REQUIRE(called_provider.load() == 2);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("rpc handle cache") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    REQUIRE(myEngine.get_handle_cache_size() == 0);
+    myEngine.set_handle_cache_size(4);
+    REQUIRE(myEngine.get_handle_cache_size() == 4);
+
+    auto add = myEngine.define("cached_add", [](const tl::request& req, int a, int b) {
+        req.respond(a + b);
+    });
+    auto neg = myEngine.define("cached_neg", [](const tl::request& req, int a) {
+        req.respond(-a);
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    // handles released by one RPC are reset and reused by the other
+    for(int i = 0; i < 20; i++) {
+        int x = add.on(self_ep)(i, 1);
+        int y = neg.on(self_ep)(i);
+        REQUIRE(x == i + 1);
+        REQUIRE(y == -i);
+    }
+
+    // the async_response outlives the callable_remote_procedure
+    std::vector<tl::async_response> responses;
+    for(int i = 0; i < 10; i++)
+        responses.push_back(add.on(self_ep).async(i, i));
+    for(int i = 0; i < 10; i++) {
+        int x = responses[i].wait();
+        REQUIRE(x == 2*i);
+    }
+    responses.clear();
+
+    myEngine.set_handle_cache_size(0);
+    int x = add.on(self_ep)(2, 3);
+    REQUIRE(x == 5);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("rpc handle cache with provider ids") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    myEngine.set_handle_cache_size(8);
+
+    myEngine.define("cached_whoami", [](const tl::request& req) {
+        req.respond(1);
+    }, 1);
+    myEngine.define("cached_whoami", [](const tl::request& req) {
+        req.respond(2);
+    }, 2);
+    auto rpc = myEngine.define("cached_whoami");
+    tl::provider_handle ph1(myEngine.self(), 1);
+    tl::provider_handle ph2(myEngine.self(), 2);
+
+    for(int i = 0; i < 10; i++) {
+        int r1 = rpc.on(ph1)();
+        int r2 = rpc.on(ph2)();
+        REQUIRE(r1 == 1);
+        REQUIRE(r2 == 2);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("rpc deadline is visible to the handler") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    auto rpc = myEngine.define("deadline_probe", [](const tl::request& req) {
+        auto now = std::chrono::system_clock::now();
+        if(req.deadline() == std::chrono::system_clock::time_point::max())
+            req.respond(-1);
+        else
+            req.respond(static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    req.deadline() - now).count()));
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    int remaining = rpc.on(self_ep)();
+    REQUIRE(remaining == -1);
+    // without propagation, timed calls keep the plain wire format
+    remaining = rpc.on(self_ep).timed(std::chrono::seconds(5));
+    REQUIRE(remaining == -1);
+    rpc.enable_deadline_propagation();
+    remaining = rpc.on(self_ep).timed(std::chrono::seconds(5));
+    REQUIRE(remaining > 0);
+    REQUIRE(remaining <= 5000);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("rpc expired requests are dropped") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    // handlers run in an execution stream that the first RPC blocks
+    tl::managed<tl::pool> handler_pool = tl::pool::create(
+        tl::pool::access::mpmc, tl::pool::kind::fifo_wait);
+    tl::managed<tl::xstream> handler_xs = tl::xstream::create(
+        tl::scheduler::predef::deflt, *handler_pool);
+
+    std::atomic<int> executed{0};
+    auto block = myEngine.define("deadline_block", [](const tl::request& req) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        req.respond();
+    }, 0, *handler_pool);
+    auto work = myEngine.define("deadline_work", [&executed](const tl::request& req, int x) {
+        executed++;
+        req.respond(x);
+    }, 0, *handler_pool);
+    work.enable_deadline_propagation();
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    REQUIRE(myEngine.get_expired_request_count() == 0);
+    auto blocking = block.on(self_ep).async();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE_THROWS_AS(work.on(self_ep).timed(std::chrono::milliseconds(100), 42),
+                      tl::timeout);
+    blocking.wait();
+
+    // the queued call is dropped once the execution stream is available
+    for(int i = 0; i < 100 && myEngine.get_expired_request_count() == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(myEngine.get_expired_request_count() == 1);
+    REQUIRE(executed == 0);
+
+    // calls whose deadline has not passed are executed normally
+    int x = work.on(self_ep).timed(std::chrono::seconds(5), 7);
+    REQUIRE(x == 7);
+    REQUIRE(executed == 1);
+
+    myEngine.finalize();
+    handler_xs->join();
+}
+
+TEST_CASE("rpc arguments are moved into the handler") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("by_value", [](const tl::request& req, copy_counter c, std::string s) {
+        req.respond(c.values.size() + s.size());
+    });
+    myEngine.define("by_reference", [](const tl::request& req, const copy_counter& c,
+                                       std::vector<int>&& v) {
+        std::vector<int> taken = std::move(v);
+        req.respond(c.values.size() + taken.size());
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    copy_counter c;
+    c.values.assign(1000, 7);
+    std::vector<int> v(10, 1);
+
+    copy_counter::copies = 0;
+    size_t result = myEngine.define("by_value").on(self_ep)(c, std::string("abc"));
+    REQUIRE(result == 1003);
+    REQUIRE(copy_counter::copies == 0);
+
+    result = myEngine.define("by_reference").on(self_ep)(c, v);
+    REQUIRE(result == 1010);
+    REQUIRE(copy_counter::copies == 0);
+
+    // self-dispatched calls copy the arguments once, for the handler
+    result = myEngine.define("by_value").enable_self_dispatch().on(self_ep)(c, std::string("abc"));
+    REQUIRE(result == 1003);
+    REQUIRE(copy_counter::copies == 1);
+
+    myEngine.finalize();
+}
+
 } // TEST_SUITE
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for RPC batching in Thallium
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <atomic>
+#include <vector>
+
+namespace tl = thallium;
+
+TEST_SUITE("RPC Batching") {
+
+TEST_CASE("batched calls get their own responses") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    myEngine.enable_batching();
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    auto rpc = myEngine.define("batched_add", [](const tl::request& req, int a, int b) {
+        req.respond(a + b);
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    {
+        tl::rpc_batcher batcher(myEngine, 16);
+        std::vector<tl::async_response> responses;
+        for(int i = 0; i < 100; i++)
+            responses.push_back(batcher.async(rpc, self_ep, i, 2*i));
+        for(int i = 0; i < 100; i++) {
+            int result = responses[i].wait();
+            REQUIRE(result == 3*i);
+        }
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("batched calls are sent by wait without flush") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    myEngine.enable_batching();
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    auto rpc = myEngine.define("batched_echo", [](const tl::request& req, const std::string& s) {
+        req.respond(s);
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    {
+        // no size or time threshold reached before waiting
+        tl::rpc_batcher batcher(myEngine, 1000, 1 << 20, 0.0);
+        auto r1 = batcher.async(rpc, self_ep, std::string("hello"));
+        auto r2 = batcher.async(rpc, self_ep, std::string("world"));
+        std::string s2 = r2.wait();
+        std::string s1 = r1.wait();
+        REQUIRE(s1 == "hello");
+        REQUIRE(s2 == "world");
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("batched calls are sent after the delay") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    myEngine.enable_batching();
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    std::atomic<int> count{0};
+    auto rpc = myEngine.define("batched_count", [&count](const tl::request& req, int x) {
+        count += x;
+        req.respond();
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    {
+        tl::rpc_batcher batcher(myEngine, 1000, 1 << 20, 1.0);
+        auto r = batcher.async(rpc, self_ep, 5);
+        // the timer flushes the queue, so polling eventually succeeds
+        while(!r.received()) tl::thread::yield();
+        REQUIRE(count == 5);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("batched calls with provider ids") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    myEngine.enable_batching();
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("batched_provider", [](const tl::request& req, int x) {
+        req.respond(x + 1);
+    }, 1);
+    myEngine.define("batched_provider", [](const tl::request& req, int x) {
+        req.respond(x + 2);
+    }, 2);
+    auto rpc = myEngine.define("batched_provider");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    {
+        tl::rpc_batcher batcher(myEngine);
+        auto r1 = batcher.async(rpc, tl::provider_handle(self_ep, 1), 10);
+        auto r2 = batcher.async(rpc, tl::provider_handle(self_ep, 2), 10);
+        batcher.flush();
+        int x1 = r1.wait();
+        int x2 = r2.wait();
+        REQUIRE(x1 == 11);
+        REQUIRE(x2 == 12);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("batched calls without response") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    myEngine.enable_batching();
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    std::atomic<int> count{0};
+    myEngine.define("batched_notify", [&count](const tl::request&, int x) {
+        count += x;
+    }).disable_response();
+    auto rpc = myEngine.define("batched_notify").disable_response();
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    {
+        tl::rpc_batcher batcher(myEngine);
+        for(int i = 0; i < 10; i++)
+            batcher.async(rpc, self_ep, 1);
+        // destroying the batcher waits for the batches to complete
+    }
+    while(count != 10) tl::thread::yield();
+    REQUIRE(count == 10);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("batched and regular calls mix") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    myEngine.enable_batching();
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    std::atomic<bool> has_endpoint{true};
+    auto rpc = myEngine.define("batched_square", [&has_endpoint](const tl::request& req, int x) {
+        if(req.get_endpoint().is_null()) has_endpoint = false;
+        req.respond(x * x);
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    {
+        tl::rpc_batcher batcher(myEngine);
+        auto r = batcher.async(rpc, self_ep, 7);
+        int direct = rpc.on(self_ep)(6);
+        int batched = r.wait();
+        REQUIRE(direct == 36);
+        REQUIRE(batched == 49);
+        REQUIRE(has_endpoint);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("batched calls to unknown rpcs fail") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    myEngine.enable_batching();
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    // registered without a handler, hence not callable within a batch
+    auto rpc = myEngine.define("batched_missing");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    {
+        tl::rpc_batcher batcher(myEngine);
+        auto r = batcher.async(rpc, self_ep, 1);
+        REQUIRE_THROWS_AS(r.wait(), tl::exception);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("batched calls are subject to admission limits") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    myEngine.enable_batching();
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    auto rpc = myEngine.define("batched_limited", [](const tl::request& req, int x) {
+        req.respond(x);
+    });
+    tl::admission_limits limits;
+    limits.max_in_flight = 1;
+    rpc.set_admission_limits(limits);
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    {
+        tl::rpc_batcher batcher(myEngine);
+        auto r1 = batcher.async(rpc, self_ep, 1);
+        auto r2 = batcher.async(rpc, self_ep, 2);
+        batcher.flush();
+        // the calls of a batch are admitted before any of them starts
+        int x1 = r1.wait();
+        REQUIRE(x1 == 1);
+        REQUIRE_THROWS_AS(r2.wait(), tl::busy);
+        REQUIRE(rpc.get_admission_stats().rejected == 1);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("batches are refused unless enabled") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    std::atomic<int> received{0};
+    auto rpc = myEngine.define("batched_refused", [&received](const tl::request& req, int x) {
+        received++;
+        req.respond(x);
+    });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    {
+        tl::rpc_batcher batcher(myEngine);
+        auto r = batcher.async(rpc, self_ep, 1);
+        REQUIRE_THROWS_AS(r.wait(), tl::exception);
+        REQUIRE(received == 0);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("malformed batches are answered") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    server.enable_batching();
+
+    // a client sending something other than a batch to the batch RPC
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc = client.define(tl::detail::batch_rpc_name());
+    tl::endpoint ep = client.lookup(static_cast<std::string>(server.self()));
+
+    REQUIRE_NOTHROW(rpc.on(ep).timed(std::chrono::seconds(5), uint64_t(1000)));
+
+    client.finalize();
+    server.finalize();
+}
+
+}
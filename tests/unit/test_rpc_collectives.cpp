@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for Thallium tree-based broadcast and reduce
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace tl = thallium;
+
+TEST_SUITE("RPC Collectives") {
+
+static const int num_servers = 7;
+
+static tl::collective_policy accept_all() {
+    tl::collective_policy policy;
+    policy.accept_target = [](const std::string&, uint16_t) { return true; };
+    return policy;
+}
+
+static std::vector<tl::engine> make_servers(bool enable = true) {
+    std::vector<tl::engine> servers;
+    for(int i = 0; i < num_servers; i++) {
+        servers.emplace_back("tcp", THALLIUM_SERVER_MODE, true);
+        if(enable) servers.back().enable_collectives(accept_all());
+    }
+    return servers;
+}
+
+static std::vector<tl::endpoint> lookup_all(tl::engine& client,
+                                            std::vector<tl::engine>& servers) {
+    std::vector<tl::endpoint> endpoints;
+    for(auto& s : servers)
+        endpoints.push_back(client.lookup(static_cast<std::string>(s.self())));
+    return endpoints;
+}
+
+static void finalize_all(tl::engine& client, std::vector<tl::engine>& servers) {
+    client.finalize();
+    for(auto& s : servers) s.finalize();
+}
+
+TEST_CASE("broadcast reaches all targets") {
+    auto servers = make_servers();
+    std::vector<std::atomic<int>> received(num_servers);
+    for(int i = 0; i < num_servers; i++) {
+        received[i] = 0;
+        servers[i].define("coll_set", [&received, i](const tl::request& req, int x) {
+            received[i] += x;
+            req.respond();
+        });
+    }
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc       = client.define("coll_set");
+    auto endpoints = lookup_all(client, servers);
+
+    SUBCASE("default arity") {
+        rpc.broadcast(endpoints, 42);
+        for(int i = 0; i < num_servers; i++)
+            REQUIRE(received[i] == 42);
+    }
+
+    SUBCASE("chain") {
+        rpc.set_tree_arity(1);
+        rpc.broadcast(endpoints, 1);
+        for(int i = 0; i < num_servers; i++)
+            REQUIRE(received[i] == 1);
+    }
+
+    SUBCASE("binary tree, responses disabled") {
+        rpc.set_tree_arity(2);
+        rpc.disable_response();
+        rpc.broadcast(endpoints, 3);
+        for(int i = 0; i < num_servers; i++)
+            REQUIRE(received[i] == 3);
+    }
+
+    finalize_all(client, servers);
+}
+
+TEST_CASE("broadcast to providers") {
+    auto servers = make_servers();
+    std::atomic<int> received{0};
+    for(auto& s : servers) {
+        s.define("coll_provider", [&received](const tl::request& req, const std::string& msg) {
+            if(msg == "hello") received++;
+            req.respond();
+        }, 3);
+    }
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc = client.define("coll_provider");
+    std::vector<tl::provider_handle> handles;
+    for(auto& ep : lookup_all(client, servers))
+        handles.emplace_back(ep, 3);
+
+    rpc.set_tree_arity(2).broadcast(handles, std::string("hello"));
+    REQUIRE(received == num_servers);
+
+    finalize_all(client, servers);
+}
+
+TEST_CASE("reduce combines all responses") {
+    auto servers = make_servers();
+    for(int i = 0; i < num_servers; i++) {
+        servers[i].define("coll_rank", [i](const tl::request& req, int offset) {
+            req.respond(i + offset);
+        });
+        servers[i].define_reduction<int>("sum", [](int a, int b) { return a + b; });
+        servers[i].define_reduction<int>("max", [](int a, int b) { return std::max(a, b); });
+    }
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc       = client.define("coll_rank");
+    auto sum       = client.define_reduction<int>("sum", [](int a, int b) { return a + b; });
+    auto max       = client.define_reduction<int>("max", [](int a, int b) { return std::max(a, b); });
+    auto endpoints = lookup_all(client, servers);
+
+    int expected = 0;
+    for(int i = 0; i < num_servers; i++) expected += i + 10;
+    for(uint32_t arity : {1u, 2u, 4u, 16u}) {
+        rpc.set_tree_arity(arity);
+        REQUIRE(rpc.reduce(endpoints, sum, 10) == expected);
+        REQUIRE(rpc.reduce(endpoints, max, 0) == num_servers - 1);
+    }
+
+    finalize_all(client, servers);
+}
+
+TEST_CASE("collectives report failed targets") {
+    auto servers = make_servers();
+    // the last server defines another RPC but not this one
+    servers.back().define("coll_other", [](const tl::request& req) {
+        req.respond();
+    });
+    for(int i = 0; i < num_servers - 1; i++) {
+        servers[i].define("coll_partial", [](const tl::request& req) {
+            req.respond(1);
+        });
+        servers[i].define_reduction<int>("sum", [](int a, int b) { return a + b; });
+    }
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc       = client.define("coll_partial");
+    auto sum       = client.define_reduction<int>("sum", [](int a, int b) { return a + b; });
+    auto endpoints = lookup_all(client, servers);
+
+    REQUIRE_THROWS_AS(rpc.broadcast(endpoints), tl::exception);
+    endpoints.pop_back();
+    REQUIRE(rpc.set_tree_arity(2).reduce(endpoints, sum) == num_servers - 1);
+
+    finalize_all(client, servers);
+}
+
+TEST_CASE("collectives are refused unless enabled") {
+    auto servers = make_servers(false);
+    std::atomic<int> received{0};
+    for(auto& s : servers) {
+        s.define("coll_refused", [&received](const tl::request& req) {
+            received++;
+            req.respond();
+        });
+    }
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc       = client.define("coll_refused");
+    auto endpoints = lookup_all(client, servers);
+
+    REQUIRE_THROWS_AS(rpc.broadcast(endpoints), tl::exception);
+    REQUIRE(received == 0);
+
+    finalize_all(client, servers);
+}
+
+TEST_CASE("collective policy limits forwarding") {
+    auto servers = make_servers(false);
+    std::atomic<int> received{0};
+    for(auto& s : servers) {
+        // no accept_target: the servers do not forward calls
+        s.enable_collectives(tl::collective_policy());
+        s.define("coll_policy", [&received](const tl::request& req) {
+            received++;
+            req.respond();
+        });
+    }
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc       = client.define("coll_policy");
+    auto endpoints = lookup_all(client, servers);
+
+    SUBCASE("forwarding refused") {
+        rpc.set_tree_arity(2);
+        REQUIRE_THROWS_AS(rpc.broadcast(endpoints), tl::exception);
+        REQUIRE(received == 2);
+    }
+
+    SUBCASE("no forwarding needed") {
+        rpc.set_tree_arity(num_servers);
+        rpc.broadcast(endpoints);
+        REQUIRE(received == num_servers);
+    }
+
+    finalize_all(client, servers);
+}
+
+TEST_CASE("collectives are subject to admission limits") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    server.enable_collectives(accept_all());
+    tl::eventual<void> gate;
+    std::atomic<int>   received{0};
+    auto limited = server.define("coll_limited", [&gate, &received](const tl::request& req) {
+        gate.wait();
+        received++;
+        req.respond();
+    });
+    tl::admission_limits limits;
+    limits.max_in_flight = 1;
+    limits.max_queued    = 1;
+    limited.set_admission_limits(limits);
+
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc = client.define("coll_limited");
+    std::vector<tl::endpoint> endpoints{client.lookup(static_cast<std::string>(server.self()))};
+
+    // fill the in-flight and queued slots of the rpc
+    std::vector<tl::async_response> responses;
+    for(int i = 0; i < 2; i++)
+        responses.push_back(rpc.on(endpoints[0]).async());
+    for(int i = 0; i < 500 && limited.get_admission_stats().admitted < 2; i++)
+        tl::thread::sleep(server, 10);
+    REQUIRE(limited.get_admission_stats().admitted == 2);
+
+    REQUIRE_THROWS_AS(rpc.broadcast(endpoints), tl::exception);
+    REQUIRE(limited.get_admission_stats().rejected == 1);
+
+    gate.set_value();
+    for(auto& r : responses) r.wait();
+    rpc.broadcast(endpoints);
+    REQUIRE(received == 3);
+
+    client.finalize();
+    server.finalize();
+}
+
+TEST_CASE("malformed collective calls are answered") {
+    tl::engine server("tcp", THALLIUM_SERVER_MODE, true);
+    server.enable_collectives(accept_all());
+
+    // a parent sending something other than a collective call
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE);
+    auto rpc = client.define(tl::detail::collective_rpc_name());
+    tl::endpoint ep = client.lookup(static_cast<std::string>(server.self()));
+
+    // the parent gets a result instead of waiting forever
+    REQUIRE_NOTHROW(rpc.on(ep).timed(std::chrono::seconds(5), uint64_t(1000)));
+
+    client.finalize();
+    server.finalize();
+}
+
+}
@@ -8,6 +8,9 @@
 #include "test_helpers.hpp"
 #include <thallium.hpp>
 #include <thallium/serialization/stl/string.hpp>
+#include <cstring>
+#include <memory>
+#include <vector>
 
 namespace tl = thallium;
 
@@ -96,6 +99,67 @@ struct MixedContextValue {
     }
 };
 
+// Arena from which ArenaString objects are allocated when decoded
+struct Arena {
+    std::vector<std::unique_ptr<char[]>> blocks;
+    int* destroyed;
+
+    explicit Arena(int* d) : destroyed(d) {}
+    ~Arena() { (*destroyed)++; }
+
+    char* allocate(size_t n) {
+        blocks.emplace_back(new char[n]);
+        return blocks.back().get();
+    }
+};
+
+// String decoded into the arena found in the context
+struct ArenaString {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    ArenaString() = default;
+    ArenaString(const char* s) : data(s), size(std::strlen(s)) {}
+
+    template<typename A>
+    void save(A& ar) const {
+        std::string s(data, size);
+        ar & s;
+    }
+
+    template<typename A>
+    void load(A& ar) {
+        std::shared_ptr<Arena>& arena = std::get<0>(ar.get_context());
+        std::string s;
+        ar & s;
+        char* buf = arena->allocate(s.size());
+        std::memcpy(buf, s.data(), s.size());
+        data = buf;
+        size = s.size();
+    }
+};
+
+class ArenaProvider : public tl::provider<ArenaProvider> {
+
+    std::string echo(const ArenaString& s) const {
+        return std::string(s.data, s.size);
+    }
+
+  public:
+
+    template<typename F>
+    ArenaProvider(tl::engine& e, uint16_t provider_id, const tl::decode_context_factory<F>& ctx)
+    : tl::provider<ArenaProvider>(e, provider_id) {
+        define("arena_provider_echo", &ArenaProvider::echo, ctx);
+    }
+};
+
+static bool wait_for_count(tl::engine& e, const int& count, int expected) {
+    for(int i = 0; i < 500 && count != expected; i++)
+        tl::thread::sleep(e, 10);
+    return count == expected;
+}
+
 TEST_SUITE("Serialization Context") {
 
 TEST_CASE("single context parameter") {
@@ -313,4 +377,44 @@ TEST_CASE("context with multiple values") {
     myEngine.finalize();
 }
 
+TEST_CASE("server-side decode context") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    int created = 0;
+    int destroyed = 0;
+    auto ctx = tl::decode_context([&created, &destroyed]() {
+        created++;
+        return std::make_tuple(std::make_shared<Arena>(&destroyed));
+    });
+
+    myEngine.define("arena_echo", [](const tl::request& req, const ArenaString& s) {
+        req.respond(std::string(s.data, s.size));
+    }, 0, ctx);
+    ArenaProvider provider(myEngine, 42, ctx);
+
+    auto rpc = myEngine.define("arena_echo");
+    auto provider_rpc = myEngine.define("arena_provider_echo");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    SUBCASE("one context per request, freed when the handler returns") {
+        std::string r1 = rpc.on(self_ep)(ArenaString("first"));
+        std::string r2 = rpc.on(self_ep)(ArenaString("second"));
+        REQUIRE(r1 == "first");
+        REQUIRE(r2 == "second");
+        REQUIRE(created == 2);
+        REQUIRE(wait_for_count(myEngine, destroyed, 2));
+    }
+
+    SUBCASE("provider member function") {
+        tl::provider_handle ph(self_ep, 42);
+        std::string r = provider_rpc.on(ph)(ArenaString("member"));
+        REQUIRE(r == "member");
+        REQUIRE(created == 1);
+        REQUIRE(wait_for_count(myEngine, destroyed, 1));
+    }
+
+    myEngine.finalize();
+}
+
 } // TEST_SUITE
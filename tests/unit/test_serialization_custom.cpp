@@ -9,6 +9,12 @@
 #include <thallium.hpp>
 #include <thallium/serialization/stl/string.hpp>
 #include <thallium/serialization/stl/vector.hpp>
+#include <thallium/serialization/stl/array.hpp>
+#include <thallium/serialization/stl/pair.hpp>
+#include <thallium/serialization/stl/tuple.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
 
 namespace tl = thallium;
 
@@ -208,6 +214,70 @@ struct TypeThatAccessesEngine {
     }
 };
 
+// Trivially copyable struct without serialize function,
+// declared bitwise-serializable
+struct Particle {
+    float   position[3];
+    float   velocity[3];
+    int32_t id;
+
+    bool operator==(const Particle& other) const {
+        return std::equal(position, position + 3, other.position)
+            && std::equal(velocity, velocity + 3, other.velocity)
+            && id == other.id;
+    }
+};
+
+namespace thallium {
+template <> struct is_bitwise_serializable<Particle> : std::true_type {};
+}
+
+// Trivially copyable struct whose serialize function skips a field,
+// opted out of bitwise serialization
+struct CachedValue {
+    int value;
+    int cache;
+
+    template<typename A>
+    void serialize(A& ar) {
+        ar & value;
+    }
+};
+
+namespace thallium {
+template <> struct is_bitwise_serializable<CachedValue> : std::false_type {};
+}
+
+// Type whose serialization uses the Mercury proc directly
+struct ProcValue {
+    uint32_t value = 0;
+
+    template<typename Archive>
+    void save(Archive& ar) const {
+        uint32_t v = value;
+        REQUIRE(hg_proc_uint32_t(ar.get_proc(), &v) == HG_SUCCESS);
+    }
+
+    template<typename Archive>
+    void load(Archive& ar) {
+        REQUIRE(hg_proc_uint32_t(ar.get_proc(), &value) == HG_SUCCESS);
+    }
+};
+
+// Large type opted into sizing before encoding
+struct PointCloud {
+    std::vector<Point3D> points;
+
+    template<typename A>
+    void serialize(A& ar) {
+        ar & points;
+    }
+};
+
+namespace thallium {
+template <> struct presize_serialization<PointCloud> : std::true_type {};
+}
+
 TEST_SUITE("Custom Serialization") {
 
 TEST_CASE("simple POD struct") {
@@ -454,4 +524,133 @@ TEST_CASE("serialization accesses engine from archive") {
     myEngine.finalize();
 }
 
+TEST_CASE("bitwise serialization of trivially copyable types") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    SUBCASE("vector of structs with serialize function") {
+        myEngine.define("echo_points", [](const tl::request& req, const std::vector<Point3D>& v) {
+            req.respond(v);
+        });
+        std::vector<Point3D> input;
+        for(int i = 0; i < 1000; i++)
+            input.emplace_back(i, 2.0 * i, 3.0 * i);
+        std::vector<Point3D> result = myEngine.define("echo_points").on(self_ep)(input);
+        REQUIRE(result == input);
+    }
+
+    SUBCASE("arrays and nested containers") {
+        using grid = std::vector<std::array<Point2D, 2>>;
+        myEngine.define("echo_grid", [](const tl::request& req, const grid& g,
+                                        const std::array<Point2D, 3>& a) {
+            req.respond(std::make_pair(g, a));
+        });
+        grid input(10);
+        for(size_t i = 0; i < input.size(); i++)
+            input[i] = {Point2D(i, 0.0), Point2D(0.0, i)};
+        std::array<Point2D, 3> corners = {Point2D(1, 2), Point2D(3, 4), Point2D(5, 6)};
+        std::pair<grid, std::array<Point2D, 3>> result =
+            myEngine.define("echo_grid").on(self_ep)(input, corners);
+        REQUIRE(result.first == input);
+        REQUIRE(result.second == corners);
+    }
+
+    SUBCASE("opted-in struct without serialize function") {
+        myEngine.define("echo_particles", [](const tl::request& req, const Particle& p,
+                                             const std::vector<Particle>& v) {
+            std::vector<Particle> out(v);
+            out.push_back(p);
+            req.respond(out);
+        });
+        Particle p = {{1.f, 2.f, 3.f}, {0.5f, 0.25f, 0.125f}, 7};
+        std::vector<Particle> input(100, p);
+        for(size_t i = 0; i < input.size(); i++)
+            input[i].id = static_cast<int32_t>(i);
+        std::vector<Particle> result = myEngine.define("echo_particles").on(self_ep)(p, input);
+        REQUIRE(result.size() == 101);
+        REQUIRE(std::equal(input.begin(), input.end(), result.begin()));
+        REQUIRE(result.back() == p);
+    }
+
+    SUBCASE("opted-out struct uses its serialize function") {
+        myEngine.define("echo_cached", [](const tl::request& req, const std::vector<CachedValue>& v) {
+            req.respond(v);
+        });
+        std::vector<CachedValue> input(5, CachedValue{3, 4});
+        std::vector<CachedValue> result = myEngine.define("echo_cached").on(self_ep)(input);
+        REQUIRE(result.size() == 5);
+        for(auto& c : result) {
+            REQUIRE(c.value == 3);
+            REQUIRE(c.cache == 0);
+        }
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("serialized_size matches the encoded size") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    REQUIRE(tl::serialized_size() == 0);
+    REQUIRE(tl::serialized_size(int32_t(1)) == 4);
+    REQUIRE(tl::serialized_size(1.0, int32_t(2)) == 12);
+    REQUIRE(tl::serialized_size(std::string("hello")) == sizeof(uint64_t) + 5);
+    REQUIRE(tl::serialized_size(std::vector<Point3D>(10))
+            == sizeof(uint64_t) + 10 * sizeof(Point3D));
+
+    ComplexShape shape;
+    shape.vertices = {Point2D(0.0, 0.0), Point2D(10.0, 0.0), Point2D(5.0, 10.0)};
+    auto args = std::make_tuple(shape, std::string(100, 'x'), std::vector<Particle>(50));
+    std::tuple<> ctx;
+    std::vector<char> buffer;
+    margo_instance_id mid = myEngine.get_margo_instance();
+    tl::meta_proc_fn mproc = [&](hg_proc_t proc) {
+        return tl::proc_object_encode(proc, args, mid, ctx);
+    };
+    REQUIRE(tl::detail::proc_encode_to_buffer(mid, mproc, buffer) == HG_SUCCESS);
+    REQUIRE(buffer.size() == tl::detail::encoded_size(args, mid, ctx));
+
+    // arguments larger than the eager buffer
+    myEngine.define("large_size", [](const tl::request& req, const std::vector<Point3D>& v) {
+        req.respond(tl::serialized_size(v));
+    });
+    std::vector<Point3D> input(100000);
+    size_t size = myEngine.define("large_size").on(myEngine.lookup(addr))(input);
+    REQUIRE(size == tl::serialized_size(input));
+
+    myEngine.finalize();
+}
+
+TEST_CASE("objects are sized before encoding only if their type opts in") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    REQUIRE(tl::detail::presized<std::tuple<std::reference_wrapper<const PointCloud>>>::value);
+    REQUIRE(!tl::detail::presized<std::tuple<std::reference_wrapper<const PointCloud>,
+                                             std::reference_wrapper<const ProcValue>>>::value);
+
+    // serialization functions using the proc must never run with a sizing archive
+    myEngine.define("proc_value", [](const tl::request& req, const ProcValue& v) {
+        ProcValue r;
+        r.value = v.value + 1;
+        req.respond(r);
+    });
+    ProcValue v;
+    v.value = 41;
+    ProcValue r = myEngine.define("proc_value").on(myEngine.lookup(addr))(v);
+    REQUIRE(r.value == 42);
+
+    myEngine.define("point_cloud", [](const tl::request& req, const PointCloud& c) {
+        req.respond(c.points.size());
+    });
+    PointCloud cloud;
+    cloud.points.resize(100000, Point3D(1.0, 2.0, 3.0));
+    size_t count = myEngine.define("point_cloud").on(myEngine.lookup(addr))(cloud);
+    REQUIRE(count == cloud.points.size());
+
+    myEngine.finalize();
+}
+
 } // TEST_SUITE
@@ -18,12 +18,16 @@
 #include <thallium/serialization/stl/pair.hpp>
 #include <thallium/serialization/stl/set.hpp>
 #include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/string_view.hpp>
 #include <thallium/serialization/stl/tuple.hpp>
 #include <thallium/serialization/stl/unordered_map.hpp>
 #include <thallium/serialization/stl/unordered_multimap.hpp>
 #include <thallium/serialization/stl/unordered_multiset.hpp>
 #include <thallium/serialization/stl/unordered_set.hpp>
 #include <thallium/serialization/stl/vector.hpp>
+#include <thallium/span.hpp>
+#include <algorithm>
+#include <cstdint>
 
 namespace tl = thallium;
 
@@ -471,4 +475,78 @@ TEST_CASE("serialize large containers") {
     myEngine.finalize();
 }
 
+TEST_CASE("deserialize into views") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("view_length", [](const tl::request& req, const tl::buffer_view& key) {
+        req.respond(std::string(key.data(), key.size()).size());
+    });
+    myEngine.define("view_sum", [](const tl::request& req, const tl::span<const double>& values) {
+        double sum = 0.0;
+        for(double v : values) sum += v;
+        req.respond(sum);
+    });
+    myEngine.define("view_payload", [](const tl::request& req, const std::string& payload) {
+        req.respond(payload);
+    });
+    myEngine.define("view_values", [](const tl::request& req, const std::vector<double>& values) {
+        // the leading char misaligns the content of the vector in the response
+        req.respond('x', values);
+    });
+
+    auto length  = myEngine.define("view_length");
+    auto sum     = myEngine.define("view_sum");
+    auto payload = myEngine.define("view_payload");
+    auto values  = myEngine.define("view_values");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    SUBCASE("buffer_view argument from a string") {
+        size_t n = length.on(self_ep)(std::string("some key"));
+        REQUIRE(n == 8);
+        n = length.on(self_ep)(std::string());
+        REQUIRE(n == 0);
+    }
+
+    SUBCASE("span argument from a vector") {
+        std::vector<double> values = {1.0, 2.0, 3.5};
+        double s = sum.on(self_ep)(values);
+        REQUIRE(s == doctest::Approx(6.5));
+    }
+
+    SUBCASE("span argument sent as a span") {
+        std::vector<double> values = {1.0, 2.0};
+        double s = sum.on(self_ep)(tl::span<const double>(values));
+        REQUIRE(s == doctest::Approx(3.0));
+    }
+
+    SUBCASE("buffer_view response valid while the packed_data lives") {
+        tl::packed_data<> response = payload.on(self_ep)(std::string("the payload"));
+        tl::buffer_view view = response.as<tl::buffer_view>();
+        REQUIRE(std::string(view.data(), view.size()) == "the payload");
+    }
+
+    SUBCASE("span<const double> response misaligned in the RPC buffer") {
+        std::vector<double> input = {1.5, 2.5, 3.5, 4.5};
+        tl::packed_data<> response = values.on(self_ep)(input);
+        char tag;
+        tl::span<const double> view;
+        std::tie(tag, view) = response.as<char, tl::span<const double>>();
+        REQUIRE(tag == 'x');
+        REQUIRE(view.size() == input.size());
+        REQUIRE(reinterpret_cast<std::uintptr_t>(view.data()) % alignof(double) == 0);
+        REQUIRE(std::equal(view.begin(), view.end(), input.begin()));
+    }
+
+#if __cplusplus >= 201703L
+    SUBCASE("string_view response") {
+        tl::packed_data<> response = payload.on(self_ep)(std::string("hello"));
+        std::string_view view = response.as<std::string_view>();
+        REQUIRE(view == "hello");
+    }
+#endif
+
+    myEngine.finalize();
+}
+
 } // TEST_SUITE
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for RPC type fingerprints (THALLIUM_HASH_RPC_TYPES)
+ */
+
+#ifndef THALLIUM_HASH_RPC_TYPES
+#define THALLIUM_HASH_RPC_TYPES
+#endif
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace tl = thallium;
+
+template <typename T>
+static uint64_t fingerprint() {
+    return tl::detail::type_fingerprint<T>::value;
+}
+
+TEST_SUITE("Type Fingerprint") {
+
+TEST_CASE("fingerprints are computed at compile time") {
+    static_assert(tl::detail::type_fingerprint<std::tuple<int>>::value
+               != tl::detail::type_fingerprint<std::tuple<long>>::value,
+                  "int and long must have different fingerprints");
+    static_assert(tl::detail::type_fingerprint<std::tuple<int, double>>::value
+               != tl::detail::type_fingerprint<std::tuple<double, int>>::value,
+                  "the order of the types must matter");
+    REQUIRE(fingerprint<std::tuple<const int&, const std::string&>>()
+         == fingerprint<std::tuple<int, std::string>>());
+    REQUIRE(fingerprint<int>() == fingerprint<std::tuple<int>>());
+    REQUIRE(fingerprint<void>() == fingerprint<std::tuple<>>());
+    REQUIRE(fingerprint<std::tuple<std::string>>() == fingerprint<std::tuple<tl::buffer_view>>());
+    REQUIRE(fingerprint<std::tuple<std::vector<double>>>()
+         == fingerprint<std::tuple<tl::span<const double>>>());
+    REQUIRE(fingerprint<std::tuple<std::vector<int>>>()
+         != fingerprint<std::tuple<std::vector<double>>>());
+}
+
+TEST_CASE("matching types are accepted") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("fp_concat", [](const tl::request& req, const std::string& s, int n) {
+        req.respond(s + std::to_string(n));
+    });
+    myEngine.define("fp_length", [](const tl::request& req, const tl::buffer_view& v) {
+        req.respond(v.size());
+    });
+
+    auto concat = myEngine.define("fp_concat");
+    auto length = myEngine.define("fp_length");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    std::string r = concat.on(self_ep)(std::string("abc"), 42);
+    REQUIRE(r == "abc42");
+    size_t n = length.on(self_ep)(std::string("abcd"));
+    REQUIRE(n == 4);
+
+    myEngine.finalize();
+}
+
+TEST_CASE("mismatching response types are rejected") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define("fp_int", [](const tl::request& req) {
+        req.respond(42);
+    });
+
+    auto rpc = myEngine.define("fp_int");
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    tl::packed_data<> response = rpc.on(self_ep)();
+    REQUIRE_THROWS(response.as<double>());
+    REQUIRE(response.as<int>() == 42);
+
+    myEngine.finalize();
+}
+
+}
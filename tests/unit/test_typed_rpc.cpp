@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2017 UChicago Argonne, LLC
+ * Unit tests for RPCs defined from an rpc_signature
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include "test_helpers.hpp"
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace tl = thallium;
+
+namespace {
+
+// Signatures shared by the clients and the servers
+constexpr tl::rpc_signature<int64_t(int64_t, int64_t)>                typed_add{"typed_add"};
+constexpr tl::rpc_signature<void(std::string)>                        typed_log{"typed_log"};
+constexpr tl::rpc_signature<std::vector<int>(std::vector<int>, bool)> typed_sort{"typed_sort"};
+constexpr tl::rpc_signature<std::string()>                            typed_name{"typed_name"};
+
+class typed_provider : public tl::provider<typed_provider> {
+
+  public:
+
+    typed_provider(tl::engine& e, uint16_t provider_id)
+    : tl::provider<typed_provider>(e, provider_id) {
+        define(typed_add, &typed_provider::add);
+        define(typed_name, &typed_provider::name);
+    }
+
+    int64_t add(int64_t a, int64_t b) const {
+        return a + b + get_provider_id();
+    }
+
+    std::string name() {
+        return "provider " + std::to_string(get_provider_id());
+    }
+};
+
+} // namespace
+
+TEST_SUITE("Typed RPC") {
+
+TEST_CASE("typed rpc round trip") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    std::atomic<int> logged{0};
+    myEngine.define(typed_add, [](int64_t a, int64_t b) { return a + b; });
+    myEngine.define(typed_log, [&logged](std::string s) { logged += static_cast<int>(s.size()); });
+    myEngine.define(typed_sort, [](std::vector<int> v, bool descending) {
+        std::sort(v.begin(), v.end());
+        if(descending) std::reverse(v.begin(), v.end());
+        return v;
+    });
+    myEngine.define(typed_name, []() { return std::string("engine"); });
+
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    SUBCASE("synchronous calls") {
+        auto add = myEngine.define(typed_add);
+        // arguments are converted to the types of the signature
+        int64_t sum = add.on(self_ep)(40, 2);
+        REQUIRE(sum == 42);
+
+        myEngine.define(typed_log).on(self_ep)("hello");
+        REQUIRE(logged == 5);
+
+        std::vector<int> sorted = myEngine.define(typed_sort).on(self_ep)({3, 1, 2}, true);
+        REQUIRE(sorted == std::vector<int>({3, 2, 1}));
+
+        REQUIRE(myEngine.define(typed_name).on(self_ep)() == "engine");
+    }
+
+    SUBCASE("asynchronous and timed calls") {
+        auto add = myEngine.define(typed_add);
+        auto response = add.on(self_ep).async(1, 2);
+        REQUIRE(response.wait() == 3);
+
+        REQUIRE(add.on(self_ep).timed(std::chrono::seconds(5), 5, 6) == 11);
+
+        auto log_response = myEngine.define(typed_log).on(self_ep).async("abc");
+        log_response.wait();
+        REQUIRE(logged == 3);
+    }
+
+    SUBCASE("self dispatch") {
+        auto add = myEngine.define(typed_add);
+        add.get_remote_procedure().enable_self_dispatch();
+        REQUIRE(add.on(self_ep)(20, 22) == 42);
+    }
+
+    myEngine.finalize();
+}
+
+TEST_CASE("typed rpc with providers") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    typed_provider p1(myEngine, 1);
+    typed_provider p2(myEngine, 2);
+
+    tl::endpoint self_ep = myEngine.lookup(addr);
+    auto add  = myEngine.define(typed_add);
+    auto name = myEngine.define(typed_name);
+
+    REQUIRE(add.on(tl::provider_handle(self_ep, 1))(1, 1) == 3);
+    REQUIRE(add.on(tl::provider_handle(self_ep, 2))(1, 1) == 4);
+    REQUIRE(name.on(tl::provider_handle(self_ep, 2))() == "provider 2");
+
+    myEngine.finalize();
+}
+
+TEST_CASE("typed and untyped calls interoperate") {
+    tl::engine myEngine("tcp", THALLIUM_SERVER_MODE, true);
+    std::string addr = static_cast<std::string>(myEngine.self());
+
+    myEngine.define(typed_add, [](int64_t a, int64_t b) { return a * b; });
+    tl::endpoint self_ep = myEngine.lookup(addr);
+
+    int64_t result = myEngine.define("typed_add").on(self_ep)(int64_t(6), int64_t(7));
+    REQUIRE(result == 42);
+
+    myEngine.finalize();
+}
+
+}